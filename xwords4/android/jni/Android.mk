@@ -103,6 +103,7 @@ COMMON_SRC_FILES +=        \
 	$(COMMON_PATH)/knownplyr.c  \
 	$(COMMON_PATH)/dllist.c     \
 	$(COMMON_PATH)/xwarray.c    \
+	$(COMMON_PATH)/arena.c      \
 	$(COMMON_PATH)/stats.c      \
 	$(COMMON_PATH)/timers.c     \
 	$(COMMON_PATH)/cJSON.c      \
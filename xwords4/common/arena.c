@@ -0,0 +1,253 @@
+/* -*-mode: C; fill-column: 78; c-basic-offset: 4; -*- */
+/*
+ * Copyright 2025 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include "arena.h"
+
+#ifdef CPLUS
+extern "C" {
+#endif
+
+#define ARENA_ALIGN 8
+#define ALIGN_UP(nn) (((nn) + (ARENA_ALIGN-1)) & ~(ARENA_ALIGN-1))
+#define DEFAULT_CHUNK_SIZE 1024
+/* Pool size classes run from 16 bytes, enough to hold the free-list link,
+   up to ARENA_MAX_POOLED */
+#define MIN_POOLED_SHIFT 4
+#define N_CLASSES 6
+
+typedef struct ArenaChunk {
+    struct ArenaChunk* next;
+    XP_U32 size;
+    XP_U32 used;
+} ArenaChunk;
+
+struct XWArena {
+    ArenaChunk* chunks;         /* one being filled is first */
+    void* last;                 /* most recent allocation, for realloc */
+    ArenaChunk* lastChunk;      /* and where it lives */
+    XP_U32 chunkSize;
+    void* freeLists[N_CLASSES]; /* each block's first word is the next */
+    ArenaStats stats;
+    MPSLOT
+};
+
+#define ARENA_HDR ALIGN_UP(sizeof(XWArena))
+#define CHUNK_HDR ALIGN_UP(sizeof(ArenaChunk))
+#define CHUNK_DATA(chunk) (((XP_U8*)(chunk)) + CHUNK_HDR)
+/* The first chunk is allocated along with the arena, right after it */
+#define FIRST_CHUNK(arena) ((ArenaChunk*)(((XP_U8*)(arena)) + ARENA_HDR))
+
+static XP_U32
+roundSize( XP_U32 size )
+{
+    /* Even zero-length allocations get a distinct address */
+    return 0 == size ? ARENA_ALIGN : ALIGN_UP(size);
+}
+
+XWArena*
+arena_make( MPFORMAL XP_U32 chunkSize )
+{
+    if ( 0 == chunkSize ) {
+        chunkSize = DEFAULT_CHUNK_SIZE;
+    }
+    chunkSize = ALIGN_UP(chunkSize);
+
+    XWArena* arena = (XWArena*)XP_MALLOC( mpool, ARENA_HDR + CHUNK_HDR
+                                          + chunkSize );
+    XP_MEMSET( arena, 0, sizeof(*arena) );
+    MPASSIGN( arena->mpool, mpool );
+    arena->chunkSize = chunkSize;
+
+    ArenaChunk* first = FIRST_CHUNK(arena);
+    first->next = NULL;
+    first->size = chunkSize;
+    first->used = 0;
+    arena->chunks = first;
+    arena->stats.nChunks = 1;
+
+    return arena;
+} /* arena_make */
+
+static void
+freeChunks( XWArena* arena )
+{
+    ArenaChunk* first = FIRST_CHUNK(arena);
+    for ( ArenaChunk* chunk = arena->chunks; !!chunk; ) {
+        ArenaChunk* next = chunk->next;
+        if ( chunk != first ) {
+            XP_FREE( arena->mpool, chunk );
+        }
+        chunk = next;
+    }
+}
+
+void
+arena_destroy( XWArena* arena )
+{
+    if ( !!arena ) {
+        freeChunks( arena );
+        XP_FREE( arena->mpool, arena );
+    }
+}
+
+void
+arena_reset( XWArena* arena )
+{
+    freeChunks( arena );
+    ArenaChunk* first = FIRST_CHUNK(arena);
+    first->next = NULL;
+    first->used = 0;
+    arena->chunks = first;
+    arena->last = NULL;
+    arena->lastChunk = NULL;
+    XP_MEMSET( arena->freeLists, 0, sizeof(arena->freeLists) );
+}
+
+static ArenaChunk*
+makeChunk( XWArena* arena, XP_U32 size )
+{
+    ArenaChunk* chunk = (ArenaChunk*)XP_MALLOC( arena->mpool,
+                                                CHUNK_HDR + size );
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    ++arena->stats.nChunks;
+    return chunk;
+}
+
+void*
+arena_alloc( XWArena* arena, XP_U32 size )
+{
+    XP_U32 need = roundSize( size );
+    ArenaChunk* chunk = arena->chunks;
+    if ( chunk->used + need > chunk->size ) {
+        if ( need > arena->chunkSize / 2 ) {
+            /* Big: give it a chunk of its own and keep filling this one */
+            ArenaChunk* own = makeChunk( arena, need );
+            own->next = chunk->next;
+            chunk->next = own;
+            chunk = own;
+        } else {
+            ArenaChunk* fresh = makeChunk( arena, arena->chunkSize );
+            fresh->next = chunk;
+            arena->chunks = fresh;
+            chunk = fresh;
+        }
+    }
+
+    void* result = CHUNK_DATA(chunk) + chunk->used;
+    chunk->used += need;
+    arena->last = result;
+    arena->lastChunk = chunk;
+
+    ++arena->stats.nAllocs;
+    arena->stats.nBytes += size;
+    return result;
+} /* arena_alloc */
+
+void*
+arena_calloc( XWArena* arena, XP_U32 size )
+{
+    void* result = arena_alloc( arena, size );
+    XP_MEMSET( result, 0, size );
+    return result;
+}
+
+void*
+arena_realloc( XWArena* arena, void* ptr, XP_U32 oldSize, XP_U32 newSize )
+{
+    void* result = NULL;
+    if ( !ptr ) {
+        result = arena_alloc( arena, newSize );
+    } else if ( ptr == arena->last ) {
+        ArenaChunk* chunk = arena->lastChunk;
+        XP_U32 oldNeed = roundSize( oldSize );
+        XP_U32 newNeed = roundSize( newSize );
+        XP_ASSERT( CHUNK_DATA(chunk) + chunk->used == (XP_U8*)ptr + oldNeed );
+        if ( chunk->used - oldNeed + newNeed <= chunk->size ) {
+            chunk->used = chunk->used - oldNeed + newNeed;
+            if ( newSize > oldSize ) {
+                arena->stats.nBytes += newSize - oldSize;
+            }
+            result = ptr;
+        }
+    }
+
+    if ( !result ) {
+        result = arena_alloc( arena, newSize );
+        XP_MEMCPY( result, ptr, XP_MIN( oldSize, newSize ) );
+    }
+    return result;
+} /* arena_realloc */
+
+static XP_U16
+sizeClass( XP_U32 size )
+{
+    XP_U16 cls = 0;
+    while ( (1 << (MIN_POOLED_SHIFT + cls)) < size ) {
+        ++cls;
+    }
+    XP_ASSERT( cls < N_CLASSES );
+    return cls;
+}
+
+void*
+arena_poolAlloc( XWArena* arena, XP_U32 size )
+{
+    void* result;
+    if ( size > ARENA_MAX_POOLED ) {
+        result = XP_CALLOC( arena->mpool, size );
+        ++arena->stats.nBig;
+    } else {
+        XP_U16 cls = sizeClass( size );
+        result = arena->freeLists[cls];
+        if ( !!result ) {
+            arena->freeLists[cls] = *(void**)result;
+            ++arena->stats.nReused;
+        } else {
+            result = arena_alloc( arena, 1 << (MIN_POOLED_SHIFT + cls) );
+        }
+        XP_MEMSET( result, 0, size );
+    }
+    return result;
+} /* arena_poolAlloc */
+
+void
+arena_poolFree( XWArena* arena, void* ptr, XP_U32 size )
+{
+    if ( !ptr ) {
+        /* nothing to do */
+    } else if ( size > ARENA_MAX_POOLED ) {
+        XP_FREE( arena->mpool, ptr );
+    } else {
+        XP_U16 cls = sizeClass( size );
+        *(void**)ptr = arena->freeLists[cls];
+        arena->freeLists[cls] = ptr;
+    }
+}
+
+void
+arena_getStats( const XWArena* arena, ArenaStats* stats )
+{
+    *stats = arena->stats;
+}
+
+#ifdef CPLUS
+}
+#endif
@@ -0,0 +1,80 @@
+/* -*-mode: C; fill-column: 78; c-basic-offset: 4; -*- */
+/*
+ * Copyright 2025 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#ifdef CPLUS
+extern "C" {
+#endif
+
+#include "mempool.h"
+#include "comtypes.h"
+#include "xptypes.h"
+
+/* Bump allocator for groups of objects that die together (e.g. everything
+ * handed back for one message, or the module contexts of one XWGame.)
+ * Memory comes from the pool a chunk at a time and is only returned by
+ * arena_reset() or arena_destroy(); there's no freeing individual
+ * allocations except through the size-class pool below.  The arena itself
+ * lives in its first chunk, so a small group costs one pool allocation in
+ * all.  Not thread-safe.
+ */
+typedef struct XWArena XWArena;
+
+/* chunkSize of 0 means use a default */
+XWArena* arena_make( MPFORMAL XP_U32 chunkSize );
+void arena_destroy( XWArena* arena );
+
+/* Drop everything allocated, keeping the first chunk for reuse */
+void arena_reset( XWArena* arena );
+
+void* arena_alloc( XWArena* arena, XP_U32 size );
+void* arena_calloc( XWArena* arena, XP_U32 size );
+/* Grows in place if ptr was the most recent allocation and there's room,
+   otherwise copies (leaving the old space unused until reset.) */
+void* arena_realloc( XWArena* arena, void* ptr, XP_U32 oldSize,
+                     XP_U32 newSize );
+
+/* Size-class pool for objects that come and go during the arena's life
+ * (e.g. a game's queued messages.)  Requests are rounded up to a power of
+ * two and freed blocks go on that class's free list for the next request
+ * of the class, so in release builds, where XP_MALLOC is the platform
+ * malloc, the game's churn stays off the heap.  Memory is zeroed.  Sizes
+ * over ARENA_MAX_POOLED go straight to the pool.  The size passed to
+ * arena_poolFree() must be the one passed to arena_poolAlloc().
+ */
+#define ARENA_MAX_POOLED 512
+void* arena_poolAlloc( XWArena* arena, XP_U32 size );
+void arena_poolFree( XWArena* arena, void* ptr, XP_U32 size );
+
+typedef struct _ArenaStats {
+    XP_U32 nAllocs;             /* arena_alloc() etc. calls */
+    XP_U32 nChunks;             /* pool allocations they cost */
+    XP_U32 nBytes;              /* requested, before alignment */
+    XP_U32 nReused;             /* arena_poolAlloc()s served by a free list */
+    XP_U32 nBig;                /* arena_poolAlloc()s too big to pool */
+} ArenaStats;
+void arena_getStats( const XWArena* arena, ArenaStats* stats );
+
+#ifdef CPLUS
+}
+#endif
+
+#endif
@@ -160,9 +160,11 @@ static void clearCurHintRect( BoardCtxt* board );
  ****************************************************************************/
 BoardCtxt*
 board_make( XWEnv xwe, ModelCtxt* model, ServerCtxt* server,
-            DrawCtx* draw, XW_UtilCtxt* util )
+            DrawCtx* draw, XW_UtilCtxt* util, XWArena* arena )
 {
-    BoardCtxt* result = (BoardCtxt*)XP_MALLOC( util->mpool, sizeof( *result ) );
+    BoardCtxt* result = !!arena
+        ? (BoardCtxt*)arena_alloc( arena, sizeof(*result) )
+        : (BoardCtxt*)XP_MALLOC( util->mpool, sizeof( *result ) );
     XP_ASSERT( !!server );
     XP_ASSERT( !!util );
     XP_ASSERT( !!model );
@@ -173,6 +175,7 @@ board_make( XWEnv xwe, ModelCtxt* model, ServerCtxt* server,
         result->selInfo = result->pti; /* equates to selPlayer == 0 */
 
         MPASSIGN(result->mpool, util->mpool);
+        result->arena = arena;
 
         result->model = model;
         result->server = server;
@@ -210,13 +213,15 @@ board_destroy( BoardCtxt* board, XWEnv xwe, XP_Bool ownsUtil )
     if ( ownsUtil ) {
         util_clearTimer( board->util, xwe, TIMER_TIMERTICK );
     }
-    XP_FREE( board->mpool, board );
+    if ( !board->arena ) {
+        XP_FREE( board->mpool, board );
+    }
 } /* board_destroy */
 
 BoardCtxt* 
 board_makeFromStream( XWEnv xwe, XWStreamCtxt* stream, ModelCtxt* model,
                       ServerCtxt* server, DrawCtx* draw, XW_UtilCtxt* util,
-                      XP_U16 nPlayers )
+                      XP_U16 nPlayers, XWArena* arena )
 {
     BoardCtxt* board;
     XP_U16 version = stream_getVersion( stream );
@@ -227,7 +232,7 @@ board_makeFromStream( XWEnv xwe, XWStreamCtxt* stream, ModelCtxt* model,
     nColsNBits = NUMCOLS_NBITS_4;
 #endif
 
-    board = board_make( xwe, model, server, draw, util );
+    board = board_make( xwe, model, server, draw, util, arena );
     board_setCallbacks( board, xwe );
 
     if ( version >= STREAM_VERS_4YOFFSET) {
@@ -416,7 +421,8 @@ board_drawSnapshot( const BoardCtxt* curBoard, XWEnv xwe, DrawCtx* dctx,
                     XP_U16 width, XP_U16 height )
 {
     BoardCtxt* newBoard = board_make( xwe, curBoard->model,
-                                      curBoard->server, dctx, curBoard->util );
+                                      curBoard->server, dctx, curBoard->util,
+                                      NULL );
     board_setDraw( newBoard, xwe, dctx ); /* so draw_dictChanged() will get called */
     XP_U16 fontWidth = width / curBoard->gi->boardSize;
     board_figureLayout( newBoard, xwe, curBoard->gi, 0, 0, width, height,
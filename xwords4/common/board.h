@@ -56,12 +56,13 @@ typedef enum {
 
 /* typedef struct BoardCtxt BoardCtxt; */
 
+/* arena, if non-NULL, owns the BoardCtxt */
 BoardCtxt* board_make( XWEnv xwe, ModelCtxt* model, ServerCtxt* server,
-                       DrawCtx* draw, XW_UtilCtxt* util );
+                       DrawCtx* draw, XW_UtilCtxt* util, XWArena* arena );
 BoardCtxt* board_makeFromStream( XWEnv xwe, XWStreamCtxt* stream,
                                  ModelCtxt* model, ServerCtxt* server, 
                                  DrawCtx* draw, XW_UtilCtxt* util,
-                                 XP_U16 nPlayers );
+                                 XP_U16 nPlayers, XWArena* arena );
 void board_setCallbacks( BoardCtxt* board, XWEnv xwe );
 void board_setDraw( BoardCtxt* board, XWEnv xwe, DrawCtx* draw );
 DrawCtx* board_getDraw( const BoardCtxt* board );
@@ -242,6 +242,7 @@ struct BoardCtxt {
     XP_Bool unused_showCellValues;
     XP_Bool showColors;
 
+    XWArena* arena;             /* owns the BoardCtxt if non-NULL */
     MPSLOT
 };
 
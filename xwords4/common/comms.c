@@ -181,6 +181,7 @@ struct CommsCtxt {
     XP_Bool processingMsg;
     const XP_UCHAR* tag;
 #endif
+    XWArena* arena;             /* owns the CommsCtxt if non-NULL */
     MPSLOT
 };
 
@@ -221,7 +222,9 @@ static XP_S16 sendMsg( const CommsCtxt* comms, XWEnv xwe, MsgQueueElem* elem,
 static MsgQueueElem* addToQueue( CommsCtxt* comms, XWEnv xwe,
                                  MsgQueueElem* newElem, XP_Bool notify );
 static XP_Bool elems_same( const MsgQueueElem* e1, const MsgQueueElem* e2 ) ;
-static void freeElem( MPFORMAL MsgQueueElem* elem );
+static void* commsCalloc( CommsCtxt* comms, XP_U32 size );
+static void commsFree( CommsCtxt* comms, void* ptr, XP_U32 size );
+static void freeElem( CommsCtxt* comms, MsgQueueElem* elem );
 static void removeFromQueue( CommsCtxt* comms, XWEnv xwe, XP_PlayerAddr channelNo,
                              MsgID msgID );
 static XP_U16 countAddrRecs( const CommsCtxt* comms );
@@ -234,7 +237,7 @@ static void sendConnect( CommsCtxt* comms, XWEnv xwe
 typedef ForEachAct (*EachMsgProc)( MsgQueueElem* elem, void* closure );
 static void forEachElem( CommsCtxt* comms, EachMsgProc proc, void* closure );
 
-static MsgQueueElem* makeNewElem( const CommsCtxt* comms, XWEnv xwe, MsgID msgID,
+static MsgQueueElem* makeNewElem( CommsCtxt* comms, XWEnv xwe, MsgID msgID,
                                   XP_PlayerAddr channelNo );
 static void notifyQueueChanged( const CommsCtxt* comms, XWEnv xwe );
 static XP_U16 makeFlags( const CommsCtxt* comms, XP_U16 headerLen,
@@ -413,9 +416,12 @@ comms_make( XWEnv xwe, XW_UtilCtxt* util, XP_Bool isServer,
             XP_U16 nPlayersHere, XP_U16 nPlayersTotal,
             RoleChangeProc rcp, void* rcClosure,
 #endif
-            XP_U16 forceChannel )
+            XP_U16 forceChannel, XWArena* arena )
 {
-    CommsCtxt* comms = (CommsCtxt*)XP_CALLOC( util->mpool, sizeof(*comms) );
+    CommsCtxt* comms = !!arena
+        ? (CommsCtxt*)arena_calloc( arena, sizeof(*comms) )
+        : (CommsCtxt*)XP_CALLOC( util->mpool, sizeof(*comms) );
+    comms->arena = arena;
     MUTEX_INIT_CHECKED( &comms->mutex, XP_TRUE, 3 );
     comms->util = util;
     comms->dutil = util_getDevUtilCtxt( util, xwe );
@@ -491,7 +497,7 @@ forEachElem( CommsCtxt* comms, EachMsgProc proc, void* closure )
 #ifdef DEBUG
                 elem->smp.next = NULL;
 #endif
-                freeElem( MPPARM(comms->mpool) elem );
+                freeElem( comms, elem );
                 XP_ASSERT( 1 <= comms->queueLen );
                 --comms->queueLen;
             } else {
@@ -529,7 +535,7 @@ cleanupAddrRecs( CommsCtxt* comms )
     for ( recs = comms->recs; !!recs; recs = next ) {
         next = recs->next;
         XP_ASSERT( !recs->_msgQueueHead );
-        XP_FREE( comms->mpool, recs );
+        commsFree( comms, recs, sizeof(*recs) );
     }
     comms->recs = (AddressRecord*)NULL;
 } /* cleanupAddrRecs */
@@ -587,7 +593,9 @@ comms_destroy( CommsCtxt* comms, XWEnv xwe )
 
     END_WITH_MUTEX();
     MUTEX_DESTROY( &comms->mutex );
-    XP_FREE( comms->mpool, comms );
+    if ( !comms->arena ) {
+        XP_FREE( comms->mpool, comms );
+    }
 } /* comms_destroy */
 
 void
@@ -750,7 +758,7 @@ comms_makeFromStream( XWEnv xwe, XWStreamCtxt* stream,
 #ifdef XWFEATURE_RELAY
                       RoleChangeProc rcp, void* rcClosure,
 #endif
-                      XP_U16 forceChannel )
+                      XP_U16 forceChannel, XWArena* arena )
 {
     LOG_FUNC();
     XP_U16 version = stream_getVersion( stream );
@@ -783,7 +791,7 @@ comms_makeFromStream( XWEnv xwe, XWStreamCtxt* stream,
 #ifdef XWFEATURE_RELAY
                                    nPlayersHere, nPlayersTotal, rcp, rcClosure,
 #endif
-                                   forceChannel );
+                                   forceChannel, arena );
 #ifndef XWFEATURE_RELAY
     XP_USE( nPlayersHere );
     XP_USE( nPlayersTotal );
@@ -821,7 +829,7 @@ comms_makeFromStream( XWEnv xwe, XWStreamCtxt* stream,
     COMMS_LOGFFV( "nAddrRecs: %d", nAddrRecs );
     AddressRecord** prevsAddrNext = &comms->recs;
     for ( int ii = 0; ii < nAddrRecs; ++ii ) {
-        AddressRecord* rec = (AddressRecord*)XP_CALLOC( util->mpool, sizeof(*rec));
+        AddressRecord* rec = (AddressRecord*)commsCalloc( comms, sizeof(*rec) );
 
         addrFromStream( &rec->addr, stream );
         logAddrComms( comms, &rec->addr, __func__ );
@@ -853,7 +861,7 @@ comms_makeFromStream( XWEnv xwe, XWStreamCtxt* stream,
     }
 
     for ( int ii = 0; ii < queueLen; ++ii ) {
-        MsgQueueElem* msg = (MsgQueueElem*)XP_CALLOC( util->mpool, sizeof(*msg) );
+        MsgQueueElem* msg = (MsgQueueElem*)commsCalloc( comms, sizeof(*msg) );
 
         msg->channelNo = readChannelNo( stream );
         if ( version >= STREAM_VERS_SMALLCOMMS ) {
@@ -881,7 +889,7 @@ comms_makeFromStream( XWEnv xwe, XWStreamCtxt* stream,
             stream_getFromStream( nliStream, stream, nliLen );
             NetLaunchInfo nli;
             if ( nli_makeFromStream( &nli, nliStream ) ) {
-                msg->smp.buf = (XP_U8*)XP_MALLOC( util->mpool, sizeof(nli) );
+                msg->smp.buf = (XP_U8*)commsCalloc( comms, sizeof(nli) );
                 XP_MEMCPY( (void*)msg->smp.buf, &nli, sizeof(nli) );
                 len = sizeof(nli); /* needed for checksum calc */
             } else {
@@ -889,7 +897,7 @@ comms_makeFromStream( XWEnv xwe, XWStreamCtxt* stream,
             }
             stream_destroy( nliStream );
         } else {
-            msg->smp.buf = (XP_U8*)XP_MALLOC( util->mpool, len );
+            msg->smp.buf = (XP_U8*)commsCalloc( comms, len );
             stream_getBytes( stream, (XP_U8*)msg->smp.buf, len );
         }
         dutil_md5sum( comms->dutil, xwe, msg->smp.buf, len, &msg->sb );
@@ -1446,11 +1454,11 @@ comms_getIsHost( const CommsCtxt* comms )
 }
 
 static MsgQueueElem*
-makeNewElem( const CommsCtxt* comms, XWEnv xwe, MsgID msgID,
+makeNewElem( CommsCtxt* comms, XWEnv xwe, MsgID msgID,
              XP_PlayerAddr channelNo )
 {
-    MsgQueueElem* newElem = (MsgQueueElem*)XP_CALLOC( comms->mpool,
-                                                      sizeof( *newElem ) );
+    MsgQueueElem* newElem = (MsgQueueElem*)commsCalloc( comms,
+                                                        sizeof( *newElem ) );
     newElem->smp.createdStamp = dutil_getCurSeconds( comms->dutil, xwe );
     newElem->channelNo = channelNo;
     newElem->msgID = msgID;
@@ -1458,7 +1466,7 @@ makeNewElem( const CommsCtxt* comms, XWEnv xwe, MsgID msgID,
 }
 
 static MsgQueueElem*
-makeElemWithID( const CommsCtxt* comms, XWEnv xwe, MsgID msgID, AddressRecord* rec,
+makeElemWithID( CommsCtxt* comms, XWEnv xwe, MsgID msgID, AddressRecord* rec,
                 XP_PlayerAddr channelNo, XWStreamCtxt* stream )
 {
     CNO_FMT( cbuf, channelNo );
@@ -1519,7 +1527,7 @@ makeElemWithID( const CommsCtxt* comms, XWEnv xwe, MsgID msgID, AddressRecord* r
 
     newElem->smp.len = stream_getSize( msgStream );
     XP_ASSERT( 0 < newElem->smp.len );
-    newElem->smp.buf = (XP_U8*)XP_MALLOC( comms->mpool, newElem->smp.len );
+    newElem->smp.buf = (XP_U8*)commsCalloc( comms, newElem->smp.len );
     stream_getBytes( msgStream, (XP_U8*)newElem->smp.buf, newElem->smp.len );
     stream_destroy( msgStream );
 
@@ -1537,7 +1545,7 @@ makeInviteElem( CommsCtxt* comms, XWEnv xwe,
     MsgQueueElem* newElem = makeNewElem( comms, xwe, 0, channelNo );
 
     XP_ASSERT( 0 == newElem->smp.len );           /* len == 0 signals is NLI */
-    newElem->smp.buf = XP_MALLOC( comms->mpool, sizeof(*nli) );
+    newElem->smp.buf = commsCalloc( comms, sizeof(*nli) );
     XP_MEMCPY( (XP_U8*)newElem->smp.buf, nli, sizeof(*nli) );
     dutil_md5sum( comms->dutil, xwe, newElem->smp.buf, sizeof(*nli), &newElem->sb );
     return newElem;
@@ -1607,14 +1615,14 @@ nukeInvites( CommsCtxt* comms, XWEnv xwe, XP_PlayerAddr channelNo )
 
     if ( !!deadRec ) {
         XP_ASSERT( !!deadRec->_msgQueueHead ); /* otherwise we'll leak */
-        freeElem( MPPARM(comms->mpool) deadRec->_msgQueueHead );
+        freeElem( comms, deadRec->_msgQueueHead );
         deadRec->_msgQueueHead = NULL;
         --comms->queueLen;
         removeFromQueue( comms, xwe, channelNo, 0 );
         CNO_FMT( cbuf, deadRec->channelNo );
         COMMS_LOGFF( "removing rec for %s", cbuf );
         XP_ASSERT( !deadRec->_msgQueueHead );
-        XP_FREEP( comms->mpool, &deadRec );
+        commsFree( comms, deadRec, sizeof(*deadRec) );
     }
 
     listRecs( comms, "end of nukeInvites" );
@@ -1893,7 +1901,7 @@ addToQueue( CommsCtxt* comms, XWEnv xwe, MsgQueueElem* newElem, XP_Bool notify )
     MsgQueueElem** head;
     AddressRecord* rec = getRecordFor( comms, newElem->channelNo );
     if ( !rec ) {
-        freeElem( MPPARM(comms->mpool) newElem );
+        freeElem( comms, newElem );
         asAdded = NULL;
         goto dropPacket;
     }
@@ -1907,7 +1915,7 @@ addToQueue( CommsCtxt* comms, XWEnv xwe, MsgQueueElem* newElem, XP_Bool notify )
         }
         if ( elems_same( *head, newElem ) ) {
             /* This does still happen! Not sure why. */
-            freeElem( MPPARM(comms->mpool) newElem );
+            freeElem( comms, newElem );
             asAdded = *head;
         } else {
             (*head)->smp.next = &newElem->smp;
@@ -2011,12 +2019,44 @@ elems_same( const MsgQueueElem* elem1, const MsgQueueElem* elem2 )
     return same;
 }
 
+/* Address records and queued messages come and go with the game's
+   traffic. When comms lives in its game's arena they're recycled through
+   the arena's pool, which the mutex makes safe to share with whatever
+   thread is sending. */
+static void*
+commsCalloc( CommsCtxt* comms, XP_U32 size )
+{
+    void* result;
+    if ( !!comms->arena ) {
+        WITH_MUTEX( &comms->mutex );
+        result = arena_poolAlloc( comms->arena, size );
+        END_WITH_MUTEX();
+    } else {
+        result = XP_CALLOC( comms->mpool, size );
+    }
+    return result;
+}
+
+static void
+commsFree( CommsCtxt* comms, void* ptr, XP_U32 size )
+{
+    if ( !!comms->arena ) {
+        WITH_MUTEX( &comms->mutex );
+        arena_poolFree( comms->arena, ptr, size );
+        END_WITH_MUTEX();
+    } else {
+        XP_FREE( comms->mpool, ptr );
+    }
+}
+
 static void
-freeElem( MPFORMAL MsgQueueElem* elem )
+freeElem( CommsCtxt* comms, MsgQueueElem* elem )
 {
     XP_ASSERT( !elem->smp.next );
-    XP_FREEP( mpool, &elem->smp.buf );
-    XP_FREE( mpool, elem );
+    /* len 0 means buf holds a NetLaunchInfo */
+    XP_U32 bufLen = 0 == elem->smp.len ? sizeof(NetLaunchInfo) : elem->smp.len;
+    commsFree( comms, (void*)elem->smp.buf, bufLen );
+    commsFree( comms, elem, sizeof(*elem) );
 }
 
 /* We've received on some channel a message with a certain ID.  This means
@@ -3502,7 +3542,7 @@ rememberChannelAddress( CommsCtxt* comms, XP_PlayerAddr channelNo,
     rec = getRecordFor( comms, channelNo );
     if ( !rec ) {
         /* not found; add a new entry */
-        rec = (AddressRecord*)XP_CALLOC( comms->mpool, sizeof(*rec) );
+        rec = (AddressRecord*)commsCalloc( comms, sizeof(*rec) );
 
         rec->channelNo = channelNo;
         rec->rr.hostID = hostID;
@@ -23,6 +23,7 @@
 #include "comtypes.h"
 #include "commstyp.h"
 #include "mempool.h"
+#include "arena.h"
 #include "xwrelay.h"
 #include "server.h"
 
@@ -143,6 +144,8 @@ typedef struct _TransportProcs {
     void* closure;
 } TransportProcs;
 
+/* If arena's non-NULL the CommsCtxt lives there, and its address records
+   and queued messages come from the arena's size-class pool */
 CommsCtxt* comms_make( XWEnv xwe, XW_UtilCtxt* util,
                        XP_Bool isServer,
                        const CommsAddrRec* selfAddr,
@@ -152,7 +155,7 @@ CommsCtxt* comms_make( XWEnv xwe, XW_UtilCtxt* util,
                        XP_U16 nPlayersHere, XP_U16 nPlayersTotal,
                        RoleChangeProc rcp, void* rcClosure,
 #endif
-                       XP_U16 forceChannel );
+                       XP_U16 forceChannel, XWArena* arena );
 
 void comms_resetSame( CommsCtxt* comms, XWEnv xwe );
 
@@ -186,7 +189,7 @@ CommsCtxt* comms_makeFromStream( XWEnv xwe, XWStreamCtxt* stream,
 #ifdef XWFEATURE_RELAY
                                  RoleChangeProc rcp, void* rcClosure,
 #endif
-                                 XP_U16 forceChannel );
+                                 XP_U16 forceChannel, XWArena* arena );
 void comms_start( CommsCtxt* comms, XWEnv xwe );
 void comms_stop( CommsCtxt* comms
 #ifdef XWFEATURE_RELAY
@@ -56,6 +56,7 @@
 #define MAX_COLS MAX_ROWS
 #define MIN_COLS 11
 
+#define STREAM_VERS_SUMMARY 0x27
 #define STREAM_VERS_SUBSEVEN 0x26
 #define STREAM_VERS_REMATCHORDER 0x25
 #define STREAM_VERS_REMATCHADDRS 0x24
@@ -109,7 +110,7 @@
 #define STREAM_VERS_405  0x01
 
 /* search for FIX_NEXT_VERSION_CHANGE next time this is changed */
-#define CUR_STREAM_VERS STREAM_VERS_SUBSEVEN
+#define CUR_STREAM_VERS STREAM_VERS_SUMMARY
 
 typedef struct XP_Rect {
     XP_S16 left;
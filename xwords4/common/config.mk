@@ -63,6 +63,7 @@ COMMON5 = \
 	$(COMMONOBJDIR)/knownplyr.o \
 	$(COMMONOBJDIR)/dllist.o \
 	$(COMMONOBJDIR)/xwarray.o \
+	$(COMMONOBJDIR)/arena.o \
 	$(COMMONOBJDIR)/stats.o \
 	$(COMMONOBJDIR)/timers.o \
 	$(COMMONOBJDIR)/md5.o \
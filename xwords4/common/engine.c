@@ -102,6 +102,9 @@ struct EngineCtxt {
     XP_Bool skipProgressCallback;
     XP_Bool isRobot;
     XP_Bool includePending;
+    XP_Bool useBits;            /* no pending tiles for the model's bitmaps
+                                   to miss */
+    const CellTile* cells;      /* the model's, as this search sees them */
     MoveIterationData miData;
 
     XP_S16 blankValues[MAX_TRAY_TILES];
@@ -136,6 +139,8 @@ static void figureCrosschecks( EngineCtxt* engine, XP_U16 col,
                                XP_U16 row, XP_U16* scoreP,
                                Crosscheck* check );
 static XP_Bool isAnchorSquare( EngineCtxt* engine, XP_U16 col, XP_U16 row );
+static XP_U32 rowAnchors( const EngineCtxt* engine, XP_U16 row );
+static void orient( EngineCtxt* engine );
 static array_edge* edge_from_tile( const DictionaryCtxt* dict, 
                                    array_edge* from, Tile tile );
 static void leftPart( EngineCtxt* engine, XWEnv xwe, Tile* tiles, XP_U16 tileLength,
@@ -449,6 +454,8 @@ engine_findMove( EngineCtxt* engine, XWEnv xwe, const ModelCtxt* model,
     engine->dict = model_getPlayerDict( model, turn );
     engine->turn = turn;
     engine->includePending = includePending;
+    engine->useBits = !includePending
+        || 0 == model_getCurrentMoveCount( model, turn );
     engine->usePrev = usePrev;
     engine->blankTile = dict_getBlankTile( engine->dict );
     engine->returnNOW = XP_FALSE;
@@ -457,6 +464,7 @@ engine_findMove( EngineCtxt* engine, XWEnv xwe, const ModelCtxt* model,
     engine->searchLimits = searchLimits;
 #endif
 
+    orient( engine );       /* model may have changed since we paused */
     engine->star_row = star_row = model_numRows(model) / 2;
     engine->isFirstMove = 
         EMPTY_TILE == localGetBoardTile( engine, star_row, 
@@ -488,13 +496,7 @@ engine_findMove( EngineCtxt* engine, XWEnv xwe, const ModelCtxt* model,
             }
             for ( ; ; ) {
                 XP_U16 firstRowToFill = 0;
-                engine->numRows = model_numRows(engine->model);
-                engine->numCols = model_numCols(engine->model);
-                if ( !engine->searchHorizontal ) {
-                    XP_U16 tmp = engine->numRows;
-                    engine->numRows = engine->numCols;
-                    engine->numCols = tmp;
-                }
+                orient( engine );
 
                 if ( 0 ) {
 #ifdef XWFEATURE_SEARCHLIMIT
@@ -624,15 +626,38 @@ findMovesOneRow( EngineCtxt* engine, XWEnv xwe )
         }
     }
 
+    XP_U32 anchors = engine->useBits ? rowAnchors( engine, row ) : 0;
     XP_S16 prevAnchor = firstSearchCol - 1;
     for ( XP_U16 col = firstSearchCol; col <= lastSearchCol && !engine->returnNOW;
           ++col ) {
-        if ( isAnchorSquare( engine, col, row ) ) { 
+        XP_Bool isAnchor;
+        if ( engine->useBits ) {
+            isAnchor = 0 != (anchors & (((XP_U32)1) << col));
+            XP_ASSERT( isAnchor == isAnchorSquare( engine, col, row ) );
+        } else {
+            isAnchor = isAnchorSquare( engine, col, row );
+        }
+        if ( isAnchor ) {
             findMovesForAnchor( engine, xwe, &prevAnchor, col, row );
         }
     }
 } /* findMovesOneRow */
 
+/* Point at the model's board as the current search direction sees it */
+static void
+orient( EngineCtxt* engine )
+{
+    const ModelCtxt* model = engine->model;
+    engine->numRows = model_numRows( model );
+    engine->numCols = model_numCols( model );
+    if ( !engine->searchHorizontal ) {
+        XP_U16 tmp = engine->numRows;
+        engine->numRows = engine->numCols;
+        engine->numCols = tmp;
+    }
+    engine->cells = model_getCells( model, !engine->searchHorizontal );
+} /* orient */
+
 static XP_Bool
 lookup( const DictionaryCtxt* dict, array_edge* edge, Tile* buf, 
         XP_U16 tileIndex, XP_U16 length ) 
@@ -783,21 +808,30 @@ localGetBoardTile( EngineCtxt* engine, XP_U16 col, XP_U16 row,
                    XP_Bool substBlank )
 {
     Tile result;
-    XP_Bool isBlank;
-
-    if ( !engine->searchHorizontal ) {
-        XP_U16 tmp = col;
-        col = row;
-        row = tmp;
-    }
-
-    if ( model_getTile( engine->model, col, row, engine->includePending,
-                        engine->turn, &result, &isBlank, NULL, NULL ) ) {
-        if ( isBlank && substBlank ) {
-            result = engine->blankTile;
+    CellTile cell = engine->cells[(row * engine->numCols) + col];
+
+    if ( 0 != (cell & TILE_PENDING_BIT) ) {
+        /* Whose it is, and whether we see it, is the model's call */
+        XP_Bool isBlank;
+        if ( !engine->searchHorizontal ) {
+            XP_U16 tmp = col;
+            col = row;
+            row = tmp;
         }
-    } else {
+        if ( model_getTile( engine->model, col, row, engine->includePending,
+                            engine->turn, &result, &isBlank, NULL, NULL ) ) {
+            if ( isBlank && substBlank ) {
+                result = engine->blankTile;
+            }
+        } else {
+            result = EMPTY_TILE;
+        }
+    } else if ( TILE_IS_EMPTY( cell ) ) {
         result = EMPTY_TILE;
+    } else if ( IS_BLANK( cell ) && substBlank ) {
+        result = engine->blankTile;
+    } else {
+        result = cell & TILE_VALUE_MASK;
     }
     return result;
 } /* localGetBoardTile */
@@ -836,6 +870,29 @@ isAnchorSquare( EngineCtxt* engine, XP_U16 col, XP_U16 row )
     return XP_FALSE;
 } /* isAnchorSquare */
 
+/* isAnchorSquare() for a whole row at once, from the model's bitmaps */
+static XP_U32
+rowAnchors( const EngineCtxt* engine, XP_U16 row )
+{
+    const ModelCtxt* model = engine->model;
+    XP_Bool transposed = !engine->searchHorizontal;
+    XP_U32 occupied = model_getOccupied( model, row, transposed );
+    XP_U32 result;
+
+    if ( engine->isFirstMove ) {
+        result = row == engine->star_row ? ((XP_U32)1) << engine->star_row : 0;
+    } else {
+        result = (occupied << 1) | (occupied >> 1);
+        if ( row != 0 ) {
+            result |= model_getOccupied( model, row - 1, transposed );
+        }
+        if ( row < engine->numRows-1 ) {
+            result |= model_getOccupied( model, row + 1, transposed );
+        }
+    }
+    return result & ~occupied;
+} /* rowAnchors */
+
 #ifdef XWFEATURE_HILITECELL
 static void
 hiliteForAnchor( EngineCtxt* engine, XWEnv xwe, XP_U16 col, XP_U16 row )
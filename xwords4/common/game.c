@@ -30,6 +30,10 @@ extern "C" {
 
 #define FLAG_HASCOMMS 0x01
 
+/* Room for a game's contexts (model, stack, server, board and comms come to
+   under 3K), with some left over for comms' first queued messages */
+#define GAME_ARENA_SIZE 4096
+
 #ifdef DEBUG
 static void
 assertUtilOK( XW_UtilCtxt* util )
@@ -188,8 +192,9 @@ game_makeNewGame( MPFORMAL XWEnv xwe, XWGame* game, CurGameInfo* gi,
     if ( success ) {
         XP_STRNCPY( gi->isoCodeStr, dict_getISOCode( dict ), VSIZE(gi->isoCodeStr) );
         XP_ASSERT( !!gi->isoCodeStr[0] );
+        game->arena = arena_make( MPPARM(mpool) GAME_ARENA_SIZE );
         game->model = model_make( MPPARM(mpool) xwe, (DictionaryCtxt*)NULL,
-                                  NULL, util, gi->boardSize );
+                                  NULL, util, gi->boardSize, game->arena );
 
         model_setDictionary( game->model, xwe, dict );
         model_setPlayerDicts( game->model, xwe, &playerDicts );
@@ -202,16 +207,17 @@ game_makeNewGame( MPFORMAL XWEnv xwe, XWGame* game, CurGameInfo* gi,
                                       nPlayersHere, nPlayersTotal,
                                       onRoleChanged, game,
 #endif
-                                      gi->forceChannel
+                                      gi->forceChannel, game->arena
                                       );
         } else {
             game->comms = (CommsCtxt*)NULL;
         }
 
 
-        game->server = server_make( xwe, game->model, game->comms, util );
+        game->server = server_make( xwe, game->model, game->comms, util,
+                                    game->arena );
         game->board = board_make( xwe, game->model, game->server,
-                                  NULL, util );
+                                  NULL, util, game->arena );
         board_setCallbacks( game->board, xwe );
 
         board_setDraw( game->board, xwe, draw );
@@ -299,6 +305,60 @@ game_changeDict( MPFORMAL XWGame* game, XWEnv xwe, CurGameInfo* gi, DictionaryCt
 }
 #endif
 
+static void
+summarizeGI( const CurGameInfo* gi, GameSummary* summary )
+{
+    XP_STRNCPY( summary->isoCodeStr, gi->isoCodeStr, VSIZE(summary->isoCodeStr)-1 );
+    for ( int ii = 0; ii < gi->nPlayers; ++ii ) {
+        const LocalPlayer* lp  = &gi->players[ii];
+        /* A remote player who hasn't joined yet has no name */
+        if ( (LP_IS_ROBOT(lp) || !LP_IS_LOCAL(lp)) && !!lp->name ) {
+            if ( '\0' != summary->opponents[0] ) {
+                XP_STRCAT( summary->opponents, ", " );
+            }
+            XP_STRCAT( summary->opponents, lp->name );
+        }
+    }
+}
+
+static void
+summaryToStream( XWStreamCtxt* stream, const GameSummary* summary )
+{
+    stream_putBits( stream, 1, summary->turnIsLocal ? 1 : 0 );
+    stream_putBits( stream, 1, summary->gameOver ? 1 : 0 );
+    stream_putBits( stream, 1, summary->quashed ? 1 : 0 );
+    stream_putBits( stream, 1, summary->canRematch ? 1 : 0 );
+    stream_putBits( stream, 1, summary->canOfferRO ? 1 : 0 );
+    stream_putU8( stream, (XP_U8)summary->turn );
+    stream_putU32( stream, summary->lastMoveTime );
+    stream_putU32( stream, (XP_U32)summary->dupTimerExpires );
+    stream_putU8( stream, summary->missingPlayers );
+    stream_putU8( stream, summary->nPacketsPending );
+    stream_putU8( stream, summary->channelNo );
+    stream_putU16( stream, (XP_U16)summary->nMoves );
+}
+
+/* What isn't saved comes from gi, as game_summarize() does it */
+static void
+summaryFromStream( XWStreamCtxt* stream, const CurGameInfo* gi,
+                   GameSummary* summary )
+{
+    XP_MEMSET( summary, 0, sizeof(*summary) );
+    summary->turnIsLocal = stream_getBits( stream, 1 );
+    summary->gameOver = stream_getBits( stream, 1 );
+    summary->quashed = stream_getBits( stream, 1 );
+    summary->canRematch = stream_getBits( stream, 1 );
+    summary->canOfferRO = stream_getBits( stream, 1 );
+    summary->turn = (XP_S8)stream_getU8( stream );
+    summary->lastMoveTime = stream_getU32( stream );
+    summary->dupTimerExpires = (XP_S32)stream_getU32( stream );
+    summary->missingPlayers = stream_getU8( stream );
+    summary->nPacketsPending = stream_getU8( stream );
+    summary->channelNo = stream_getU8( stream );
+    summary->nMoves = (XP_S16)stream_getU16( stream );
+    summarizeGI( gi, summary );
+}
+
 XP_Bool
 game_makeFromStream( MPFORMAL XWEnv xwe, XWStreamCtxt* stream,
                      XWGame* game, CurGameInfo* gi,
@@ -317,6 +377,9 @@ game_makeFromStream( MPFORMAL XWEnv xwe, XWStreamCtxt* stream,
     } else {
         do { /* do..while so can break */
             stream_setVersion( stream, strVersion );
+            if ( STREAM_VERS_SUMMARY <= strVersion ) {
+                (void)stream_getU16( stream ); /* header length */
+            }
 
             gi_readFromStream( MPPARM(mpool) stream, gi );
             if ( !game ) {
@@ -335,6 +398,7 @@ game_makeFromStream( MPFORMAL XWEnv xwe, XWStreamCtxt* stream,
             if ( !dict ) {
                 break;
             }
+            game->arena = arena_make( MPPARM(mpool) GAME_ARENA_SIZE );
 
             /* Previous stream versions didn't save anything if built
              * standalone.  Now we always save something.  But we need to know
@@ -354,6 +418,11 @@ game_makeFromStream( MPFORMAL XWEnv xwe, XWStreamCtxt* stream,
                     hasComms = flags & FLAG_HASCOMMS;
                 }
             }
+            if ( STREAM_VERS_SUMMARY <= strVersion ) {
+                /* Skip it: it's for readers that stop at the header */
+                GameSummary summary;
+                summaryFromStream( stream, gi, &summary );
+            }
 
             XP_ASSERT( hasComms == (SERVER_STANDALONE != gi->serverRole) );
             if ( hasComms ) {
@@ -363,22 +432,25 @@ game_makeFromStream( MPFORMAL XWEnv xwe, XWStreamCtxt* stream,
 #ifdef XWFEATURE_RELAY
                                                     onRoleChanged, game,
 #endif
-                                                    gi->forceChannel );
+                                                    gi->forceChannel,
+                                                    game->arena );
             } else {
                 XP_ASSERT( NULL == game->comms );
                 game->comms = NULL;
             }
 
             game->model = model_makeFromStream( MPPARM(mpool) xwe, stream, dict,
-                                                &playerDicts, util );
+                                                &playerDicts, util, game->arena );
 
             game->server = server_makeFromStream( xwe, stream,
                                                   game->model, game->comms, 
-                                                  util, gi->nPlayers );
+                                                  util, gi->nPlayers,
+                                                  game->arena );
 
             game->board = board_makeFromStream( xwe, stream,
                                                 game->model, game->server, 
-                                                NULL, util, gi->nPlayers );
+                                                NULL, util, gi->nPlayers,
+                                                game->arena );
             setListeners( game, cp );
             board_setDraw( game->board, xwe, draw );
             success = XP_TRUE;
@@ -446,6 +518,8 @@ game_saveToStream( const XWGame* game, const CurGameInfo* gi,
     XP_ASSERT( gi_equal( gi, game->util->gameInfo ) );
     stream_putU8( stream, CUR_STREAM_VERS );
     stream_setVersion( stream, CUR_STREAM_VERS );
+    XWStreamPos lenPos = stream_getPos( stream, POS_WRITE );
+    stream_putU16( stream, 0 ); /* header length, set below */
 
     gi_writeToStream( stream, gi );
 
@@ -456,6 +530,25 @@ game_saveToStream( const XWGame* game, const CurGameInfo* gi,
 
         XP_U8 flags = NULL == game->comms ? 0 : FLAG_HASCOMMS;
         stream_putU8( stream, flags );
+
+        GameSummary summary;
+        game_summarize( game, gi, &summary );
+        summaryToStream( stream, &summary );
+    }
+
+    /* Now that its length is known, go back and write the header again
+       behind it. A put at a rewound position truncates the stream, so
+       copy the header out first. */
+    XP_U32 hdrStart = (lenPos >> 3) + sizeof(XP_U16);
+    XP_U16 hdrLen = (XP_U16)((stream_getPos( stream, POS_WRITE ) >> 3)
+                             - hdrStart);
+    XP_U8 hdr[hdrLen];
+    XP_MEMCPY( hdr, stream_getPtr( stream ) + hdrStart, hdrLen );
+    (void)stream_setPos( stream, POS_WRITE, lenPos );
+    stream_putU16( stream, hdrLen );
+    stream_putBytes( stream, hdr, hdrLen );
+
+    if ( !!game ) {
         if ( NULL != game->comms ) {
             comms_writeToStream( game->comms, stream, saveToken );
         }
@@ -466,6 +559,41 @@ game_saveToStream( const XWGame* game, const CurGameInfo* gi,
     }
 } /* game_saveToStream */
 
+XP_U16
+game_headerLen( const XP_U8* prefix )
+{
+    XP_U16 result = 0;
+    XP_U8 strVersion = prefix[0];
+    if ( STREAM_VERS_SUMMARY <= strVersion && strVersion <= CUR_STREAM_VERS ) {
+        result = GAME_HEADER_PREFIX_LEN + ((prefix[1] << 8) | prefix[2]);
+    }
+    return result;
+}
+
+XP_Bool
+game_summaryFromStream( MPFORMAL XWStreamCtxt* stream, CurGameInfo* gi,
+                        GameSummary* summary )
+{
+    XP_Bool success = XP_FALSE;
+    XP_U8 strVersion = stream_getU8( stream );
+    if ( strVersion <= CUR_STREAM_VERS ) {
+        stream_setVersion( stream, strVersion );
+        if ( STREAM_VERS_SUMMARY <= strVersion ) {
+            (void)stream_getU16( stream ); /* header length */
+        }
+        gi_readFromStream( MPPARM(mpool) stream, gi );
+
+        success = STREAM_VERS_SUMMARY <= strVersion
+            && 0 < stream_getSize( stream );
+        if ( success ) {
+            (void)stream_getU32( stream ); /* created */
+            (void)stream_getU8( stream );  /* flags */
+            summaryFromStream( stream, gi, summary );
+        }
+    }
+    return success;
+} /* game_summaryFromStream */
+
 void
 game_saveSucceeded( const XWGame* game, XWEnv xwe, XP_U16 saveToken )
 {
@@ -538,21 +666,11 @@ game_summarize( const XWGame* game, const CurGameInfo* gi, GameSummary* summary
     ServerCtxt* server = game->server;
     summary->turn = server_getCurrentTurn( server, &summary->turnIsLocal );
     summary->lastMoveTime = server_getLastMoveTime(server);
-    XP_STRNCPY( summary->isoCodeStr, gi->isoCodeStr, VSIZE(summary->isoCodeStr)-1 );
     summary->gameOver = server_getGameIsOver( server );
     summary->nMoves = model_getNMoves( game->model );
     summary->dupTimerExpires = server_getDupTimerExpires( server );
     summary->canRematch = server_canRematch( server, &summary->canOfferRO );
-
-    for ( int ii = 0; ii < gi->nPlayers; ++ii ) {
-        const LocalPlayer* lp  = &gi->players[ii];
-        if ( LP_IS_ROBOT(lp) || !LP_IS_LOCAL(lp) ) {
-            if ( '\0' != summary->opponents[0] ) {
-                XP_STRCAT( summary->opponents, ", " );
-            }
-            XP_STRCAT( summary->opponents, lp->name );
-        }
-    }
+    summarizeGI( gi, summary );
     if ( !!game->comms ) {
         summary->missingPlayers = server_getMissingPlayers( server );
         summary->nPacketsPending =
@@ -602,6 +720,9 @@ game_dispose( XWGame* game, XWEnv xwe )
         server_destroy( game->server );
         game->server = NULL;
     }
+    /* Last: everything above lived in it */
+    arena_destroy( game->arena );
+    game->arena = NULL;
 } /* game_dispose */
 
 static void
@@ -27,6 +27,7 @@
 #include "comms.h"
 #include "server.h"
 #include "util.h"
+#include "arena.h"
 
 #ifdef CPLUS
 extern "C" {
@@ -73,6 +74,7 @@ typedef struct _XWGame {
     ModelCtxt* model;
     ServerCtxt* server;
     CommsCtxt* comms;
+    XWArena* arena;     /* holds the above; lives until game_dispose() */
     XP_U32 created;     /* dutil_getCurSeconds() of creation */
 } XWGame;
 
@@ -103,6 +105,19 @@ XP_Bool game_makeFromInvite( XWGame* newGame, XWEnv xwe, const NetLaunchInfo* nl
 
 void game_saveToStream( const XWGame* game, const CurGameInfo* gi,
                         XWStreamCtxt* stream, XP_U16 saveToken );
+
+/* Saves from STREAM_VERS_SUMMARY on start with a header: the gi, then a
+   GameSummary as of the save. Given a save's first GAME_HEADER_PREFIX_LEN
+   bytes, game_headerLen() says how many bytes from the start that header
+   spans, or 0 if the save's too old to have one. */
+#define GAME_HEADER_PREFIX_LEN 3
+XP_U16 game_headerLen( const XP_U8* prefix );
+
+/* Reads the gi, and the summary if the save has one, without building the
+   game. The stream need hold only the header. Returns XP_FALSE if there's
+   no summary; gi's read either way and must be disposed. */
+XP_Bool game_summaryFromStream( MPFORMAL XWStreamCtxt* stream,
+                                CurGameInfo* gi, GameSummary* summary );
 void game_saveSucceeded( const XWGame* game, XWEnv xwe, XP_U16 saveToken );
 
 XP_Bool game_receiveMessage( XWGame* game, XWEnv xwe, XWStreamCtxt* stream,
@@ -40,7 +40,7 @@ typedef struct MemPoolEntry {
     XP_U32 lineNo;
     XP_U32 size;
     void* ptr;
-    XP_U16 index;
+    XP_U32 index;
 } MemPoolEntry;
 
 struct MemPoolCtx {
@@ -50,7 +50,7 @@ struct MemPoolCtx {
 
     XP_U16 nFree;
     XP_U16 nUsed;
-    XP_U16 nAllocs;
+    XP_U32 nAllocs;
     MPStatsBuf stats;
 
     XP_UCHAR tag[64];
@@ -378,6 +378,12 @@ mpool_getNUsed( MemPoolCtx* mpool )
     return mpool->nUsed;
 } /* mpool_getNUsed */
 
+XP_U32
+mpool_getNAllocs( const MemPoolCtx* mpool )
+{
+    return mpool->nAllocs;
+}
+
 #ifdef CPLUS
 }
 #endif
@@ -49,6 +49,8 @@ void mpool_freep( MemPoolCtx* mpool, void** ptr, const char* file,
 
 void mpool_stats( MemPoolCtx* mpool, XWStreamCtxt* stream );
 XP_U16 mpool_getNUsed( MemPoolCtx* mpool );
+/* Total allocations ever made, for comparing before and after something */
+XP_U32 mpool_getNAllocs( const MemPoolCtx* mpool );
 
 typedef struct _MPStatsBuf {
     XP_U32 curBytes;
@@ -180,38 +180,34 @@ mem_stream_getU32( DBG_PROC_FORMAL XWStreamCtxt* p_sctx )
     return XP_NTOHL( result );
 } /* mem_stream_getU32 */
 
-static XP_Bool
-getOneBit( MemStreamCtxt* stream )
-{
-    XP_U8 mask, rack;
-    XP_Bool result;
-
-    if ( stream->nReadBits == 0 ) {
-        ++stream->curReadPos;
-    }
-    XP_ASSERT( stream->curReadPos <= stream->nBytesWritten );
-
-    rack = stream->buf[stream->curReadPos-1];
-    mask = 1 << stream->nReadBits++;
-    result = (rack & mask) != 0;
-
-    if ( stream->nReadBits == 8 ) {
-        stream->nReadBits = 0;
-    }
-    return result;
-} /* getOneBit */
-
+/* Bits are packed LSB-first.  Rather than going a bit at a time, take as
+ * many as the current byte holds on each pass. */
 static XP_U32
 mem_stream_getBits( XWStreamCtxt* p_sctx, XP_U16 nBits )
 {
     MemStreamCtxt* stream = (MemStreamCtxt*)p_sctx;
-    XP_U32 mask;
     XP_U32 result = 0;
+    XP_U16 shift = 0;
+
+    while ( 0 < nBits ) {
+        if ( stream->nReadBits == 0 ) {
+            ++stream->curReadPos;
+        }
+        XP_ASSERT( stream->curReadPos <= stream->nBytesWritten );
 
-    for ( mask = 1L; nBits--; mask <<= 1 ) {
-        if ( getOneBit( stream ) ) {
-            result |= mask;
+        XP_U16 nHere = 8 - stream->nReadBits;
+        if ( nHere > nBits ) {
+            nHere = nBits;
         }
+        XP_U32 rack = stream->buf[stream->curReadPos-1] >> stream->nReadBits;
+        rack &= (1 << nHere) - 1;
+        if ( shift < 32 ) {
+            result |= rack << shift;
+        }
+
+        shift += nHere;
+        nBits -= nHere;
+        stream->nReadBits = (stream->nReadBits + nHere) % 8;
     }
 
     return result;
@@ -280,7 +276,15 @@ mem_stream_putBytes( XWStreamCtxt* p_sctx, const void* whence,
 
     if ( newSize > stream->nBytesAllocated ) {
         XP_ASSERT( newSize + STREAM_INCR_SIZE < 0xFFFF );
-        stream->nBytesAllocated = (XP_U16)newSize + STREAM_INCR_SIZE;
+        /* Grow geometrically so a stream written a byte at a time (e.g. a
+           saved game) isn't realloc'd every STREAM_INCR_SIZE bytes. */
+        XP_U32 newAlloc = 2 * (XP_U32)stream->nBytesAllocated;
+        if ( newAlloc < newSize + STREAM_INCR_SIZE ) {
+            newAlloc = newSize + STREAM_INCR_SIZE;
+        } else if ( newAlloc > 0xFFFE ) {
+            newAlloc = 0xFFFE;
+        }
+        stream->nBytesAllocated = (XP_U16)newAlloc;
         stream->buf = 
             (XP_U8*)XP_REALLOC( stream->mpool, stream->buf, 
                                 stream->nBytesAllocated );
@@ -320,32 +324,6 @@ mem_stream_putU32( XWStreamCtxt* p_sctx, XP_U32 data )
     mem_stream_putBytes( p_sctx, &data, sizeof(data) );
 } /* mem_stream_putU32 */
 
-static void
-putOneBit( MemStreamCtxt* stream, XP_U16 bit )
-{
-    XP_U8 mask, rack;
-
-    if ( stream->nWriteBits == 0 ) {
-        if ( stream->curWritePos == stream->nBytesWritten ) {
-            stream_putU8( (XWStreamCtxt*)stream, 0 ); /* increments curPos */
-        } else {
-            stream->buf[stream->curWritePos++] = 0;
-        }
-    }
-
-    XP_ASSERT( stream->curWritePos > 0 );
-    rack = stream->buf[stream->curWritePos-1];
-    mask = 1 << stream->nWriteBits++;
-    if ( bit ) {
-        rack |= mask;
-    } else {
-        rack &= ~mask;
-    }
-    stream->buf[stream->curWritePos-1] = rack;
-
-    stream->nWriteBits %= 8;
-} /* putOneBit */
-
 static void
 mem_stream_putBits( XWStreamCtxt* p_sctx, XP_U16 nBits, XP_U32 data
                     DBG_LINE_FILE_FORMAL )
@@ -357,9 +335,29 @@ mem_stream_putBits( XWStreamCtxt* p_sctx, XP_U16 nBits, XP_U32 data
 
     XP_ASSERT( nBits > 0 );
 
-    while ( nBits-- ) {
-        putOneBit( stream, (XP_U16)(((data & 1L) != 0)? 1:0) );
-        data >>= 1;
+    while ( 0 < nBits ) {
+        if ( stream->nWriteBits == 0 ) {
+            if ( stream->curWritePos == stream->nBytesWritten ) {
+                stream_putU8( p_sctx, 0 ); /* increments curPos */
+            } else {
+                stream->buf[stream->curWritePos++] = 0;
+            }
+        }
+        XP_ASSERT( stream->curWritePos > 0 );
+
+        /* Fill what's left of the current byte, leaving any bits above
+           those alone as setting them one at a time used to. */
+        XP_U16 nHere = 8 - stream->nWriteBits;
+        if ( nHere > nBits ) {
+            nHere = nBits;
+        }
+        XP_U8 mask = ((1 << nHere) - 1) << stream->nWriteBits;
+        XP_U8* rack = &stream->buf[stream->curWritePos-1];
+        *rack = (*rack & ~mask) | ((data << stream->nWriteBits) & mask);
+
+        data = nHere < 32 ? data >> nHere : 0;
+        nBits -= nHere;
+        stream->nWriteBits = (stream->nWriteBits + nHere) % 8;
     }
 #ifdef DEBUG
     if ( data != 0 ) {
@@ -426,20 +424,33 @@ mem_stream_getSize( const XWStreamCtxt* p_sctx )
     return size;
 } /* mem_stream_getSize */
 
-static XP_U32
-mem_stream_getHash( const XWStreamCtxt* p_sctx, XWStreamPos pos )
+/* Whole bytes before pos; the partial one, if any, is hashed masked */
+static XP_U16
+hashedBytes( XWStreamPos pos )
 {
-    XP_U32 hash = 0;
-    const MemStreamCtxt* stream = (const MemStreamCtxt*)p_sctx;
-    const XP_U8* ptr = stream->buf; 
     XP_U16 len = BYTE_PART(pos);
-    XP_U16 bits = BIT_PART(pos);
-    if ( 0 != bits ) {
+    if ( 0 != BIT_PART(pos) ) {
         XP_ASSERT( 0 < len );
         --len;
     }
+    return len;
+}
+
+static XP_U32
+mem_stream_getHashFrom( const XWStreamCtxt* p_sctx, XWStreamPos pos,
+                        XWStreamPos* fromPos, XP_U32* fromHash )
+{
+    const MemStreamCtxt* stream = (const MemStreamCtxt*)p_sctx;
+    const XP_U8* ptr = stream->buf; 
+    XP_U16 start = hashedBytes( *fromPos );
+    XP_U16 len = hashedBytes( pos );
+    XP_U16 bits = BIT_PART(pos);
+    XP_ASSERT( start <= len );
+
+    XP_U32 hash = augmentHash( *fromHash, ptr + start, len - start );
+    *fromPos = pos;
+    *fromHash = hash;
 
-    hash = augmentHash( 0, ptr, len );
     if ( 0 != bits ) {
         XP_U8 byt = ptr[len];
         byt &= ~(0xFF << bits);
@@ -449,6 +460,14 @@ mem_stream_getHash( const XWStreamCtxt* p_sctx, XWStreamPos pos )
 
     /* XP_LOGF( "%s(nBytes=%d, nBits=%d) => %X", __func__, len, bits, hash ); */
     return hash;
+} /* mem_stream_getHashFrom */
+
+static XP_U32
+mem_stream_getHash( const XWStreamCtxt* p_sctx, XWStreamPos pos )
+{
+    XWStreamPos fromPos = START_OF_STREAM;
+    XP_U32 fromHash = 0;
+    return mem_stream_getHashFrom( p_sctx, pos, &fromPos, &fromHash );
 } /* mem_stream_getHash */
 
 static const XP_U8*
@@ -599,6 +618,7 @@ make_vtable( MemStreamCtxt* stream )
 
     SET_VTABLE_ENTRY( vtable, stream_getSize, mem );
     SET_VTABLE_ENTRY( vtable, stream_getHash, mem );
+    SET_VTABLE_ENTRY( vtable, stream_getHashFrom, mem );
     SET_VTABLE_ENTRY( vtable, stream_getPtr, mem );
     SET_VTABLE_ENTRY( vtable, stream_getAddress, mem );
     SET_VTABLE_ENTRY( vtable, stream_setAddress, mem );
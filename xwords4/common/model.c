@@ -70,6 +70,8 @@ static void buildModelFromStack( ModelCtxt* model, XWEnv xwe, StackCtxt* stack,
                                  MovePrintFuncPre mpfpr, 
                                  MovePrintFuncPost mpfpo, void* closure );
 static void setPendingCounts( ModelCtxt* model, XP_S16 turn );
+static void releaseTiles( ModelCtxt* model );
+static void unshareTiles( ModelCtxt* model );
 static XP_S16 setContains( const TrayTileSet* tiles, Tile tile );
 static void loadPlayerCtxt( const ModelCtxt* model, XWStreamCtxt* stream, 
                             XP_U16 version, PlayerCtxt* pc );
@@ -90,12 +92,15 @@ static void assertDiffTurn( ModelCtxt* model, XWEnv xwe, XP_U16 turn,
  ****************************************************************************/
 ModelCtxt*
 model_make( MPFORMAL XWEnv xwe, const DictionaryCtxt* dict,
-            const PlayerDicts* dicts, XW_UtilCtxt* util, XP_U16 nCols )
+            const PlayerDicts* dicts, XW_UtilCtxt* util, XP_U16 nCols,
+            XWArena* arena )
 {
-    ModelCtxt* result = (ModelCtxt*)XP_MALLOC( mpool, sizeof( *result ) );
+    ModelCtxt* result = !!arena ? (ModelCtxt*)arena_alloc( arena, sizeof(*result) )
+        : (ModelCtxt*)XP_MALLOC( mpool, sizeof( *result ) );
     if ( result != NULL ) {
         XP_MEMSET( result, 0, sizeof(*result) );
         MPASSIGN(result->vol.mpool, mpool);
+        result->vol.arena = arena;
 
         result->vol.util = util;
         result->vol.dutil = util_getDevUtilCtxt( util, xwe );
@@ -117,7 +122,7 @@ model_make( MPFORMAL XWEnv xwe, const DictionaryCtxt* dict,
 ModelCtxt* 
 model_makeFromStream( MPFORMAL XWEnv xwe, XWStreamCtxt* stream,
                       const DictionaryCtxt* dict, const PlayerDicts* dicts,
-                      XW_UtilCtxt* util )
+                      XW_UtilCtxt* util, XWArena* arena )
 {
     ModelCtxt* model;
     XP_U16 nCols;
@@ -138,7 +143,7 @@ model_makeFromStream( MPFORMAL XWEnv xwe, XWStreamCtxt* stream,
 
     XP_U16 nPlayers = (XP_U16)stream_getBits( stream, NPLAYERS_NBITS );
 
-    model = model_make( MPPARM(mpool) xwe, dict, dicts, util, nCols );
+    model = model_make( MPPARM(mpool) xwe, dict, dicts, util, nCols, arena );
     model->nPlayers = nPlayers;
 
 #ifdef STREAM_VERS_BIGBOARD
@@ -178,6 +183,47 @@ model_makeFromStream( MPFORMAL XWEnv xwe, XWStreamCtxt* stream,
     return model;
 } /* model_makeFromStream */
 
+ModelCtxt*
+model_clone( ModelCtxt* model, XWEnv xwe )
+{
+    ModelCtxt* result = (ModelCtxt*)XP_MALLOC( model->vol.mpool,
+                                               sizeof( *result ) );
+    XP_MEMCPY( result, model, sizeof(*result) );
+
+    ModelVolatiles* vol = &result->vol;
+    vol->boardListenerFunc = NULL;
+    vol->boardListenerData = NULL;
+    vol->trayListenerFunc = NULL;
+    vol->trayListenerData = NULL;
+    vol->dictListenerFunc = NULL;
+    vol->dictListenerData = NULL;
+    XP_MEMSET( &vol->rwi, 0, sizeof(vol->rwi) );
+    vol->wni.proc = recordWord;
+    vol->wni.closure = &vol->rwi;
+
+    vol->dict = dict_ref( model->vol.dict, xwe );
+    for ( int ii = 0; ii < VSIZE(vol->dicts.dicts); ++ii ) {
+        vol->dicts.dicts[ii] = dict_ref( model->vol.dicts.dicts[ii], xwe );
+    }
+
+    result->loaner = !!model->loaner ? model->loaner : model;
+    vol->arena = NULL;          /* clones are short-lived; the pool's fine */
+    vol->bonuses = NULL;
+    vol->nBonuses = 0;
+
+    if ( !model->vol.tilesRefs ) {
+        model->vol.tilesRefs = XP_MALLOC( vol->mpool,
+                                          sizeof(*model->vol.tilesRefs) );
+        *model->vol.tilesRefs = 1;
+    }
+    ++*model->vol.tilesRefs;
+    vol->tilesRefs = model->vol.tilesRefs;
+
+    vol->stack = stack_clone( model->vol.stack );
+
+    return result;
+} /* model_clone */
+
 void
 model_writeToStream( const ModelCtxt* model, XWStreamCtxt* stream )
 {
@@ -264,10 +310,10 @@ model_setSize( ModelCtxt* model, XP_U16 nCols )
 
     ModelVolatiles* vol = &model->vol;
     if ( oldSize != nCols ) {
-        if ( !!vol->tiles ) {
-            XP_FREE( vol->mpool, vol->tiles );
-        }
+        releaseTiles( model );
         vol->tiles = XP_MALLOC( vol->mpool, TILES_SIZE(model, nCols) );
+    } else {
+        unshareTiles( model );
     }
     XP_MEMSET( vol->tiles, TILE_EMPTY_BIT, TILES_SIZE(model, nCols) );
 
@@ -276,7 +322,8 @@ model_setSize( ModelCtxt* model, XP_U16 nCols )
     } else {
         vol->stack = stack_make( MPPARM(vol->mpool)
                                  dutil_getVTManager(vol->dutil),
-                                 vol->gi->nPlayers, vol->gi->inDuplicateMode );
+                                 vol->gi->nPlayers, vol->gi->inDuplicateMode,
+                                 vol->arena );
     }
 } /* model_setSize */
 
@@ -295,8 +342,10 @@ model_destroy( ModelCtxt* model, XWEnv xwe )
     if ( !!model->vol.bonuses ) {
         XP_FREE( model->vol.mpool, model->vol.bonuses );
     }
-    XP_FREE( model->vol.mpool, model->vol.tiles );
-    XP_FREE( model->vol.mpool, model );
+    releaseTiles( model );
+    if ( !model->vol.arena ) {
+        XP_FREE( model->vol.mpool, model );
+    }
 } /* model_destroy */
 
 XP_U32
@@ -852,12 +901,61 @@ model_getCellOwner( ModelCtxt* model, XP_U16 col, XP_U16 row )
     return result;
 } /* model_getCellOwner */
 
+/* Drop our hold on the board, which clones may share */
+static void
+releaseTiles( ModelCtxt* model )
+{
+    ModelVolatiles* vol = &model->vol;
+    if ( !vol->tiles ) {
+        /* nothing to do */
+    } else if ( !vol->tilesRefs ) {
+        XP_FREE( vol->mpool, vol->tiles );
+    } else if ( 0 == --*vol->tilesRefs ) {
+        XP_FREE( vol->mpool, vol->tilesRefs );
+        XP_FREE( vol->mpool, vol->tiles );
+    }
+    vol->tiles = NULL;
+    vol->tilesRefs = NULL;
+}
+
+/* Get our own copy of the board before writing to it, if it's shared */
+static void
+unshareTiles( ModelCtxt* model )
+{
+    ModelVolatiles* vol = &model->vol;
+    if ( !vol->tilesRefs ) {
+        /* not shared */
+    } else if ( 1 == *vol->tilesRefs ) {
+        XP_FREEP( vol->mpool, &vol->tilesRefs ); /* the others are gone */
+    } else {
+        XP_U16 size = TILES_SIZE( model, model->nCols );
+        CellTile* tiles = XP_MALLOC( vol->mpool, size );
+        XP_MEMCPY( tiles, vol->tiles, size );
+        --*vol->tilesRefs;
+        vol->tilesRefs = NULL;
+        vol->tiles = tiles;
+    }
+}
+
 static void
 setModelTileRaw( ModelCtxt* model, XP_U16 col, XP_U16 row, CellTile tile )
 {
-    XP_ASSERT( col < model->nCols );
+    XP_U16 nCols = model->nCols;
+    XP_ASSERT( col < nCols );
     XP_ASSERT( row < model->nRows );
-    model->vol.tiles[(row*model->nCols) + col] = tile;
+    unshareTiles( model );
+    model->vol.tiles[(row*nCols) + col] = tile;
+    model->vol.tiles[(nCols*nCols) + (col*nCols) + row] = tile;
+
+    XP_U32 colBit = ((XP_U32)1) << col;
+    XP_U32 rowBit = ((XP_U32)1) << row;
+    if ( 0 == (tile & (TILE_EMPTY_BIT | TILE_PENDING_BIT)) ) {
+        model->rowBits[row] |= colBit;
+        model->colBits[col] |= rowBit;
+    } else {
+        model->rowBits[row] &= ~colBit;
+        model->colBits[col] &= ~rowBit;
+    }
 } /* model_setTile */
 
 static CellTile 
@@ -2217,6 +2315,23 @@ model_numCols( const ModelCtxt* model )
     return model->nCols;
 } /* model_numCols */
 
+const CellTile*
+model_getCells( const ModelCtxt* model, XP_Bool transposed )
+{
+    const CellTile* result = model->vol.tiles;
+    if ( transposed ) {
+        result += model->nCols * model->nRows;
+    }
+    return result;
+}
+
+XP_U32
+model_getOccupied( const ModelCtxt* model, XP_U16 line, XP_Bool transposed )
+{
+    XP_ASSERT( line < model->nCols );
+    return transposed ? model->colBits[line] : model->rowBits[line];
+}
+
 void
 model_setBoardListener( ModelCtxt* model, BoardListener bl, void* data )
 {
@@ -2474,22 +2589,6 @@ printMovePost( ModelCtxt* model, XWEnv xwe, XP_U16 XP_UNUSED(moveN),
     }
 } /* printMovePost */
 
-static void
-copyStack( const ModelCtxt* model, StackCtxt* destStack,
-           const StackCtxt* srcStack )
-{
-    XWStreamCtxt* stream =
-        mem_stream_make_raw( MPPARM(model->vol.mpool)
-                             dutil_getVTManager(model->vol.dutil) );
-
-    stream_setVersion( stream, stack_getVersion(srcStack) );
-    stack_writeToStream( srcStack, stream );
-    stack_loadFromStream( destStack, stream );
-    XP_ASSERT( stack_getVersion(destStack) == stack_getVersion( srcStack ) );
-
-    stream_destroy( stream );
-} /* copyStack */
-
 static ModelCtxt*
 makeTmpModel( const ModelCtxt* model, XWEnv xwe, XWStreamCtxt* stream,
               MovePrintFuncPre mpf_pre, MovePrintFuncPost mpf_post, 
@@ -2497,7 +2596,8 @@ makeTmpModel( const ModelCtxt* model, XWEnv xwe, XWStreamCtxt* stream,
 {
     ModelCtxt* tmpModel = model_make( MPPARM(model->vol.mpool) 
                                       xwe, model_getDictionary(model), NULL,
-                                      model->vol.util, model_numCols(model) );
+                                      model->vol.util, model_numCols(model),
+                                      NULL );
     tmpModel->loaner = model;
     model_setNPlayers( tmpModel, model->nPlayers );
 
@@ -2550,12 +2650,10 @@ scoreLastMove( ModelCtxt* model, XWEnv xwe, MoveInfo* moveInfo, XP_U16 howMany,
     WordNotifierInfo notifyInfo;
     FirstWordData data;
 
-    ModelCtxt* tmpModel = makeTmpModel( model, xwe, NULL, NULL, NULL, NULL );
+    ModelCtxt* tmpModel = model_clone( model, xwe );
     XP_U16 turn;
     XP_S16 moveNum = -1;
 
-    copyStack( model, tmpModel->vol.stack, model->vol.stack );
-
     if ( !model_undoLatestMoves( tmpModel, xwe, NULL, howMany, &turn,
                                  &moveNum ) ) {
         XP_ASSERT( 0 );
@@ -2669,13 +2767,13 @@ model_listWordsThrough( ModelCtxt* model, XWEnv xwe, XP_U16 col, XP_U16 row,
                         XP_S16 turn, XWStreamCtxt* stream )
 {
     XP_Bool found = XP_FALSE;
-    ModelCtxt* tmpModel = makeTmpModel( model, xwe, NULL, NULL, NULL, NULL );
-    copyStack( model, tmpModel->vol.stack, model->vol.stack );
+    ModelCtxt* tmpModel = model_clone( model, xwe );
 
     XP_Bool isHorizontal;
     if ( tilesInLine( model, turn, &isHorizontal ) ) {
         MoveInfo moveInfo = {};
         normalizeMoves( model, turn, isHorizontal, &moveInfo );
+        model_resetCurrentTurn( tmpModel, xwe, turn ); /* pending came along */
         model_makeTurnFromMoveInfo( tmpModel, xwe, turn, &moveInfo );
 
         /* Might not be a legal move. If isn't, don't add it! */
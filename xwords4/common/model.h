@@ -24,6 +24,7 @@
 #include "dictnry.h"
 #include "mempool.h"
 #include "dutil.h"
+#include "arena.h"
 
 #ifdef CPLUS
 extern "C" {
@@ -70,12 +71,21 @@ typedef XP_U16 TileBit;    /* bits indicating selection of tiles in tray */
                                           only */
 
 
+/* If arena's non-NULL the model and its stack live there (and go when it
+   does) rather than in the pool */
 ModelCtxt* model_make( MPFORMAL XWEnv xwe, const DictionaryCtxt* dict,
-                       const PlayerDicts* dicts, XW_UtilCtxt* util, XP_U16 nCols );
+                       const PlayerDicts* dicts, XW_UtilCtxt* util, XP_U16 nCols,
+                       XWArena* arena );
 
 ModelCtxt* model_makeFromStream( MPFORMAL XWEnv xwe, XWStreamCtxt* stream,
                                  const DictionaryCtxt* dict, const PlayerDicts* dicts,
-                                 XW_UtilCtxt* util );
+                                 XW_UtilCtxt* util, XWArena* arena );
+
+/* A copy of model for trying things out on, e.g. undoing moves. It shares
+   the board and move stack with model until either changes them, and the
+   bonus squares always, so must be destroyed first. Listeners aren't
+   copied. */
+ModelCtxt* model_clone( ModelCtxt* model, XWEnv xwe );
 
 void model_writeToStream( const ModelCtxt* model, XWStreamCtxt* stream );
 
@@ -155,6 +165,13 @@ XP_S16 model_trayContains( ModelCtxt* model, XP_S16 turn, Tile tile );
 XP_U16 model_numRows( const ModelCtxt* model );
 XP_U16 model_numCols( const ModelCtxt* model );
 
+/* For the engine: the raw cells, row-major or (transposed) column-major,
+   and a bit per committed tile in a row (or, transposed, column). Pending
+   cells need model_getTile() to sort out. */
+const CellTile* model_getCells( const ModelCtxt* model, XP_Bool transposed );
+XP_U32 model_getOccupied( const ModelCtxt* model, XP_U16 line,
+                          XP_Bool transposed );
+
 /* XP_U16 model_numTilesCurrentTray( ModelCtxt* model ); */
 /* Tile model_currentTrayTile( ModelCtxt* model, XP_U16 index ); */
 void model_addToCurrentMove( ModelCtxt* model, XP_S16 turn, 
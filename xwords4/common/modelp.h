@@ -65,10 +65,12 @@ typedef struct ModelVolatiles {
     RecordWordsInfo rwi;
     WordNotifierInfo wni; 
     XP_U16 nTilesOnBoard;
-    CellTile* tiles;
+    CellTile* tiles;            /* row-major, then again transposed */
+    XP_U16* tilesRefs;          /* non-NULL once tiles are shared by a clone */
 
     XP_U16 nBonuses;
     XWBonusType* bonuses;
+    XWArena* arena;             /* owns the model if non-NULL */
 
     MPSLOT
 } ModelVolatiles;
@@ -82,10 +84,15 @@ struct ModelCtxt {
     XP_U16 nCols;
     XP_U16 nRows;
 
+    /* A bit per committed (not pending) tile: rowBits[row] has bit col set,
+       and colBits[col] bit row. Kept by setModelTileRaw(). */
+    XP_U32 rowBits[MAX_ROWS];
+    XP_U32 colBits[MAX_COLS];
+
     const ModelCtxt* loaner;    /* allows sharing bonuses */
 };
 
-#define TILES_SIZE(m,nc) ((nc) * (nc) * sizeof((m)->vol.tiles[0]))
+#define TILES_SIZE(m,nc) (2 * (nc) * (nc) * sizeof((m)->vol.tiles[0]))
 
 void invalidateScore( ModelCtxt* model, XP_S16 player );
 XP_Bool tilesInLine( ModelCtxt* model, XP_S16 turn, XP_Bool* isHorizontal );
@@ -41,9 +41,8 @@ extern "C" {
 struct StackCtxt {
     VTableMgr* vtmgr;
     XWStreamCtxt* data;
+    XP_U16* dataRefs;           /* non-NULL once data's shared by a clone */
     XWStreamPos   top;
-    XWStreamPos cachedPos;
-    XP_U16 cacheNext;
     XP_U16 nEntries;
     XP_U16 bitsPerTile;
     XP_U16 highWaterMark;
@@ -53,6 +52,24 @@ struct StackCtxt {
 
     XP_Bool inDuplicateMode;
 
+    /* Side index into data, so getting the Nth entry, popping and redoing
+       don't have to re-decode the stream from the start. offsets[ii] is
+       where entry ii starts (and offsets[nIndexed] where the last indexed
+       one ends), and entries[ii] is entry ii already decoded. Extended as
+       entries are pushed or first read, and may reach past nEntries into
+       the redo area. Never persisted: data is still the real thing.
+       hashes[ii] is the running hash of data up to offsets[ii], so
+       stack_getHash() needn't rehash from the start. */
+    XWStreamPos* offsets;
+#ifdef STREAM_VERS_HASHSTREAM
+    XP_U32* hashes;
+#endif
+    StackEntry* entries;
+    XP_U16 nIndexed;
+    XP_U16 indexSize;
+
+    XWArena* arena;             /* owns the StackCtxt if non-NULL */
+
     DIRTY_SLOT
     MPSLOT
 };
@@ -61,12 +78,16 @@ struct StackCtxt {
 #define VERS_7TILES_BIT 0x01
 
 static XP_Bool popEntryImpl( StackCtxt* stack, StackEntry* entry );
+static void truncIndex( StackCtxt* stack, XP_U16 nn );
+static void readEntry( const StackCtxt* stack, StackEntry* entry );
+static void releaseData( StackCtxt* stack );
 
 void
 stack_init( StackCtxt* stack, XP_U16 nPlayers, XP_Bool inDuplicateMode )
 {
     stack->nEntries = stack->highWaterMark = 0;
     stack->top = START_OF_STREAM;
+    truncIndex( stack, 0 );
     stack->nPlayers = nPlayers;
     stack->inDuplicateMode = inDuplicateMode;
 
@@ -94,11 +115,35 @@ XP_U32
 stack_getHash( const StackCtxt* stack )
 {
     XP_U32 hash = 0;
-    if ( !!stack->data ) {
+    XP_U16 nn = stack->nEntries;
+    if ( !stack->data ) {
+        /* nothing to hash */
+    } else if ( !!stack->offsets && nn <= stack->nIndexed ) {
+        XWStreamPos fromPos = stack->offsets[nn];
+        XP_U32 fromHash = stack->hashes[nn];
+        XP_ASSERT( fromPos == stack->top );
+        hash = stream_getHashFrom( stack->data, stack->top,
+                                   &fromPos, &fromHash );
+#ifdef DEBUG_HASHING
+        XP_ASSERT( hash == stream_getHash( stack->data, stack->top ) );
+#endif
+    } else {
+        /* Not indexed this far yet, e.g. just loaded */
         hash = stream_getHash( stack->data, stack->top );
     }
     return hash;
 } /* stack_getHash */
+
+/* Running hash at the end of entry nn - 1, given the one at its start */
+static void
+hashIndexed( StackCtxt* stack, XP_U16 nn )
+{
+    XWStreamPos fromPos = stack->offsets[nn-1];
+    XP_U32 fromHash = stack->hashes[nn-1];
+    (void)stream_getHashFrom( stack->data, stack->offsets[nn],
+                              &fromPos, &fromHash );
+    stack->hashes[nn] = fromHash;
+}
 #endif
 
 void
@@ -110,12 +155,15 @@ stack_setBitsPerTile( StackCtxt* stack, XP_U16 bitsPerTile )
 }
 
 StackCtxt*
-stack_make( MPFORMAL VTableMgr* vtmgr, XP_U16 nPlayers, XP_Bool inDuplicateMode )
+stack_make( MPFORMAL VTableMgr* vtmgr, XP_U16 nPlayers, XP_Bool inDuplicateMode,
+            XWArena* arena )
 {
-    StackCtxt* result = (StackCtxt*)XP_MALLOC( mpool, sizeof( *result ) );
+    StackCtxt* result = !!arena ? (StackCtxt*)arena_alloc( arena, sizeof(*result) )
+        : (StackCtxt*)XP_MALLOC( mpool, sizeof( *result ) );
     if ( !!result ) {
         XP_MEMSET( result, 0, sizeof(*result) );
         MPASSIGN(result->mpool, mpool);
+        result->arena = arena;
         result->vtmgr = vtmgr;
         result->nPlayers = nPlayers;
         result->inDuplicateMode = inDuplicateMode;
@@ -127,12 +175,18 @@ stack_make( MPFORMAL VTableMgr* vtmgr, XP_U16 nPlayers, XP_Bool inDuplicateMode
 void
 stack_destroy( StackCtxt* stack )
 {
-    if ( !!stack->data ) {
-        stream_destroy( stack->data );
-    }
+    releaseData( stack );
+    truncIndex( stack, 0 );
+    XP_FREEP( stack->mpool, &stack->offsets );
+#ifdef STREAM_VERS_HASHSTREAM
+    XP_FREEP( stack->mpool, &stack->hashes );
+#endif
+    XP_FREEP( stack->mpool, &stack->entries );
     /* Ok to close with a dirty stack, e.g. if not saving a deleted game */
     // ASSERT_NOT_DIRTY( stack );
-    XP_FREE( stack->mpool, stack );
+    if ( !stack->arena ) {
+        XP_FREE( stack->mpool, stack );
+    }
 } /* stack_destroy */
 
 void
@@ -156,6 +210,8 @@ stack_loadFromStream( StackCtxt* stack, XWStreamCtxt* stream )
         stack->typeBits = 2;
     }
     nBytes &= ~HAVE_FLAGS_MASK;
+    truncIndex( stack, 0 );
+    releaseData( stack );
 
     if ( nBytes > 0 ) {
         XP_U8 stackVersion = STREAM_VERS_NINETILES - 1;
@@ -223,13 +279,165 @@ stack_copy( const StackCtxt* stack )
     stack_writeToStream( stack, stream );
 
     newStack = stack_make( MPPARM(stack->mpool) stack->vtmgr,
-                           stack->nPlayers, stack->inDuplicateMode );
+                           stack->nPlayers, stack->inDuplicateMode, NULL );
     stack_loadFromStream( newStack, stream );
     stack_setBitsPerTile( newStack, stack->bitsPerTile );
     stream_destroy( stream );
     return newStack;
 }
 
+static void
+copyEntry( StackCtxt* XP_UNUSED_DBG(stack), StackEntry* dest,
+           const StackEntry* src )
+{
+    *dest = *src;
+    if ( PAUSE_TYPE == src->moveType ) {
+        dest->u.pause.msg = copyString( stack->mpool, src->u.pause.msg );
+    }
+}
+
+/* Make room for nn indexed entries */
+static void
+growIndex( StackCtxt* stack, XP_U16 nn )
+{
+    if ( stack->indexSize < nn ) {
+        XP_U16 newSize = XP_MAX( 16, stack->indexSize * 2 );
+        if ( newSize < nn ) {
+            newSize = nn;
+        }
+        stack->offsets = XP_REALLOC( stack->mpool, stack->offsets,
+                                     (newSize + 1) * sizeof(stack->offsets[0]) );
+#ifdef STREAM_VERS_HASHSTREAM
+        stack->hashes = XP_REALLOC( stack->mpool, stack->hashes,
+                                    (newSize + 1) * sizeof(stack->hashes[0]) );
+#endif
+        stack->entries = XP_REALLOC( stack->mpool, stack->entries,
+                                     newSize * sizeof(stack->entries[0]) );
+        if ( 0 == stack->indexSize ) {
+            stack->offsets[0] = START_OF_STREAM;
+#ifdef STREAM_VERS_HASHSTREAM
+            stack->hashes[0] = 0;
+#endif
+        }
+        stack->indexSize = newSize;
+    }
+}
+
+/* Forget indexed entries from nn on */
+static void
+truncIndex( StackCtxt* stack, XP_U16 nn )
+{
+    while ( nn < stack->nIndexed ) {
+        stack_freeEntry( stack, &stack->entries[--stack->nIndexed] );
+    }
+}
+
+/* Decode and index entries until the first nn are covered. Each entry gets
+   decoded once, however it's then accessed. */
+static void
+extendIndex( StackCtxt* stack, XP_U16 nn )
+{
+    XP_ASSERT( nn <= stack->highWaterMark );
+    if ( stack->nIndexed < nn ) {
+        XP_ASSERT( !!stack->data );
+        growIndex( stack, nn );
+
+        XWStreamPos oldPos = stream_setPos( stack->data, POS_READ,
+                                            stack->offsets[stack->nIndexed] );
+        while ( stack->nIndexed < nn ) {
+            XP_U16 ii = stack->nIndexed++;
+            readEntry( stack, &stack->entries[ii] );
+            stack->entries[ii].moveNum = (XP_U8)ii;
+            stack->offsets[ii+1] = stream_getPos( stack->data, POS_READ );
+#ifdef STREAM_VERS_HASHSTREAM
+            hashIndexed( stack, ii + 1 );
+#endif
+        }
+        (void)stream_setPos( stack->data, POS_READ, oldPos );
+    }
+}
+
+/* Drop our hold on data, which clones may share */
+static void
+releaseData( StackCtxt* stack )
+{
+    if ( !stack->data ) {
+        /* nothing to do */
+    } else if ( !stack->dataRefs ) {
+        stream_destroy( stack->data );
+    } else if ( 0 == --*stack->dataRefs ) {
+        XP_FREE( stack->mpool, stack->dataRefs );
+        stream_destroy( stack->data );
+    }
+    stack->data = NULL;
+    stack->dataRefs = NULL;
+}
+
+/* Get our own copy of data before writing to it, if it's shared */
+static void
+unshareData( StackCtxt* stack )
+{
+    if ( !stack->dataRefs ) {
+        /* not shared */
+    } else if ( 1 == *stack->dataRefs ) {
+        XP_FREEP( stack->mpool, &stack->dataRefs ); /* the others are gone */
+    } else {
+        XWStreamCtxt* data = stack->data;
+        XWStreamCtxt* copy = mem_stream_make_raw( MPPARM(stack->mpool)
+                                                  stack->vtmgr );
+        stream_setVersion( copy, stream_getVersion( data ) );
+        XWStreamPos oldPos = stream_setPos( data, POS_READ, START_OF_STREAM );
+        stream_getFromStream( copy, data, stream_getSize( data ) );
+        (void)stream_setPos( data, POS_READ, oldPos );
+
+        --*stack->dataRefs;
+        stack->dataRefs = NULL;
+        stack->data = copy;
+    }
+}
+
+StackCtxt*
+stack_clone( StackCtxt* stack )
+{
+    StackCtxt* result = (StackCtxt*)XP_MALLOC( stack->mpool, sizeof(*result) );
+    XP_MEMCPY( result, stack, sizeof(*result) );
+    result->arena = NULL;
+
+    if ( !!stack->data ) {
+        if ( !stack->dataRefs ) {
+            stack->dataRefs = XP_MALLOC( stack->mpool,
+                                         sizeof(*stack->dataRefs) );
+            *stack->dataRefs = 1;
+        }
+        ++*stack->dataRefs;
+        result->dataRefs = stack->dataRefs;
+    }
+
+    /* The index isn't shared: it's cheap to copy, and spares the clone
+       re-decoding everything */
+    result->offsets = NULL;
+#ifdef STREAM_VERS_HASHSTREAM
+    result->hashes = NULL;
+#endif
+    result->entries = NULL;
+    result->nIndexed = result->indexSize = 0;
+    XP_U16 nIndexed = stack->nIndexed;
+    if ( 0 < nIndexed ) {
+        growIndex( result, nIndexed );
+        XP_MEMCPY( result->offsets, stack->offsets,
+                   (nIndexed + 1) * sizeof(result->offsets[0]) );
+#ifdef STREAM_VERS_HASHSTREAM
+        XP_MEMCPY( result->hashes, stack->hashes,
+                   (nIndexed + 1) * sizeof(result->hashes[0]) );
+#endif
+        for ( XP_U16 ii = 0; ii < nIndexed; ++ii ) {
+            copyEntry( result, &result->entries[ii], &stack->entries[ii] );
+        }
+        result->nIndexed = nIndexed;
+    }
+    return result;
+} /* stack_clone */
+
 static void
 pushEntryImpl( StackCtxt* stack, const StackEntry* entry )
 {
@@ -246,6 +454,12 @@ pushEntryImpl( StackCtxt* stack, const StackEntry* entry )
         stack->typeBits = stack->inDuplicateMode ? 3 : 2;     /* the new size */
         XP_ASSERT( 0 == (~VERS_7TILES_BIT & stack->flags) );
     }
+    unshareData( stack );
+    stream = stack->data;
+
+    /* Whatever was in the redo area is about to be overwritten */
+    truncIndex( stack, stack->nEntries );
+    XP_Bool indexIt = stack->nIndexed == stack->nEntries;
 
     XWStreamPos oldLoc = stream_setPos( stream, POS_WRITE, stack->top );
 
@@ -290,6 +504,20 @@ pushEntryImpl( StackCtxt* stack, const StackEntry* entry )
     ++stack->nEntries;
     stack->highWaterMark = stack->nEntries;
     stack->top = stream_setPos( stream, POS_WRITE, oldLoc );
+
+    if ( indexIt ) {
+        XP_U16 nn = stack->nIndexed;
+        XP_ASSERT( stack->nEntries == nn + 1 );
+        growIndex( stack, nn + 1 );
+        XP_ASSERT( stack->offsets[nn] < stack->top );
+        copyEntry( stack, &stack->entries[nn], entry );
+        stack->entries[nn].moveNum = (XP_U8)nn;
+        stack->offsets[nn+1] = stack->top;
+#ifdef STREAM_VERS_HASHSTREAM
+        hashIndexed( stack, nn + 1 );
+#endif
+        stack->nIndexed = nn + 1;
+    }
     SET_DIRTY( stack );
 } /* pushEntryImpl */
 
@@ -303,6 +531,7 @@ pushEntry( StackCtxt* stack, const StackEntry* entry )
     if ( 1 < stack->nPlayers &&
          stack_getNthEntry( stack, stack->nEntries - 1, &prevTop ) ) {
         XP_ASSERT( stack->inDuplicateMode || prevTop.playerNum != entry->playerNum );
+        stack_freeEntry( stack, &prevTop );
     }
 #endif
 
@@ -314,6 +543,7 @@ pushEntry( StackCtxt* stack, const StackEntry* entry )
     if ( popEntryImpl( stack, &lastEntry ) ) {
         XP_ASSERT( origHash == stack_getHash( stack ) );
         pushEntryImpl( stack, &lastEntry );
+        stack_freeEntry( stack, &lastEntry );
         XP_ASSERT( newHash == stack_getHash( stack ) );
         XP_LOGFF( "all ok; pushed type %s for player %d into pos #%d, hash now %X (was %X)",
                   StackMoveType_2str(entry->moveType), entry->playerNum,
@@ -476,24 +706,6 @@ stack_addPause( StackCtxt* stack, DupPauseType pauseType, XP_S16 turn,
     stack_freeEntry( stack, &move );
 }
 
-static XP_Bool
-setCacheReadyFor( StackCtxt* stack, XP_U16 nn )
-{
-    XP_U16 ii;
-    
-    stream_setPos( stack->data, POS_READ, START_OF_STREAM );
-    for ( ii = 0; ii < nn; ++ii ) {
-        StackEntry dummy;
-        readEntry( stack, &dummy );
-        stack_freeEntry( stack, &dummy );
-    }
-
-    stack->cacheNext = nn;
-    stack->cachedPos = stream_getPos( stack->data, POS_READ );
-
-    return XP_TRUE;
-} /* setCacheReadyFor */
-
 XP_U16
 stack_getNEntries( const StackCtxt* stack )
 {
@@ -503,27 +715,11 @@ stack_getNEntries( const StackCtxt* stack )
 XP_Bool
 stack_getNthEntry( StackCtxt* stack, const XP_U16 nn, StackEntry* entry )
 {
-    XP_Bool found;
-
-    if ( nn >= stack->nEntries ) {
-        found = XP_FALSE;
-    } else if ( stack->cacheNext != nn ) {
-        XP_ASSERT( !!stack->data );
-        found = setCacheReadyFor( stack, nn );
-        XP_ASSERT( stack->cacheNext == nn );
-    } else {
-        found = XP_TRUE;
-    }
-
+    XP_Bool found = nn < stack->nEntries;
     if ( found ) {
-        XWStreamPos oldPos = stream_setPos( stack->data, POS_READ, 
-                                            stack->cachedPos );
-
-        readEntry( stack, entry );
-        entry->moveNum = (XP_U8)nn;
-
-        stack->cachedPos = stream_setPos( stack->data, POS_READ, oldPos );
-        ++stack->cacheNext;
+        extendIndex( stack, nn + 1 );
+        copyEntry( stack, entry, &stack->entries[nn] );
+        XP_ASSERT( entry->moveNum == (XP_U8)nn );
 
         /* XP_LOGF( "%s(%d) (typ=%s, player=%d, num=%d)", __func__, nn, */
         /*          StackMoveType_2str(entry->moveType), entry->playerNum, entry->moveNum ); */
@@ -538,9 +734,7 @@ popEntryImpl( StackCtxt* stack, StackEntry* entry )
     XP_Bool found = stack_getNthEntry( stack, nn, entry );
     if ( found ) {
         stack->nEntries = nn;
-
-        setCacheReadyFor( stack, nn ); /* set cachedPos by side-effect */
-        stack->top = stack->cachedPos;
+        stack->top = stack->offsets[nn]; /* indexed by stack_getNthEntry() */
     }
     return found;
 }
@@ -578,11 +772,11 @@ stack_redo( StackCtxt* stack, StackEntry* entry )
     XP_Bool canRedo = (stack->nEntries + 1) <= stack->highWaterMark;
     if ( canRedo ) {
         ++stack->nEntries;
+        extendIndex( stack, stack->nEntries );
         if ( NULL != entry ) {
             stack_getNthEntry( stack, stack->nEntries-1, entry );
         }
-        setCacheReadyFor( stack, stack->nEntries );
-        stack->top = stack->cachedPos;
+        stack->top = stack->offsets[stack->nEntries];
     }
     return canRedo;
 } /* stack_redo */
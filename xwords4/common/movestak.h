@@ -82,7 +82,9 @@ typedef struct _StackEntry {
 
 typedef struct StackCtxt StackCtxt;
 
-StackCtxt* stack_make( MPFORMAL VTableMgr* vtmgr, XP_U16 nPlayers, XP_Bool inDuplicateMode );
+/* arena, if non-NULL, owns the StackCtxt itself (not the data it grows) */
+StackCtxt* stack_make( MPFORMAL VTableMgr* vtmgr, XP_U16 nPlayers,
+                       XP_Bool inDuplicateMode, XWArena* arena );
 void stack_destroy( StackCtxt* stack );
 
 void stack_init( StackCtxt* stack, XP_U16 nPlayers, XP_Bool inDuplicateMode );
@@ -94,6 +96,8 @@ void stack_setBitsPerTile( StackCtxt* stack, XP_U16 bitsPerTile );
 void stack_loadFromStream( StackCtxt* stack, XWStreamCtxt* stream );
 void stack_writeToStream( const StackCtxt* stack, XWStreamCtxt* stream );
 StackCtxt* stack_copy( const StackCtxt* stack );
+/* Shares stack's data until either is pushed to */
+StackCtxt* stack_clone( StackCtxt* stack );
 
 void stack_addMove( StackCtxt* stack, XP_U16 turn, const MoveInfo* moveInfo, 
                     const TrayTileSet* newTiles );
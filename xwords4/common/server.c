@@ -187,6 +187,7 @@ struct ServerCtxt {
 #ifdef XWFEATURE_SLOW_ROBOT
     XP_Bool robotWaiting;
 #endif
+    XWArena* arena;             /* owns the ServerCtxt if non-NULL */
     MPSLOT
 };
 
@@ -420,14 +421,18 @@ initServer( ServerCtxt* server, XWEnv xwe )
 } /* initServer */
 
 ServerCtxt* 
-server_make( XWEnv xwe, ModelCtxt* model, CommsCtxt* comms, XW_UtilCtxt* util )
+server_make( XWEnv xwe, ModelCtxt* model, CommsCtxt* comms, XW_UtilCtxt* util,
+             XWArena* arena )
 {
-    ServerCtxt* result = (ServerCtxt*)XP_MALLOC( util->mpool, sizeof(*result) );
+    ServerCtxt* result = !!arena
+        ? (ServerCtxt*)arena_alloc( arena, sizeof(*result) )
+        : (ServerCtxt*)XP_MALLOC( util->mpool, sizeof(*result) );
 
     if ( result != NULL ) {
         XP_MEMSET( result, 0, sizeof(*result) );
 
         MPASSIGN(result->mpool, util->mpool);
+        result->arena = arena;
 
         result->vol.model = model;
         result->vol.comms = comms;
@@ -618,12 +623,13 @@ server_getPendingRegs( const ServerCtxt* server )
 
 ServerCtxt*
 server_makeFromStream( XWEnv xwe, XWStreamCtxt* stream, ModelCtxt* model,
-                       CommsCtxt* comms, XW_UtilCtxt* util, XP_U16 nPlayers )
+                       CommsCtxt* comms, XW_UtilCtxt* util, XP_U16 nPlayers,
+                       XWArena* arena )
 {
     ServerCtxt* server;
     XP_U16 version = stream_getVersion( stream );
 
-    server = server_make( xwe, model, comms, util );
+    server = server_make( xwe, model, comms, util, arena );
     getNV( stream, &server->nv, nPlayers );
     
     if ( stream_getBits(stream, 1) != 0 ) {
@@ -785,7 +791,9 @@ server_destroy( ServerCtxt* server )
 {
     cleanupServer( server );
 
-    XP_FREE( server->mpool, server );
+    if ( !server->arena ) {
+        XP_FREE( server->mpool, server );
+    }
 } /* server_destroy */
 
 #ifdef XWFEATURE_SLOW_ROBOT
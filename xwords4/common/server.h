@@ -31,12 +31,14 @@
 extern "C" {
 #endif
 
+/* arena, if non-NULL, owns the ServerCtxt */
 ServerCtxt* server_make( XWEnv xwe, ModelCtxt* model, CommsCtxt* comms,
-                         XW_UtilCtxt* util );
+                         XW_UtilCtxt* util, XWArena* arena );
 
 ServerCtxt* server_makeFromStream( XWEnv xwe, XWStreamCtxt* stream,
                                    ModelCtxt* model, CommsCtxt* comms,
-                                   XW_UtilCtxt* util, XP_U16 nPlayers );
+                                   XW_UtilCtxt* util, XP_U16 nPlayers,
+                                   XWArena* arena );
 
 void server_writeToStream( const ServerCtxt* server, XWStreamCtxt* stream );
 
@@ -265,35 +265,63 @@ smsproto_prepOutbound( SMSProto* state, XWEnv xwe, SMS_CMD cmd, XP_U32 gameID,
     return result;
 } /* smsproto_prepOutbound */
 
+/* Big enough for the array and a couple of full-sized messages */
+#define MSGARRAY_ARENA_SIZE 512
+
 static SMSMsgArray*
-appendLocMsg( SMSProto* XP_UNUSED_DBG(state), SMSMsgArray* arr, SMSMsgLoc* msg )
+makeArray( SMSProto* XP_UNUSED_DBG(state), SMS_FORMAT format )
+{
+    XWArena* arena = arena_make( MPPARM(state->mpool) MSGARRAY_ARENA_SIZE );
+    SMSMsgArray* arr = arena_calloc( arena, sizeof(*arr) );
+    arr->arena = arena;
+    arr->format = format;
+    return arr;
+}
+
+/* Copies data into the array's arena, so it can point at the stack */
+static XP_U8*
+copyData( SMSMsgArray* arr, const XP_U8* data, XP_U16 len )
+{
+    XP_U8* result = arena_alloc( arr->arena, len );
+    XP_MEMCPY( result, data, len );
+    return result;
+}
+
+static SMSMsgArray*
+appendLocMsg( SMSProto* state, SMSMsgArray* arr, const SMSMsgLoc* msg )
 {
     if ( NULL == arr ) {
-        arr = XP_CALLOC( state->mpool, sizeof(*arr) );
-        arr->format = FORMAT_LOC;
+        arr = makeArray( state, FORMAT_LOC );
     } else {
         XP_ASSERT( arr->format == FORMAT_LOC );
     }
 
-    arr->u.msgsLoc = XP_REALLOC( state->mpool, arr->u.msgsLoc,
-                                 (arr->nMsgs + 1) * sizeof(*arr->u.msgsLoc) );
-    arr->u.msgsLoc[arr->nMsgs++] = *msg;
+    XP_U16 nMsgs = arr->nMsgs;
+    arr->u.msgsLoc = arena_realloc( arr->arena, arr->u.msgsLoc,
+                                    nMsgs * sizeof(*arr->u.msgsLoc),
+                                    (nMsgs + 1) * sizeof(*arr->u.msgsLoc) );
+    SMSMsgLoc* loc = &arr->u.msgsLoc[arr->nMsgs++];
+    *loc = *msg;
+    loc->data = copyData( arr, msg->data, msg->len );
     return arr;
 }
 
 static SMSMsgArray*
-appendNetMsg( SMSProto* XP_UNUSED_DBG(state), SMSMsgArray* arr, SMSMsgNet* msg )
+appendNetMsg( SMSProto* state, SMSMsgArray* arr, const SMSMsgNet* msg )
 {
     if ( NULL == arr ) {
-        arr = XP_CALLOC( state->mpool, sizeof(*arr) );
-        arr->format = FORMAT_NET;
+        arr = makeArray( state, FORMAT_NET );
     } else {
         XP_ASSERT( arr->format == FORMAT_NET );
     }
 
-    arr->u.msgsNet = XP_REALLOC( state->mpool, arr->u.msgsNet,
-                                 (arr->nMsgs + 1) * sizeof(*arr->u.msgsNet) );
-    arr->u.msgsNet[arr->nMsgs++] = *msg;
+    XP_U16 nMsgs = arr->nMsgs;
+    arr->u.msgsNet = arena_realloc( arr->arena, arr->u.msgsNet,
+                                    nMsgs * sizeof(*arr->u.msgsNet),
+                                    (nMsgs + 1) * sizeof(*arr->u.msgsNet) );
+    SMSMsgNet* net = &arr->u.msgsNet[arr->nMsgs++];
+    *net = *msg;
+    net->data = copyData( arr, msg->data, msg->len );
     return arr;
 }
 
@@ -354,9 +382,8 @@ smsproto_prepInbound( SMSProto* state, XWEnv xwe, const XP_UCHAR* fromPhone,
                             SMSMsgLoc msg = { .len = msgLen,
                                               .cmd = cmd,
                                               .gameID = gameID,
-                                              .data = XP_MALLOC( state->mpool, msgLen ),
+                                              .data = buf,
                             };
-                            XP_MEMCPY( msg.data, buf, msgLen );
                             result = appendLocMsg( state, result, &msg );
                         } else {
                             XP_LOGF( "%s(): expected port %d, got %d", __func__,
@@ -385,31 +412,9 @@ smsproto_prepInbound( SMSProto* state, XWEnv xwe, const XP_UCHAR* fromPhone,
 }
 
 void
-smsproto_freeMsgArray( SMSProto* state, SMSMsgArray* arr )
+smsproto_freeMsgArray( SMSProto* XP_UNUSED(state), SMSMsgArray* arr )
 {
-    WITH_MUTEX( &state->mutex );
-
-    for ( int ii = 0; ii < arr->nMsgs; ++ii ) {
-        XP_U8** ptr = arr->format == FORMAT_LOC
-            ? &arr->u.msgsLoc[ii].data : &arr->u.msgsNet[ii].data;
-        XP_FREEP( state->mpool, ptr );
-    }
-
-    void** ptr;
-    switch( arr->format ) {
-    case FORMAT_LOC:
-        ptr = (void**)&arr->u.msgsLoc;
-        break;
-    case FORMAT_NET:
-        ptr = (void**)&arr->u.msgsNet;
-        break;
-    default:
-        XP_ASSERT(0);
-        ptr = NULL;
-    }
-    XP_FREEP( state->mpool, ptr );
-    XP_FREEP( state->mpool, &arr );
-    END_WITH_MUTEX();
+    arena_destroy( arr->arena );
 }
 
 #if defined DEBUG
@@ -781,16 +786,16 @@ completeMsgs( SMSProto* state, SMSMsgArray* arr, const XP_UCHAR* fromPhone,
         SMS_CMD cmd;
         if ( headerFromStream( stream, &cmd, &port, &gameID ) ) {
             XP_U16 len = stream_getSize( stream );
+            XP_U8 buf[len];
             SMSMsgLoc msg = { .len = len,
                               .cmd = cmd,
                               .gameID = gameID,
-                              .data = XP_MALLOC( state->mpool, len ),
+                              .data = buf,
             };
             if ( stream_gotBytes( stream, msg.data, len ) && port == wantPort ) {
                 arr = appendLocMsg( state, arr, &msg );
             } else {
                 XP_LOGFF( "expected port %d, got %d", wantPort, port );
-                XP_FREEP( state->mpool, &msg.data );
             }
         }
         destroyStream( stream );
@@ -830,8 +835,9 @@ toNetMsgs( SMSProto* state, XWEnv xwe, ToPhoneRec* rec, XP_Bool forceOld )
                 XP_LOGFF( "combining %d through %d (%d msgs)", ii, last - 1, nMsgs );
             }
             int len = 1 + sum + (nMsgs * 2); /* 1: len & msgID */
+            XP_U8 buf[len];
             SMSMsgNet newMsg = { .len = len,
-                                 .data = XP_MALLOC( state->mpool, len )
+                                 .data = buf,
             };
             int indx = 0;
             newMsg.data[indx++] = SMS_PROTO_VERSION_COMBO;
@@ -857,8 +863,9 @@ toNetMsgs( SMSProto* state, XWEnv xwe, ToPhoneRec* rec, XP_Bool forceOld )
                 }
                 lenLeft -= useLen;
 
+                XP_U8 buf[useLen + 4];
                 SMSMsgNet newMsg = { .len = useLen + 4,
-                                     .data = XP_MALLOC( state->mpool, useLen + 4 )
+                                     .data = buf,
                 };
                 newMsg.data[0] = SMS_PROTO_VERSION_JAVA;
                 newMsg.data[1] = msgID;
@@ -1097,6 +1104,27 @@ smsproto_runTests( MPFORMAL XWEnv xwe, XW_DUtilCtxt* dutil )
        go. */
     smsproto_freeMsgArray( state, arr ); /* give it a chance to store state */
 
+#ifdef MEM_DEBUG
+    /* How much does a message cost, out and back? */
+    const int nRounds = 100;
+    XP_U32 allocs0 = mpool_getNAllocs( mpool );
+    for ( int ii = 0; ii < nRounds; ++ii ) {
+        arr = smsproto_prepOutbound( state, xwe, DATA, gameID, buf, smallSiz,
+                                     "44444", port, XP_TRUE, &waitSecs );
+        for ( int jj = 0; jj < arr->nMsgs; ++jj ) {
+            out = smsproto_prepInbound( state, xwe, "44444", port,
+                                        arr->u.msgsNet[jj].data,
+                                        arr->u.msgsNet[jj].len );
+            if ( !!out ) {
+                smsproto_freeMsgArray( state, out );
+            }
+        }
+        smsproto_freeMsgArray( state, arr );
+    }
+    XP_LOGFF( "%.1f allocations per message round trip",
+              (double)(mpool_getNAllocs( mpool ) - allocs0) / nRounds );
+#endif
+
     smsproto_free( state );
     LOG_RETURN_VOID();
 }
@@ -43,6 +43,7 @@
 
 #include "xptypes.h"
 #include "mempool.h" /* debug only */
+#include "arena.h"
 #include "nli.h"
 
 typedef struct SMSProto SMSProto;
@@ -68,6 +69,8 @@ typedef struct _SMSMsgNet {
 
 typedef enum { FORMAT_NONE, FORMAT_LOC, FORMAT_NET } SMS_FORMAT;
 
+/* The array, its messages and their data all live in arena, so freeing
+   the lot is one call. */
 typedef struct _SMSMsgArray {
     XP_U16 nMsgs;
     SMS_FORMAT format;
@@ -75,6 +78,7 @@ typedef struct _SMSMsgArray {
         SMSMsgNet* msgsNet;
         SMSMsgLoc* msgsLoc;
     } u;
+    XWArena* arena;
 } SMSMsgArray;
 
 struct SMSProto* smsproto_init( MPFORMAL XWEnv xwe, XW_DUtilCtxt* dutil );
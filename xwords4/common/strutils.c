@@ -40,29 +40,79 @@ bitsForMax( XP_U32 nn )
     return result;
 } /* bitsForMax */
 
+/* Tiles, scores and moves are runs of small bit fields.  Rather than hand
+ * each to the stream separately, gather them in a 64-bit accumulator and
+ * pass them on 32 bits at a time.  The stream's bit layout is LSB-first, so
+ * the result is identical to putting/getting the fields one by one.
+ */
+typedef struct _BitPacker {
+    XWStreamCtxt* stream;
+    uint64_t acc;
+    XP_U16 nBits;
+} BitPacker;
+
 static void
-tilesToStream( XWStreamCtxt* stream, const Tile* tiles, XP_U16 nTiles )
+packBits( BitPacker* bp, XP_U16 nBits, XP_U32 data )
 {
-    while ( nTiles-- ) {
-        stream_putBits( stream, TILE_NBITS, *tiles++ );
+    XP_ASSERT( 0 < nBits && nBits <= 32 );
+    XP_ASSERT( nBits == 32 || 0 == (data >> nBits) );
+    bp->acc |= ((uint64_t)data) << bp->nBits;
+    bp->nBits += nBits;
+    if ( 32 <= bp->nBits ) {
+        stream_putBits( bp->stream, 32, (XP_U32)bp->acc );
+        bp->acc >>= 32;
+        bp->nBits -= 32;
     }
-} /* tilesToStream */
+}
+
+static void
+packFlush( BitPacker* bp )
+{
+    if ( 0 < bp->nBits ) {
+        stream_putBits( bp->stream, bp->nBits, (XP_U32)bp->acc );
+        bp->acc = 0;
+        bp->nBits = 0;
+    }
+}
+
+/* Reading can't run ahead of what the caller will consume or the stream
+   would be left in the wrong place, so the caller says how many bits to
+   expect in all. */
+typedef struct _BitUnpacker {
+    XWStreamCtxt* stream;
+    uint64_t acc;
+    XP_U16 nBits;
+    XP_U32 nLeft;
+} BitUnpacker;
+
+static XP_U32
+unpackBits( BitUnpacker* bu, XP_U16 nBits )
+{
+    XP_ASSERT( nBits <= 32 );
+    if ( bu->nBits < nBits ) {
+        XP_U16 nGet = bu->nLeft < 32 ? (XP_U16)bu->nLeft : 32;
+        XP_ASSERT( bu->nBits + nGet >= nBits );
+        bu->acc |= ((uint64_t)stream_getBits( bu->stream, nGet )) << bu->nBits;
+        bu->nBits += nGet;
+        bu->nLeft -= nGet;
+    }
+    XP_U32 result = (XP_U32)(bu->acc & ((((uint64_t)1) << nBits) - 1));
+    bu->acc >>= nBits;
+    bu->nBits -= nBits;
+    return result;
+}
 
 void
 traySetToStream( XWStreamCtxt* stream, const TrayTileSet* ts )
 {
     XP_U16 nTiles = ts->nTiles;
-    stream_putBits( stream, tilesNBits(stream), nTiles );
-    tilesToStream( stream, ts->tiles, nTiles );
-} /* traySetFromStream */
-
-static void
-tilesFromStream( XWStreamCtxt* stream, Tile* tiles, XP_U16 nTiles )
-{
-    while ( nTiles-- ) {
-        *tiles++ = (Tile)stream_getBits( stream, TILE_NBITS );
+    BitPacker bp = { .stream = stream };
+    packBits( &bp, tilesNBits(stream), nTiles );
+    for ( XP_U16 ii = 0; ii < nTiles; ++ii ) {
+        packBits( &bp, TILE_NBITS, ts->tiles[ii] );
     }
-} /* tilesFromStream */
+    packFlush( &bp );
+} /* traySetFromStream */
 
 void
 scoresToStream( XWStreamCtxt* stream, XP_U16 nScores, const XP_U16* scores )
@@ -77,10 +127,12 @@ scoresToStream( XWStreamCtxt* stream, XP_U16 nScores, const XP_U16* scores )
         }
 
         XP_U16 bits = bitsForMax( maxScore );
-        stream_putBits( stream, 4, bits );
+        BitPacker bp = { .stream = stream };
+        packBits( &bp, 4, bits );
         for ( XP_U16 ii = 0; ii < nScores; ++ii ) {
-            stream_putBits( stream, bits, scores[ii] );
+            packBits( &bp, bits, scores[ii] );
         }
+        packFlush( &bp );
     }
 }
 
@@ -89,9 +141,11 @@ scoresFromStream( XWStreamCtxt* stream, XP_U16 nScores, XP_U16* scores )
 {
     if ( 0 < nScores ) {
         XP_U16 bits = (XP_U16)stream_getBits( stream, 4 );
+        BitUnpacker bu = { .stream = stream, .nLeft = nScores * bits };
         for ( XP_U16 ii = 0; ii < nScores; ++ii ) {
-            scores[ii] = stream_getBits( stream, bits );
+            scores[ii] = unpackBits( &bu, bits );
         }
+        XP_ASSERT( 0 == bu.nBits && 0 == bu.nLeft );
     }
 }
 
@@ -99,7 +153,10 @@ void
 traySetFromStream( XWStreamCtxt* stream, TrayTileSet* ts )
 {
     XP_U16 nTiles = (XP_U16)stream_getBits( stream, tilesNBits( stream ) );
-    tilesFromStream( stream, ts->tiles, nTiles );
+    BitUnpacker bu = { .stream = stream, .nLeft = nTiles * TILE_NBITS };
+    for ( XP_U16 ii = 0; ii < nTiles; ++ii ) {
+        ts->tiles[ii] = (Tile)unpackBits( &bu, TILE_NBITS );
+    }
     ts->nTiles = (XP_U8)nTiles;
 } /* traySetFromStream */
 
@@ -122,21 +179,23 @@ moveInfoToStream( XWStreamCtxt* stream, const MoveInfo* mi, XP_U16 bitsPerTile )
 #endif
     assertSorted( mi );
 
-    stream_putBits( stream, tilesNBits( stream ), mi->nTiles );
-    stream_putBits( stream, NUMCOLS_NBITS_5, mi->commonCoord );
-    stream_putBits( stream, 1, mi->isHorizontal );
+    BitPacker bp = { .stream = stream };
+    packBits( &bp, tilesNBits( stream ), mi->nTiles );
+    packBits( &bp, NUMCOLS_NBITS_5, mi->commonCoord );
+    packBits( &bp, 1, mi->isHorizontal );
 
     XP_ASSERT( bitsPerTile == 5 || bitsPerTile == 6 );
     for ( XP_U16 ii = 0; ii < mi->nTiles; ++ii ) {
-        stream_putBits( stream, NUMCOLS_NBITS_5, mi->tiles[ii].varCoord );
+        packBits( &bp, NUMCOLS_NBITS_5, mi->tiles[ii].varCoord );
 
         Tile tile = mi->tiles[ii].tile;
 #ifdef DEBUG
         /* offset += XP_SNPRINTF( &buf[offset], VSIZE(buf)-offset, "%x,", tile ); */
 #endif
-        stream_putBits( stream, bitsPerTile, tile & TILE_VALUE_MASK );
-        stream_putBits( stream, 1, (tile & TILE_BLANK_BIT) != 0 );
+        packBits( &bp, bitsPerTile, tile & TILE_VALUE_MASK );
+        packBits( &bp, 1, (tile & TILE_BLANK_BIT) != 0 );
     }
+    packFlush( &bp );
     // XP_LOGF( "%s(): tiles: %s", __func__, buf );
 }
 
@@ -149,12 +208,15 @@ moveInfoFromStream( XWStreamCtxt* stream, MoveInfo* mi, XP_U16 bitsPerTile )
 #endif
     mi->nTiles = stream_getBits( stream, tilesNBits( stream ) );
     XP_ASSERT( mi->nTiles <= MAX_TRAY_TILES );
-    mi->commonCoord = stream_getBits( stream, NUMCOLS_NBITS_5 );
-    mi->isHorizontal = stream_getBits( stream, 1 );
+    BitUnpacker bu = { .stream = stream,
+                       .nLeft = NUMCOLS_NBITS_5 + 1
+                       + mi->nTiles * (NUMCOLS_NBITS_5 + bitsPerTile + 1) };
+    mi->commonCoord = unpackBits( &bu, NUMCOLS_NBITS_5 );
+    mi->isHorizontal = unpackBits( &bu, 1 );
     for ( XP_U16 ii = 0; ii < mi->nTiles; ++ii ) {
-        mi->tiles[ii].varCoord = stream_getBits( stream, NUMCOLS_NBITS_5 );
-        Tile tile = stream_getBits( stream, bitsPerTile );
-        if ( 0 != stream_getBits( stream, 1 ) ) {
+        mi->tiles[ii].varCoord = unpackBits( &bu, NUMCOLS_NBITS_5 );
+        Tile tile = unpackBits( &bu, bitsPerTile );
+        if ( 0 != unpackBits( &bu, 1 ) ) {
             tile |= TILE_BLANK_BIT;
         }
         mi->tiles[ii].tile = tile;
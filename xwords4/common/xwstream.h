@@ -93,6 +93,11 @@ typedef struct StreamCtxVTable {
 
     XP_U16 (*m_stream_getSize)( const XWStreamCtxt* dctx );
     XP_U32 (*m_stream_getHash)( const XWStreamCtxt* dctx, XWStreamPos pos );
+    /* Same result as getHash(), but picks up where a previous call for
+       *fromPos left off (START_OF_STREAM and 0 to begin), and updates them
+       so a later call for a pos further on can start from here. */
+    XP_U32 (*m_stream_getHashFrom)( const XWStreamCtxt* dctx, XWStreamPos pos,
+                                    XWStreamPos* fromPos, XP_U32* fromHash );
     
     const XP_U8* (*m_stream_getPtr)( const XWStreamCtxt* dctx );
 
@@ -184,6 +189,9 @@ struct XWStreamCtxt {
 #define stream_getHash(sc, p)                       \
         (sc)->vtable->m_stream_getHash((sc), (p))
 
+#define stream_getHashFrom(sc, p, fp, fh)                               \
+        (sc)->vtable->m_stream_getHashFrom((sc), (p), (fp), (fh))
+
 #define stream_getPtr(sc) \
          (sc)->vtable->m_stream_getPtr((sc))
 
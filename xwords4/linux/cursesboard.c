@@ -446,6 +446,7 @@ disposeBoard( CursesBoardGlobals* bGlobals, XP_Bool rmFromList )
         cmenu_pop( bGlobals->cbState->menuState );
     }
 
+    gdb_flushFor( cGlobals->params->pDb, cGlobals );
     game_dispose( &cGlobals->game, NULL_XWE );
     gi_disposePlayerInfo( MPPARM(cGlobals->util->mpool) cGlobals->gi );
 
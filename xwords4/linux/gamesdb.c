@@ -56,6 +56,174 @@ static void execNoResult( sqlite3* pDb, const gchar* query, bool errOK );
 
 static void assertPrintResult( sqlite3* pDb, int result, int expect );
 
+/* Per-connection state. Statements are prepared once and kept. Writes are
+ * batched: the first opens a transaction that stays open until the flush
+ * interval's passed (or the main loop's next idle if it's 0), so a game's
+ * blob, summary and snapshot -- and those of every other game saved in the
+ * meantime -- share one commit. Reads on the same connection see what's not
+ * yet committed. Anything that mustn't be reported until it's on disk (a
+ * saved game's acks) waits in pending for the COMMIT.
+ */
+typedef struct _DBState {
+    sqlite3* pDb;
+    GHashTable* stmts;          /* query text => sqlite3_stmt* */
+    guint flushMS;
+    guint flushSrc;             /* non-0 while a transaction's open */
+    GQueue pending;             /* PendingCommit*s, run after COMMIT */
+} DBState;
+
+typedef struct _PendingCommit {
+    GDBCommittedProc proc;
+    void* closure;
+    XP_U16 token;
+} PendingCommit;
+
+static GSList* s_dbStates = NULL;
+
+static DBState*
+getState( sqlite3* pDb )
+{
+    DBState* state = NULL;
+    for ( GSList* iter = s_dbStates; !!iter; iter = iter->next ) {
+        DBState* one = (DBState*)iter->data;
+        if ( one->pDb == pDb ) {
+            state = one;
+            break;
+        }
+    }
+    XP_ASSERT( !!state );
+    return state;
+}
+
+static void
+finalizeStmt( gpointer data )
+{
+    sqlite3_finalize( (sqlite3_stmt*)data );
+}
+
+/* Returns a cached statement, ready for binding. Pass it to doneStmt() when
+   finished with it. */
+static sqlite3_stmt*
+getStmt( sqlite3* pDb, const char* query )
+{
+    DBState* state = getState( pDb );
+    sqlite3_stmt* stmt = g_hash_table_lookup( state->stmts, query );
+    if ( !stmt ) {
+        int result = sqlite3_prepare_v3( pDb, query, -1,
+                                         SQLITE_PREPARE_PERSISTENT,
+                                         &stmt, NULL );
+        assertPrintResult( pDb, result, SQLITE_OK );
+        g_hash_table_insert( state->stmts, g_strdup(query), stmt );
+    }
+    return stmt;
+}
+
+static void
+doneStmt( sqlite3_stmt* stmt )
+{
+    sqlite3_reset( stmt );
+    sqlite3_clear_bindings( stmt );
+}
+
+static void
+stepDone( sqlite3* pDb, sqlite3_stmt* stmt )
+{
+    int result = sqlite3_step( stmt );
+    if ( SQLITE_DONE != result ) {
+        XP_LOGFF( "sqlite3_step => %s", sqlite3_errstr( result ) );
+        assertPrintResult( pDb, result, SQLITE_DONE );
+    }
+    doneStmt( stmt );
+}
+
+static void
+commit( DBState* state )
+{
+    sqlite3_stmt* stmt = getStmt( state->pDb, "COMMIT" );
+    stepDone( state->pDb, stmt );
+
+    /* Detach first: procs may write, opening the next batch */
+    GQueue committed = state->pending;
+    g_queue_init( &state->pending );
+    for ( GList* iter = committed.head; !!iter; iter = iter->next ) {
+        PendingCommit* pc = (PendingCommit*)iter->data;
+        (*pc->proc)( pc->closure, pc->token );
+        g_free( pc );
+    }
+    g_queue_clear( &committed );
+}
+
+static gboolean
+flushProc( gpointer data )
+{
+    DBState* state = (DBState*)data;
+    state->flushSrc = 0;
+    commit( state );
+    return G_SOURCE_REMOVE;
+}
+
+/* Call before any write: opens the batch's transaction if need be */
+static void
+startWrite( sqlite3* pDb )
+{
+    DBState* state = getState( pDb );
+    if ( 0 == state->flushSrc ) {
+        sqlite3_stmt* stmt = getStmt( pDb, "BEGIN" );
+        stepDone( pDb, stmt );
+        state->flushSrc = 0 == state->flushMS
+            ? g_idle_add( flushProc, state )
+            : g_timeout_add( state->flushMS, flushProc, state );
+    }
+}
+
+void
+gdb_flush( sqlite3* pDb )
+{
+    DBState* state = getState( pDb );
+    if ( 0 != state->flushSrc ) {
+        g_source_remove( state->flushSrc );
+        state->flushSrc = 0;
+        commit( state );
+    }
+}
+
+void
+gdb_onCommit( sqlite3* pDb, GDBCommittedProc proc, void* closure,
+              XP_U16 token )
+{
+    DBState* state = getState( pDb );
+    if ( 0 == state->flushSrc ) {
+        (*proc)( closure, token ); /* nothing uncommitted */
+    } else {
+        PendingCommit* pc = g_malloc( sizeof(*pc) );
+        pc->proc = proc;
+        pc->closure = closure;
+        pc->token = token;
+        g_queue_push_tail( &state->pending, pc );
+    }
+}
+
+void
+gdb_flushFor( sqlite3* pDb, const void* closure )
+{
+    if ( !!pDb ) {
+        DBState* state = getState( pDb );
+        for ( GList* iter = state->pending.head; !!iter; iter = iter->next ) {
+            if ( closure == ((PendingCommit*)iter->data)->closure ) {
+                gdb_flush( pDb );
+                break;
+            }
+        }
+    }
+}
+
+void
+gdb_setFlushInterval( sqlite3* pDb, guint flushMS )
+{
+    gdb_flush( pDb );
+    getState( pDb )->flushMS = flushMS;
+}
+
 /* Versioning:
  *
  * Version 0 is defined, and not having a version code means you're 0. For
@@ -81,6 +249,17 @@ gdb_open( const char* dbName )
         sqlite3_open( dbName, &pDb );
     XP_ASSERT( SQLITE_OK == result );
 
+    DBState* state = g_malloc0( sizeof(*state) );
+    state->pDb = pDb;
+    state->stmts = g_hash_table_new_full( g_str_hash, g_str_equal,
+                                          g_free, finalizeStmt );
+    s_dbStates = g_slist_prepend( s_dbStates, state );
+
+    /* With the write-ahead log a commit doesn't have to wait for fsync (only
+       checkpoints do), and readers in other processes don't block us. */
+    (void)sqlite3_exec( pDb, "PRAGMA journal_mode=WAL; "
+                        "PRAGMA synchronous=NORMAL", NULL, NULL, NULL );
+
     if ( gamesTableExists( pDb ) ) {
         int32_t oldVersion;
         if ( !gdb_fetchInt( pDb, KEY_DB_VERSION, &oldVersion ) ) {
@@ -207,6 +386,13 @@ createTables( sqlite3* pDb )
 void
 gdb_close( sqlite3* pDb )
 {
+    if ( !!pDb ) {
+        gdb_flush( pDb );
+        DBState* state = getState( pDb );
+        s_dbStates = g_slist_remove( s_dbStates, state );
+        g_hash_table_destroy( state->stmts );
+        g_free( state );
+    }
     sqlite3_close( pDb );
     LOG_RETURN_VOID();
 }
@@ -216,52 +402,40 @@ writeBlobColumnData( const XP_U8* data, gsize len, XP_U16 strVersion, sqlite3* p
                      sqlite3_int64 curRow, const char* column )
 {
     XP_LOGFF( "(col=%s)", column );
-    int result;
     char query[256];
 
-    sqlite3_stmt* stmt = NULL;
     XP_Bool newGame = -1 == curRow;
-    if ( newGame ) {         /* new row; need to insert blob first */
+    if ( newGame ) {
         const char* fmt = "INSERT INTO games (%s) VALUES (?)";
         snprintf( query, sizeof(query), fmt, column );
     } else {
-        const char* fmt = "UPDATE games SET %s=? where rowid=%lld";
-        snprintf( query, sizeof(query), fmt, column, curRow );
+        const char* fmt = "UPDATE games SET %s=? WHERE rowid=?";
+        snprintf( query, sizeof(query), fmt, column );
     }
-    XP_LOGFF( "query: %s", query );
 
-    result = sqlite3_prepare_v2( pDb, query, -1, &stmt, NULL );
-    assertPrintResult( pDb, result, SQLITE_OK );
-    result = sqlite3_bind_zeroblob( stmt, 1 /*col 0 ??*/, sizeof(XP_U16) + len );
+    /* The stream version goes first; sqlite takes ownership of the buffer */
+    XP_ASSERT( strVersion <= CUR_STREAM_VERS );
+    gsize blobLen = sizeof(strVersion) + len;
+    XP_U8* blob = g_malloc( blobLen );
+    XP_MEMCPY( blob, &strVersion, sizeof(strVersion) );
+    XP_MEMCPY( blob + sizeof(strVersion), data, len );
+
+    startWrite( pDb );
+    sqlite3_stmt* stmt = getStmt( pDb, query );
+    int result = sqlite3_bind_blob( stmt, 1, blob, blobLen, g_free );
     assertPrintResult( pDb, result, SQLITE_OK );
-    result = sqlite3_step( stmt );
-    if ( SQLITE_DONE != result ) {
-        XP_LOGFF( "sqlite3_step => %s", sqlite3_errstr( result ) );
-        XP_ASSERT(0);
+    if ( !newGame ) {
+        result = sqlite3_bind_int64( stmt, 2, curRow );
+        assertPrintResult( pDb, result, SQLITE_OK );
     }
     XP_USE( result );
+    stepDone( pDb, stmt );
 
-    if ( newGame ) {         /* new row; need to insert blob first */
+    if ( newGame ) {
         curRow = sqlite3_last_insert_rowid( pDb );
         XP_LOGFF( "new rowid: %lld", curRow );
     }
 
-    sqlite3_blob* blob;
-    result = sqlite3_blob_open( pDb, "main", "games", column,
-                                curRow, 1 /*flags: writeable*/, &blob );
-    assertPrintResult( pDb, result, SQLITE_OK );
-    XP_ASSERT( strVersion <= CUR_STREAM_VERS );
-    result = sqlite3_blob_write( blob, &strVersion, sizeof(strVersion), 0/*offset*/ );
-    assertPrintResult( pDb, result, SQLITE_OK );
-    result = sqlite3_blob_write( blob, data, len, sizeof(strVersion) /* offset */ );
-    assertPrintResult( pDb, result, SQLITE_OK );
-    result = sqlite3_blob_close( blob );
-    assertPrintResult( pDb, result, SQLITE_OK );
-
-    if ( !!stmt ) {
-        sqlite3_finalize( stmt );
-    }
-
     LOG_RETURNF( "%lld", curRow );
     return curRow;
 } /* writeBlobColumnData */
@@ -415,57 +589,50 @@ gdb_summarize( CommonGlobals* cGlobals )
 
     XP_S16 nTiles = server_countTilesInPool( game->server );
 
-    gchar* pairs[40];
-    int indx = 0;
-    pairs[indx++] = g_strdup_printf( "ended=%d", gameOver?1:0 );
-    pairs[indx++] = g_strdup_printf( "turn=%d", turn);
-    pairs[indx++] = g_strdup_printf( "local=%d", isLocal?1:0);
-    pairs[indx++] = g_strdup_printf( "ntotal=%d", nTotal );
-    pairs[indx++] = g_strdup_printf( "nmissing=%d", nMissing);
-    pairs[indx++] = g_strdup_printf( "nmoves=%d", nMoves);
-    pairs[indx++] = g_strdup_printf( "seed=%d", seed);
-    pairs[indx++] = g_strdup_printf( "isoCode='%s'", gi->isoCodeStr);
-    pairs[indx++] = g_strdup_printf( "gameid=%d", gameID);
-    pairs[indx++] = g_strdup_printf( "connvia='%s'", connvia);
+    const char* query = "UPDATE games SET "
+        "ended=?, turn=?, local=?, ntotal=?, nmissing=?, nmoves=?, seed=?, "
+        "isoCode=?, gameid=?, connvia=?, "
 #ifdef XWFEATURE_RELAY
-    pairs[indx++] = g_strdup_printf( "relayid='%s'", relayID);
+        "relayid=?, "
 #endif
-    pairs[indx++] = g_strdup_printf( "lastMoveTime=%d", lastMoveTime );
-    pairs[indx++] = g_strdup_printf( "dupTimerExpires=%d", dupTimerExpires);
-    pairs[indx++] = g_strdup_printf( "scores='%s'", scoresStr);
-    pairs[indx++] = g_strdup_printf( "nPending=%d", nPending );
-    pairs[indx++] = g_strdup_printf( "role=%d", gi->serverRole);
-    pairs[indx++] = g_strdup_printf( "created=%d", game->created );
-    pairs[indx++] = g_strdup_printf( "channel=%d", gi->forceChannel );
-    pairs[indx++] = g_strdup_printf( "nTiles=%d", nTiles );
-    pairs[indx++] = NULL;
-    XP_ASSERT( indx < VSIZE(pairs) );
-
-    gchar* vals = g_strjoinv( ",", pairs );
-    for ( int ii = 0; !!pairs[ii]; ++ii ) {
-        g_free( pairs[ii] );
-    }
+        "lastMoveTime=?, dupTimerExpires=?, scores=?, nPending=?, role=?, "
+        "created=?, channel=?, nTiles=? "
+        "WHERE rowid=?";
+    sqlite3* pDb = cGlobals->params->pDb;
     XP_ASSERT( -1 != cGlobals->rowid );
-    gchar* query = g_strdup_printf( "UPDATE games SET %s WHERE rowid=%lld",
-                                    vals, cGlobals->rowid );
-    g_free( vals );
-    XP_LOGFF( "query: %s", query );
-    sqlite3_stmt* stmt = NULL;
-    int result = sqlite3_prepare_v2( cGlobals->params->pDb, query, -1, &stmt, NULL );
-    assertPrintResult( cGlobals->params->pDb, result, SQLITE_OK );
-    result = sqlite3_step( stmt );
-    if ( SQLITE_DONE != result ) {
-        XP_LOGFF( "sqlite3_step=>%s", sqlite3_errstr( result ) );
-        XP_ASSERT( 0 );
-    }
-    sqlite3_finalize( stmt );
-    XP_USE( result );
+
+    startWrite( pDb );
+    sqlite3_stmt* stmt = getStmt( pDb, query );
+    int col = 1;
+    sqlite3_bind_int( stmt, col++, gameOver?1:0 );
+    sqlite3_bind_int( stmt, col++, turn );
+    sqlite3_bind_int( stmt, col++, isLocal?1:0 );
+    sqlite3_bind_int( stmt, col++, nTotal );
+    sqlite3_bind_int( stmt, col++, nMissing );
+    sqlite3_bind_int( stmt, col++, nMoves );
+    sqlite3_bind_int( stmt, col++, seed );
+    sqlite3_bind_text( stmt, col++, gi->isoCodeStr, -1, SQLITE_STATIC );
+    sqlite3_bind_int( stmt, col++, gameID );
+    sqlite3_bind_text( stmt, col++, connvia, -1, SQLITE_STATIC );
+#ifdef XWFEATURE_RELAY
+    sqlite3_bind_text( stmt, col++, relayID, -1, SQLITE_STATIC );
+#endif
+    sqlite3_bind_int( stmt, col++, lastMoveTime );
+    sqlite3_bind_int( stmt, col++, dupTimerExpires );
+    sqlite3_bind_text( stmt, col++, scoresStr, -1, SQLITE_STATIC );
+    sqlite3_bind_int( stmt, col++, nPending );
+    sqlite3_bind_int( stmt, col++, gi->serverRole );
+    sqlite3_bind_int( stmt, col++, game->created );
+    sqlite3_bind_int( stmt, col++, gi->forceChannel );
+    sqlite3_bind_int( stmt, col++, nTiles );
+    sqlite3_bind_int64( stmt, col++, cGlobals->rowid );
+    XP_ASSERT( col - 1 == sqlite3_bind_parameter_count( stmt ) );
+    stepDone( pDb, stmt );
 
     if ( !cGlobals->params->useCurses ) {
         addSnapshot( cGlobals );
     }
     g_free( scoresStr );
-    g_free( query );
 }
 
 GSList*
@@ -473,12 +640,7 @@ gdb_listGames( sqlite3* pDb )
 {
     GSList* list = NULL;
     
-    sqlite3_stmt *ppStmt;
-    int result = sqlite3_prepare_v2( pDb, 
-                                     "SELECT rowid FROM games ORDER BY rowid", 
-                                     -1, &ppStmt, NULL );
-    assertPrintResult( pDb, result, SQLITE_OK );
-    XP_USE( result );
+    sqlite3_stmt *ppStmt = getStmt( pDb, "SELECT rowid FROM games ORDER BY rowid" );
     while ( NULL != ppStmt ) {
         switch( sqlite3_step( ppStmt ) ) {
         case SQLITE_ROW:        /* have data */
@@ -490,7 +652,7 @@ gdb_listGames( sqlite3* pDb )
         }
         break;
         case SQLITE_DONE:
-            sqlite3_finalize( ppStmt );
+            doneStmt( ppStmt );
             ppStmt = NULL;
             break;
         default:
@@ -517,11 +679,9 @@ GHashTable*
 gdb_getRelayIDsToRowsMap( sqlite3* pDb )
 {
     GHashTable* table = g_hash_table_new( g_str_hash, g_str_equal );
-    sqlite3_stmt *ppStmt;
-    int result = sqlite3_prepare_v2( pDb, "SELECT relayid, rowid FROM games "
-                                     "where NOT relayid = ''", -1, &ppStmt, NULL );
-    assertPrintResult( pDb, result, SQLITE_OK );
-    while ( result == SQLITE_OK && NULL != ppStmt ) {
+    sqlite3_stmt *ppStmt = getStmt( pDb, "SELECT relayid, rowid FROM games "
+                                    "where NOT relayid = ''" );
+    while ( NULL != ppStmt ) {
         switch( sqlite3_step( ppStmt ) ) {
         case SQLITE_ROW:        /* have data */
         {
@@ -536,7 +696,7 @@ gdb_getRelayIDsToRowsMap( sqlite3* pDb )
         }
         break;
         case SQLITE_DONE:
-            sqlite3_finalize( ppStmt );
+            doneStmt( ppStmt );
             ppStmt = NULL;
             break;
         default:
@@ -552,17 +712,14 @@ XP_Bool
 gdb_getGameInfoForRow( sqlite3* pDb, sqlite3_int64 rowid, GameInfo* gib )
 {
     XP_Bool success = XP_FALSE;
-    const char* fmt = "SELECT ended, turn, local, nmoves, ntotal, nmissing, "
+    const char* query = "SELECT ended, turn, local, nmoves, ntotal, nmissing, "
         "isoCode, seed, connvia, gameid, lastMoveTime, dupTimerExpires, "
         "relayid, scores, nPending, nTiles, role, channel, created, snap "
-        "FROM games WHERE rowid = %lld";
-    XP_UCHAR query[256];
-    snprintf( query, sizeof(query), fmt, rowid );
+        "FROM games WHERE rowid = ?";
 
-    sqlite3_stmt* ppStmt;
-    int result = sqlite3_prepare_v2( pDb, query, -1, &ppStmt, NULL );
-    assertPrintResult( pDb, result, SQLITE_OK );
-    result = sqlite3_step( ppStmt );
+    sqlite3_stmt* ppStmt = getStmt( pDb, query );
+    sqlite3_bind_int64( ppStmt, 1, rowid );
+    int result = sqlite3_step( ppStmt );
     if ( SQLITE_ROW == result ) {
         success = XP_TRUE;
         int col = 0;
@@ -608,7 +765,7 @@ gdb_getGameInfoForRow( sqlite3* pDb, sqlite3_int64 rowid, GameInfo* gib )
         gib->snap = snap;
 #endif
     }
-    sqlite3_finalize( ppStmt );
+    doneStmt( ppStmt );
 
     return success;
 }
@@ -630,22 +787,20 @@ gdb_getRowsForGameID( sqlite3* pDb, XP_U32 gameID, sqlite3_int64* rowids,
     int maxRowIDs = *nRowIDs;
     *nRowIDs = 0;
 
-    char buf[256];
-    snprintf( buf, sizeof(buf), "SELECT rowid from games WHERE gameid = %d "
-              "LIMIT %d", gameID, maxRowIDs );
-    sqlite3_stmt *ppStmt;
-    int result = sqlite3_prepare_v2( pDb, buf, -1, &ppStmt, NULL );
-    assertPrintResult( pDb, result, SQLITE_OK );
+    sqlite3_stmt *ppStmt = getStmt( pDb, "SELECT rowid from games "
+                                    "WHERE gameid = ? LIMIT ?" );
+    sqlite3_bind_int( ppStmt, 1, gameID );
+    sqlite3_bind_int( ppStmt, 2, maxRowIDs );
     int ii;
     for ( ii = 0; ii < maxRowIDs; ++ii ) {
-        result = sqlite3_step( ppStmt );
+        int result = sqlite3_step( ppStmt );
         if ( SQLITE_ROW != result ) {
             break;
         }
         rowids[ii] = sqlite3_column_int64( ppStmt, 0 );
         ++*nRowIDs;
     }
-    sqlite3_finalize( ppStmt );
+    doneStmt( ppStmt );
 }
 
 static XP_Bool
@@ -653,13 +808,12 @@ loadBlobColumn( XWStreamCtxt* stream, sqlite3* pDb, sqlite3_int64 rowid,
                 const char* column )
 {
     char buf[256];
-    snprintf( buf, sizeof(buf), "SELECT %s from games WHERE rowid = %lld", 
-              column, rowid );
+    snprintf( buf, sizeof(buf), "SELECT %s from games WHERE rowid = ?", 
+              column );
 
-    sqlite3_stmt *ppStmt;
-    int result = sqlite3_prepare_v2( pDb, buf, -1, &ppStmt, NULL );
-    assertPrintResult( pDb, result, SQLITE_OK );
-    result = sqlite3_step( ppStmt );
+    sqlite3_stmt *ppStmt = getStmt( pDb, buf );
+    sqlite3_bind_int64( ppStmt, 1, rowid );
+    int result = sqlite3_step( ppStmt );
     XP_Bool success = SQLITE_ROW == result;
     if ( success ) {
         const void* ptr = sqlite3_column_blob( ppStmt, 0 );
@@ -675,7 +829,7 @@ loadBlobColumn( XWStreamCtxt* stream, sqlite3* pDb, sqlite3_int64 rowid,
                              size - sizeof(strVersion) );
         }
     }
-    sqlite3_finalize( ppStmt );
+    doneStmt( ppStmt );
     return success;
 }
 
@@ -685,13 +839,55 @@ gdb_loadGame( XWStreamCtxt* stream, sqlite3* pDb, sqlite3_int64 rowid )
     return loadBlobColumn( stream, pDb, rowid, "game" );
 }
 
+/* Reads the blob a piece at a time: the version and the game's first few
+   bytes, then as much more as they say the header needs */
+XP_Bool
+gdb_loadGameHeader( XWStreamCtxt* stream, sqlite3* pDb, sqlite3_int64 rowid )
+{
+    XP_Bool success = XP_FALSE;
+    sqlite3_blob* blob;
+    if ( SQLITE_OK == sqlite3_blob_open( pDb, "main", "games", "game", rowid,
+                                         0, &blob ) ) {
+        XP_U16 strVersion;
+        XP_U8 prefix[GAME_HEADER_PREFIX_LEN];
+        const int prefixEnd = sizeof(strVersion) + sizeof(prefix);
+        const int size = sqlite3_blob_bytes( blob );
+        if ( prefixEnd <= size
+             && SQLITE_OK == sqlite3_blob_read( blob, &strVersion,
+                                                sizeof(strVersion), 0 )
+             && SQLITE_OK == sqlite3_blob_read( blob, prefix, sizeof(prefix),
+                                                sizeof(strVersion) ) ) {
+            XP_U16 headerLen = game_headerLen( prefix );
+            if ( 0 < headerLen && sizeof(strVersion) + headerLen <= size ) {
+                XP_U8 buf[headerLen];
+                XP_MEMCPY( buf, prefix, sizeof(prefix) );
+                success = SQLITE_OK ==
+                    sqlite3_blob_read( blob, &buf[sizeof(prefix)],
+                                       headerLen - sizeof(prefix), prefixEnd );
+                if ( success ) {
+                    stream_setVersion( stream, strVersion );
+                    stream_putBytes( stream, buf, headerLen );
+                }
+            }
+        }
+        sqlite3_blob_close( blob );
+    }
+
+    if ( !success ) {
+        /* Saved before there was a header? Then it's all needed */
+        success = gdb_loadGame( stream, pDb, rowid );
+    }
+    return success;
+}
+
 void
 gdb_deleteGame( sqlite3* pDb, sqlite3_int64 rowid )
 {
     XP_ASSERT( !!pDb );
-    char query[256];
-    snprintf( query, sizeof(query), "DELETE FROM games WHERE rowid = %lld", rowid );
-    execNoResult( pDb, query, false );
+    startWrite( pDb );
+    sqlite3_stmt* stmt = getStmt( pDb, "DELETE FROM games WHERE rowid = ?" );
+    sqlite3_bind_int64( stmt, 1, rowid );
+    stepDone( pDb, stmt );
 }
 
 void
@@ -703,23 +899,20 @@ gdb_getSummary( sqlite3* pDb, DevSummary* ds )
                pending messages after a game finishes. PENDING */
             // "nPending > 0 OR "
             "ended = 0";
-        sqlite3_stmt* ppStmt;
-        int err = sqlite3_prepare_v2( pDb, query, -1, &ppStmt, NULL );
-        assertPrintResult( pDb, err, SQLITE_OK );
-        err = sqlite3_step( ppStmt );
+        sqlite3_stmt* ppStmt = getStmt( pDb, query );
+        int err = sqlite3_step( ppStmt );
         XP_ASSERT( SQLITE_ROW == err );
+        XP_USE( err );
         ds->allDone = 0 == sqlite3_column_int( ppStmt, 0 );
-        sqlite3_finalize( ppStmt );
+        doneStmt( ppStmt );
     }
 
     {
         XP_Bool allSet = XP_TRUE;
         const char* query = "SELECT nTiles FROM games";
-        sqlite3_stmt* ppStmt;
-        int err = sqlite3_prepare_v2( pDb, query, -1, &ppStmt, NULL );
-        assertPrintResult( pDb, err, SQLITE_OK );
+        sqlite3_stmt* ppStmt = getStmt( pDb, query );
         for ( ; ; ) {
-            err = sqlite3_step( ppStmt );
+            int err = sqlite3_step( ppStmt );
             if ( SQLITE_ROW != err ) {
                 break;
             }
@@ -727,7 +920,7 @@ gdb_getSummary( sqlite3* pDb, DevSummary* ds )
             allSet = allSet && 0 <= nTiles;
             ds->nTiles += nTiles;
         }
-        sqlite3_finalize( ppStmt );
+        doneStmt( ppStmt );
 
         if ( !allSet ) {
             ds->nTiles += -1;
@@ -736,13 +929,12 @@ gdb_getSummary( sqlite3* pDb, DevSummary* ds )
 
     {
         const char* query = "SELECT count(rowid) FROM games";
-        sqlite3_stmt* ppStmt;
-        int err = sqlite3_prepare_v2( pDb, query, -1, &ppStmt, NULL );
-        assertPrintResult( pDb, err, SQLITE_OK );
-        err = sqlite3_step( ppStmt );
+        sqlite3_stmt* ppStmt = getStmt( pDb, query );
+        int err = sqlite3_step( ppStmt );
         XP_ASSERT( SQLITE_ROW == err );
+        XP_USE( err );
         ds->nGames = sqlite3_column_int( ppStmt, 0 );
-        sqlite3_finalize( ppStmt );
+        doneStmt( ppStmt );
     }
 }
 
@@ -750,11 +942,12 @@ void
 gdb_store( sqlite3* pDb, const gchar* key, const gchar* value )
 {
     XP_ASSERT( !!pDb );
-    gchar* query =
-        g_strdup_printf( "INSERT OR REPLACE INTO pairs (key, value) "
-                         "VALUES ('%s', '%s')", key, value );
-    execNoResult( pDb, query, false );
-    g_free( query );
+    startWrite( pDb );
+    sqlite3_stmt* stmt = getStmt( pDb, "INSERT OR REPLACE INTO pairs "
+                                  "(key, value) VALUES (?, ?)" );
+    sqlite3_bind_text( stmt, 1, key, -1, SQLITE_STATIC );
+    sqlite3_bind_text( stmt, 2, value, -1, SQLITE_STATIC );
+    stepDone( pDb, stmt );
 }
 
 bool
@@ -786,28 +979,26 @@ gdb_storeInt( sqlite3* pDb, const gchar* key, int32_t val )
 }
 
 static FetchResult
-fetchQuery( sqlite3* pDb, const char* query, gchar* buf, gint* buflen )
+fetchQuery( sqlite3* pDb, const char* query, const gchar* param,
+            gchar* buf, gint* buflen )
 {
     XP_ASSERT( !!pDb );
     FetchResult fetchRes = NOT_THERE;
 
-    sqlite3_stmt* ppStmt;
-    int sqlResult = sqlite3_prepare_v2( pDb, query, -1, &ppStmt, NULL );
-    XP_Bool found = SQLITE_OK == sqlResult;
+    sqlite3_stmt* ppStmt = getStmt( pDb, query );
+    sqlite3_bind_text( ppStmt, 1, param, -1, SQLITE_STATIC );
+    int sqlResult = sqlite3_step( ppStmt );
+    XP_Bool found = SQLITE_ROW == sqlResult;
     if ( found ) {
-        sqlResult = sqlite3_step( ppStmt );
-        found = SQLITE_ROW == sqlResult;
-        if ( found ) {
-            if ( getColumnText( ppStmt, 0, buf, buflen ) ) {
-                fetchRes = SUCCESS;
-            } else {
-                fetchRes = BUFFER_TOO_SMALL;
-            }
-        } else if ( !!buf ) {
-            buf[0] = '\0';
+        if ( getColumnText( ppStmt, 0, buf, buflen ) ) {
+            fetchRes = SUCCESS;
+        } else {
+            fetchRes = BUFFER_TOO_SMALL;
         }
+    } else if ( !!buf ) {
+        buf[0] = '\0';
     }
-    sqlite3_finalize( ppStmt );
+    doneStmt( ppStmt );
     return fetchRes;
 }
 
@@ -816,23 +1007,14 @@ gdb_fetch( sqlite3* pDb, const gchar* key, const XP_UCHAR* keySuffix,
            gchar* buf, gint* buflen )
 {
     XP_ASSERT( !!pDb );
-    FetchResult fetchRes = NOT_THERE;
-    char query[256];
-#ifdef DEBUG
-    int len =
-#endif
-        snprintf( query, sizeof(query),
-                  "SELECT value from pairs where key = '%s'", key );
-    XP_ASSERT( len < sizeof(query) );
-    fetchRes = fetchQuery( pDb, query, buf, buflen );
+    FetchResult fetchRes =
+        fetchQuery( pDb, "SELECT value from pairs where key = ?", key,
+                    buf, buflen );
     if ( NOT_THERE == fetchRes && NULL != keySuffix ) {
-#ifdef DEBUG
-        len =
-#endif
-            snprintf( query, sizeof(query),
-                      "SELECT value from pairs where key LIKE '%%%s'", keySuffix );
-        XP_ASSERT( len < sizeof(query) );
-        fetchRes = fetchQuery( pDb, query, buf, buflen );
+        gchar* pattern = g_strdup_printf( "%%%s", keySuffix );
+        fetchRes = fetchQuery( pDb, "SELECT value from pairs where key LIKE ?",
+                               pattern, buf, buflen );
+        g_free( pattern );
 
         /* Let's rewrite it using the correct key so this code can eventually
            go away */
@@ -859,9 +1041,10 @@ void
 gdb_remove( sqlite3* pDb, const gchar* key )
 {
     XP_ASSERT( !!pDb );
-    char query[256];
-    snprintf( query, sizeof(query), "DELETE FROM pairs WHERE key = '%s'", key );
-    execNoResult( pDb, query, false );
+    startWrite( pDb );
+    sqlite3_stmt* stmt = getStmt( pDb, "DELETE FROM pairs WHERE key = ?" );
+    sqlite3_bind_text( stmt, 1, key, -1, SQLITE_STATIC );
+    stepDone( pDb, stmt );
 }
 
 static XP_Bool
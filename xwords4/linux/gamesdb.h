@@ -56,6 +56,20 @@ typedef struct _GameInfo {
 sqlite3* gdb_open( const char* dbName );
 void gdb_close( sqlite3* pDb );
 
+/* Writes are committed in batches: at the main loop's next idle by default,
+   or flushMS after the first of them if that's non-0. gdb_flush() commits
+   whatever's pending right away; gdb_close() does too. */
+void gdb_setFlushInterval( sqlite3* pDb, guint flushMS );
+void gdb_flush( sqlite3* pDb );
+
+/* Call proc once what's been written so far is committed: right away if
+   nothing's pending. gdb_flushFor() commits now if anything's waiting on
+   closure; call it before closure goes away. */
+typedef void (*GDBCommittedProc)( void* closure, XP_U16 token );
+void gdb_onCommit( sqlite3* pDb, GDBCommittedProc proc, void* closure,
+                   XP_U16 token );
+void gdb_flushFor( sqlite3* pDb, const void* closure );
+
 void gdb_write( XWStreamCtxt* stream, XWEnv xwe, void* closure );
 sqlite3_int64 gdb_writeNewGame( XWStreamCtxt* stream, sqlite3* pDb );
 
@@ -74,6 +88,10 @@ XP_Bool gdb_getGameInfoForGID( sqlite3* pDb, XP_U32 gameID, GameInfo* gib );
 void gdb_getRowsForGameID( sqlite3* pDb, XP_U32 gameID, sqlite3_int64* rowids,
                            int* nRowIDs );
 XP_Bool gdb_loadGame( XWStreamCtxt* stream, sqlite3* pDb, sqlite3_int64 rowid );
+/* Like gdb_loadGame(), but loads only the header game_summaryFromStream()
+   reads, if the save has one */
+XP_Bool gdb_loadGameHeader( XWStreamCtxt* stream, sqlite3* pDb,
+                            sqlite3_int64 rowid );
 void gdb_deleteGame( sqlite3* pDb, sqlite3_int64 rowid );
 
 typedef struct _DevSummary {
@@ -730,6 +730,7 @@ cleanup( GtkGameGlobals* globals )
 #ifdef XWFEATURE_RELAY
     linux_close_socket( cGlobals );
 #endif
+    gdb_flushFor( cGlobals->params->pDb, cGlobals );
     game_dispose( &cGlobals->game, NULL_XWE );
     gi_disposePlayerInfo( MEMPOOL cGlobals->gi );
 
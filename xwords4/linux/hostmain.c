@@ -0,0 +1,1031 @@
+/*
+ * Copyright 2025 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <signal.h>
+#include <unistd.h>
+#include <stdio.h>
+
+#include "hostmain.h"
+#include "linuxmain.h"
+#include "linuxsms.h"
+#include "lindutil.h"
+#include "gamesdb.h"
+#include "mqttcon.h"
+#include "device.h"
+#include "game.h"
+#include "server.h"
+#include "comms.h"
+#include "util.h"
+#include "dbgutil.h"
+#include "strutils.h"
+#include "memstream.h"
+#include "gsrcwrap.h"
+
+#define HOST_BATCH 16                /* activations per trip through loop */
+#define HOST_MAX_DOS 64              /* server_do() calls per activation */
+#define HOST_GRACE_US (5 * G_USEC_PER_SEC) /* don't close games younger */
+#define HOST_SWEEP_SECS 30
+
+typedef struct _HostStats {
+    XP_U32 nActivations;
+    XP_U32 nMsgsIn;
+    XP_U32 nMsgsOut;
+    XP_U32 nInvites;
+    XP_U32 nOpens;
+    XP_U32 nCloses;
+    XP_U32 nGamesOver;
+    gint64 activeUS;            /* total time spent in activations */
+} HostStats;
+
+typedef struct _HostState HostState;
+
+/* A device is a dutil and the DB it stores into, so a devID and the games
+   that device is in. The first is the process's own; the rest run on
+   copies of its params with their own dutil and DB. */
+typedef struct _HostDevice {
+    HostState* hs;
+    LaunchParams* params;
+    LaunchParams ownParams;     /* params, for all but the first device */
+    GHashTable* games;          /* &rowid -> HostGame*, for open games */
+    GQueue runQ;                /* sqlite3_int64* rowids waiting to run */
+    GHashTable* queued;         /* set of the same, to drop duplicates */
+    guint runSrc;
+} HostDevice;
+
+struct _HostState {
+    LaunchParams* params;
+    GMainLoop* loop;
+    HostDevice** devices;
+    int nDevices;
+    guint sweepSrc;
+    guint statsSrc;
+    int quitpipe[2];
+
+    HostStats stats;            /* for all devices */
+    HostStats lastStats;        /* as of last periodic report */
+    gint64 startUS;
+    gint64 lastStatsUS;
+};
+
+typedef struct _HostGame {
+    CommonGlobals cGlobals;     /* must be first: util->closure is cast */
+    HostDevice* dev;
+    gint64 lastUsed;
+    XP_Bool over;               /* counted in stats.nGamesOver */
+} HostGame;
+
+static HostState g_host;
+
+static void schedule( HostDevice* dev, sqlite3_int64 rowid );
+
+static void
+host_util_userError( XW_UtilCtxt* XP_UNUSED(uc), XWEnv XP_UNUSED(xwe),
+                     UtilErrID XP_UNUSED_DBG(id) )
+{
+    XP_LOGFF( "(id=%d)", id );
+}
+
+static void
+host_util_notifyMove( XW_UtilCtxt* XP_UNUSED(uc), XWEnv XP_UNUSED(xwe),
+                      XWStreamCtxt* XP_UNUSED(stream) )
+{
+    /* Nobody's here to confirm a move */
+    LOG_FUNC();
+}
+
+static void
+host_util_notifyTrade( XW_UtilCtxt* XP_UNUSED(uc), XWEnv XP_UNUSED(xwe),
+                       const XP_UCHAR** XP_UNUSED(tiles),
+                       XP_U16 XP_UNUSED(nTiles) )
+{
+    LOG_FUNC();
+}
+
+static void
+host_util_notifyPickTileBlank( XW_UtilCtxt* XP_UNUSED(uc), XWEnv XP_UNUSED(xwe),
+                               XP_U16 XP_UNUSED(playerNum),
+                               XP_U16 XP_UNUSED(col), XP_U16 XP_UNUSED(row),
+                               const XP_UCHAR** XP_UNUSED(texts),
+                               XP_U16 XP_UNUSED(nTiles) )
+{
+    LOG_FUNC();
+}
+
+static void
+host_util_informNeedPickTiles( XW_UtilCtxt* XP_UNUSED(uc),
+                               XWEnv XP_UNUSED(xwe),
+                               XP_Bool XP_UNUSED(isInitial),
+                               XP_U16 XP_UNUSED(player),
+                               XP_U16 XP_UNUSED(nToPick),
+                               XP_U16 XP_UNUSED(nFaces),
+                               const XP_UCHAR** XP_UNUSED(faces),
+                               const XP_U16* XP_UNUSED(counts) )
+{
+    LOG_FUNC();
+}
+
+static void
+host_util_informNeedPassword( XW_UtilCtxt* XP_UNUSED(uc),
+                              XWEnv XP_UNUSED(xwe),
+                              XP_U16 XP_UNUSED_DBG(playerNum),
+                              const XP_UCHAR* XP_UNUSED_DBG(name) )
+{
+    XP_LOGFF( "(player=%d, name=%s)", playerNum, name );
+}
+
+static void
+host_util_trayHiddenChange( XW_UtilCtxt* XP_UNUSED(uc), XWEnv XP_UNUSED(xwe),
+                            XW_TrayVisState XP_UNUSED(state),
+                            XP_U16 XP_UNUSED(nVisibleRows) )
+{
+}
+
+static void
+host_util_yOffsetChange( XW_UtilCtxt* XP_UNUSED(uc), XWEnv XP_UNUSED(xwe),
+                         XP_U16 XP_UNUSED(maxOffset),
+                         XP_U16 XP_UNUSED(oldOffset),
+                         XP_U16 XP_UNUSED(newOffset) )
+{
+}
+
+#ifdef XWFEATURE_TURNCHANGENOTIFY
+static void
+host_util_turnChanged( XW_UtilCtxt* XP_UNUSED(uc), XWEnv XP_UNUSED(xwe),
+                       XP_S16 XP_UNUSED(newTurn) )
+{
+}
+#endif
+
+static void
+host_util_notifyDupStatus( XW_UtilCtxt* XP_UNUSED(uc), XWEnv XP_UNUSED(xwe),
+                           XP_Bool XP_UNUSED(amHost),
+                           const XP_UCHAR* XP_UNUSED_DBG(msg) )
+{
+    XP_LOGFF( "(msg=%s)", msg );
+}
+
+static void
+host_util_informMove( XW_UtilCtxt* XP_UNUSED(uc), XWEnv XP_UNUSED(xwe),
+                      XP_S16 XP_UNUSED(turn), XWStreamCtxt* XP_UNUSED(expl),
+                      XWStreamCtxt* XP_UNUSED(words) )
+{
+}
+
+static void
+host_util_informUndo( XW_UtilCtxt* XP_UNUSED(uc), XWEnv XP_UNUSED(xwe) )
+{
+    LOG_FUNC();
+}
+
+static void
+host_util_informNetDict( XW_UtilCtxt* XP_UNUSED(uc), XWEnv XP_UNUSED(xwe),
+                         const XP_UCHAR* XP_UNUSED(isoCode),
+                         const XP_UCHAR* XP_UNUSED_DBG(oldName),
+                         const XP_UCHAR* XP_UNUSED_DBG(newName),
+                         const XP_UCHAR* XP_UNUSED(newSum),
+                         XWPhoniesChoice XP_UNUSED(phoniesAction) )
+{
+    XP_LOGFF( "(old=%s, new=%s)", oldName, newName );
+}
+
+static void
+host_util_notifyGameOver( XW_UtilCtxt* XP_UNUSED_DBG(uc), XWEnv XP_UNUSED(xwe),
+                          XP_S16 XP_UNUSED_DBG(quitter) )
+{
+    XP_LOGFF( "(gameID=%X, quitter=%d)", uc->gameInfo->gameID, quitter );
+}
+
+#ifdef XWFEATURE_HILITECELL
+static XP_Bool
+host_util_hiliteCell( XW_UtilCtxt* XP_UNUSED(uc), XWEnv XP_UNUSED(xwe),
+                      XP_U16 XP_UNUSED(col), XP_U16 XP_UNUSED(row) )
+{
+    return XP_TRUE;
+}
+#endif
+
+static XP_Bool
+host_util_engineProgressCallback( XW_UtilCtxt* XP_UNUSED(uc),
+                                  XWEnv XP_UNUSED(xwe) )
+{
+    return XP_TRUE;
+}
+
+static XP_Bool
+host_util_altKeyDown( XW_UtilCtxt* XP_UNUSED(uc), XWEnv XP_UNUSED(xwe) )
+{
+    return XP_FALSE;
+}
+
+static void
+host_util_notifyIllegalWords( XW_UtilCtxt* XP_UNUSED(uc), XWEnv XP_UNUSED(xwe),
+                              const BadWordInfo* XP_UNUSED(bwi),
+                              const XP_UCHAR* XP_UNUSED(dictName),
+                              XP_U16 XP_UNUSED_DBG(player),
+                              XP_Bool XP_UNUSED_DBG(turnLost),
+                              XP_U32 XP_UNUSED(bwKey) )
+{
+    XP_LOGFF( "(player=%d, turnLost=%s)", player, boolToStr(turnLost) );
+}
+
+static void
+host_util_remSelected( XW_UtilCtxt* XP_UNUSED(uc), XWEnv XP_UNUSED(xwe) )
+{
+}
+
+static void
+host_util_timerSelected( XW_UtilCtxt* XP_UNUSED(uc), XWEnv XP_UNUSED(xwe),
+                         XP_Bool XP_UNUSED(inDuplicateMode),
+                         XP_Bool XP_UNUSED(canPause) )
+{
+}
+
+#ifndef XWFEATURE_MINIWIN
+static void
+host_util_bonusSquareHeld( XW_UtilCtxt* XP_UNUSED(uc), XWEnv XP_UNUSED(xwe),
+                           XWBonusType XP_UNUSED(bonus) )
+{
+}
+
+static void
+host_util_playerScoreHeld( XW_UtilCtxt* XP_UNUSED(uc), XWEnv XP_UNUSED(xwe),
+                           XP_U16 XP_UNUSED(player) )
+{
+}
+#endif
+
+#ifdef XWFEATURE_BOARDWORDS
+static void
+host_util_cellSquareHeld( XW_UtilCtxt* XP_UNUSED(uc), XWEnv XP_UNUSED(xwe),
+                          XWStreamCtxt* XP_UNUSED(words) )
+{
+}
+#endif
+
+static void
+host_util_informWordsBlocked( XW_UtilCtxt* XP_UNUSED(uc), XWEnv XP_UNUSED(xwe),
+                              XP_U16 XP_UNUSED_DBG(nBadWords),
+                              XWStreamCtxt* XP_UNUSED(words),
+                              const XP_UCHAR* XP_UNUSED_DBG(dictName) )
+{
+    XP_LOGFF( "(nBadWords=%d, dict=%s)", nBadWords, dictName );
+}
+
+#ifdef XWFEATURE_SEARCHLIMIT
+static XP_Bool
+host_util_getTraySearchLimits( XW_UtilCtxt* XP_UNUSED(uc), XWEnv XP_UNUSED(xwe),
+                               XP_U16* XP_UNUSED(min), XP_U16* XP_UNUSED(max) )
+{
+    return XP_FALSE;
+}
+#endif
+
+#ifdef XWFEATURE_CHAT
+static void
+host_util_showChat( XW_UtilCtxt* XP_UNUSED(uc), XWEnv XP_UNUSED(xwe),
+                    const XP_UCHAR* const XP_UNUSED_DBG(msg),
+                    XP_S16 XP_UNUSED_DBG(from),
+                    XP_U32 XP_UNUSED(timestamp) )
+{
+    XP_LOGFF( "(from=%d, msg=%s)", from, msg );
+}
+#endif
+
+void
+setupHostUtilCallbacks( XW_UtilCtxt* util )
+{
+#define SET_PROC(NAM) util->vtable->m_util_##NAM = host_util_##NAM
+    SET_PROC(userError);
+    SET_PROC(notifyMove);
+    SET_PROC(notifyTrade);
+    SET_PROC(notifyPickTileBlank);
+    SET_PROC(informNeedPickTiles);
+    SET_PROC(informNeedPassword);
+    SET_PROC(trayHiddenChange);
+    SET_PROC(yOffsetChange);
+#ifdef XWFEATURE_TURNCHANGENOTIFY
+    SET_PROC(turnChanged);
+#endif
+    SET_PROC(notifyDupStatus);
+    SET_PROC(informMove);
+    SET_PROC(informUndo);
+    SET_PROC(informNetDict);
+    SET_PROC(notifyGameOver);
+#ifdef XWFEATURE_HILITECELL
+    SET_PROC(hiliteCell);
+#endif
+    SET_PROC(engineProgressCallback);
+    SET_PROC(altKeyDown);
+    SET_PROC(notifyIllegalWords);
+    SET_PROC(remSelected);
+    SET_PROC(timerSelected);
+#ifndef XWFEATURE_MINIWIN
+    SET_PROC(bonusSquareHeld);
+    SET_PROC(playerScoreHeld);
+#endif
+#ifdef XWFEATURE_BOARDWORDS
+    SET_PROC(cellSquareHeld);
+#endif
+    SET_PROC(informWordsBlocked);
+#ifdef XWFEATURE_SEARCHLIMIT
+    SET_PROC(getTraySearchLimits);
+#endif
+#ifdef XWFEATURE_CHAT
+    SET_PROC(showChat);
+#endif
+#undef SET_PROC
+
+    assertTableFull( util->vtable, sizeof(*util->vtable), "host util" );
+} /* setupHostUtilCallbacks */
+
+/* Count what goes out, then send it the usual way */
+static XP_S16
+host_send( XWEnv xwe, const SendMsgsPacket* const msgs, XP_U16 streamVersion,
+           const CommsAddrRec* addr, CommsConnType conType, XP_U32 gameID,
+           void* closure )
+{
+    HostGame* hg = (HostGame*)closure;
+    for ( const SendMsgsPacket* packet = msgs; !!packet;
+          packet = packet->next ) {
+        ++hg->dev->hs->stats.nMsgsOut;
+    }
+    return linux_send( xwe, msgs, streamVersion, addr, conType, gameID,
+                       &hg->cGlobals );
+}
+
+static void
+host_countChanged( XWEnv XP_UNUSED(xwe), void* XP_UNUSED(closure),
+                   XP_U16 XP_UNUSED_DBG(newCount),
+                   XP_Bool XP_UNUSED_DBG(quashed) )
+{
+    XP_LOGFF( "(newCount=%d, quashed=%s)", newCount, boolToStr(quashed) );
+}
+
+#ifdef COMMS_XPORT_FLAGSPROC
+static XP_U32
+host_getFlags( XWEnv XP_UNUSED(xwe), void* XP_UNUSED(closure) )
+{
+    return COMMS_XPORT_FLAGS_NONE;
+}
+#endif
+
+static void
+initTProcsHost( CommonGlobals* cGlobals )
+{
+    cGlobals->procs.closure = cGlobals;
+    cGlobals->procs.sendMsgs = host_send;
+#ifdef XWFEATURE_COMMS_INVITE
+    cGlobals->procs.sendInvt = linux_send_invt;
+#endif
+    cGlobals->procs.countChanged = host_countChanged;
+#ifdef COMMS_XPORT_FLAGSPROC
+    cGlobals->procs.getFlags = host_getFlags;
+#endif
+}
+
+static void
+initCP( CommonGlobals* cGlobals )
+{
+    const LaunchParams* params = cGlobals->params;
+    cGlobals->cp.showRobotScores = params->showRobotScores;
+    cGlobals->cp.skipMQTTAdd = params->skipMQTTAdd;
+    cGlobals->cp.skipCommitConfirm = params->skipCommitConfirm;
+    cGlobals->cp.sortNewTiles = params->sortNewTiles;
+#ifdef XWFEATURE_SLOW_ROBOT
+    cGlobals->cp.robotThinkMin = params->robotThinkMin;
+    cGlobals->cp.robotThinkMax = params->robotThinkMax;
+    cGlobals->cp.robotTradePct = params->robotTradePct;
+#endif
+#ifdef XWFEATURE_ROBOTPHONIES
+    cGlobals->cp.makePhonyPct = params->makePhonyPct;
+#endif
+}
+
+static void
+onGameSaved( void* closure, sqlite3_int64 XP_UNUSED(rowid), XP_Bool firstTime )
+{
+    HostGame* hg = (HostGame*)closure;
+    if ( firstTime ) {
+        /* Key is the game's own rowid field, so lives as long as it does */
+        g_hash_table_insert( hg->dev->games, &hg->cGlobals.rowid, hg );
+    }
+}
+
+static HostGame*
+initGame( HostDevice* dev, sqlite3_int64 rowid, const CurGameInfo* gip )
+{
+    LaunchParams* params = dev->params;
+    HostGame* hg = g_malloc0( sizeof(*hg) );
+    hg->dev = dev;
+    CommonGlobals* cGlobals = &hg->cGlobals;
+
+    cGlobals->gi = &cGlobals->_gi;
+    gi_copy( MPPARM(params->mpool) cGlobals->gi, !!gip? gip : &params->pgi );
+
+    cGlobals->rowid = rowid;
+    cGlobals->params = params;
+    setupUtil( cGlobals );
+    cGlobals->util->closure = hg;
+    setupHostUtilCallbacks( cGlobals->util );
+
+    cGlobals->onSave = onGameSaved;
+    cGlobals->onSaveClosure = hg;
+
+    initTProcsHost( cGlobals );
+    initCP( cGlobals );
+    makeSelfAddress( &cGlobals->selfAddr, params );
+
+    return hg;
+} /* initGame */
+
+static void
+disposeGame( HostGame* hg )
+{
+    CommonGlobals* cGlobals = &hg->cGlobals;
+    cancelTimers( cGlobals );
+    if ( 0 != cGlobals->idleID ) {
+        g_source_remove( cGlobals->idleID );
+    }
+
+    gdb_flushFor( cGlobals->params->pDb, cGlobals );
+    game_dispose( &cGlobals->game, NULL_XWE );
+    gi_disposePlayerInfo( MPPARM(cGlobals->util->mpool) cGlobals->gi );
+    disposeUtil( cGlobals );
+    g_free( hg );
+}
+
+static HostGame*
+openGame( HostDevice* dev, sqlite3_int64 rowid, const CurGameInfo* gi )
+{
+    HostGame* hg = initGame( dev, rowid, gi );
+    CommonGlobals* cGlobals = &hg->cGlobals;
+    if ( linuxOpenGame( cGlobals ) ) {
+        hg->lastUsed = g_get_monotonic_time();
+        hg->over = server_getGameIsOver( cGlobals->game.server );
+        ++dev->hs->stats.nOpens;
+        /* new games were added when first saved */
+        g_hash_table_insert( dev->games, &cGlobals->rowid, hg );
+    } else {
+        disposeGame( hg );
+        hg = NULL;
+    }
+    return hg;
+}
+
+static HostGame*
+getGame( HostDevice* dev, sqlite3_int64 rowid )
+{
+    HostGame* hg = (HostGame*)g_hash_table_lookup( dev->games, &rowid );
+    if ( !hg ) {
+        hg = openGame( dev, rowid, NULL );
+    }
+    if ( !!hg ) {
+        hg->lastUsed = g_get_monotonic_time();
+    }
+    return hg;
+}
+
+/* Save them all, commit once, then dispose: disposeGame() would otherwise
+   commit for each game in turn. */
+static void
+closeGames( HostDevice* dev, GList* games )
+{
+    for ( GList* iter = games; !!iter; iter = iter->next ) {
+        CommonGlobals* cGlobals = &((HostGame*)iter->data)->cGlobals;
+        XP_LOGFF( "closing row %lld", cGlobals->rowid );
+        linuxSaveGame( cGlobals );
+        g_hash_table_remove( dev->games, &cGlobals->rowid );
+    }
+    gdb_flush( dev->params->pDb );
+    for ( GList* iter = games; !!iter; iter = iter->next ) {
+        disposeGame( (HostGame*)iter->data );
+        ++dev->hs->stats.nCloses;
+    }
+}
+
+static gint
+cmpLastUsed( gconstpointer aa, gconstpointer bb )
+{
+    gint64 diff = ((const HostGame*)aa)->lastUsed
+        - ((const HostGame*)bb)->lastUsed;
+    return diff < 0 ? -1 : diff > 0 ? 1 : 0;
+}
+
+/* Close least-recently-used games until no more than hostMaxOpen are open,
+   skipping any used within the grace period: those may still have an
+   idle proc or timer pending, and are likely to be used again soon. */
+static void
+evictIdle( HostDevice* dev )
+{
+    guint nOpen = g_hash_table_size( dev->games );
+    guint maxOpen = dev->params->hostMaxOpen;
+    if ( nOpen > maxOpen ) {
+        gint64 cutoff = g_get_monotonic_time() - HOST_GRACE_US;
+        GList* candidates = NULL;
+        GHashTableIter iter;
+        gpointer value;
+        g_hash_table_iter_init( &iter, dev->games );
+        while ( g_hash_table_iter_next( &iter, NULL, &value ) ) {
+            HostGame* hg = (HostGame*)value;
+            if ( hg->lastUsed < cutoff && !hg->cGlobals.packetQueue
+                 && !g_hash_table_contains( dev->queued,
+                                            &hg->cGlobals.rowid ) ) {
+                candidates = g_list_prepend( candidates, hg );
+            }
+        }
+
+        candidates = g_list_sort( candidates, cmpLastUsed );
+        GList* closing = NULL;
+        for ( GList* iter = candidates; !!iter && nOpen > maxOpen;
+              iter = iter->next ) {
+            closing = g_list_prepend( closing, iter->data );
+            --nOpen;
+        }
+        closeGames( dev, closing );
+        g_list_free( closing );
+        g_list_free( candidates );
+    }
+} /* evictIdle */
+
+static void
+noteIfOver( HostGame* hg )
+{
+    if ( !hg->over && server_getGameIsOver( hg->cGlobals.game.server ) ) {
+        hg->over = XP_TRUE;
+        ++hg->dev->hs->stats.nGamesOver;
+    }
+}
+
+/* Let the game do whatever it can without a user: robot moves, sends,
+   replies to what it just received. Then save. */
+static void
+activate( HostGame* hg )
+{
+    HostState* hs = hg->dev->hs;
+    CommonGlobals* cGlobals = &hg->cGlobals;
+    gint64 start = g_get_monotonic_time();
+
+    int nDos;
+    for ( nDos = 0; nDos < HOST_MAX_DOS; ++nDos ) {
+        if ( !server_do( cGlobals->game.server, NULL_XWE ) ) {
+            break;
+        }
+    }
+    linuxSaveGame( cGlobals );
+    noteIfOver( hg );
+
+    hg->lastUsed = g_get_monotonic_time();
+    hs->stats.activeUS += hg->lastUsed - start;
+    ++hs->stats.nActivations;
+
+    if ( HOST_MAX_DOS == nDos ) {
+        /* Still busy (robots playing each other?): let the others run */
+        XP_LOGFF( "row %lld not done; requeuing", cGlobals->rowid );
+        schedule( hg->dev, cGlobals->rowid );
+    }
+}
+
+static gint runQueued( gpointer data );
+
+static void
+schedule( HostDevice* dev, sqlite3_int64 rowid )
+{
+    if ( 0 <= rowid && !g_hash_table_contains( dev->queued, &rowid ) ) {
+        sqlite3_int64* key = g_new( sqlite3_int64, 1 );
+        *key = rowid;
+        g_hash_table_add( dev->queued, key ); /* owns key */
+        g_queue_push_tail( &dev->runQ, key );
+        if ( 0 == dev->runSrc ) {
+            dev->runSrc = g_idle_add( runQueued, dev );
+        }
+    }
+}
+
+static gint
+runQueued( gpointer data )
+{
+    HostDevice* dev = (HostDevice*)data;
+    for ( int ii = 0; ii < HOST_BATCH && !g_queue_is_empty( &dev->runQ );
+          ++ii ) {
+        sqlite3_int64* key = (sqlite3_int64*)g_queue_pop_head( &dev->runQ );
+        sqlite3_int64 rowid = *key;
+        g_hash_table_remove( dev->queued, key ); /* frees key */
+
+        HostGame* hg = getGame( dev, rowid );
+        if ( !!hg ) {
+            activate( hg );
+        }
+    }
+
+    evictIdle( dev );
+
+    gint result = !g_queue_is_empty( &dev->runQ );
+    if ( !result ) {
+        dev->runSrc = 0;
+    }
+    return result;
+}
+
+/* The db's summary says the turn's local, not whether a robot's playing it,
+   so read that from the gi in the saved game's header. Saves too old to have
+   one are loaded whole, and only their gi's read. */
+static XP_Bool
+robotOnTurn( HostDevice* dev, const GameInfo* gib )
+{
+    XP_Bool result = XP_FALSE;
+    LaunchParams* params = dev->params;
+    XWStreamCtxt* stream = mem_stream_make_raw( MPPARM(params->mpool)
+                                                params->vtMgr );
+    if ( gdb_loadGameHeader( stream, params->pDb, gib->rowid ) ) {
+        CurGameInfo gi = {};
+        GameSummary summary;
+        XP_S16 turn = game_summaryFromStream( MPPARM(params->mpool) stream,
+                                              &gi, &summary )
+            ? summary.turn : gib->turn;
+        if ( 0 <= turn && turn < gi.nPlayers ) {
+            const LocalPlayer* lp = &gi.players[turn];
+            result = LP_IS_LOCAL(lp) && LP_IS_ROBOT(lp);
+        }
+        gi_disposePlayerInfo( MPPARM(params->mpool) &gi );
+    }
+    stream_destroy( stream );
+    return result;
+}
+
+/* A local human's turn isn't something we can make progress on */
+static XP_Bool
+needsRun( HostDevice* dev, const GameInfo* gib )
+{
+    XP_Bool result = !gib->gameOver;
+    if ( result ) {
+        XP_U32 now = dutil_getCurSeconds( dev->params->dutil, NULL_XWE );
+        result = 0 < gib->nPending
+            || (0 != gib->dupTimerExpires && gib->dupTimerExpires <= now)
+            || (gib->turnLocal && robotOnTurn( dev, gib ));
+    }
+    return result;
+}
+
+/* Queue every closed game that has something to do. Open games have their
+   timers and idle procs running already. */
+static void
+sweep( HostDevice* dev )
+{
+    sqlite3* pDb = dev->params->pDb;
+    GSList* games = gdb_listGames( pDb );
+    int nQueued = 0;
+    for ( GSList* iter = games; !!iter; iter = iter->next ) {
+        sqlite3_int64 rowid = *(sqlite3_int64*)iter->data;
+        GameInfo gib;
+        if ( !g_hash_table_contains( dev->games, &rowid )
+             && gdb_getGameInfoForRow( pDb, rowid, &gib )
+             && needsRun( dev, &gib ) ) {
+            schedule( dev, rowid );
+            ++nQueued;
+        }
+    }
+    XP_LOGFF( "queued %d of %d games", nQueued, g_slist_length( games ) );
+    gdb_freeGamesList( games );
+
+    evictIdle( dev );
+}
+
+static gint
+sweepProc( gpointer data )
+{
+    HostState* hs = (HostState*)data;
+    for ( int ii = 0; ii < hs->nDevices; ++ii ) {
+        sweep( hs->devices[ii] );
+    }
+    return TRUE;
+}
+
+static void
+printStats( HostState* hs, const char* label, const HostStats* cur,
+            const HostStats* prev, gint64 elapsedUS )
+{
+    double secs = XP_MAX( 1, elapsedUS ) / (double)G_USEC_PER_SEC;
+    XP_U32 nActs = cur->nActivations - prev->nActivations;
+    double meanMS = 0 == nActs ? 0.0
+        : (cur->activeUS - prev->activeUS) / 1000.0 / nActs;
+    guint nOpen = 0;
+    guint nQueued = 0;
+    for ( int ii = 0; ii < hs->nDevices; ++ii ) {
+        nOpen += g_hash_table_size( hs->devices[ii]->games );
+        nQueued += g_queue_get_length( &hs->devices[ii]->runQ );
+    }
+    fprintf( stderr, "%s: %.1f activations/sec (mean %.2f ms), %.1f msgs in/sec, "
+             "%.1f msgs out/sec; %d open, %d queued; %d opens, %d closes, "
+             "%d invites, %d games over\n", label,
+             nActs / secs, meanMS,
+             (cur->nMsgsIn - prev->nMsgsIn) / secs,
+             (cur->nMsgsOut - prev->nMsgsOut) / secs,
+             nOpen, nQueued,
+             cur->nOpens - prev->nOpens, cur->nCloses - prev->nCloses,
+             cur->nInvites - prev->nInvites,
+             cur->nGamesOver - prev->nGamesOver );
+}
+
+static gint
+statsProc( gpointer data )
+{
+    HostState* hs = (HostState*)data;
+    gint64 now = g_get_monotonic_time();
+    printStats( hs, "host", &hs->stats, &hs->lastStats,
+                now - hs->lastStatsUS );
+    hs->lastStats = hs->stats;
+    hs->lastStatsUS = now;
+    return TRUE;
+}
+
+void
+hostInviteReceived( void* closure, const NetLaunchInfo* nli )
+{
+    HostDevice* dev = (HostDevice*)closure;
+    sqlite3_int64 rowids[1];
+    int nRowIDs = VSIZE(rowids);
+    gdb_getRowsForGameID( dev->params->pDb, nli->gameID, rowids, &nRowIDs );
+    if ( 0 == nRowIDs ) {
+        HostGame* hg = initGame( dev, -1, NULL );
+        CommonGlobals* cGlobals = &hg->cGlobals;
+        if ( game_makeFromInvite( &cGlobals->game, NULL_XWE, nli,
+                                  &cGlobals->selfAddr, cGlobals->util,
+                                  (DrawCtx*)NULL, &cGlobals->cp,
+                                  &cGlobals->procs ) ) {
+            ++dev->hs->stats.nInvites;
+            hg->lastUsed = g_get_monotonic_time();
+            linuxSaveGame( cGlobals ); /* assigns rowid, adds to games */
+            schedule( dev, cGlobals->rowid );
+        } else {
+            XP_LOGFF( "unable to make game from invite" );
+            disposeGame( hg );
+        }
+    } else {
+        XP_LOGFF( "Not accepting duplicate invitation (gameID=%X)",
+                  nli->gameID );
+    }
+}
+
+void
+hostMsgReceived( void* closure, const CommsAddrRec* from, XP_U32 gameID,
+                 const XP_U8* buf, XP_U16 len )
+{
+    HostDevice* dev = (HostDevice*)closure;
+    ++dev->hs->stats.nMsgsIn;
+
+    sqlite3_int64 rowids[4];
+    int nRows = VSIZE( rowids );
+    gdb_getRowsForGameID( dev->params->pDb, gameID, rowids, &nRows );
+    for ( int ii = 0; ii < nRows; ++ii ) {
+        HostGame* hg = getGame( dev, rowids[ii] );
+        if ( !!hg ) {
+            gameGotBuf( &hg->cGlobals, XP_FALSE, buf, len, from );
+            noteIfOver( hg );
+            /* The rest, including saving, happens at activation */
+            schedule( dev, rowids[ii] );
+        }
+    }
+    if ( 0 == nRows ) {
+        XP_LOGFF( "no game for gameID %X", gameID );
+    }
+}
+
+void
+hostGameGone( void* XP_UNUSED(closure), const CommsAddrRec* XP_UNUSED(from),
+              XP_U32 XP_UNUSED_DBG(gameID) )
+{
+    XP_LOGFF( "(gameID=%X)", gameID );
+}
+
+/* A new game's remote players are robots on the next device over, if
+   there's more than one, so hosted devices play each other. */
+static void
+inviteNext( HostGame* hg )
+{
+    HostState* hs = hg->dev->hs;
+    CommonGlobals* cGlobals = &hg->cGlobals;
+    XP_U16 nRemote = 0;
+    for ( int ii = 0; ii < cGlobals->gi->nPlayers; ++ii ) {
+        if ( !cGlobals->gi->players[ii].isLocal ) {
+            ++nRemote;
+        }
+    }
+    if ( 1 < hs->nDevices && 0 < nRemote
+         && types_hasType( hs->params->conTypes, COMMS_CONN_MQTT ) ) {
+        int next = 0;
+        while ( hs->devices[next] != hg->dev ) {
+            ++next;
+        }
+        next = (next + 1) % hs->nDevices;
+
+        MQTTDevID devID;
+        dvc_getMQTTDevID( hs->devices[next]->params->dutil, NULL_XWE, &devID );
+        CommsAddrRec selfAddr;
+        comms_getSelfAddr( cGlobals->game.comms, &selfAddr );
+        NetLaunchInfo nli;
+        nli_init( &nli, cGlobals->gi, &selfAddr, nRemote, 1 );
+        nli.remotesAreRobots = XP_TRUE;
+        mqttc_invite( hg->dev->params, &nli, &devID );
+    }
+}
+
+static void
+makeNewGames( HostDevice* dev, int count )
+{
+    for ( int ii = 0; ii < count; ++ii ) {
+        HostGame* hg = openGame( dev, -1, NULL );
+        if ( !!hg ) {
+            inviteNext( hg );
+            schedule( dev, hg->cGlobals.rowid );
+        }
+    }
+}
+
+static void
+closeAll( HostDevice* dev )
+{
+    GList* games = g_hash_table_get_values( dev->games );
+    closeGames( dev, games );
+    g_list_free( games );
+}
+
+/* The first device is the process's own; each other one gets a copy of its
+   params with a dutil and DB of its own, so its own devID. Only the first
+   does SMS: there's just the one phone number. */
+static HostDevice*
+makeDevice( HostState* hs, int index )
+{
+    HostDevice* dev = g_malloc0( sizeof(*dev) );
+    dev->hs = hs;
+    if ( 0 == index ) {
+        dev->params = hs->params;
+    } else {
+        LaunchParams* params = dev->params = &dev->ownParams;
+        *params = *hs->params;
+        types_rmType( &params->conTypes, COMMS_CONN_SMS );
+        gchar* dbName = g_strdup_printf( "%s.dev%d", hs->params->dbName,
+                                         index );
+        params->pDb = gdb_open( dbName );
+        g_free( dbName );
+        gdb_setFlushInterval( params->pDb, params->dbFlushMS );
+        params->dutil = linux_dutils_init( MPPARM(params->mpool)
+                                           params->vtMgr, params );
+        dvc_init( params->dutil, NULL_XWE );
+    }
+    dev->params->appGlobals = dev;
+
+    dev->games = g_hash_table_new( g_int64_hash, g_int64_equal );
+    dev->queued = g_hash_table_new_full( g_int64_hash, g_int64_equal,
+                                         g_free, NULL );
+    g_queue_init( &dev->runQ );
+    return dev;
+}
+
+static void
+freeDevice( HostDevice* dev )
+{
+    if ( 0 != dev->runSrc ) {
+        g_source_remove( dev->runSrc );
+    }
+    g_queue_clear( &dev->runQ );
+    g_hash_table_destroy( dev->queued );
+    g_hash_table_destroy( dev->games );
+
+    if ( dev->params == &dev->ownParams ) {
+        linux_dutils_free( &dev->params->dutil );
+        gdb_close( dev->params->pDb );
+    }
+    g_free( dev );
+}
+
+static void
+SIGINTTERM_handler( int XP_UNUSED(signal) )
+{
+    if ( 1 != write( g_host.quitpipe[1], "!", 1 ) ) {
+        XP_ASSERT(0);
+    }
+}
+
+static gboolean
+handle_quitwrite( GIOChannel* source, GIOCondition XP_UNUSED(condition),
+                  gpointer data )
+{
+    LOG_FUNC();
+    char ch;
+    if ( 1 != read( g_io_channel_unix_get_fd( source ), &ch, sizeof(ch) ) ) {
+        XP_ASSERT(0);
+    }
+    HostState* hs = (HostState*)data;
+    g_main_loop_quit( hs->loop );
+    return TRUE;
+}
+
+#ifdef XWFEATURE_SMS
+static void
+smsInviteReceivedHost( void* closure, const NetLaunchInfo* nli )
+{
+    hostInviteReceived( closure, nli );
+}
+
+static void
+smsMsgReceivedHost( void* closure, const CommsAddrRec* from, XP_U32 gameID,
+                    const XP_U8* buf, XP_U16 len )
+{
+    hostMsgReceived( closure, from, gameID, buf, len );
+}
+#endif
+
+void
+hostmain( LaunchParams* params )
+{
+    HostState* hs = &g_host;
+    XP_MEMSET( hs, 0, sizeof(*hs) );
+    hs->params = params;
+
+    hs->loop = g_main_loop_new( NULL, FALSE );
+    hs->nDevices = XP_MAX( 1, params->hostDevices );
+    hs->devices = g_new0( HostDevice*, hs->nDevices );
+    for ( int ii = 0; ii < hs->nDevices; ++ii ) {
+        hs->devices[ii] = makeDevice( hs, ii );
+        if ( 0 < ii ) {
+            mqttc_addDevice( params, hs->devices[ii]->params );
+        }
+    }
+
+# ifdef DEBUG
+    int piperesult =
+# endif
+        pipe( hs->quitpipe );
+    XP_ASSERT( piperesult == 0 );
+    ADD_SOCKET( hs, hs->quitpipe[0], handle_quitwrite );
+
+    struct sigaction act = { .sa_handler = SIGINTTERM_handler };
+    sigaction( SIGINT, &act, NULL );
+    sigaction( SIGTERM, &act, NULL );
+
+    mqttc_init( params );
+
+#ifdef XWFEATURE_SMS
+    gchar* myPhone = NULL;
+    XP_U16 myPort = 0;
+    if ( parseSMSParams( params, &myPhone, &myPort ) ) {
+        SMSProcs smsProcs = {
+            .inviteReceived = smsInviteReceivedHost,
+            .msgReceived = smsMsgReceivedHost,
+        };
+        linux_sms_init( params, myPhone, myPort, &smsProcs, hs->devices[0] );
+    }
+#endif
+
+    hs->startUS = hs->lastStatsUS = g_get_monotonic_time();
+    for ( int ii = 0; ii < hs->nDevices; ++ii ) {
+        makeNewGames( hs->devices[ii], params->hostNewGames );
+    }
+    sweepProc( hs );
+    hs->sweepSrc = g_timeout_add_seconds( HOST_SWEEP_SECS, sweepProc, hs );
+    if ( 0 < params->hostStatsSecs ) {
+        hs->statsSrc = g_timeout_add_seconds( params->hostStatsSecs,
+                                              statsProc, hs );
+    }
+
+    g_main_loop_run( hs->loop );
+
+    g_source_remove( hs->sweepSrc );
+    if ( 0 != hs->statsSrc ) {
+        g_source_remove( hs->statsSrc );
+    }
+
+    for ( int ii = 0; ii < hs->nDevices; ++ii ) {
+        closeAll( hs->devices[ii] );
+    }
+    const HostStats zeros = {};
+    printStats( hs, "host total", &hs->stats, &zeros,
+                g_get_monotonic_time() - hs->startUS );
+
+    for ( int ii = 0; ii < hs->nDevices; ++ii ) {
+        dvc_store( hs->devices[ii]->params->dutil, NULL_XWE );
+    }
+    linux_sms_cleanup( params );
+    mqttc_cleanup( params );
+
+    for ( int ii = 0; ii < hs->nDevices; ++ii ) {
+        freeDevice( hs->devices[ii] );
+    }
+    g_free( hs->devices );
+    g_main_loop_unref( hs->loop );
+} /* hostmain */
@@ -0,0 +1,46 @@
+/*
+ * Copyright 2025 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef _HOSTMAIN_H_
+#define _HOSTMAIN_H_
+
+#include "main.h"
+#include "nli.h"
+
+/* Headless front end: no UI, any number of games in the DB. A game is
+ * opened when there's something for it to do (a message arrived, it's a
+ * local robot's turn, it has unacked messages, its duplicate-mode timer's
+ * due) and closed again once it's been idle a while and more than
+ * --host-max-open are open. Everything runs on the glib main loop.
+ *
+ * With --host-devices N it's N devices, each with its own dutil, devID and
+ * DB, sharing one MQTT connection that hands each what's addressed to it.
+ * A new game's remote players are invited from the next device over.
+ */
+void hostmain( LaunchParams* params );
+
+/* Util UI callbacks for a game nobody's watching: they log, and decline
+   anything that needs an answer. Caller sets util->closure. */
+void setupHostUtilCallbacks( XW_UtilCtxt* util );
+
+void hostInviteReceived( void* closure, const NetLaunchInfo* nli );
+void hostMsgReceived( void* closure, const CommsAddrRec* from,
+                      XP_U32 gameID, const XP_U8* buf, XP_U16 len );
+void hostGameGone( void* closure, const CommsAddrRec* from, XP_U32 gameID );
+
+#endif
@@ -35,6 +35,7 @@
 #include "linuxdict.h"
 #include "cursesmain.h"
 #include "gtkmain.h"
+#include "hostmain.h"
 #include "mqttcon.h"
 
 
@@ -149,7 +150,9 @@ linux_dutil_onInviteReceived( XW_DUtilCtxt* duc, XWEnv XP_UNUSED(xwe),
     XP_LOGFF( "sum: %s", sum );
     g_free( sum );
 
-    if ( params->useCurses ) {
+    if ( params->headless ) {
+        hostInviteReceived( params->appGlobals, nli );
+    } else if ( params->useCurses ) {
         inviteReceivedCurses( params->appGlobals, nli );
     } else {
         inviteReceivedGTK( params->appGlobals, nli );
@@ -165,7 +168,9 @@ linux_dutil_onMessageReceived( XW_DUtilCtxt* duc, XWEnv XP_UNUSED(xwe),
     XP_LOGFF( "(gameID=%X)", gameID );
     LaunchParams* params = (LaunchParams*)duc->closure;
 
-    if ( params->useCurses ) {
+    if ( params->headless ) {
+        hostMsgReceived( params->appGlobals, from, gameID, buf, len );
+    } else if ( params->useCurses ) {
         mqttMsgReceivedCurses( params->appGlobals, from, gameID, buf, len );
     } else {
         msgReceivedGTK( params->appGlobals, from, gameID, buf, len );
@@ -188,7 +193,9 @@ linux_dutil_onGameGoneReceived( XW_DUtilCtxt* duc, XWEnv XP_UNUSED(xwe),
                                 XP_U32 gameID, const CommsAddrRec* from )
 {
     LaunchParams* params = (LaunchParams*)duc->closure;
-    if ( params->useCurses ) {
+    if ( params->headless ) {
+        hostGameGone( params->appGlobals, from, gameID );
+    } else if ( params->useCurses ) {
         gameGoneCurses( params->appGlobals, from, gameID );
     } else {
         gameGoneGTK( params->appGlobals, from, gameID );
@@ -68,6 +68,8 @@
 # include "gtkboard.h"
 # include "gtkmain.h"
 #endif
+#include "hostmain.h"
+#include "selfplay.h"
 #include "model.h"
 #include "util.h"
 #include "strutils.h"
@@ -216,6 +218,83 @@ send_msgs_idle( gpointer data )
     return FALSE;
 }
 
+/* Time nIters round trips through game_saveToStream() and
+ * game_makeFromStream(), the loads going into a scratch game that's then
+ * disposed. Also time reading back just the header, as
+ * game_summaryFromStream() does.
+ */
+static void
+benchSaveLoad( CommonGlobals* cGlobals, int nIters )
+{
+    LaunchParams* params = cGlobals->params;
+    XP_U16 size = 0;
+    gint64 saveUS = 0;
+    gint64 loadUS = 0;
+    gint64 headerUS = 0;
+#ifdef MEM_DEBUG
+    MemPoolCtx* mpool = cGlobals->util->mpool;
+    XP_U32 saveAllocs = 0;
+    XP_U32 loadAllocs = 0;
+#endif
+
+    for ( int ii = 0; ii < nIters; ++ii ) {
+#ifdef MEM_DEBUG
+        XP_U32 allocs0 = mpool_getNAllocs( mpool );
+#endif
+        gint64 start = g_get_monotonic_time();
+        XWStreamCtxt* stream =
+            mem_stream_make_sized( MPPARM(cGlobals->util->mpool)
+                                   params->vtMgr, size, NULL, 0, NULL,
+                                   NULL_XWE );
+        game_saveToStream( &cGlobals->game, cGlobals->gi, stream,
+                           cGlobals->curSaveToken );
+        size = stream_getSize( stream );
+        gint64 saved = g_get_monotonic_time();
+#ifdef MEM_DEBUG
+        XP_U32 allocs1 = mpool_getNAllocs( mpool );
+#endif
+
+        XWGame game = {};
+        XP_Bool loaded =
+            game_makeFromStream( MPPARM(cGlobals->util->mpool) NULL_XWE,
+                                 stream, &game, cGlobals->gi,
+                                 cGlobals->util, NULL, &cGlobals->cp,
+                                 &cGlobals->procs );
+        gint64 done = g_get_monotonic_time();
+#ifdef MEM_DEBUG
+        saveAllocs += allocs1 - allocs0;
+        loadAllocs += mpool_getNAllocs( mpool ) - allocs1;
+#endif
+        (void)stream_setPos( stream, POS_READ, 0 );
+        CurGameInfo gi = {};
+        GameSummary summary;
+        (void)game_summaryFromStream( MPPARM(cGlobals->util->mpool) stream,
+                                      &gi, &summary );
+        gi_disposePlayerInfo( MPPARM(cGlobals->util->mpool) &gi );
+        headerUS += g_get_monotonic_time() - done;
+        stream_destroy( stream );
+        if ( !loaded ) {
+            XP_LOGFF( "load %d failed", ii );
+            break;
+        }
+        game_dispose( &game, NULL_XWE );
+
+        saveUS += saved - start;
+        loadUS += done - saved;
+    }
+
+    fprintf( stderr, "%s(): %d games of %d bytes: %.1f saves/sec, "
+             "%.1f loads/sec, %.1f header loads/sec\n", __func__, nIters,
+             size, (1000000.0 * nIters) / XP_MAX( saveUS, 1 ),
+             (1000000.0 * nIters) / XP_MAX( loadUS, 1 ),
+             (1000000.0 * nIters) / XP_MAX( headerUS, 1 ) );
+#ifdef MEM_DEBUG
+    fprintf( stderr, "%s(): %.1f allocations per save, %.1f per load\n",
+             __func__, (double)saveAllocs / XP_MAX( nIters, 1 ),
+             (double)loadAllocs / XP_MAX( nIters, 1 ) );
+#endif
+} /* benchSaveLoad */
+
 bool
 linuxOpenGame( CommonGlobals* cGlobals )
 {
@@ -292,6 +371,10 @@ linuxOpenGame( CommonGlobals* cGlobals )
         server_do( cGlobals->game.server, NULL_XWE );
         linuxSaveGame( cGlobals );   /* again, to include address etc. */
 
+        if ( 0 < params->benchSaveLoad ) {
+            benchSaveLoad( cGlobals, params->benchSaveLoad );
+        }
+
         (void)g_idle_add( send_msgs_idle, cGlobals );
     }
     LOG_RETURNF( "%s", boolToStr(opened) );
@@ -490,6 +573,13 @@ strFromStream( XWStreamCtxt* stream )
     return buf;
 } /* strFromStream */
 
+static void
+saveCommitted( void* closure, XP_U16 saveToken )
+{
+    CommonGlobals* cGlobals = (CommonGlobals*)closure;
+    game_saveSucceeded( &cGlobals->game, NULL_XWE, saveToken );
+}
+
 void
 linuxSaveGame( CommonGlobals* cGlobals )
 {
@@ -519,10 +609,13 @@ linuxSaveGame( CommonGlobals* cGlobals )
             cGlobals->lastStreamSize = stream_getSize( outStream );
             stream_destroy( outStream );
 
-            game_saveSucceeded( &cGlobals->game, NULL_XWE, cGlobals->curSaveToken );
-
             if ( !!pDb ) {
                 gdb_summarize( cGlobals );
+                /* Don't let comms ack what a crash could still lose */
+                gdb_onCommit( pDb, saveCommitted, cGlobals,
+                              cGlobals->curSaveToken );
+            } else {
+                saveCommitted( cGlobals, cGlobals->curSaveToken );
             }
             XP_LOGFF( "saved" );
         } else {
@@ -716,6 +809,12 @@ typedef enum {
     ,CMD_GAMESEED
     ,CMD_GAMEFILE
     ,CMD_DBFILE
+    ,CMD_DBFLUSH_MS
+    ,CMD_HEADLESS
+    ,CMD_HOST_DEVICES
+    ,CMD_HOST_MAX_OPEN
+    ,CMD_HOST_NEW_GAMES
+    ,CMD_HOST_STATS_SECS
     ,CMD_SAVEFAIL_PCT
 #ifdef USE_SQLITE
     ,CMD_GAMEDB_FILE
@@ -821,6 +920,9 @@ typedef enum {
 #endif
     ,CMD_ASKTIME
     ,CMD_SMSTEST
+    ,CMD_BENCH_SAVELOAD
+    ,CMD_SELFPLAY
+    ,CMD_SELFPLAY_JOBS
     ,CMD_REMATCH_ON_OVER
     ,CMD_STATUS_SOCKET_NAME
     ,CMD_CMDS_SOCKET_NAME
@@ -872,6 +974,21 @@ static CmdInfoRec CmdInfoRecs[] = {
     ,{ CMD_GAMESEED, true, "game-seed", "game seed (for relay play)" }
     ,{ CMD_GAMEFILE, true, "file", "file to save to/read from" }
     ,{ CMD_DBFILE, true, "db", "sqlite3 db to store game data" }
+    ,{ CMD_DBFLUSH_MS, true, "db-flush-ms",
+       "commit db writes in batches this many ms apart (default: 0, meaning "
+       "at next idle); a crash loses what's not yet committed" }
+    ,{ CMD_HEADLESS, false, "headless-host",
+       "no UI: run every game in the db as messages and turns require" }
+    ,{ CMD_HOST_DEVICES, true, "host-devices",
+       "headless: be this many devices, each with its own devID and db; all "
+       "but the first use <db>.devN (default: 1)" }
+    ,{ CMD_HOST_MAX_OPEN, true, "host-max-open",
+       "headless: close a device's idle games beyond this many (default: 64)" }
+    ,{ CMD_HOST_NEW_GAMES, true, "host-new-games",
+       "headless: create this many games per device from the game params at "
+       "startup" }
+    ,{ CMD_HOST_STATS_SECS, true, "host-stats-secs",
+       "headless: print throughput this often (default: 10; 0: only at exit)" }
     ,{ CMD_SAVEFAIL_PCT, true, "savefail-pct", "How often, at random, does save fail?" }
 #ifdef USE_SQLITE
     ,{ CMD_GAMEDB_FILE, true, "game-db-file",
@@ -989,6 +1106,12 @@ static CmdInfoRec CmdInfoRecs[] = {
        "Wait this many ms before cancelling dialog (default 500 ms; 0 means forever)" }
 #endif
     ,{ CMD_SMSTEST, false, "run-sms-test", "Run smsproto_runTests() on startup"}
+    ,{ CMD_BENCH_SAVELOAD, true, "bench-save-load",
+       "Save and reload each opened game this many times, logging games/sec" }
+    ,{ CMD_SELFPLAY, true, "selfplay",
+       "Play this many robot-only games (seeds from --seed up), report and exit" }
+    ,{ CMD_SELFPLAY_JOBS, true, "selfplay-jobs",
+       "Processes to spread --selfplay games over (default: one per core)" }
 
     ,{ CMD_REMATCH_ON_OVER, false, "rematch-when-done", "Rematch games if they end" }
     ,{ CMD_STATUS_SOCKET_NAME, true, "status-socket-name",
@@ -2893,6 +3016,9 @@ main( int argc, char** argv )
 #else  /* curses is the default if GTK isn't available */
     mainParams.useCurses = XP_TRUE;
 #endif
+    mainParams.hostDevices = 1;
+    mainParams.hostMaxOpen = 64;
+    mainParams.hostStatsSecs = 10;
 
     struct option* longopts = make_longopts();
 
@@ -3015,6 +3141,24 @@ main( int argc, char** argv )
         case CMD_DBFILE:
             mainParams.dbName = optarg;
             break;
+        case CMD_DBFLUSH_MS:
+            mainParams.dbFlushMS = atoi( optarg );
+            break;
+        case CMD_HEADLESS:
+            mainParams.headless = XP_TRUE;
+            break;
+        case CMD_HOST_DEVICES:
+            mainParams.hostDevices = atoi( optarg );
+            break;
+        case CMD_HOST_MAX_OPEN:
+            mainParams.hostMaxOpen = atoi( optarg );
+            break;
+        case CMD_HOST_NEW_GAMES:
+            mainParams.hostNewGames = atoi( optarg );
+            break;
+        case CMD_HOST_STATS_SECS:
+            mainParams.hostStatsSecs = atoi( optarg );
+            break;
         case CMD_SAVEFAIL_PCT:
             mainParams.saveFailPct = atoi( optarg );
             break;
@@ -3363,6 +3507,15 @@ main( int argc, char** argv )
         case CMD_SMSTEST:
             mainParams.runSMSTest = XP_TRUE;
             break;
+        case CMD_BENCH_SAVELOAD:
+            mainParams.benchSaveLoad = atoi( optarg );
+            break;
+        case CMD_SELFPLAY:
+            mainParams.selfPlayGames = atoi( optarg );
+            break;
+        case CMD_SELFPLAY_JOBS:
+            mainParams.selfPlayJobs = atoi( optarg );
+            break;
 
         case CMD_REMATCH_ON_OVER:
             mainParams.rematchOnDone = XP_TRUE;
@@ -3509,11 +3662,16 @@ main( int argc, char** argv )
 
         XP_ASSERT( !!mainParams.dbName );
         mainParams.pDb = gdb_open( mainParams.dbName );
+        gdb_setFlushInterval( mainParams.pDb, mainParams.dbFlushMS );
 
         dvc_init( mainParams.dutil, NULL_XWE );
         testPhonies( &mainParams );
         
-        if ( mainParams.useCurses ) {
+        if ( 0 < mainParams.selfPlayGames ) {
+            result = selfplay( &mainParams, seed ) ? 0 : 1;
+        } else if ( mainParams.headless ) {
+            hostmain( &mainParams );
+        } else if ( mainParams.useCurses ) {
             /* if ( mainParams.needsNewGame ) { */
             /*     /\* curses doesn't have newgame dialog *\/ */
             /*     usage( argv[0], "game params required for curses version, e.g. --name Eric --room MyRoom" */
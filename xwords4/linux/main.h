@@ -59,6 +59,7 @@ typedef struct _LaunchParams {
     char* dbName;
     char* localName;
     sqlite3* pDb;               /* null unless opened */
+    guint dbFlushMS;            /* batch db writes this long; 0: until idle */
     XP_U16 saveFailPct;
     XP_U16 smsSendFailPct;
     const XP_UCHAR* playerDictNames[MAX_NUM_PLAYERS];
@@ -114,11 +115,19 @@ typedef struct _LaunchParams {
     XP_Bool skipUserErrs;
 
     XP_Bool useCurses;
-    void* appGlobals;           /* cursesmain or gtkmain sets this */
+    XP_Bool headless;           /* no UI: hostmain runs instead */
+    XP_U16 hostDevices;         /* devices hostmain runs, each with a db */
+    XP_U16 hostMaxOpen;         /* games hostmain keeps open, per device */
+    XP_U16 hostNewGames;        /* create this many per device at startup */
+    XP_U16 hostStatsSecs;       /* hostmain reports this often; 0: at end */
+    void* appGlobals;           /* cursesmain, gtkmain or hostmain sets this */
 
     XP_Bool useUdp;
     XP_Bool useHTTP;
     XP_Bool runSMSTest;
+    int benchSaveLoad;          /* save+reload opened game this many times */
+    XP_U32 selfPlayGames;       /* play this many robot games, then exit */
+    XP_U16 selfPlayJobs;        /* in this many processes; 0: one per core */
     XP_Bool rematchOnDone;
     XP_Bool noHTTPAuto;
     bool forceNewGame;
@@ -27,12 +27,16 @@
 
 typedef struct _MQTTConStorage {
     LaunchParams* params;
-    struct mosquitto* mosq;
     MQTTDevID clientID;
     gchar clientIDStr[32];
+    /* Whose connection to use: this one's own, unless it's a device added
+       with mqttc_addDevice(). Only the connection's has the rest set. */
+    struct _MQTTConStorage* conn;
+    struct mosquitto* mosq;
     int msgPipe[2];
     XP_Bool connected;
     GSList* queue;
+    GHashTable* devices;        /* clientIDStr -> added device's storage */
 } MQTTConStorage;
 
 typedef struct _QElem {
@@ -200,6 +204,7 @@ getStorage( LaunchParams* params )
     MQTTConStorage* storage = (MQTTConStorage*)params->mqttConStorage;
     if ( NULL == storage ) {
         storage = XP_CALLOC( params->mpool, sizeof(*storage) );
+        storage->conn = storage;
         params->mqttConStorage = storage;
     }
     return storage;
@@ -242,19 +247,13 @@ onMessageReceived( struct mosquitto* XP_UNUSED_DBG(mosq), void *userdata,
 }
 
 static void
-connect_callback( struct mosquitto* mosq, void* userdata,
-                  int XP_UNUSED_DBG(connErr) )
+subscribe( struct mosquitto* mosq, XW_DUtilCtxt* dutil )
 {
-    XP_LOGFF( "(err=%s)", mosquitto_strerror(connErr) );
-    MQTTConStorage* storage = (MQTTConStorage*)userdata;
-    storage->connected = XP_TRUE;
-
     XP_UCHAR topicStorage[256];
     XP_UCHAR* topics[4];
     XP_U16 nTopics = VSIZE(topics);
     XP_U8 qos;
-    dvc_getMQTTSubTopics( storage->params->dutil, NULL_XWE,
-                          topicStorage, VSIZE(topicStorage),
+    dvc_getMQTTSubTopics( dutil, NULL_XWE, topicStorage, VSIZE(topicStorage),
                           &nTopics, topics, &qos );
     int mid;
     int err = mosquitto_subscribe_multiple( mosq, &mid, nTopics, topics,
@@ -262,6 +261,25 @@ connect_callback( struct mosquitto* mosq, void* userdata,
     XP_LOGFF( "mosquitto_subscribe(topics[0]=%s, etc) => %s, mid=%d", topics[0],
               mosquitto_strerror(err), mid );
     XP_USE(err);
+}
+
+static void
+connect_callback( struct mosquitto* mosq, void* userdata,
+                  int XP_UNUSED_DBG(connErr) )
+{
+    XP_LOGFF( "(err=%s)", mosquitto_strerror(connErr) );
+    MQTTConStorage* storage = (MQTTConStorage*)userdata;
+    storage->connected = XP_TRUE;
+
+    subscribe( mosq, storage->params->dutil );
+    if ( !!storage->devices ) {
+        GHashTableIter iter;
+        gpointer value;
+        g_hash_table_iter_init( &iter, storage->devices );
+        while ( g_hash_table_iter_next( &iter, NULL, &value ) ) {
+            subscribe( mosq, ((MQTTConStorage*)value)->params->dutil );
+        }
+    }
 
     tickleQueue( storage );
 } /* connect_callback */
@@ -300,14 +318,40 @@ log_callback( struct mosquitto *mosq, void *userdata, int level,
     /* XP_LOGFF( "msg: %s", str ); */
 }
 
+/* Every topic subscribed to has the devID it's for as its third part:
+   xw4/device/<devid>[/...] or xw4/msg/<devid>. */
+static XW_DUtilCtxt*
+dutilForTopic( const MQTTConStorage* storage, const XP_UCHAR* topic )
+{
+    XW_DUtilCtxt* result = storage->params->dutil;
+    if ( !!storage->devices ) {
+        const XP_UCHAR* devIDStr = strchr( topic, '/' );
+        if ( !!devIDStr ) {
+            devIDStr = strchr( devIDStr + 1, '/' );
+        }
+        if ( !!devIDStr ) {
+            gchar buf[VSIZE(storage->clientIDStr)];
+            XP_SNPRINTF( buf, VSIZE(buf), "%s", devIDStr + 1 );
+            gchar* end = strchr( buf, '/' );
+            if ( !!end ) {
+                *end = '\0';
+            }
+            const MQTTConStorage* device =
+                g_hash_table_lookup( storage->devices, buf );
+            if ( !!device ) {
+                result = device->params->dutil;
+            }
+        }
+    }
+    return result;
+}
+
 static gboolean
 handle_gotmsg( GIOChannel* source, GIOCondition XP_UNUSED(condition), gpointer data )
 {
     MQTTConStorage* storage = (MQTTConStorage*)data;
     // XP_LOGFF( "(len=%d)", message->payloadlen );
     LOG_FUNC();
-    XW_DUtilCtxt* dutil = storage->params->dutil;
-    sts_increment( dutil, NULL_XWE, STAT_MQTT_RCVD );
 
     int pipe = g_io_channel_unix_get_fd( source );
     XP_ASSERT( pipe == storage->msgPipe[0] );
@@ -326,6 +370,8 @@ handle_gotmsg( GIOChannel* source, GIOCondition XP_UNUSED(condition), gpointer d
         read( pipe, topicBuf, topicLen );
     XP_ASSERT( nRead == topicLen);
     XP_ASSERT( '\0' == topicBuf[topicLen-1] );
+    XW_DUtilCtxt* dutil = dutilForTopic( storage, (XP_UCHAR*)topicBuf );
+    sts_increment( dutil, NULL_XWE, STAT_MQTT_RCVD );
 
     short msgLen;
 #ifdef DEBUG
@@ -341,8 +387,7 @@ handle_gotmsg( GIOChannel* source, GIOCondition XP_UNUSED(condition), gpointer d
         read( pipe, msgBuf, msgLen );
     XP_ASSERT( nRead == msgLen );
 
-    dvc_parseMQTTPacket( storage->params->dutil, NULL_XWE,
-                         (XP_UCHAR*)topicBuf, msgBuf, msgLen );
+    dvc_parseMQTTPacket( dutil, NULL_XWE, (XP_UCHAR*)topicBuf, msgBuf, msgLen );
     LOG_RETURN_VOID();
     return TRUE;
 } /* handle_gotmsg */
@@ -351,8 +396,8 @@ void
 mqttc_init( LaunchParams* params )
 {
     if ( types_hasType( params->conTypes, COMMS_CONN_MQTT ) ) {
-        XP_ASSERT( !params->mqttConStorage );
         MQTTConStorage* storage = getStorage( params );
+        XP_ASSERT( !storage->mosq );
         storage->params = params;
 
         loadClientID( params, storage );
@@ -398,6 +443,27 @@ mqttc_init( LaunchParams* params )
     }
 }
 
+void
+mqttc_addDevice( LaunchParams* params, LaunchParams* devParams )
+{
+    if ( types_hasType( params->conTypes, COMMS_CONN_MQTT ) ) {
+        MQTTConStorage* storage = getStorage( params );
+        XP_ASSERT( !storage->mosq );
+        if ( !storage->devices ) {
+            storage->devices = g_hash_table_new( g_str_hash, g_str_equal );
+        }
+
+        devParams->mqttConStorage = NULL; /* in case it's a copy of params */
+        MQTTConStorage* device = getStorage( devParams );
+        device->params = devParams;
+        device->conn = storage;
+        loadClientID( devParams, device );
+        XP_ASSERT( !g_hash_table_contains( storage->devices,
+                                           device->clientIDStr ) );
+        g_hash_table_insert( storage->devices, device->clientIDStr, device );
+    }
+}
+
 void
 mqttc_cleanup( LaunchParams* params )
 {
@@ -410,6 +476,18 @@ mqttc_cleanup( LaunchParams* params )
     XP_LOGFF( "quitting with %d undelivered messages",
               g_slist_length(storage->queue) );
 
+    if ( !!storage->devices ) {
+        GHashTableIter iter;
+        gpointer value;
+        g_hash_table_iter_init( &iter, storage->devices );
+        while ( g_hash_table_iter_next( &iter, NULL, &value ) ) {
+            MQTTConStorage* device = (MQTTConStorage*)value;
+            device->params->mqttConStorage = NULL;
+            XP_FREEP( params->mpool, &device );
+        }
+        g_hash_table_destroy( storage->devices );
+    }
+
     XP_ASSERT( params->mqttConStorage == storage ); /* cheat */
     XP_FREEP( params->mpool, &storage );
     params->mqttConStorage = NULL;
@@ -435,7 +513,7 @@ msgAndTopicProc( void* closure, const XP_UCHAR* topic, const XP_U8* buf,
                  XP_U16 len, XP_U8 qos )
 {
     MQTTConStorage* storage = (MQTTConStorage*)closure;
-    (void)enqueue( storage, topic, buf, len, qos );
+    (void)enqueue( storage->conn, topic, buf, len, qos );
 }
 
 void
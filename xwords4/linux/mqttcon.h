@@ -26,6 +26,11 @@
 void mqttc_init( LaunchParams* params );
 void mqttc_cleanup( LaunchParams* params );
 
+/* Have params' connection serve another device too: subscribe to its
+   topics, hand what arrives on them to devParams->dutil, and send for it.
+   Call before mqttc_init(). mqttc_cleanup( params ) cleans up after it. */
+void mqttc_addDevice( LaunchParams* params, LaunchParams* devParams );
+
 const MQTTDevID* mqttc_getDevID( LaunchParams* params );
 const gchar* mqttc_getDevIDStr( LaunchParams* params );
 void mqttc_invite( LaunchParams* params, const NetLaunchInfo* nli,
@@ -0,0 +1,333 @@
+/*
+ * Copyright 2025 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "selfplay.h"
+#include "hostmain.h"
+#include "linuxmain.h"
+#include "game.h"
+#include "server.h"
+#include "model.h"
+#include "dbgutil.h"
+
+#define SELFPLAY_MAX_STALLS 8   /* server_do() calls without a move */
+#define SELFPLAY_MAX_DOS 10000  /* give up on a game after this many */
+
+/* What a child reports for each game, followed by nTurns XP_U32 turn
+   latencies in microseconds */
+typedef struct _GameResult {
+    XP_U32 index;
+    XP_S16 scores[MAX_NUM_PLAYERS];
+    XP_U16 nMoves;              /* entries in the move history */
+    XP_U16 nTurns;              /* server_do() calls that added to it */
+    XP_U32 stackHash;           /* model_getHash(): covers every move */
+    XP_Bool finished;
+    gint64 elapsedUS;
+} GameResult;
+
+static void
+dropIdle( CommonGlobals* cGlobals )
+{
+    /* Nothing runs the main loop here; we call server_do() ourselves */
+    if ( 0 != cGlobals->idleID ) {
+        g_source_remove( cGlobals->idleID );
+        cGlobals->idleID = 0;
+    }
+}
+
+static void
+playOne( LaunchParams* params, XP_U32 index, XP_U32 seed, GameResult* result,
+         GArray* latencies )
+{
+    srandom( seed );
+
+    CommonGlobals cGlobals = {};
+    cGlobals.params = params;
+    cGlobals.rowid = -1;
+    cGlobals.gi = &cGlobals._gi;
+    gi_copy( MPPARM(params->mpool) cGlobals.gi, &params->pgi );
+    cGlobals.gi->serverRole = SERVER_STANDALONE;
+    cGlobals.gi->gameID = game_makeGameID( seed );
+    setupUtil( &cGlobals );
+    cGlobals.util->closure = &cGlobals;
+    setupHostUtilCallbacks( cGlobals.util );
+
+    XP_MEMSET( result, 0, sizeof(*result) );
+    result->index = index;
+
+    gint64 start = g_get_monotonic_time();
+    if ( game_makeNewGame( MPPARM(cGlobals.util->mpool) NULL_XWE,
+                           &cGlobals.game, cGlobals.gi, &cGlobals.selfAddr,
+                           NULL, cGlobals.util, NULL, &cGlobals.cp,
+                           &cGlobals.procs ) ) {
+        ServerCtxt* server = cGlobals.game.server;
+        ModelCtxt* model = cGlobals.game.model;
+        int nStalls = 0;
+        for ( int ii = 0; ii < SELFPLAY_MAX_DOS && nStalls < SELFPLAY_MAX_STALLS
+                  && !server_getGameIsOver( server ); ++ii ) {
+            XP_S16 nBefore = model_getNMoves( model );
+            gint64 before = g_get_monotonic_time();
+            (void)server_do( server, NULL_XWE );
+            XP_U32 tookUS = g_get_monotonic_time() - before;
+            dropIdle( &cGlobals );
+
+            if ( model_getNMoves( model ) == nBefore ) {
+                ++nStalls;
+            } else {
+                nStalls = 0;
+                g_array_append_val( latencies, tookUS );
+                ++result->nTurns;
+            }
+        }
+
+        result->finished = server_getGameIsOver( server );
+        result->nMoves = model_getNMoves( model );
+        result->stackHash = model_getHash( model );
+        ScoresArray scores;
+        model_getCurScores( model, &scores, result->finished );
+        for ( int ii = 0; ii < cGlobals.gi->nPlayers; ++ii ) {
+            result->scores[ii] = scores.arr[ii];
+        }
+    }
+    result->elapsedUS = g_get_monotonic_time() - start;
+    XP_LOGFF( "game %u (seed %u): finished: %s after %d moves",
+              index, seed, boolToStr(result->finished), result->nMoves );
+
+    cancelTimers( &cGlobals );
+    game_dispose( &cGlobals.game, NULL_XWE );
+    gi_disposePlayerInfo( MPPARM(cGlobals.util->mpool) cGlobals.gi );
+    disposeUtil( &cGlobals );
+} /* playOne */
+
+/* Runs in the child: play every nJobs-th game, starting with job */
+static void
+runJob( LaunchParams* params, XP_U32 seed, int job, int nJobs, FILE* out )
+{
+    GArray* latencies = g_array_new( FALSE, FALSE, sizeof(XP_U32) );
+    for ( XP_U32 index = job; index < params->selfPlayGames; index += nJobs ) {
+        GameResult result;
+        g_array_set_size( latencies, 0 );
+        playOne( params, index, seed + index, &result, latencies );
+        fwrite( &result, sizeof(result), 1, out );
+        fwrite( latencies->data, sizeof(XP_U32), latencies->len, out );
+    }
+    g_array_free( latencies, TRUE );
+}
+
+static gint
+cmpU32( gconstpointer aa, gconstpointer bb )
+{
+    XP_U32 one = *(const XP_U32*)aa;
+    XP_U32 two = *(const XP_U32*)bb;
+    return one < two ? -1 : one > two ? 1 : 0;
+}
+
+static double
+percentileMS( const GArray* sorted, int pct )
+{
+    double result = 0.0;
+    if ( 0 < sorted->len ) {
+        guint index = (sorted->len - 1) * pct / 100;
+        result = g_array_index( sorted, XP_U32, index ) / 1000.0;
+    }
+    return result;
+}
+
+/* FNV-1a, over everything that should come out the same if the engine
+   plays the same moves */
+static XP_U32
+hashIn( XP_U32 hash, const void* ptr, size_t len )
+{
+    const XP_U8* bytes = (const XP_U8*)ptr;
+    for ( size_t ii = 0; ii < len; ++ii ) {
+        hash ^= bytes[ii];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+static void
+report( const LaunchParams* params, XP_U32 seed, int nJobs,
+        const GameResult* results, GArray* latencies, gint64 wallUS )
+{
+    const CurGameInfo* gi = &params->pgi;
+    XP_U32 nGames = params->selfPlayGames;
+    XP_U32 nFinished = 0;
+    gint64 cpuUS = 0;
+    double totals[MAX_NUM_PLAYERS] = {};
+    double wins[MAX_NUM_PLAYERS] = {};
+    XP_U32 digest = 2166136261;
+
+    for ( XP_U32 ii = 0; ii < nGames; ++ii ) {
+        const GameResult* result = &results[ii];
+        cpuUS += result->elapsedUS;
+        digest = hashIn( digest, &result->finished, sizeof(result->finished) );
+        digest = hashIn( digest, &result->nMoves, sizeof(result->nMoves) );
+        digest = hashIn( digest, &result->stackHash,
+                         sizeof(result->stackHash) );
+        digest = hashIn( digest, result->scores,
+                         gi->nPlayers * sizeof(result->scores[0]) );
+        if ( !result->finished ) {
+            continue;
+        }
+        ++nFinished;
+
+        XP_S16 best = result->scores[0];
+        int nBest = 0;
+        for ( int jj = 0; jj < gi->nPlayers; ++jj ) {
+            totals[jj] += result->scores[jj];
+            if ( result->scores[jj] > best ) {
+                best = result->scores[jj];
+                nBest = 1;
+            } else if ( result->scores[jj] == best ) {
+                ++nBest;
+            }
+        }
+        /* Ties split the win */
+        for ( int jj = 0; jj < gi->nPlayers; ++jj ) {
+            if ( result->scores[jj] == best ) {
+                wins[jj] += 1.0 / nBest;
+            }
+        }
+    }
+
+    g_array_sort( latencies, cmpU32 );
+    XP_U32 nTurns = latencies->len;
+    double sumMS = 0.0;
+    for ( guint ii = 0; ii < nTurns; ++ii ) {
+        sumMS += g_array_index( latencies, XP_U32, ii ) / 1000.0;
+    }
+
+    double wallSecs = XP_MAX( 1, wallUS ) / (double)G_USEC_PER_SEC;
+    double cpuSecs = XP_MAX( 1, cpuUS ) / (double)G_USEC_PER_SEC;
+    fprintf( stderr, "%s(): %u games (%u finished) in %.2f secs using %d "
+             "processes; seeds %u..%u\n", __func__, nGames, nFinished,
+             wallSecs, nJobs, seed, seed + nGames - 1 );
+    fprintf( stderr, "%s(): %u robot turns: %.1f moves/sec, %.1f per process\n",
+             __func__, nTurns, nTurns / wallSecs, nTurns / cpuSecs );
+    fprintf( stderr, "%s(): turn latency (ms): mean %.2f, p50 %.2f, p90 %.2f, "
+             "p99 %.2f, max %.2f\n", __func__,
+             0 == nTurns ? 0.0 : sumMS / nTurns,
+             percentileMS( latencies, 50 ), percentileMS( latencies, 90 ),
+             percentileMS( latencies, 99 ), percentileMS( latencies, 100 ) );
+    for ( int ii = 0; ii < gi->nPlayers; ++ii ) {
+        const LocalPlayer* lp = &gi->players[ii];
+        fprintf( stderr, "%s(): player %d (%s, iq %d): avg score %.1f, "
+                 "won %.1f%%\n", __func__, ii, lp->name, lp->robotIQ,
+                 0 == nFinished ? 0.0 : totals[ii] / nFinished,
+                 0 == nFinished ? 0.0 : 100.0 * wins[ii] / nFinished );
+    }
+    fprintf( stderr, "%s(): outcomes digest: %08X\n", __func__, digest );
+} /* report */
+
+static XP_Bool
+canSelfPlay( const CurGameInfo* gi )
+{
+    XP_Bool result = 0 < gi->nPlayers;
+    for ( int ii = 0; result && ii < gi->nPlayers; ++ii ) {
+        const LocalPlayer* lp = &gi->players[ii];
+        result = LP_IS_LOCAL(lp) && LP_IS_ROBOT(lp);
+    }
+    return result;
+}
+
+XP_Bool
+selfplay( LaunchParams* params, XP_U32 seed )
+{
+    XP_Bool success = canSelfPlay( &params->pgi );
+    if ( !success ) {
+        fprintf( stderr, "%s(): every player must be a local robot "
+                 "(use --robot)\n", __func__ );
+    } else {
+        XP_U32 nGames = params->selfPlayGames;
+        int nJobs = params->selfPlayJobs;
+        if ( 0 == nJobs ) {
+            nJobs = sysconf( _SC_NPROCESSORS_ONLN );
+        }
+        nJobs = XP_MAX( 1, XP_MIN( nJobs, nGames ) );
+
+        /* Processes rather than threads: the common code keeps per-process
+           state (random(), the dict cache, the mempool), and this way each
+           game gets its own random() seeded just for it. */
+        FILE* outs[nJobs];
+        pid_t pids[nJobs];
+        for ( int job = 0; job < nJobs; ++job ) {
+            outs[job] = tmpfile();
+            if ( !outs[job] ) {
+                nJobs = job;    /* so only these get closed */
+                success = XP_FALSE;
+                break;
+            }
+        }
+
+        gint64 start = g_get_monotonic_time();
+        fflush( NULL );
+        for ( int job = 0; success && job < nJobs; ++job ) {
+            pids[job] = fork();
+            if ( 0 == pids[job] ) {
+                runJob( params, seed, job, nJobs, outs[job] );
+                fclose( outs[job] );
+                _exit( 0 );     /* skip parent's atexit handlers, db etc. */
+            }
+        }
+
+        GameResult* results = g_malloc0( nGames * sizeof(*results) );
+        GArray* latencies = g_array_new( FALSE, FALSE, sizeof(XP_U32) );
+        for ( int job = 0; job < nJobs; ++job ) {
+            int status;
+            if ( !success ) {
+                /* Couldn't get started */
+            } else if ( pids[job] < 0
+                        || pids[job] != waitpid( pids[job], &status, 0 )
+                        || !WIFEXITED(status) || 0 != WEXITSTATUS(status) ) {
+                fprintf( stderr, "%s(): process %d failed\n", __func__, job );
+                success = XP_FALSE;
+            }
+
+            FILE* out = outs[job];
+            rewind( out );
+            GameResult result;
+            while ( 1 == fread( &result, sizeof(result), 1, out ) ) {
+                XP_ASSERT( result.index < nGames );
+                results[result.index] = result;
+                XP_U32 tooks[result.nTurns];
+                if ( result.nTurns != fread( tooks, sizeof(tooks[0]),
+                                             result.nTurns, out ) ) {
+                    XP_ASSERT(0);
+                    break;
+                }
+                g_array_append_vals( latencies, tooks, result.nTurns );
+            }
+            fclose( out );
+        }
+
+        if ( success ) {
+            report( params, seed, nJobs, results, latencies,
+                    g_get_monotonic_time() - start );
+        }
+
+        g_array_free( latencies, TRUE );
+        g_free( results );
+    }
+    return success;
+} /* selfplay */
@@ -0,0 +1,34 @@
+/*
+ * Copyright 2025 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef _SELFPLAY_H_
+#define _SELFPLAY_H_
+
+#include "main.h"
+
+/* Play params->selfPlayGames standalone robot-vs-robot games, set up from
+ * the command-line game params (players, dict, board size, duplicate
+ * mode), spread across params->selfPlayJobs forked processes. Game n is
+ * seeded with seed + n, so a run's outcomes don't depend on the number of
+ * processes and can be compared across builds. Reports throughput, robot
+ * turn latency, scores and win rates to stderr. Returns false if any game
+ * couldn't be played.
+ */
+XP_Bool selfplay( LaunchParams* params, XP_U32 seed );
+
+#endif
@@ -0,0 +1,53 @@
+/* -*-mode: C; fill-column: 78; c-basic-offset: 4; -*- */
+/* 
+ * Copyright 2018 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef _CAPFMT_H_
+#define _CAPFMT_H_
+
+/* Format of the packet capture files the relay writes (see capture.h) and
+ * replay reads.  Every integer is big-endian; addresses and ports are as
+ * they were on the wire.
+ *
+ * File header, CAP_FILE_HDR_LEN bytes:
+ *     magic     6  "XWRCAP"
+ *     version   2  CAP_VERSION
+ *     started   8  wall-clock seconds when capture began
+ *
+ * Then records, each CAP_REC_HDR_LEN bytes followed by the packet:
+ *     delta     4  microseconds since the previous record (or since the
+ *                  capture started), saturating
+ *     kind      1  CAP_KIND_UDP or CAP_KIND_TCP
+ *     flags     1  0
+ *     lport     2  relay port a TCP packet came in on; 0 for UDP
+ *     addr      4  sender's IPv4 address
+ *     port      2  sender's port
+ *     len       2  packet length
+ *
+ * A TCP packet is recorded without its two-byte length prefix.
+ */
+
+#define CAP_MAGIC "XWRCAP"
+#define CAP_VERSION 1
+#define CAP_FILE_HDR_LEN 16
+#define CAP_REC_HDR_LEN 16
+
+#define CAP_KIND_UDP 1
+#define CAP_KIND_TCP 2
+
+#endif
@@ -0,0 +1,234 @@
+/* -*-mode: C; fill-column: 78; c-basic-offset: 4; -*- */
+/* 
+ * Copyright 2018 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "capture.h"
+#include "metrics.h"
+#include "mlock.h"
+
+/* How far the writer may fall behind before packets are dropped */
+#define CAPTURE_MAX_PENDING (16 * 1024 * 1024)
+/* Wake the writer early once this much is waiting */
+#define CAPTURE_WRITE_AT (64 * 1024)
+
+static PacketCapture* s_instance = NULL;
+
+/* static */ PacketCapture*
+PacketCapture::Get()
+{
+    if ( NULL == s_instance ) {
+        s_instance = new PacketCapture();
+    }
+    return s_instance;
+}
+
+PacketCapture::PacketCapture()
+    : m_on(false)
+    , m_fd(-1)
+    , m_lastUsecs(0)
+    , m_nRecorded(0)
+    , m_nDropped(0)
+    , m_nWritten(0)
+{
+    pthread_mutex_init( &m_mutex, NULL );
+    pthread_cond_init( &m_cond, NULL );
+
+    pthread_t thread;
+    int result = pthread_create( &thread, NULL, thread_main, this );
+    assert( 0 == result );
+    pthread_detach( thread );
+}
+
+static void
+putInt( vector<uint8_t>& out, uint64_t val, int nBytes )
+{
+    for ( int ii = nBytes - 1; ii >= 0; --ii ) {
+        out.push_back( (uint8_t)(val >> (ii * 8)) );
+    }
+}
+
+bool
+PacketCapture::Start( const char* path, string& err )
+{
+    bool ok = false;
+    MutexLock ml( &m_mutex );
+    if ( m_on ) {
+        err = "already capturing to " + m_path;
+    } else if ( -1 != m_fd ) {
+        err = "still writing out " + m_path;
+    } else {
+        m_fd = open( path, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+        if ( -1 == m_fd ) {
+            err = strerror( errno );
+        } else {
+            m_path = path;
+            m_nRecorded = m_nDropped = 0;
+            m_nWritten = 0;
+
+            m_pending.clear();
+            m_pending.insert( m_pending.end(), CAP_MAGIC,
+                              CAP_MAGIC + strlen(CAP_MAGIC) );
+            putInt( m_pending, CAP_VERSION, 2 );
+            putInt( m_pending, time( NULL ), 8 );
+            assert( CAP_FILE_HDR_LEN == m_pending.size() );
+
+            m_lastUsecs = Metrics::NowUsecs();
+            m_on = ok = true;
+            pthread_cond_signal( &m_cond );
+            logf( XW_LOGINFO, "%s: capturing to %s", __func__, path );
+        }
+    }
+    return ok;
+}
+
+/* The writer closes the file once what's pending is out */
+void
+PacketCapture::Stop()
+{
+    MutexLock ml( &m_mutex );
+    if ( m_on ) {
+        m_on = false;
+        pthread_cond_signal( &m_cond );
+    }
+}
+
+void
+PacketCapture::Record( const AddrInfo* addr, const uint8_t* buf, int len )
+{
+    uint16_t lport = 0;
+    if ( addr->isTCP() ) {
+        struct sockaddr_in local;
+        socklen_t siz = sizeof(local);
+        if ( 0 == getsockname( addr->getSocket(), (struct sockaddr*)&local,
+                               &siz ) ) {
+            lport = ntohs( local.sin_port );
+        }
+    }
+    const struct sockaddr_in* sin = &addr->saddr()->u.addr_in;
+
+    MutexLock ml( &m_mutex );
+    if ( !m_on ) {
+        /* stopped since caller checked */
+    } else if ( m_pending.size() + CAP_REC_HDR_LEN + len > CAPTURE_MAX_PENDING ) {
+        ++m_nDropped;
+    } else {
+        uint64_t now = Metrics::NowUsecs();
+        uint64_t delta = now - m_lastUsecs;
+        if ( delta > 0xFFFFFFFF ) {
+            delta = 0xFFFFFFFF;
+        }
+        m_lastUsecs = now;
+
+        putInt( m_pending, delta, 4 );
+        m_pending.push_back( addr->isTCP() ? CAP_KIND_TCP : CAP_KIND_UDP );
+        m_pending.push_back( 0 );
+        putInt( m_pending, lport, 2 );
+        putInt( m_pending, ntohl( sin->sin_addr.s_addr ), 4 );
+        putInt( m_pending, ntohs( sin->sin_port ), 2 );
+        putInt( m_pending, len, 2 );
+        m_pending.insert( m_pending.end(), buf, buf + len );
+        ++m_nRecorded;
+
+        if ( CAPTURE_WRITE_AT <= m_pending.size() ) {
+            pthread_cond_signal( &m_cond );
+        }
+    }
+}
+
+/* static */ void*
+PacketCapture::thread_main( void* arg )
+{
+    blockSignals();
+    return ((PacketCapture*)arg)->threadProc();
+}
+
+void*
+PacketCapture::threadProc()
+{
+    vector<uint8_t> buf;
+    for ( ; ; ) {
+        int fd;
+        bool closeAfter;
+        {
+            MutexLock ml( &m_mutex );
+            if ( m_pending.size() < CAPTURE_WRITE_AT && m_on ) {
+                struct timespec ts;
+                clock_gettime( CLOCK_REALTIME, &ts );
+                ts.tv_sec += 1;
+                (void)pthread_cond_timedwait( &m_cond, &m_mutex, &ts );
+            } else if ( -1 == m_fd ) {
+                (void)pthread_cond_wait( &m_cond, &m_mutex );
+            }
+            buf.swap( m_pending );
+            fd = m_fd;
+            closeAfter = !m_on && -1 != m_fd;
+        }
+
+        size_t nDone = 0;
+        while ( -1 != fd && nDone < buf.size() ) {
+            ssize_t nWritten = write( fd, &buf[nDone], buf.size() - nDone );
+            if ( 0 <= nWritten ) {
+                nDone += nWritten;
+            } else if ( EINTR != errno ) {
+                logf( XW_LOGERROR, "%s: write failed: %s; stopping capture",
+                      __func__, strerror(errno) );
+                Stop();
+                closeAfter = true;
+                break;
+            }
+        }
+        __sync_fetch_and_add( &m_nWritten, nDone );
+        buf.clear();
+
+        if ( closeAfter ) {
+            MutexLock ml( &m_mutex );
+            assert( !m_on );
+            m_pending.clear();  /* unless the write failed, already empty */
+            close( m_fd );
+            m_fd = -1;
+            logf( XW_LOGINFO, "%s: closed %s: %d packets, %d dropped",
+                  __func__, m_path.c_str(), m_nRecorded, m_nDropped );
+        }
+    }
+    return NULL;
+}
+
+void
+PacketCapture::printStats( StrWPF& out )
+{
+    MutexLock ml( &m_mutex );
+    if ( m_on ) {
+        out.catf( "capturing to %s\n", m_path.c_str() );
+    } else if ( -1 != m_fd ) {
+        out.catf( "stopped; still writing %s\n", m_path.c_str() );
+    } else {
+        out.catf( "not capturing\n" );
+    }
+    if ( 0 < m_path.size() ) {
+        out.catf( "packets: %d; dropped: %d; bytes written: %lld; "
+                  "pending: %d\n", m_nRecorded, m_nDropped,
+                  (long long)m_nWritten, m_pending.size() );
+    }
+}
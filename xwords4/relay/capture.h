@@ -0,0 +1,76 @@
+/* -*-mode: C; fill-column: 78; c-basic-offset: 4; -*- */
+/* 
+ * Copyright 2018 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+#include "xwrelay_priv.h"
+#include "addrinfo.h"
+#include "strwpf.h"
+#include "capfmt.h"
+
+using namespace std;
+
+/* Opt-in capture of every inbound packet, UDP or TCP, with its sender and
+ * arrival time, for replay (see replay.cpp) against a test relay.  Packets
+ * are recorded as they're queued for the worker threads, so the capture
+ * has what those threads saw and in the order they got it.  Records are
+ * appended to an in-memory buffer that a background thread writes out; if
+ * the disk falls behind by more than CAPTURE_MAX_PENDING bytes, packets
+ * are dropped from the capture (not from the relay) and counted.
+ *
+ * Started at launch if CAPTURE_PATH is set, or from the ctrl port.
+ */
+
+class PacketCapture {
+ public:
+    static PacketCapture* Get();
+
+    bool Start( const char* path, string& err );
+    void Stop();
+    bool IsOn() const { return m_on; }
+    void Record( const AddrInfo* addr, const uint8_t* buf, int len );
+
+    /* called from ctrl port */
+    void printStats( StrWPF& out );
+
+ private:
+    PacketCapture();
+    static void* thread_main( void* arg );
+    void* threadProc();
+
+    volatile bool m_on;
+    pthread_mutex_t m_mutex;
+    pthread_cond_t m_cond;
+    vector<uint8_t> m_pending;
+    int m_fd;                   /* -1 when closed */
+    string m_path;
+    uint64_t m_lastUsecs;
+
+    /* stats */
+    int m_nRecorded;
+    int m_nDropped;
+    uint64_t m_nWritten;        /* bytes */
+};
+
+#endif
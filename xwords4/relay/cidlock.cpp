@@ -25,6 +25,7 @@
 #include "cidlock.h"
 #include "mlock.h"
 #include "strwpf.h"
+#include "shardmgr.h"
 
 // #define CIDLOCK_DEBUG
 
@@ -56,26 +57,34 @@ CidLock* CidLock::s_instance = NULL;
 
 CidLock::CidLock() : m_nextCID(0)
 {
-    pthread_mutex_init( &m_infos_mutex, NULL );
-    pthread_cond_init( &m_infos_condvar, NULL );
+    for ( int ii = 0; ii < CID_NSHARDS; ++ii ) {
+        pthread_mutex_init( &m_shards[ii].m_mutex, NULL );
+        pthread_cond_init( &m_shards[ii].m_condvar, NULL );
+    }
+    pthread_mutex_init( &m_nextCID_mutex, NULL );
 }
  
 CidLock::~CidLock()
 {
-    pthread_mutex_destroy( &m_infos_mutex );
+    for ( int ii = 0; ii < CID_NSHARDS; ++ii ) {
+        pthread_mutex_destroy( &m_shards[ii].m_mutex );
+        pthread_cond_destroy( &m_shards[ii].m_condvar );
+    }
+    pthread_mutex_destroy( &m_nextCID_mutex );
 }
 
 #ifdef CIDLOCK_DEBUG
-# define PRINT_CLAIMED() print_claimed(__func__)
+# define PRINT_CLAIMED(shard) print_claimed((shard), __func__)
 void 
-CidLock::print_claimed( const char* caller )
+CidLock::print_claimed( const Shard* shard, const char* caller )
 {
     int unclaimed = 0;
     StrWPF str;
     str.catf( "after %s: ", caller );
-    // Assume we have the mutex!!!!
+    // Assume we have the shard's mutex!!!!
     map< CookieID, CidInfo*>::const_iterator iter;
-    for ( iter = m_infos.begin(); iter != m_infos.end(); ++iter ) {
+    for ( iter = shard->m_infos.begin(); iter != shard->m_infos.end(); 
+          ++iter ) {
         CidInfo* info = iter->second;
         if ( 0 == info->GetOwner() ) {
             ++unclaimed;
@@ -87,7 +96,7 @@ CidLock::print_claimed( const char* caller )
     logf( XW_LOGINFO, "%s: claimed: %s", __func__, str.c_str() );
 }
 #else
-# define PRINT_CLAIMED()
+# define PRINT_CLAIMED(shard)
 #endif
 
 CidInfo* 
@@ -97,20 +106,24 @@ CidLock::Claim( const CookieID origCid )
 #ifdef CIDLOCK_DEBUG
     logf( XW_LOGINFO, "%s(%d)", __func__, origCid );
 #endif
+    if ( 0 == cid ) {
+        MutexLock ml( &m_nextCID_mutex );
+        do {
+            cid = ++m_nextCID;
+        } while ( 0 == cid || !ShardMgr::OwnsCid( cid ) );
+        logf( XW_LOGINFO, "%s: assigned cid: %d", __func__, cid );
+    }
+
     CidInfo* info = NULL;
     pthread_t self = pthread_self();
+    Shard* shard = &m_shards[CID_SHARD(cid)];
+    MutexLock ml( &shard->m_mutex, &shard->m_nContended );
+    ++shard->m_nClaims;
     for ( ; ; ) {
-        MutexLock ml( &m_infos_mutex );
-
-        if ( 0 == cid ) {
-            cid = ++m_nextCID;
-            logf( XW_LOGINFO, "%s: assigned cid: %d", __func__, cid );
-        }
-
-        map< CookieID, CidInfo*>::iterator iter = m_infos.find( cid );
-        if ( iter == m_infos.end() ) { // not there at all
+        map< CookieID, CidInfo*>::iterator iter = shard->m_infos.find( cid );
+        if ( iter == shard->m_infos.end() ) { // not there at all
             info = new CidInfo( cid );
-            m_infos.insert( pair<CookieID, CidInfo*>( cid, info ) );
+            shard->m_infos.insert( pair<CookieID, CidInfo*>( cid, info ) );
         } else {
             pthread_t owner = iter->second->GetOwner();
             if ( 0 == owner || self == owner ) {
@@ -120,14 +133,15 @@ CidLock::Claim( const CookieID origCid )
 
         if ( NULL != info ) {   // we're done
             info->SetOwner( self );
-            PRINT_CLAIMED();
+            PRINT_CLAIMED( shard );
             break;
         }
 
 #ifdef CIDLOCK_DEBUG
         logf( XW_LOGINFO, "%s(%d): waiting....", __func__, cid );
 #endif
-        pthread_cond_wait( &m_infos_condvar, &m_infos_mutex );
+        ++shard->m_nWaits;
+        pthread_cond_wait( &shard->m_condvar, &shard->m_mutex );
     }
 #ifdef CIDLOCK_DEBUG
     logf( XW_LOGINFO, "%s(%d): DONE", __func__, origCid );
@@ -142,35 +156,30 @@ CidLock::ClaimSocket( const AddrInfo* addr )
 #ifdef CIDLOCK_DEBUG
     logf( XW_LOGINFO, "%s(sock=%d)", __func__, addr->socket() );
 #endif
-    for ( ; ; ) {
-        MutexLock ml( &m_infos_mutex );
+    /* We don't know which game the socket belongs to, so look in every
+       shard.  As before, a match that's currently claimed isn't waited for:
+       we return NULL. */
+    for ( int ii = 0; NULL == info && ii < CID_NSHARDS; ++ii ) {
+        Shard* shard = &m_shards[ii];
+        MutexLock ml( &shard->m_mutex, &shard->m_nContended );
 
         map<CookieID, CidInfo*>::const_iterator iter;
-        for ( iter = m_infos.begin(); NULL == info && iter != m_infos.end(); 
-              ++iter ) {
+        for ( iter = shard->m_infos.begin(); 
+              NULL == info && iter != shard->m_infos.end(); ++iter ) {
             const vector<AddrInfo>& addrs = iter->second->GetAddrs();
             vector<AddrInfo>::const_iterator iter2;
             for ( iter2 = addrs.begin(); iter2 != addrs.end(); ++iter2 ) {
                 if ( iter2->equals(*addr) ) {
-                    assert( !info ); // I hit this -- twice!!!!
                     if ( 0 == iter->second->GetOwner() ) {
                         info = iter->second;
                         info->SetOwner( pthread_self() );
-                        PRINT_CLAIMED();
+                        ++shard->m_nClaims;
+                        PRINT_CLAIMED( shard );
                     }
-                    // break;
+                    break;
                 }
             }
         }
-
-        /* break if socket isn't here or if it's not claimed */
-        if ( iter == m_infos.end() || NULL != info ) {
-            break;
-        }
-#ifdef CIDLOCK_DEBUG
-        logf( XW_LOGINFO, "%s(sock=%d): waiting....", __func__, addr->socket() );
-#endif
-        pthread_cond_wait( &m_infos_condvar, &m_infos_mutex );
     }
 
 #ifdef CIDLOCK_DEBUG
@@ -187,9 +196,10 @@ CidLock::Relinquish( CidInfo* claim, bool drop )
     logf( XW_LOGINFO, "%s(%d,drop=%d)", __func__, cid, drop );
 #endif
 
-    MutexLock ml( &m_infos_mutex );
-    map< CookieID, CidInfo*>::iterator iter = m_infos.find( cid );
-    assert( iter != m_infos.end() );
+    Shard* shard = &m_shards[CID_SHARD(cid)];
+    MutexLock ml( &shard->m_mutex, &shard->m_nContended );
+    map< CookieID, CidInfo*>::iterator iter = shard->m_infos.find( cid );
+    assert( iter != shard->m_infos.end() );
     assert( iter->second == claim );
     assert( claim->GetOwner() == pthread_self() );
     if ( drop ) {
@@ -197,7 +207,7 @@ CidLock::Relinquish( CidInfo* claim, bool drop )
         logf( XW_LOGINFO, "%s: deleting %p (cid=%d)",
               __func__, claim, claim->GetCid() );
 #endif
-        m_infos.erase( iter );
+        shard->m_infos.erase( iter );
         claim->SetOwner( 0 );
         delete claim;
     } else {
@@ -207,9 +217,33 @@ CidLock::Relinquish( CidInfo* claim, bool drop )
         }
         claim->SetOwner( 0 );
     }
-    PRINT_CLAIMED();
-    pthread_cond_signal( &m_infos_condvar );
+    PRINT_CLAIMED( shard );
+    /* Waiters in this shard may want different cids, so wake them all */
+    pthread_cond_broadcast( &shard->m_condvar );
 #ifdef CIDLOCK_DEBUG
     logf( XW_LOGINFO, "%s(%d,drop=%d): DONE", __func__, cid, drop );
 #endif
 }
+
+void
+CidLock::printStats( StrWPF& out )
+{
+    int nInfos = 0, nClaims = 0, nContended = 0, nWaits = 0;
+    int maxInfos = 0;
+    for ( int ii = 0; ii < CID_NSHARDS; ++ii ) {
+        Shard* shard = &m_shards[ii];
+        MutexLock ml( &shard->m_mutex );
+        int count = shard->m_infos.size();
+        nInfos += count;
+        if ( maxInfos < count ) {
+            maxInfos = count;
+        }
+        nClaims += shard->m_nClaims;
+        nContended += shard->m_nContended;
+        nWaits += shard->m_nWaits;
+    }
+    out.catf( "cidlock: %d shards; %d cids (max %d in one shard)\n", 
+              CID_NSHARDS, nInfos, maxInfos );
+    out.catf( "  claims: %d; mutex contended: %d; waited on claim: %d\n", 
+              nClaims, nContended, nWaits );
+}
@@ -26,6 +26,7 @@
 #include <set>
 #include "xwrelay.h"
 #include "cref.h"
+#include "strwpf.h"
 
 using namespace std;
 
@@ -56,6 +57,12 @@ class CidInfo {
     vector<AddrInfo> m_addrs;
 };
 
+/* CIDs are spread across this many shards, each with its own mutex and
+   condvar, so threads working on different games don't wait on each other.
+   CRefMgr stripes its cookie map the same way. */
+#define CID_NSHARDS 32
+#define CID_SHARD(cid) ((cid) % CID_NSHARDS)
+
 class CidLock {
 
  public:
@@ -72,15 +79,30 @@ class CidLock {
     CidInfo* ClaimSocket( const AddrInfo* addr );
     void Relinquish( CidInfo* claim, bool drop );
 
+    /* called from ctrl port */
+    void printStats( StrWPF& out );
+
  private:
+    class Shard {
+    public:
+        Shard() : m_nClaims(0), m_nContended(0), m_nWaits(0) {}
+        map< CookieID, CidInfo* > m_infos;
+        pthread_mutex_t m_mutex;
+        pthread_cond_t m_condvar;
+
+        /* stats; protected by m_mutex */
+        int m_nClaims;
+        int m_nContended;       /* had to wait for m_mutex */
+        int m_nWaits;           /* had to wait for another thread's claim */
+    };
+
     static CidLock* s_instance;
 
     CidLock();
-    void print_claimed( const char* caller );
+    void print_claimed( const Shard* shard, const char* caller );
 
-    map< CookieID, CidInfo* > m_infos;
-    pthread_mutex_t m_infos_mutex;
-    pthread_cond_t m_infos_condvar;
+    Shard m_shards[CID_NSHARDS];
+    pthread_mutex_t m_nextCID_mutex;
     int m_nextCID;
 
 }; /* CidLock */
@@ -43,6 +43,8 @@
 #include "devmgr.h"
 #include "permid.h"
 #include "udpack.h"
+#include "shardmgr.h"
+#include "metrics.h"
 
 using namespace std;
 
@@ -95,6 +97,8 @@ CookieRef::ReInit( const char* cookie, const char* connName, CookieID cid,
     m_locking_thread = 0;
     m_starttime = uptime();
     m_in_handleEvents = false;
+    memset( m_unrecordedSent, 0, sizeof(m_unrecordedSent) );
+    m_allConnTimer = TIMER_ASIS;
     m_langCode = langCode;
     memset( &m_sockets, 0, sizeof(m_sockets) );
 
@@ -265,10 +269,25 @@ CookieRef::_Reconnect( int clientVersion, DevID* devID, HostID hid,
 void
 CookieRef::_HandleAck( HostID hostID )
 {
-    CRefEvent evt( XWE_GOTONEACK );
-    evt.u.ack.srcID = hostID;
-    m_eventQueue.push_back( evt );
-    handleEvents();
+    /* A device resends its ack until it hears from us, so a burst of them
+       is common.  Once one's been noted the rest change nothing. */
+    bool dup = false;
+    if ( hostID >= HOST_ID_SERVER && hostID <= MAX_DEVICES ) {
+        RWReadLock rrl( &m_socketsRWLock );
+        HostRec* hr = m_sockets[hostID-1];
+        dup = !!hr && !hr->m_ackPending;
+    }
+
+    if ( dup ) {
+        logf( XW_LOGINFO, "%s: dropping dup ack from hid %d", __func__,
+              hostID );
+        Metrics::Get()->Inc( MC_COALESCED_DUPACK );
+    } else {
+        CRefEvent evt( XWE_GOTONEACK );
+        evt.u.ack.srcID = hostID;
+        pushEvent( evt );
+        handleEvents();
+    }
 }
 
 void
@@ -605,7 +624,7 @@ CookieRef::pushHeartbeatEvent( HostID id, int sock )
     CRefEvent evt( XWE_HEARTRCVD );
     evt.u.heart.id = id;
     evt.u.heart.socket = sock;
-    m_eventQueue.push_back( evt );
+    pushEvent( evt );
 }
 
 void
@@ -660,6 +679,49 @@ CookieRef::pushGameDead( const AddrInfo* addr )
     m_eventQueue.push_back( evt );
 }
 
+/* Queue evt unless an event that would do the same thing is already
+ * waiting: more acks or heartbeats from a host, or more of the
+ * game-wide checks, that arrive while a pass is running.
+ */
+void
+CookieRef::pushEvent( const CRefEvent& evt )
+{
+    bool dup = false;
+    deque<CRefEvent>::const_iterator iter;
+    for ( iter = m_eventQueue.begin(); !dup && m_eventQueue.end() != iter;
+          ++iter ) {
+        if ( iter->type == evt.type ) {
+            switch ( evt.type ) {
+            case XWE_GOTONEACK:
+                dup = iter->u.ack.srcID == evt.u.ack.srcID;
+                break;
+#ifdef RELAY_HEARTBEAT
+            case XWE_HEARTRCVD:
+                dup = iter->u.heart.id == evt.u.heart.id;
+                break;
+#endif
+            case XWE_TRYTELL:
+                dup = iter->addr.equals( evt.addr );
+                break;
+            case XWE_ALLHERE:
+            case XWE_NOMOREMSGS:
+                dup = true;
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    if ( dup ) {
+        logf( XW_LOGVERBOSE0, "%s: %s already queued", __func__,
+              eventString(evt.type) );
+        Metrics::Get()->Inc( MC_COALESCED_EVENT );
+    } else {
+        m_eventQueue.push_back( evt );
+    }
+}
+
 void
 CookieRef::handleEvents()
 {
@@ -806,7 +868,7 @@ CookieRef::handleEvents()
                 //cancelAllConnectedTimer();
                 if ( 0 == DBMgr::Get()->CountStoredMessages( ConnName() ) ) {
                     CRefEvent evt( XWE_NOMOREMSGS );
-                    m_eventQueue.push_back( evt );
+                    pushEvent( evt );
                 }
                 break;
 
@@ -839,8 +901,39 @@ CookieRef::handleEvents()
         }
     }
     m_in_handleEvents = false;
+    flushDeferred();
 } /* handleEvents */
 
+void
+CookieRef::flushDeferred()
+{
+    assert( !m_in_handleEvents );
+
+    int nRecords = 0;
+    for ( int ii = 0; ii < MAX_DEVICES; ++ii ) {
+        if ( 0 != m_unrecordedSent[ii] ) {
+            ++nRecords;
+        }
+    }
+    if ( 0 < nRecords ) {
+        Metrics::Get()->Inc( MC_COALESCED_SENTREC, nRecords - 1 );
+        DBMgr::Get()->RecordSent( ConnName(), m_unrecordedSent );
+        memset( m_unrecordedSent, 0, sizeof(m_unrecordedSent) );
+    }
+
+    switch ( m_allConnTimer ) {
+    case TIMER_SET:
+        setAllConnectedTimer();
+        break;
+    case TIMER_CANCEL:
+        cancelAllConnectedTimer();
+        break;
+    case TIMER_ASIS:
+        break;
+    }
+    m_allConnTimer = TIMER_ASIS;
+}
+
 bool
 CookieRef::send_with_length( const AddrInfo* addr, HostID dest, 
                              const uint8_t* buf, int bufLen, bool cascade,
@@ -851,10 +944,15 @@ CookieRef::send_with_length( const AddrInfo* addr, HostID dest,
         if ( HOST_ID_NONE == dest ) {
             dest = HostForSocket(addr);
         }
-        if ( HOST_ID_NONE != dest ) {
-            DBMgr::Get()->RecordSent( ConnName(), dest, bufLen );
-        } else {
+        if ( HOST_ID_NONE == dest ) {
             logf( XW_LOGERROR, "%s: no hid for addr", __func__ );
+        } else if ( m_in_handleEvents ) {
+            if ( 0 != m_unrecordedSent[dest-1] ) {
+                Metrics::Get()->Inc( MC_COALESCED_SENTREC );
+            }
+            m_unrecordedSent[dest-1] += bufLen;
+        } else {
+            DBMgr::Get()->RecordSent( ConnName(), dest, bufLen );
         }
     } else {
         failed = true;
@@ -894,7 +992,7 @@ CookieRef::send_stored_messages( HostID dest, const AddrInfo* addr )
         DBMgr* dbmgr = DBMgr::Get();
         const char* cname = ConnName();
         vector<DBMgr::MsgInfo> msgs;
-        dbmgr->GetStoredMessages( cname, dest, msgs );
+        dbmgr->ClaimStoredMessages( cname, dest, msgs );
 
         vector<int> sentIDs;
         vector<DBMgr::MsgInfo>::const_iterator iter;
@@ -912,6 +1010,13 @@ CookieRef::send_stored_messages( HostID dest, const AddrInfo* addr )
             }
         }
         dbmgr->RemoveStoredMessages( sentIDs );
+
+        /* Claimed but not sent: let the next fetch have them */
+        vector<int> unsent;
+        for ( ; msgs.end() != iter; ++iter ) {
+            unsent.push_back( iter->msgID() );
+        }
+        dbmgr->ReleaseStoredMessages( unsent.data(), unsent.size() );
     }
 } /* send_stored_messages */
 
@@ -1037,7 +1142,7 @@ CookieRef::postCheckAllHere()
 {
     if ( DBMgr::Get()->AllDevsAckd( ConnName() ) ) {
         CRefEvent evt( XWE_ALLHERE );
-        m_eventQueue.push_back( evt );
+        pushEvent( evt );
     }
 }
 
@@ -1055,13 +1160,17 @@ void
 CookieRef::postTellHaveMsgs( const AddrInfo* addr )
 {
     CRefEvent evt( XWE_TRYTELL, addr );
-    m_eventQueue.push_back( evt );
+    pushEvent( evt );
     assert( m_in_handleEvents );
 }
 
 void
 CookieRef::setAllConnectedTimer()
 {
+    if ( m_in_handleEvents ) {
+        m_allConnTimer = TIMER_SET;
+        return;
+    }
     time_t inHowLong;
     if ( RelayConfigs::GetConfigs()->GetValueFor( "ALLCONN", &inHowLong ) ) {
         TimerMgr::GetTimerMgr()->SetTimer( inHowLong,
@@ -1101,12 +1210,16 @@ CookieRef::cancelAckTimer( HostID hid )
     assert( hid <= 4 );
     m_timers[hid-1].m_this = NULL;
     
-    // TimerMgr::GetTimerMgr()->ClearTimer( s_checkAck, this );
+    TimerMgr::GetTimerMgr()->ClearTimer( s_checkAck, &m_timers[hid-1] );
 }
 
 void
 CookieRef::cancelAllConnectedTimer()
 {
+    if ( m_in_handleEvents ) {
+        m_allConnTimer = TIMER_CANCEL;
+        return;
+    }
     TimerMgr::GetTimerMgr()->ClearTimer( s_checkAllConnected, this );
 }
 
@@ -1249,9 +1362,9 @@ CookieRef::forward_or_store( const CRefEvent* evt )
             DevIDRelay devid;
             AddrInfo::ClientToken token;
             if ( DBMgr::Get()->TokenFor( ConnName(), dest, &devid, &token ) ) {
-                const AddrInfo::AddrUnion* saddr = DevMgr::Get()->get( devid );
-                if ( !!saddr ) {
-                    AddrInfo addr( token, saddr );
+                AddrInfo::AddrUnion saddr;
+                if ( DevMgr::Get()->get( devid, &saddr ) ) {
+                    AddrInfo addr( token, &saddr );
                     postTellHaveMsgs( &addr );
                 }
             }
@@ -1387,7 +1500,12 @@ void
 CookieRef::assignConnName( void )
 {
     if ( '\0' == ConnName()[0] ) {
-        m_connName += /*CONNNAME_DELIM + */PermID::GetNextUniqueID();
+        /* Only use a name that'll be routed back to this relay */
+        string name;
+        do {
+            name = PermID::GetNextUniqueID();
+        } while ( !ShardMgr::OwnsGame( name.c_str() ) );
+        m_connName += /*CONNNAME_DELIM + */name;
 
         logf( XW_LOGINFO, "%s: assigning name: %s", __func__, ConnName() );
     } else {
@@ -230,7 +230,9 @@ class CookieRef {
     void pushRemoveSocketEvent( const AddrInfo* addr );
     void pushNotifyDisconEvent( const AddrInfo* addr, XWREASON why );
 
+    void pushEvent( const CRefEvent& evt );
     void handleEvents();
+    void flushDeferred();
 
     void sendResponse( const CRefEvent* evt, bool initial, 
                        const DevIDRelay* devID );
@@ -306,7 +308,12 @@ class CookieRef {
     AckTimer m_timers[4];
 
     pthread_t m_locking_thread;
-    bool m_in_handleEvents;     /* for debugging only */
+    bool m_in_handleEvents;
+
+    /* Work put off until the end of a handleEvents() pass so that a burst
+       of events costs one DB write and one timer reset */
+    int m_unrecordedSent[MAX_DEVICES]; /* bytes sent, by hid-1 */
+    enum { TIMER_ASIS, TIMER_SET, TIMER_CANCEL } m_allConnTimer;
     int m_delayMicros;
 }; /* CookieRef */
 
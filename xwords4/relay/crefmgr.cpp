@@ -57,13 +57,17 @@ CRefMgr::Get()
 
 CRefMgr::CRefMgr()
     : m_nRoomsFilled(0)
+    , m_nCrefs(0)
     , m_startTime(time(NULL))
 {
     /* should be using pthread_once() here */
     /* pthread_mutex_init( &m_SocketStuffMutex, NULL ); */
     pthread_mutex_init( &m_roomsFilledMutex, NULL );
     pthread_mutex_init( &m_freeList_mutex, NULL );
-    pthread_rwlock_init( &m_cookieMapRWLock, NULL );
+    pthread_mutex_init( &m_nCrefsMutex, NULL );
+    for ( int ii = 0; ii < CID_NSHARDS; ++ii ) {
+        pthread_rwlock_init( &m_shards[ii].m_rwlock, NULL );
+    }
     m_db = DBMgr::Get();
     m_cidlock = CidLock::GetInstance();
 }
@@ -76,7 +80,10 @@ CRefMgr::~CRefMgr()
     delete m_cidlock;
 
     pthread_mutex_destroy( &m_freeList_mutex );
-    pthread_rwlock_destroy( &m_cookieMapRWLock );
+    pthread_mutex_destroy( &m_nCrefsMutex );
+    for ( int ii = 0; ii < CID_NSHARDS; ++ii ) {
+        pthread_rwlock_destroy( &m_shards[ii].m_rwlock );
+    }
 
     s_instance = NULL;
 }
@@ -86,18 +93,21 @@ CRefMgr::CloseAll()
 {
     /* Get every cref instance, shut it down */
 
-    for ( ; ; ) {
-        CookieRef* cref = NULL;
-        {
-            RWWriteLock rwl( &m_cookieMapRWLock );
-            CookieMap::iterator iter = m_cookieMap.begin();
-            if ( iter == m_cookieMap.end() ) {
-                break;
-            }
-            cref = iter->second; 
+    for ( int ii = 0; ii < CID_NSHARDS; ++ii ) {
+        CookieShard* shard = &m_shards[ii];
+        for ( ; ; ) {
+            CookieRef* cref = NULL;
             {
-                SafeCref scr( cref->GetCid(), false ); /* cref */
-                scr.Shutdown();
+                RWWriteLock rwl( &shard->m_rwlock );
+                CookieMap::iterator iter = shard->m_map.begin();
+                if ( iter == shard->m_map.end() ) {
+                    break;
+                }
+                cref = iter->second; 
+                {
+                    SafeCref scr( cref->GetCid(), false ); /* cref */
+                    scr.Shutdown();
+                }
             }
         }
     }
@@ -120,7 +130,8 @@ CRefMgr::GetNumRoomsFilled( void )
 int 
 CRefMgr::GetSize( void )
 {
-    return m_cookieMap.size();
+    MutexLock ml( &m_nCrefsMutex );
+    return m_nCrefs;
 }
 
 void
@@ -148,31 +159,55 @@ CRefMgr::GetStats( CrefMgrInfo& mgrInfo )
     }
     mgrInfo.m_ports = m_ports.c_str();
 
-    RWReadLock rwl( &m_cookieMapRWLock );
-    mgrInfo.m_nCrefsCurrent = m_cookieMap.size();
-
-    CookieMap::iterator iter;
-    for ( iter = m_cookieMap.begin(); iter != m_cookieMap.end(); ++iter ) {
-        CookieRef* cref = iter->second;
-
-        CrefInfo info;
-        info.m_cookie = cref->Cookie();
-        info.m_connName = cref->ConnName();
-        info.m_cid = cref->GetCid();
-        info.m_curState = cref->CurState();
-        info.m_nPlayersSought = cref->GetPlayersSought();
-        info.m_nPlayersHere = cref->GetPlayersHere();
-        info.m_startTime = cref->GetStarttime();
-        info.m_langCode = cref->GetLangCode();
+    mgrInfo.m_nCrefsCurrent = 0;
+    for ( int ii = 0; ii < CID_NSHARDS; ++ii ) {
+        CookieShard* shard = &m_shards[ii];
+        RWReadLock rwl( &shard->m_rwlock, &shard->m_nContended );
+        mgrInfo.m_nCrefsCurrent += shard->m_map.size();
+
+        CookieMap::iterator iter;
+        for ( iter = shard->m_map.begin(); iter != shard->m_map.end(); 
+              ++iter ) {
+            CookieRef* cref = iter->second;
+
+            CrefInfo info;
+            info.m_cookie = cref->Cookie();
+            info.m_connName = cref->ConnName();
+            info.m_cid = cref->GetCid();
+            info.m_curState = cref->CurState();
+            info.m_nPlayersSought = cref->GetPlayersSought();
+            info.m_nPlayersHere = cref->GetPlayersHere();
+            info.m_startTime = cref->GetStarttime();
+            info.m_langCode = cref->GetLangCode();
         
-        SafeCref sc(cref->GetCid(), false );
-        sc.GetHostsConnected( &info.m_hostsIds, &info.m_hostSeeds, 
-                              &info.m_hostIps );
+            SafeCref sc(cref->GetCid(), false );
+            sc.GetHostsConnected( &info.m_hostsIds, &info.m_hostSeeds, 
+                                  &info.m_hostIps );
         
-        mgrInfo.m_crefInfo.push_back( info );
+            mgrInfo.m_crefInfo.push_back( info );
+        }
     }
 }
 
+void
+CRefMgr::printLockStats( StrWPF& out )
+{
+    int nContended = 0;
+    int maxSize = 0;
+    for ( int ii = 0; ii < CID_NSHARDS; ++ii ) {
+        CookieShard* shard = &m_shards[ii];
+        RWReadLock rwl( &shard->m_rwlock );
+        nContended += shard->m_nContended;
+        int size = shard->m_map.size();
+        if ( maxSize < size ) {
+            maxSize = size;
+        }
+    }
+    out.catf( "cookie map: %d shards; %d crefs (max %d in one shard)\n", 
+              CID_NSHARDS, GetSize(), maxSize );
+    out.catf( "  rwlock contended: %d\n", nContended );
+}
+
 CookieID
 CRefMgr::cookieIDForConnName( const char* connName )
 {
@@ -180,16 +215,19 @@ CRefMgr::cookieIDForConnName( const char* connName )
     /* for now, just walk the existing data structure and see if the thing's
        in use.  If it isn't, return a new id. */
 
-    RWReadLock rwl( &m_cookieMapRWLock );
+    for ( int ii = 0; 0 == cid && ii < CID_NSHARDS; ++ii ) {
+        CookieShard* shard = &m_shards[ii];
+        RWReadLock rwl( &shard->m_rwlock, &shard->m_nContended );
 
-    CookieMap::iterator iter = m_cookieMap.begin();
-    while ( iter != m_cookieMap.end() ) {
-        CookieRef* cref = iter->second;
-        if ( 0 == strcmp( cref->ConnName(), connName ) ) {
-            cid = iter->first;
-            break;
+        CookieMap::iterator iter = shard->m_map.begin();
+        while ( iter != shard->m_map.end() ) {
+            CookieRef* cref = iter->second;
+            if ( 0 == strcmp( cref->ConnName(), connName ) ) {
+                cid = iter->first;
+                break;
+            }
+            ++iter;
         }
-        ++iter;
     }
 
     return cid;
@@ -516,7 +554,8 @@ CRefMgr::AddNew( const char* cookie, const char* connName, CookieID cid,
 
     CookieRef* ref = getFromFreeList();
 
-    RWWriteLock rwl( &m_cookieMapRWLock );
+    CookieShard* shard = &m_shards[CID_SHARD(cid)];
+    RWWriteLock rwl( &shard->m_rwlock, &shard->m_nContended );
     logf( XW_LOGINFO, "making new cref: %d", cid );
     
     if ( !!ref ) {
@@ -529,13 +568,16 @@ CRefMgr::AddNew( const char* cookie, const char* connName, CookieID cid,
     ref->assignConnName();
 
     pair<CookieMap::iterator,bool> result =
-        m_cookieMap.insert( pair<CookieID, CookieRef*>(ref->GetCid(), ref ) );
+        shard->m_map.insert( pair<CookieID, CookieRef*>(ref->GetCid(), ref ) );
     assert( result.second );
+    assert( CID_SHARD(ref->GetCid()) == CID_SHARD(cid) );
     logf( XW_LOGINFO, "%s: paired cookie %s/connName %s with cid %d", __func__, 
           (cookie?cookie:"NULL"), connName, ref->GetCid() );
 
+    MutexLock ml( &m_nCrefsMutex );
+    ++m_nCrefs;
 #ifdef RELAY_HEARTBEAT
-    if ( m_cookieMap.size() == 1 ) {
+    if ( m_nCrefs == 1 ) {
         RelayConfigs* cfg = RelayConfigs::GetConfigs();
         int heartbeat;
         if ( cfg->GetValueFor( "HEARTBEAT", &heartbeat ) ) {
@@ -562,22 +604,19 @@ CRefMgr::Recycle_locked( CookieRef* cref )
 
     /* don't grab this lock until after releasing cref's lock; otherwise
        deadlock happens. */
-    RWWriteLock rwl( &m_cookieMapRWLock );
-
-    CookieMap::iterator iter = m_cookieMap.begin();
-    while ( iter != m_cookieMap.end() ) {
-        CookieRef* ref = iter->second;
-        if ( ref == cref ) {
-            logf( XW_LOGINFO, "%s: erasing cref cid %d", __func__, cid );
-            m_cookieMap.erase( iter );
-            break;
-        }
-        ++iter;
-    }
-    assert( iter != m_cookieMap.end() ); /* we found something */
+    CookieShard* shard = &m_shards[CID_SHARD(cid)];
+    RWWriteLock rwl( &shard->m_rwlock, &shard->m_nContended );
+
+    CookieMap::iterator iter = shard->m_map.find( cid );
+    assert( iter != shard->m_map.end() ); /* we found something */
+    assert( iter->second == cref );
+    logf( XW_LOGINFO, "%s: erasing cref cid %d", __func__, cid );
+    shard->m_map.erase( iter );
 
+    MutexLock ml( &m_nCrefsMutex );
+    --m_nCrefs;
 #ifdef RELAY_HEARTBEAT
-    if ( m_cookieMap.size() == 0 ) {
+    if ( m_nCrefs == 0 ) {
         TimerMgr::GetTimerMgr()->ClearTimer( heartbeatProc, this );
     }
 #endif
@@ -606,10 +645,11 @@ CRefMgr::checkHeartbeats( time_t now )
 {
     vector<CookieRef*> crefs;
 
-    {
-        RWReadLock rwl( &m_cookieMapRWLock );
-        CookieMap::iterator iter = m_cookieMap.begin();
-        while ( iter != m_cookieMap.end() ) {
+    for ( int ii = 0; ii < CID_NSHARDS; ++ii ) {
+        CookieShard* shard = &m_shards[ii];
+        RWReadLock rwl( &shard->m_rwlock, &shard->m_nContended );
+        CookieMap::iterator iter = shard->m_map.begin();
+        while ( iter != shard->m_map.end() ) {
             crefs.push_back(iter->second);
             ++iter;
         }
@@ -632,25 +672,49 @@ CRefMgr::uptime( void )
 /* static */ CookieMapIterator
 CRefMgr::GetCookieIterator()
 {
-    CookieMapIterator iter(&m_cookieMapRWLock);
+    CookieMapIterator iter( this );
     return iter;
 }
 
 
-CookieMapIterator::CookieMapIterator(pthread_rwlock_t* rwlock)
-    : m_rwl( rwlock )
-    ,_iter( CRefMgr::Get()->m_cookieMap.begin() )
+CookieMapIterator::CookieMapIterator( CRefMgr* mgr )
+    : m_mgr( mgr )
+    , m_shard( -1 )
+    , m_locked( false )
 {
 }
 
+CookieMapIterator::~CookieMapIterator()
+{
+    if ( m_locked ) {
+        pthread_rwlock_unlock( &m_mgr->m_shards[m_shard].m_rwlock );
+    }
+}
+
 CookieID
 CookieMapIterator::Next()
 {
     CookieID cid = 0;
-    if ( _iter != CRefMgr::Get()->m_cookieMap.end() ) {
-        CookieRef* cref = _iter->second;
-        cid = cref->GetCid();
-        ++_iter;
+    for ( ; ; ) {
+        if ( !m_locked ) {
+            if ( m_shard + 1 >= CID_NSHARDS ) {
+                break;
+            }
+            ++m_shard;
+            pthread_rwlock_rdlock( &m_mgr->m_shards[m_shard].m_rwlock );
+            m_locked = true;
+            _iter = m_mgr->m_shards[m_shard].m_map.begin();
+        }
+
+        CRefMgr::CookieShard* shard = &m_mgr->m_shards[m_shard];
+        if ( _iter != shard->m_map.end() ) {
+            CookieRef* cref = _iter->second;
+            cid = cref->GetCid();
+            ++_iter;
+            break;
+        }
+        pthread_rwlock_unlock( &shard->m_rwlock );
+        m_locked = false;
     }
     return cid;
 }
@@ -28,6 +28,7 @@
 #include "dbmgr.h"
 #include "mlock.h"
 #include "cidlock.h"
+#include "strwpf.h"
 
 typedef map<CookieID,CookieRef*> CookieMap;
 class CookieMapIterator;
@@ -101,9 +102,22 @@ class CRefMgr {
 
     void GetStats( CrefMgrInfo& info );
 
+    /* called from ctrl port */
+    void printLockStats( StrWPF& out );
+
  private:
     friend class SafeCref;
 
+    /* The cookie map is striped by cid the same way CidLock is, so
+       creating or recycling one game only write-locks its own shard. */
+    class CookieShard {
+    public:
+        CookieShard() : m_nContended(0) {}
+        pthread_rwlock_t m_rwlock;
+        CookieMap m_map;
+        int m_nContended;
+    };
+
     /* We'll recycle cref instances rather than free and new them.  This
        solves, inelegantly, a problem where I want to free an instance (while
        holding its mutex) but can't know if other threads are trying to obtain
@@ -151,8 +165,11 @@ class CRefMgr {
     pthread_mutex_t m_roomsFilledMutex;
     int m_nRoomsFilled;
 
-    pthread_rwlock_t m_cookieMapRWLock;
-    CookieMap m_cookieMap;
+    CookieShard m_shards[CID_NSHARDS];
+
+    /* guards the total count, which starts and stops the heartbeat timer */
+    pthread_mutex_t m_nCrefsMutex;
+    int m_nCrefs;
 
     time_t m_startTime;
     string m_ports;
@@ -406,13 +423,17 @@ class SafeCref {
 }; /* SafeCref class */
 
 
+/* Walks the shards in turn, read-locking each only while its cids are being
+   returned.  Nothing's locked until the first call to Next(). */
 class CookieMapIterator {
  public:
-    CookieMapIterator(pthread_rwlock_t* rwlock);
-    ~CookieMapIterator() {}
+    CookieMapIterator( CRefMgr* mgr );
+    ~CookieMapIterator();
     CookieID Next();
  private:
-    RWReadLock m_rwl;
+    CRefMgr* m_mgr;
+    int m_shard;
+    bool m_locked;
     CookieMap::const_iterator _iter;
 };
 
@@ -51,6 +51,11 @@
 #include "tpool.h"
 #include "devmgr.h"
 #include "udpack.h"
+#include "msgstore.h"
+#include "timermgr.h"
+#include "metrics.h"
+#include "shardmgr.h"
+#include "capture.h"
 #include "strwpf.h"
 
 /* this is *only* for testing.  Don't abuse!!!! */
@@ -72,6 +77,12 @@ static bool cmd_acks( int sock, const char* cmd, int argc, gchar** argv );
 static bool cmd_quit( int sock, const char* cmd, int argc, gchar** argv );
 static bool cmd_print( int sock, const char* cmd, int argc, gchar** argv );
 static bool cmd_devs( int sock, const char* cmd, int argc, gchar** argv );
+static bool cmd_msgs( int sock, const char* cmd, int argc, gchar** argv );
+static bool cmd_locks( int sock, const char* cmd, int argc, gchar** argv );
+static bool cmd_timers( int sock, const char* cmd, int argc, gchar** argv );
+static bool cmd_metrics( int sock, const char* cmd, int argc, gchar** argv );
+static bool cmd_shards( int sock, const char* cmd, int argc, gchar** argv );
+static bool cmd_capture( int sock, const char* cmd, int argc, gchar** argv );
 /* static bool cmd_lock( int sock, gchar** argv ); */
 static bool cmd_help( int sock, const char* cmd, int argc, gchar** argv );
 static bool cmd_start( int sock, const char* cmd, int argc, gchar** argv );
@@ -131,20 +142,26 @@ print_to_sock( int sock, bool addCR, const char* what, ... )
 static const FuncRec gFuncs[] = {
     { "?", cmd_help },
     { "acks", cmd_acks },
+    { "capture", cmd_capture },
     { "crash", cmd_crash },
     /* { "eject", cmd_kill_eject }, */
     { "get", cmd_get },
     { "help", cmd_help },
     /* { "kill", cmd_kill_eject }, */
     /* { "lock", cmd_lock }, */
+    { "locks", cmd_locks },
     { "print", cmd_print },
     { "devs", cmd_devs },
+    { "metrics", cmd_metrics },
+    { "msgs", cmd_msgs },
     { "quit", cmd_quit },
     { "rev", cmd_rev },
     { "set", cmd_set },
+    { "shards", cmd_shards },
     { "shutdown", cmd_shutdown },
     { "start", cmd_start },
     { "stop", cmd_stop },
+    { "timers", cmd_timers },
     { "uptime", cmd_uptime },
 };
 
@@ -697,6 +714,131 @@ cmd_devs( int sock, const char* cmd, int argc, gchar** argv )
     return false;
 }
 
+static bool
+cmd_msgs( int sock, const char* cmd, int argc, gchar** argv )
+{
+    if ( 1 == argc ) {
+        StrWPF result;
+        MsgStore* store = MsgStore::Get();
+        if ( NULL == store ) {
+            result.catf( "message store disabled; messages go to DB\n" );
+        } else {
+            store->printStats( result );
+        }
+        send( sock, result.c_str(), result.size(), 0 );
+    } else {
+        print_to_sock( sock, true,
+                       "* %s -- prints stats about in-memory stored messages",
+                       cmd );
+    }
+    return false;
+}
+
+static bool
+cmd_locks( int sock, const char* cmd, int argc, gchar** argv )
+{
+    if ( 1 == argc ) {
+        StrWPF result;
+        CidLock::GetInstance()->printStats( result );
+        CRefMgr::Get()->printLockStats( result );
+        send( sock, result.c_str(), result.size(), 0 );
+    } else {
+        print_to_sock( sock, true,
+                       "* %s -- prints cid and cookie map shard contention",
+                       cmd );
+    }
+    return false;
+}
+
+static bool
+cmd_metrics( int sock, const char* cmd, int argc, gchar** argv )
+{
+    if ( 1 == argc ) {
+        StrWPF result;
+        Metrics::Get()->Render( result );
+        send( sock, result.c_str(), result.size(), 0 );
+    } else {
+        print_to_sock( sock, true,
+                       "* %s -- prints what GET /metrics would (Prometheus "
+                       "text format)", cmd );
+    }
+    return false;
+}
+
+static bool
+cmd_shards( int sock, const char* cmd, int argc, gchar** argv )
+{
+    if ( 1 == argc ) {
+        StrWPF result;
+        ShardMgr* shards = ShardMgr::Get();
+        if ( NULL == shards ) {
+            result.catf( "not sharded (SHARD_NODES not set)\n" );
+        } else {
+            shards->printStats( result );
+        }
+        send( sock, result.c_str(), result.size(), 0 );
+    } else {
+        print_to_sock( sock, true,
+                       "* %s -- prints traffic to and from other relays",
+                       cmd );
+    }
+    return false;
+}
+
+static bool
+cmd_capture( int sock, const char* cmd, int argc, gchar** argv )
+{
+    bool found = true;
+    StrWPF result;
+    PacketCapture* capture = PacketCapture::Get();
+    if ( 1 == argc ) {
+        capture->printStats( result );
+    } else if ( 3 == argc && 0 == strcmp( "start", argv[1] ) ) {
+        string err;
+        if ( capture->Start( argv[2], err ) ) {
+            result.catf( "capturing to %s\n", argv[2] );
+        } else {
+            result.catf( "unable to capture: %s\n", err.c_str() );
+        }
+    } else if ( 2 == argc && 0 == strcmp( "stop", argv[1] ) ) {
+        capture->Stop();
+        capture->printStats( result );
+    } else {
+        found = false;
+    }
+
+    if ( found ) {
+        send( sock, result.c_str(), result.size(), 0 );
+    } else {
+        const char* strs[] = {
+            "* %s -- prints capture status\n"
+            ,"* %s start <path> -- record inbound packets to <path>\n"
+            ,"* %s stop\n"
+        };
+        StrWPF help;
+        for ( size_t ii = 0; ii < VSIZE(strs); ++ii ) {
+            help.catf( strs[ii], cmd );
+        }
+        send( sock, help.c_str(), help.size(), 0 );
+    }
+    return false;
+}
+
+static bool
+cmd_timers( int sock, const char* cmd, int argc, gchar** argv )
+{
+    if ( 1 == argc ) {
+        StrWPF result;
+        TimerMgr::GetTimerMgr()->printStats( result );
+        send( sock, result.c_str(), result.size(), 0 );
+    } else {
+        print_to_sock( sock, true,
+                       "* %s -- prints counts of pending and fired timers",
+                       cmd );
+    }
+    return false;
+}
+
 #if 0
 static bool
 cmd_lock( int sock, gchar** argv )
@@ -30,6 +30,10 @@
 #include <glib.h>
 
 #include "dbmgr.h"
+#include "msgstore.h"
+#include "metrics.h"
+#include "shardmgr.h"
+#include "permid.h"
 #include "strwpf.h"
 #include "mlock.h"
 #include "configs.h"
@@ -74,7 +78,40 @@ DBMgr::DBMgr()
 
     pthread_key_create( &m_conn_key, destr_function );
 
-    pthread_mutex_init( &m_haveNoMessagesMutex, NULL );
+    // Long enough for the ack to come back or time out; onMsgAcked()
+    // releases the claim early if it fails.
+    if ( !RelayConfigs::GetConfigs()->GetValueFor( "MSG_CLAIM_SECS",
+                                                   &m_claimSecs ) ) {
+        int ackLimit;
+        if ( !RelayConfigs::GetConfigs()->GetValueFor( "UDP_ACK_LIMIT",
+                                                       &ackLimit ) ) {
+            ackLimit = 60;
+        }
+        m_claimSecs = 2 * ackLimit;
+    }
+
+    int nSlots;
+    if ( !RelayConfigs::GetConfigs()->GetValueFor( "NOMSGS_SLOTS", &nSlots ) ) {
+        nSlots = 64 * 1024;
+    }
+    m_noMsgs = new NoMsgsCache( nSlots );
+
+    int maxGames, maxDevices, cacheSecs;
+    if ( !RelayConfigs::GetConfigs()->GetValueFor( "ROWCACHE_GAMES",
+                                                   &maxGames ) ) {
+        maxGames = 16 * 1024;
+    }
+    if ( !RelayConfigs::GetConfigs()->GetValueFor( "ROWCACHE_DEVICES",
+                                                   &maxDevices ) ) {
+        maxDevices = 64 * 1024;
+    }
+    if ( !RelayConfigs::GetConfigs()->GetValueFor( "ROWCACHE_SECS",
+                                                   &cacheSecs ) ) {
+        cacheSecs = 300;
+    }
+    m_games = new RowCache<GameRow>( maxGames, cacheSecs );
+    m_devices = new RowCache<DevIDRelay>( maxDevices, cacheSecs );
+    m_devKeys = new RowCache<string>( maxDevices, cacheSecs );
 
     srand( time( NULL ) );
 }
@@ -92,6 +129,7 @@ void
 DBMgr::AddNew( const char* cookie, const char* connName, CookieID cid, 
                int langCode, int nPlayersT, bool isPublic )
 {         
+    METRICS_DB_TIMER();
     if ( !cookie ) cookie = "";
     if ( !connName ) connName = "";
  
@@ -111,11 +149,25 @@ DBMgr::AddNew( const char* cookie, const char* connName, CookieID cid,
                                      qb.paramCount(), NULL,
                                      qb.paramValues(),
                                      NULL, NULL, 0 );
-    if ( PGRES_COMMAND_OK != PQresultStatus(result) ) {
+    bool ok = PGRES_COMMAND_OK == PQresultStatus(result);
+    if ( !ok ) {
         logf( XW_LOGERROR, "PQexec=>%s;%s", PQresStatus(PQresultStatus(result)), 
               PQresultErrorMessage(result) );
     }
     PQclear( result );
+
+    RowCache<GameRow>::Update upd( m_games, connName );
+    if ( ok ) {
+        GameRow row;
+        row.m_cid = cid;
+        row.m_cidNull = false;
+        row.m_room = cookie;
+        row.m_lang = langCode;
+        row.m_nTotal = nPlayersT;
+        upd.Set( row );
+    } else {
+        upd.Drop();
+    }
 }
 
 /* Grab the row for a connname.  If the params don't check out, return false.
@@ -126,27 +178,17 @@ DBMgr::FindGameFor( const char* connName, char* cookieBuf, int bufLen,
                     int nPlayersH, int nPlayersS,
                     int* langP, bool* isDead, CookieID* cidp )
 {
-    bool found = false;
-
-    const char* fmt = "SELECT cid, room, lang, dead FROM "
-        GAMES_TABLE " WHERE connName = '%s' AND nTotal = %d "
-        "AND %d = seeds[%d] AND 'A' = ack[%d] "
-        ;
-    StrWPF query;
-    query.catf( fmt, connName, nPlayersS, seed, hid, hid );
-    logf( XW_LOGINFO, "query: %s", query.c_str() );
-
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
-    assert( 1 >= PQntuples( result ) );
-    found = 1 == PQntuples( result );
+    GameRow row;
+    bool found = getGameRow( connName, &row )
+        && row.m_nTotal == nPlayersS
+        && row.m_seeds.Is( hid, seed )
+        && row.m_ack.Is( hid, 'A' );
     if ( found ) {
-        int col = 0;
-        *cidp = atoi( PQgetvalue( result, 0, col++ ) );
-        snprintf( cookieBuf, bufLen, "%s", PQgetvalue( result, 0, col++ ) );
-        *langP = atoi( PQgetvalue( result, 0, col++ ) );
-        *isDead = 't' == PQgetvalue( result, 0, col++ )[0];
+        *cidp = row.m_cid;
+        snprintf( cookieBuf, bufLen, "%s", row.m_room.c_str() );
+        *langP = row.m_lang;
+        *isDead = row.m_dead;
     }
-    PQclear( result );
 
     logf( XW_LOGINFO, "%s(%s)=>%d", __func__, connName, found );
     return found;
@@ -158,26 +200,15 @@ DBMgr::FindGame( const char* connName, HostID hid, char* roomBuf, int roomBufLen
 {
     CookieID cid = 0;
 
-    const char* fmt = "SELECT cid, room, lang, nTotal, nPerDevice[%d], dead FROM "
-        GAMES_TABLE " WHERE connName = '%s'"
-        // " LIMIT 1"
-        ;
-    StrWPF query;
-    query.catf( fmt, hid, connName );
-    logf( XW_LOGINFO, "query: %s", query.c_str() );
-
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
-    assert( 1 >= PQntuples( result ) );
-    if ( 1 == PQntuples( result ) ) {
-        int col = 0;
-        cid = atoi( PQgetvalue( result, 0, col++ ) );
-        snprintf( roomBuf, roomBufLen, "%s", PQgetvalue( result, 0, col++ ) );
-        *langP = atoi( PQgetvalue( result, 0, col++ ) );
-        *nPlayersTP = atoi( PQgetvalue( result, 0, col++ ) );
-        *nPlayersHP = atoi( PQgetvalue( result, 0, col++ ) );
-        *isDead = 't' == PQgetvalue( result, 0, col++ )[0];
+    GameRow row;
+    if ( getGameRow( connName, &row ) ) {
+        cid = row.m_cid;
+        snprintf( roomBuf, roomBufLen, "%s", row.m_room.c_str() );
+        *langP = row.m_lang;
+        *nPlayersTP = row.m_nTotal;
+        *nPlayersHP = row.m_nPerDevice.Get( hid );
+        *isDead = row.m_dead;
     }
-    PQclear( result );
 
     logf( XW_LOGINFO, "%s(%s)=>%d", __func__, connName, cid );
     return cid;
@@ -189,6 +220,7 @@ DBMgr::FindGame( const AddrInfo::ClientToken clientToken, HostID hid,
                  char* roomBuf, int roomBufLen,
                  int* langP, int* nPlayersTP, int* nPlayersHP )
 {
+    METRICS_DB_TIMER();
     CookieID cid = 0;
     const char* fmt = "SELECT cid, room, lang, nTotal, nPerDevice[%d], connname FROM "
         GAMES_TABLE " WHERE tokens[%d] = %d and NOT dead";
@@ -221,6 +253,7 @@ bool
 DBMgr::FindPlayer( DevIDRelay relayID, AddrInfo::ClientToken token, 
                    string& connName, HostID* hidp, unsigned short* seed )
 {
+    METRICS_DB_TIMER();
     int nSuccesses = 0;
 
     const char* fmt = 
@@ -270,22 +303,13 @@ DBMgr::FindRelayIDFor( const char* connName, HostID hid,
                        unsigned short seed, const DevID* host,
                        DevIDRelay* devIDP )
 {
-    DevIDRelay devID = DEVID_NONE;
-    StrWPF query;
-    query.catf( "SELECT devids[%d] FROM " GAMES_TABLE " WHERE "
-                "connname = '%s' AND seeds[%d] = %d", hid, 
-                connName, hid, seed );
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
-    int nTuples = PQntuples( result );
-    assert( nTuples <= 1 );
-    bool found = nTuples == 1;
+    GameRow row;
+    bool found = getGameRow( connName, &row ) && row.m_seeds.Is( hid, seed );
     if ( found ) {
-        devID = (DevIDRelay)strtoul( PQgetvalue( result, 0, 0 ), NULL, 10 );
+        DevIDRelay devID = row.m_devids.Get( hid );
         *devIDP = devID;
         ReregisterDevice( devID, host, NULL, 0, NULL, NULL, 0);
-    }
-    PQclear( result );
-    if ( !found ) {
+    } else {
         logf( XW_LOGERROR, "%s: relayid not found for slot %d of %s)", 
               __func__, hid, connName );
     }
@@ -298,6 +322,7 @@ DBMgr::SeenSeed( const char* cookie, unsigned short seed,
                  char* connNameBuf, int bufLen, int* nPlayersHP, 
                  CookieID* cid )
 {
+    METRICS_DB_TIMER();
     QueryBuilder qb;
     qb.appendQueryf( "SELECT cid, connName, seeds, sum_array(nPerDevice) FROM "
                      GAMES_TABLE
@@ -340,6 +365,7 @@ DBMgr::FindRecentOpen( const char* cookie, int lang, int nPlayersT, int nPlayers
                        bool wantsPublic, char* connNameBuf, int bufLen,
                        int* nPlayersHP )
 {
+    METRICS_DB_TIMER();
     QueryBuilder qb;
     qb.appendQueryf("SELECT cid, connName, sum_array(nPerDevice) FROM "
                     GAMES_TABLE
@@ -378,17 +404,12 @@ DBMgr::FindRecentOpen( const char* cookie, int lang, int nPlayersT, int nPlayers
 bool
 DBMgr::AllDevsAckd( const char* const connName )
 {
-    const char* cmd = "SELECT ntotal=sum_array(nperdevice) AND 'A'=ALL(ack) from " GAMES_TABLE
-        " WHERE connName='%s'";
-    StrWPF query;
-    query.catf( cmd, connName );
-    logf( XW_LOGINFO, "query: %s", query.c_str() );
-
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
-    int nTuples = PQntuples( result );
-    assert( nTuples <= 1 );
-    bool full = nTuples == 1 && 't' == PQgetvalue( result, 0, 0 )[0];
-    PQclear( result );
+    bool full = false;
+    GameRow row;
+    int nHere;
+    if ( getGameRow( connName, &row ) && row.m_nPerDevice.Sum( &nHere ) ) {
+        full = row.m_nTotal == nHere && row.m_ack.All( 'A' );
+    }
     return full;
 }
 
@@ -399,6 +420,7 @@ DBMgr::RegisterDevice( const DevID* host, int clientVersion,
                        const char* const desc, const char* const model,
                        const char* const osVers, unsigned short variantCode )
 {
+    METRICS_DB_TIMER();
     DevIDRelay devID;
     assert( host->m_devIDType != ID_TYPE_NONE );
 
@@ -421,7 +443,7 @@ DBMgr::RegisterDevice( const DevID* host, int clientVersion,
                                 // of uniqueness problem.
             do {
                 devID = (DevIDRelay)random();
-            } while ( DEVID_NONE == devID );
+            } while ( DEVID_NONE == devID || !ShardMgr::OwnsDevice( devID ) );
 
             QueryBuilder qb;
             qb.appendQueryf( "INSERT INTO " DEVICES_TABLE " (id, devTypes[1],"
@@ -440,6 +462,17 @@ DBMgr::RegisterDevice( const DevID* host, int clientVersion,
 
             success = execParams( qb );
         }
+
+        devicesChanged( devID, host );
+        string key = devKey( host->m_devIDType, host->m_devIDString );
+        {
+            RowCache<DevIDRelay>::Update upd( m_devices, key );
+            upd.Set( devID );
+        }
+        StrWPF idKey;
+        idKey.catf( "%d", devID );
+        RowCache<string>::Update upd( m_devKeys, idKey );
+        upd.Set( key );
     }
     return devID;
 } // RegisterDevice
@@ -456,6 +489,7 @@ DBMgr::ReregisterDevice( DevIDRelay relayID, const DevID* host,
                          const char* const model, const char* const osVers,
                          unsigned short variantCode )
 {
+    METRICS_DB_TIMER();
     QueryBuilder qb;
     qb.appendQueryf( "UPDATE " DEVICES_TABLE " SET "
                      "devTypes[1] = $$, "
@@ -467,6 +501,7 @@ DBMgr::ReregisterDevice( DevIDRelay relayID, const DevID* host,
                   relayID );
     qb.finish();
     execParams( qb );
+    devicesChanged( relayID, host );
 }
 
 // Return true if the relayID exists in the DB already
@@ -476,6 +511,7 @@ DBMgr::UpdateDevice( DevIDRelay relayID, const char* const desc,
                      const char* const osVers, unsigned short variantCode,
                      bool check )
 {
+    METRICS_DB_TIMER();
     bool exists = !check;
     if ( !exists ) {
         StrWPF test;
@@ -534,21 +570,22 @@ DBMgr::AddToGame( const char* connName, HostID curID, int clientVersion,
                   int nToAdd, unsigned short seed, const AddrInfo* addr,
                   DevIDRelay devID, bool ackd )
 {
+    METRICS_DB_TIMER();
     HostID newID = curID;
 
     if ( newID == HOST_ID_NONE ) {
-        int ackArr[4] = {0};
-        int seedArr[4] = {0};
-        readArray( connName, "nPerDevice", ackArr );
-        readArray( connName, "seeds", seedArr );
+        GameRow row;
+        bool found = getGameRow( connName, &row );
+        assert( found );
 
         // If our seed's already there, grab that slot.  Otherwise grab the
         // first empty one.
         HostID firstEmpty = HOST_ID_NONE;
         for ( newID = HOST_ID_SERVER; newID <= 4; ++newID ) {
-            if ( seedArr[newID-1] == seed ) {
+            if ( row.m_seeds.Get( newID ) == seed ) {
                 break;
-            } else if ( HOST_ID_NONE == firstEmpty && 0 == ackArr[newID-1] ) {
+            } else if ( HOST_ID_NONE == firstEmpty
+                        && 0 == row.m_nPerDevice.Get( newID ) ) {
                 firstEmpty = newID;
             }
         }
@@ -580,7 +617,21 @@ DBMgr::AddToGame( const char* connName, HostID curID, int clientVersion,
     }
 
     logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
-    execSql( query );
+    bool ok = execSql( query );
+
+    RowCache<GameRow>::Update upd( m_games, connName );
+    GameRow* row = upd.GetRow();
+    if ( !ok ) {
+        upd.Drop();
+    } else if ( NULL != row ) {
+        row->m_nPerDevice.Set( newID, nToAdd );
+        row->m_seeds.Set( newID, seed );
+        if ( DEVID_NONE != devID ) {
+            row->m_devids.Set( newID, devID );
+        }
+        row->m_tokens.Set( newID, addr->clientToken() );
+        row->m_ack.Set( newID, ackd ? 'A' : 'a' );
+    }
 
     return newID;
 } /* AddToGame */
@@ -588,61 +639,63 @@ DBMgr::AddToGame( const char* connName, HostID curID, int clientVersion,
 void
 DBMgr::NoteAckd( const char* const connName, HostID id )
 {
+    METRICS_DB_TIMER();
     const char* fmt = "UPDATE " GAMES_TABLE " SET ack[%d]='A'"
         " WHERE connName = '%s'";
     StrWPF query;
     query.catf( fmt, id, connName );
     logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
 
-    execSql( query );
+    bool ok = execSql( query );
+
+    RowCache<GameRow>::Update upd( m_games, connName );
+    GameRow* row = upd.GetRow();
+    if ( !ok ) {
+        upd.Drop();
+    } else if ( NULL != row ) {
+        row->m_ack.Set( id, 'A' );
+    }
 }
 
 bool
 DBMgr::RmDeviceByHid( const char* connName, HostID hid )
 {
+    METRICS_DB_TIMER();
     const char* fmt = "UPDATE " GAMES_TABLE " SET nPerDevice[%d] = 0, "
         "seeds[%d] = 0, ack[%d]='-', mtimes[%d]='now' WHERE connName = '%s'";
     StrWPF query;
     query.catf( fmt, hid, hid, hid, hid, connName );
     logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
 
-    return execSql( query );
+    bool ok = execSql( query );
+
+    RowCache<GameRow>::Update upd( m_games, connName );
+    GameRow* row = upd.GetRow();
+    if ( !ok ) {
+        upd.Drop();
+    } else if ( NULL != row ) {
+        row->m_nPerDevice.Set( hid, 0 );
+        row->m_seeds.Set( hid, 0 );
+        row->m_ack.Set( hid, '-' );
+    }
+    return ok;
 }
 
 HostID
 DBMgr::HIDForSeed( const char* const connName, unsigned short seed )
 {
     HostID hid = HOST_ID_NONE;
-    char seeds[128] = {0};
-    const char* fmt = "SELECT seeds FROM " GAMES_TABLE
-        " WHERE connName = '%s'"
-        " AND %d = ANY(seeds)";
-    StrWPF query;
-    query.catf( fmt, connName, seed );
-    logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
-    if ( 1 == PQntuples( result ) ) {
-        snprintf( seeds, sizeof(seeds), "%s", PQgetvalue( result, 0, 0 ) );
-    }
-    PQclear( result );
-
-    if ( 0 != seeds[0] ) {
-        char *saveptr = NULL;
-        int ii;
-        char* str;
-        for ( str = seeds, ii = 0; ; str = NULL, ++ii ) {
-            char* tok = strtok_r( str, "{},", &saveptr );
-            if ( NULL == tok ) {
+    GameRow row;
+    if ( getGameRow( connName, &row ) ) {
+        for ( HostID indx = 1; indx <= 4; ++indx ) {
+            if ( row.m_seeds.Is( indx, seed ) ) {
+                hid = indx;
                 break;
-            } else {
-                int asint = atoi( tok );
-                if ( asint == seed ) {
-                    hid = ii + 1;
-                    break;
-                }
             }
         }
-    } else {
+    }
+
+    if ( HOST_ID_NONE == hid ) {
         assert(0);              /* but don't ship with this!!!! */
     }
 
@@ -661,21 +714,14 @@ DBMgr::RmDeviceBySeed( const char* const connName, unsigned short seed )
 bool
 DBMgr::HaveDevice( const char* connName, HostID hid, int seed )
 {
-    bool found = false;
-    const char* fmt = "SELECT * from " GAMES_TABLE 
-        " WHERE connName = '%s' AND seeds[%d] = %d";
-    StrWPF query;
-    query.catf( fmt, connName, hid, seed );
-    logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
-    found = 1 == PQntuples( result );
-    PQclear( result );
-    return found;
+    GameRow row;
+    return getGameRow( connName, &row ) && row.m_seeds.Is( hid, seed );
 }
 
 bool
 DBMgr::AddCID( const char* const connName, CookieID cid )
 {
+    METRICS_DB_TIMER();
     const char* fmt = "UPDATE " GAMES_TABLE " SET cid = %d "
         " WHERE connName = '%s' AND cid IS NULL";
     StrWPF query;
@@ -683,6 +729,15 @@ DBMgr::AddCID( const char* const connName, CookieID cid )
     logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
 
     bool result = execSql( query );
+
+    RowCache<GameRow>::Update upd( m_games, connName );
+    GameRow* row = upd.GetRow();
+    if ( !result ) {
+        upd.Drop();
+    } else if ( NULL != row && row->m_cidNull ) {
+        row->m_cid = cid;
+        row->m_cidNull = false;
+    }
     logf( XW_LOGINFO, "%s(cid=%d)=>%d", __func__, cid, result );
     return result;
 }
@@ -690,18 +745,29 @@ DBMgr::AddCID( const char* const connName, CookieID cid )
 void
 DBMgr::ClearCID( const char* connName )
 {
+    METRICS_DB_TIMER();
     const char* fmt = "UPDATE " GAMES_TABLE " SET cid = null "
         "WHERE connName = '%s'";
     StrWPF query;
     query.catf( fmt, connName );
     logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
 
-    execSql( query );
+    bool ok = execSql( query );
+
+    RowCache<GameRow>::Update upd( m_games, connName );
+    GameRow* row = upd.GetRow();
+    if ( !ok ) {
+        upd.Drop();
+    } else if ( NULL != row ) {
+        row->m_cid = 0;
+        row->m_cidNull = true;
+    }
 }
 
 void
 DBMgr::RecordSent( const char* const connName, HostID hid, int nBytes )
 {
+    METRICS_DB_TIMER();
     assert( hid >= 0 && hid <= 4 );
     const char* fmt = "UPDATE " GAMES_TABLE " SET"
         " nsents[%d] = nsents[%d] + %d, mtimes[%d] = 'now'"
@@ -713,10 +779,35 @@ DBMgr::RecordSent( const char* const connName, HostID hid, int nBytes )
     execSql( query );
 }
 
+void
+DBMgr::RecordSent( const char* const connName, const int* nBytes )
+{
+    METRICS_DB_TIMER();
+    StrWPF query;
+    query.catf( "UPDATE " GAMES_TABLE " SET" );
+    const char* sep = "";
+    for ( HostID hid = 1; hid <= 4; ++hid ) {
+        if ( 0 != nBytes[hid-1] ) {
+            query.catf( "%s nsents[%d] = nsents[%d] + %d, mtimes[%d] = 'now'",
+                        sep, hid, hid, nBytes[hid-1], hid );
+            sep = ",";
+        }
+    }
+    if ( '\0' != *sep ) {
+        query.catf( " WHERE connName = '%s'", connName );
+        logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
+        execSql( query );
+    }
+}
+
 void
 DBMgr::RecordSent( const int* msgIDs, int nMsgIDs )
 {
-    if ( nMsgIDs > 0 ) {
+    METRICS_DB_TIMER();
+    MsgStore* store = MsgStore::Get();
+    if ( NULL != store ) {
+        store->RecordSent( msgIDs, nMsgIDs );
+    } else if ( nMsgIDs > 0 ) {
         StrWPF query;
         query.catf( "SELECT connname,hid,sum(msglen)"
                     " FROM " MSGS_TABLE " WHERE id IN (" );
@@ -749,6 +840,7 @@ void
 DBMgr::RecordAddress( const char* const connName, HostID hid, 
                       const AddrInfo* addr )
 {
+    METRICS_DB_TIMER();
     assert( hid >= 0 && hid <= 4 );
     const char* fmt = "UPDATE " GAMES_TABLE " SET addrs[%d] = \'%s\'"
         " WHERE connName = '%s'";
@@ -763,28 +855,40 @@ DBMgr::RecordAddress( const char* const connName, HostID hid,
 void
 DBMgr::GetPlayerCounts( const char* const connName, int* nTotal, int* nHere )
 {
-    const char* fmt = "SELECT ntotal, sum_array(nperdevice) FROM " GAMES_TABLE
-        " WHERE connName = '%s'";
-    StrWPF query;
-    query.catf( fmt, connName );
-    logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
-
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
-    assert( 1 == PQntuples( result ) );
-    *nTotal = atoi( PQgetvalue( result, 0, 0 ) );
-    *nHere = atoi( PQgetvalue( result, 0, 1 ) );
-    PQclear( result );
+    GameRow row;
+    bool found = getGameRow( connName, &row );
+    assert( found );
+    *nTotal = row.m_nTotal;
+    (void)row.m_nPerDevice.Sum( nHere );
 }
 
 void
 DBMgr::KillGame( const char* const connName, int hid )
 {
+    METRICS_DB_TIMER();
     const char* fmt = "UPDATE " GAMES_TABLE " SET dead = TRUE,"
         " nperdevice[%d] = - nperdevice[%d]"
         " WHERE connName = '%s'";
     StrWPF query;
     query.catf( fmt, hid, hid, connName );
-    execSql( query );
+    bool ok = execSql( query );
+
+    {
+        RowCache<GameRow>::Update upd( m_games, connName );
+        GameRow* row = upd.GetRow();
+        if ( !ok ) {
+            upd.Drop();
+        } else if ( NULL != row ) {
+            row->m_dead = true;
+            row->m_nPerDevice.Set( hid, - row->m_nPerDevice.Get( hid ),
+                                   row->m_nPerDevice.IsNull( hid ) );
+        }
+    }
+
+    MsgStore* store = MsgStore::Get();
+    if ( NULL != store ) {
+        store->GameDied( connName );
+    }
 }
 
 void
@@ -818,12 +922,27 @@ DBMgr::WaitDBConn( void )
 void
 DBMgr::ClearCIDs( void )
 {
-    execSql( "UPDATE " GAMES_TABLE " set cid = null" );
+    METRICS_DB_TIMER();
+    m_games->Clear();
+    if ( NULL == ShardMgr::Get() ) {
+        execSql( "UPDATE " GAMES_TABLE " set cid = null" );
+    } else {
+        /* Other relays' games aren't ours to reset */
+        string prefix = PermID::GetServerName() + ":";
+        QueryBuilder qb;
+        qb.appendQueryf( "UPDATE " GAMES_TABLE " set cid = null"
+                         " WHERE left(connName, $$) = $$" )
+            .appendParam( (int)prefix.size() )
+            .appendParam( prefix.c_str() )
+            .finish();
+        execParams( qb );
+    }
 }
 
 void
 DBMgr::PublicRooms( int lang, int nPlayers, int* nNames, string& names )
 {
+    METRICS_DB_TIMER();
     const char* fmt = "SELECT room, nTotal-sum_array(nPerDevice),"
         " round( extract( epoch from age('now', ctime)))"
         " FROM " GAMES_TABLE
@@ -856,21 +975,16 @@ DBMgr::TokenFor( const char* const connName, int hid, DevIDRelay* devid,
                  AddrInfo::ClientToken* token )
 {
     bool found = false;
-    const char* fmt = "SELECT tokens[%d], devids[%d] FROM " GAMES_TABLE
-        " WHERE connName='%s'";
-    StrWPF query;
-    query.catf( fmt, hid, hid, connName );
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
-    if ( 1 == PQntuples( result ) ) {
-        AddrInfo::ClientToken token_tmp = atoi( PQgetvalue( result, 0, 0 ) );
-        DevIDRelay devid_tmp = atoi( PQgetvalue( result, 0, 1 ) );
+    GameRow row;
+    if ( getGameRow( connName, &row ) ) {
+        AddrInfo::ClientToken token_tmp = row.m_tokens.Get( hid );
+        DevIDRelay devid_tmp = row.m_devids.Get( hid );
         if ( AddrInfo::NULL_TOKEN != token_tmp && 0 != devid_tmp ) {
             *token = token_tmp;
             *devid = devid_tmp;
             found = true;
         }
     }
-    PQclear( result );
 
     if ( found ) {
         logf( XW_LOGINFO, "%s(%s,%d)=>true (%d, %d)", __func__, connName, hid, 
@@ -925,21 +1039,52 @@ DBMgr::execParams( QueryBuilder& qb )
     return success;
 }
 
-void
-DBMgr::readArray( const char* const connName, const char* column, int arr[]  ) /* len 4 */
+/* The games row for connName, from the cache if it's there */
+bool
+DBMgr::getGameRow( const char* const connName, GameRow* row )
 {
-    const char* fmt = "SELECT %s FROM " GAMES_TABLE " WHERE connName='%s'";
-
-    StrWPF query;
-    query.catf( fmt, column, connName );
-    logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
-
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
-    assert( 1 == PQntuples( result ) );
-    const char* arrStr = PQgetvalue( result, 0, 0 );
-    logf( XW_LOGINFO, "%s: arrStr=\"%s\"", __func__, arrStr );
-    sscanf( arrStr, "{%d,%d,%d,%d}", &arr[0], &arr[1], &arr[2], &arr[3] );
-    PQclear( result );
+    string key( connName );
+    uint32_t gen;
+    bool found = m_games->Get( key, row, &gen );
+    if ( found ) {
+        Metrics::Get()->Inc( MC_ROWCACHE_GAMES_HIT );
+    } else {
+        Metrics::Get()->Inc( MC_ROWCACHE_GAMES_MISS );
+        METRICS_DB_TIMER();
+        QueryBuilder qb;
+        qb.appendQueryf( "SELECT cid, room, lang, nTotal, dead, nPerDevice,"
+                         " seeds, ack, devids, tokens FROM " GAMES_TABLE
+                         " WHERE connName = $$" )
+            .appendParam( connName )
+            .finish();
+        PGresult* result = PQexecParams( getThreadConn(), qb.c_str(),
+                                         qb.paramCount(), NULL,
+                                         qb.paramValues(),
+                                         NULL, NULL, 0 );
+        assert( 1 >= PQntuples( result ) );
+        found = PGRES_TUPLES_OK == PQresultStatus( result )
+            && 1 == PQntuples( result );
+        if ( found ) {
+            int col = 0;
+            row->m_cidNull = PQgetisnull( result, 0, col );
+            row->m_cid = atoi( PQgetvalue( result, 0, col++ ) );
+            row->m_room = PQgetvalue( result, 0, col++ );
+            row->m_lang = atoi( PQgetvalue( result, 0, col++ ) );
+            row->m_nTotal = atoi( PQgetvalue( result, 0, col++ ) );
+            row->m_dead = 't' == PQgetvalue( result, 0, col++ )[0];
+            PGArray4* arrays[] = { &row->m_nPerDevice, &row->m_seeds,
+                                   &row->m_ack, &row->m_devids,
+                                   &row->m_tokens };
+            for ( size_t ii = 0; ii < VSIZE(arrays); ++ii, ++col ) {
+                arrays[ii]->Parse( PQgetvalue( result, 0, col ),
+                                   PQgetisnull( result, 0, col ),
+                                   &row->m_ack == arrays[ii] );
+            }
+            m_games->Put( key, *row, gen );
+        }
+        PQclear( result );
+    }
+    return found;
 }
 
 // parse something created by comms.c's formatRelayID
@@ -959,19 +1104,27 @@ DevIDRelay
 DBMgr::getDevID( const char* connName, int hid )
 {
     DevIDRelay devID = DEVID_NONE;
-    const char* fmt = "SELECT devids[%d] FROM " GAMES_TABLE " WHERE connName='%s'";
-    StrWPF query;
-    query.catf( fmt, hid, connName );
-    logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
-
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
-    if ( 1 == PQntuples( result ) ) {
-        devID = (DevIDRelay)strtoul( PQgetvalue( result, 0, 0 ), NULL, 10 );
+    GameRow row;
+    if ( getGameRow( connName, &row ) ) {
+        devID = row.m_devids.Get( hid );
     }
-    PQclear( result );
     return devID;
 }
 
+void
+DBMgr::getDevIDAndToken( const char* connName, int hid, DevIDRelay* devID,
+                         AddrInfo::ClientToken* token )
+{
+    *devID = DEVID_NONE;
+    *token = AddrInfo::NULL_TOKEN;
+
+    GameRow row;
+    if ( getGameRow( connName, &row ) ) {
+        *devID = row.m_devids.Get( hid );
+        *token = row.m_tokens.Get( hid );
+    }
+}
+
 DevIDRelay 
 DBMgr::getDevID( const DevID* devID )
 {
@@ -996,20 +1149,69 @@ DBMgr::getDevID( const DevID* devID )
     }
 
     if ( 0 < query.size() ) {
-        logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
-        PGresult* result = PQexec( getThreadConn(), query.c_str() );
-        int nTuples = PQntuples( result );
-        assert( 1 >= nTuples );
-        if ( 1 == nTuples ) {
-            rDevID = (DevIDRelay)strtoul( PQgetvalue( result, 0, 0 ), NULL, 10 );
+        string key = devKey( devIDType, devIDString );
+        uint32_t gen;
+        if ( m_devices->Get( key, &rDevID, &gen ) ) {
+            Metrics::Get()->Inc( MC_ROWCACHE_DEVICES_HIT );
+        } else {
+            Metrics::Get()->Inc( MC_ROWCACHE_DEVICES_MISS );
+            METRICS_DB_TIMER();
+            logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
+            PGresult* result = PQexec( getThreadConn(), query.c_str() );
+            int nTuples = PQntuples( result );
+            assert( 1 >= nTuples );
+            if ( 1 == nTuples ) {
+                rDevID = (DevIDRelay)strtoul( PQgetvalue( result, 0, 0 ),
+                                              NULL, 10 );
+                m_devices->Put( key, rDevID, gen );
+                if ( ID_TYPE_RELAY != devIDType ) {
+                    StrWPF idKey;
+                    idKey.catf( "%d", rDevID );
+                    m_devKeys->Put( idKey, key, gen );
+                }
+            }
+            PQclear( result );
         }
-        PQclear( result );
     }
     logf( XW_LOGINFO, "%s(in='%s')=>%d (0x%.8X)", __func__, 
           devIDString.c_str(), rDevID, rDevID );
     return rDevID;
 }
 
+/* static */ string
+DBMgr::devKey( DevIDType typ, const string& devIDString )
+{
+    StrWPF key;
+    key.catf( "%d/%s", typ, devIDString.c_str() );
+    return key;
+}
+
+/* relayID's row now has host's ID.  What relayID was cached under before
+   no longer finds it, and what host's ID finds may have changed. */
+void
+DBMgr::devicesChanged( DevIDRelay relayID, const DevID* host )
+{
+    StrWPF idKey;
+    idKey.catf( "%d", relayID );
+
+    string oldKey;
+    uint32_t gen;
+    if ( m_devKeys->Get( idKey, &oldKey, &gen ) ) {
+        m_devices->Drop( oldKey );
+    }
+    m_devKeys->Drop( idKey );
+    if ( ID_TYPE_RELAY != host->m_devIDType ) {
+        m_devices->Drop( devKey( host->m_devIDType, host->m_devIDString ) );
+    }
+}
+
+void
+DBMgr::GetRowCacheSizes( int* nGames, int* nDevices )
+{
+    *nGames = m_games->Size();
+    *nDevices = m_devices->Size();
+}
+
 /*
  id | connname  | hid |   msg   
 ----+-----------+-----+---------
@@ -1021,6 +1223,7 @@ DBMgr::getDevID( const DevID* devID )
 int
 DBMgr::CountStoredMessages( const char* const connName, int hid )
 {
+    METRICS_DB_TIMER();
     StrWPF test;
     test.catf( "connname = '%s'", connName );
 #ifdef HAVE_STIME
@@ -1036,12 +1239,22 @@ DBMgr::CountStoredMessages( const char* const connName, int hid )
 int
 DBMgr::CountStoredMessages( const char* const connName )
 {
+    MsgStore* store = MsgStore::Get();
+    if ( NULL != store ) {
+        return store->CountStored( connName );
+    }
     return CountStoredMessages( connName, -1 );
 } /* CountStoredMessages */
 
 int
 DBMgr::CountStoredMessages( DevIDRelay relayID )
 {
+    METRICS_DB_TIMER();
+    MsgStore* store = MsgStore::Get();
+    if ( NULL != store ) {
+        return store->CountStored( relayID );
+    }
+
     StrWPF test;
     test.catf( "devid = %d", relayID );
 #ifdef HAVE_STIME
@@ -1055,6 +1268,13 @@ int
 DBMgr::StoreMessage( DevIDRelay destDevID, const uint8_t* const buf,
                      int len )
 {
+    METRICS_DB_TIMER();
+    Metrics::Get()->Inc( MC_MSGS_STORED );
+    MsgStore* store = MsgStore::Get();
+    if ( NULL != store ) {
+        return store->Store( destDevID, buf, len );
+    }
+
     int msgID = 0;
     clearHasNoMessages( destDevID );
 
@@ -1089,6 +1309,16 @@ int
 DBMgr::StoreMessage( const char* const connName, int destHid,
                      const uint8_t* buf, int len )
 {
+    METRICS_DB_TIMER();
+    Metrics::Get()->Inc( MC_MSGS_STORED );
+    MsgStore* store = MsgStore::Get();
+    if ( NULL != store ) {
+        DevIDRelay devID;
+        AddrInfo::ClientToken token;
+        getDevIDAndToken( connName, destHid, &devID, &token );
+        return store->Store( connName, destHid, devID, token, buf, len );
+    }
+
     int msgID = 0;
     clearHasNoMessages( connName, destHid );
 
@@ -1176,7 +1406,8 @@ DBMgr::storedMessagesImpl( string test, vector<DBMgr::MsgInfo>& msgs,
                            bool nullConnnameOK )
 {
     StrWPF query;
-    query.catf( "SELECT id, msg64, msg, msglen, token, connname FROM "
+    query.catf( "SELECT id, msg64, msg, msglen, token, connname, hid, devid"
+                " FROM "
                 MSGS_TABLE " WHERE %s "
 #ifdef HAVE_STIME 
                 " AND stime = 'epoch' "
@@ -1191,85 +1422,361 @@ DBMgr::storedMessagesImpl( string test, vector<DBMgr::MsgInfo>& msgs,
 
     logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
     PGresult* result = PQexec( getThreadConn(), query.c_str() );
+    readMessages( result, 0, msgs );
+    PQclear( result );
+}
 
+/* Rows are id, msg64, msg, msglen, token, connname, hid, devid starting at
+   column firstCol.  A NULL id means no message on that row. */
+void
+DBMgr::readMessages( PGresult* result, int firstCol,
+                     vector<DBMgr::MsgInfo>& msgs )
+{
     int nTuples = PQntuples( result );
     for ( int ii = 0; ii < nTuples; ++ii ) {
-        int id = atoi( PQgetvalue( result, ii, 0 ) );
-        AddrInfo::ClientToken token = atoi( PQgetvalue( result, ii, 4 ) );
-        const char* connname = PQgetvalue( result, ii, 5 );
+        if ( PQgetisnull( result, ii, firstCol ) ) {
+            continue;
+        }
+        int id = atoi( PQgetvalue( result, ii, firstCol ) );
+        AddrInfo::ClientToken token = atoi( PQgetvalue( result, ii, firstCol + 4 ) );
+        const char* connname = PQgetvalue( result, ii, firstCol + 5 );
         bool hasConnname = connname != NULL && '\0' != connname[0];
         MsgInfo msg( id, token, hasConnname );
+        if ( hasConnname ) {
+            msg.connName = connname;
+            msg.hid = atoi( PQgetvalue( result, ii, firstCol + 6 ) );
+        }
+        msg.devID = (DevIDRelay)strtoul( PQgetvalue( result, ii, firstCol + 7 ),
+                                         NULL, 10 );
 
-        decodeMessage( result, m_useB64, ii, 1, 2, msg.msg );
-        size_t msglen = atoi( PQgetvalue( result, ii, 3 ) );
+        decodeMessage( result, m_useB64, ii, firstCol + 1, firstCol + 2,
+                       msg.msg );
+        size_t msglen = atoi( PQgetvalue( result, ii, firstCol + 3 ) );
         assert( 0 == msglen || msg.msg.size() == msglen );
         msgs.push_back( msg );
     }
-    PQclear( result );
 }
 
-void
-DBMgr::GetStoredMessages( DevIDRelay relayID, vector<MsgInfo>& msgs )
+/* Claim, in one statement, the unsent messages matching test that aren't
+   already claimed, returning them in id order.  The first column of every
+   row counts those that matched but were already claimed; there's always at
+   least one row so that's known even when none were claimable.  The
+   UPDATE's own re-check of claimed keeps two concurrent claims from both
+   getting a message.  Returns false if any were already claimed. */
+bool
+DBMgr::claimMessagesImpl( const char* test, QueryBuilder& qb,
+                          vector<DBMgr::MsgInfo>& msgs, bool nullConnnameOK )
 {
-    if ( !hasNoMessages( relayID ) ) {
-        StrWPF query;
-        query.catf( "devid=%d", relayID );
-        storedMessagesImpl( query, msgs, true );
+    StrWPF expired;
+    expired.catf( "claimed <= now() - interval '%d seconds'", m_claimSecs );
 
-        if ( 0 == msgs.size() ) {
-            setHasNoMessages( relayID );
-        }
+    qb.appendQueryf( "WITH cand AS (SELECT id, NOT (%s) AS busy FROM " MSGS_TABLE
+                     " WHERE %s"
+#ifdef HAVE_STIME
+                     " AND stime = 'epoch'"
+#endif
+                     " AND (connname IN (SELECT connname FROM " GAMES_TABLE
+                     " WHERE NOT " GAMES_TABLE ".dead)%s)), ",
+                     expired.c_str(), test,
+                     nullConnnameOK ? " OR connname IS NULL" : "" )
+        .appendQueryf( "upd AS (UPDATE " MSGS_TABLE " SET claimed = now()"
+                       " WHERE id IN (SELECT id FROM cand WHERE NOT busy)"
+                       " AND %s RETURNING id, msg64, msg, msglen, token,"
+                       " connname, hid, devid) ", expired.c_str() )
+        .appendQueryf( "SELECT b.n, upd.* FROM (SELECT count(*) AS n FROM cand"
+                       " WHERE busy) b LEFT JOIN upd ON true ORDER BY upd.id" )
+        .finish();
+
+    PGresult* result = PQexecParams( getThreadConn(), qb.c_str(),
+                                     qb.paramCount(), NULL,
+                                     qb.paramValues(),
+                                     NULL, NULL, 0 );
+    bool noneBusy = false;
+    if ( PGRES_TUPLES_OK == PQresultStatus( result ) ) {
+        noneBusy = 0 < PQntuples( result )
+            && 0 == atoi( PQgetvalue( result, 0, 0 ) );
+        readMessages( result, 1, msgs );
+    } else {
+        logf( XW_LOGERROR, "%s: PQexecParams=>%s;%s", __func__,
+              PQresStatus(PQresultStatus(result)),
+              PQresultErrorMessage(result) );
     }
+    PQclear( result );
+    logf( XW_LOGINFO, "%s(%s): claimed %d; noneBusy: %d", __func__, test,
+          msgs.size(), noneBusy );
+    return noneBusy;
 }
 
 void
 DBMgr::GetStoredMessages( const char* const connName, HostID hid, 
                           vector<DBMgr::MsgInfo>& msgs )
 {
-    if ( !hasNoMessages( connName, hid ) ) {
+    MsgStore* store = MsgStore::Get();
+    uint64_t key = noMsgsKey( connName, hid );
+    uint32_t gen;
+    if ( NULL != store ) {
+        store->GetStored( connName, hid, msgs );
+    } else if ( !m_noMsgs->Has( key, &gen ) ) {
         StrWPF query;
         query.catf( "hid = %d AND connname = '%s'", hid, connName );
         storedMessagesImpl( query, msgs, false );
 
         if ( 0 == msgs.size() ) {
-            setHasNoMessages( connName, hid );
+            m_noMsgs->Set( key, gen );
+        }
+    }
+}
+
+void
+DBMgr::ClaimStoredMessages( DevIDRelay relayID, vector<MsgInfo>& msgs )
+{
+    MsgStore* store = MsgStore::Get();
+    uint64_t key = noMsgsKey( relayID );
+    uint32_t gen;
+    if ( NULL != store ) {
+        store->GetStored( relayID, msgs );
+    } else if ( !m_noMsgs->Has( key, &gen ) ) {
+        METRICS_DB_TIMER();
+        QueryBuilder qb;
+        qb.appendParam( relayID );
+        if ( claimMessagesImpl( "devid = $$", qb, msgs, true )
+             && 0 == msgs.size() ) {
+            m_noMsgs->Set( key, gen );
         }
     }
 }
 
 void
-DBMgr::RemoveStoredMessages( string& msgids )
+DBMgr::ClaimStoredMessages( const char* const connName, HostID hid, 
+                            vector<DBMgr::MsgInfo>& msgs )
+{
+    MsgStore* store = MsgStore::Get();
+    uint64_t key = noMsgsKey( connName, hid );
+    uint32_t gen;
+    if ( NULL != store ) {
+        store->GetStored( connName, hid, msgs );
+    } else if ( !m_noMsgs->Has( key, &gen ) ) {
+        METRICS_DB_TIMER();
+        QueryBuilder qb;
+        qb.appendParam( connName ).appendParam( hid );
+        if ( claimMessagesImpl( "connname = $$ AND hid = $$", qb, msgs, false )
+             && 0 == msgs.size() ) {
+            m_noMsgs->Set( key, gen );
+        }
+    }
+}
+
+// Make messages claimable again, e.g. because their ack never came.  Whoever
+// they're for may be cached as having none waiting, so fix that too.
+void
+DBMgr::ReleaseStoredMessages( const int* msgIDs, int nMsgIDs )
+{
+    if ( NULL == MsgStore::Get() && 0 < nMsgIDs ) {
+        METRICS_DB_TIMER();
+        PGresult* result;
+        if ( idsQuery( "UPDATE " MSGS_TABLE " SET claimed = 'epoch'"
+                       " WHERE id = ANY($$::integer[])"
+                       " RETURNING devid, connname, hid", msgIDs, nMsgIDs,
+                       &result ) ) {
+            int nTuples = PQntuples( result );
+            for ( int ii = 0; ii < nTuples; ++ii ) {
+                if ( !PQgetisnull( result, ii, 0 ) ) {
+                    DevIDRelay devid = strtoul( PQgetvalue( result, ii, 0 ),
+                                                NULL, 10 );
+                    m_noMsgs->Clear( noMsgsKey( devid ) );
+                }
+                if ( !PQgetisnull( result, ii, 1 ) ) {
+                    m_noMsgs->Clear( noMsgsKey( PQgetvalue( result, ii, 1 ),
+                                                atoi( PQgetvalue( result, ii, 2 ) ) ) );
+                }
+            }
+        }
+        PQclear( result );
+    }
+}
+
+/* Run fmt, whose one parameter is an integer[] of msgIDs.  Caller must
+   PQclear() *resultp */
+bool
+DBMgr::idsQuery( const char* fmt, const int* msgIDs, int nMsgIDs,
+                 PGresult** resultp )
 {
-    const char* fmt = 
-#ifdef HAVE_STIME
-        "UPDATE " MSGS_TABLE " SET stime='now' "
-#else
-        "DELETE FROM " MSGS_TABLE 
-#endif
-        " WHERE id IN (%s)";
+    StrWPF ids;
+    ids.append( "{" );
+    for ( int ii = 0; ii < nMsgIDs; ++ii ) {
+        ids.catf( 0 == ii ? "%d" : ",%d", msgIDs[ii] );
+    }
+    ids.append( "}" );
+
+    QueryBuilder qb;
+    qb.appendQueryf( "%s", fmt )
+        .appendParam( ids.c_str() )
+        .finish();
+    logf( XW_LOGINFO, "%s: query: %s (%s)", __func__, qb.c_str(), ids.c_str() );
+
+    *resultp = PQexecParams( getThreadConn(), qb.c_str(), qb.paramCount(),
+                             NULL, qb.paramValues(), NULL, NULL, 0 );
+    ExecStatusType status = PQresultStatus( *resultp );
+    bool ok = PGRES_COMMAND_OK == status || PGRES_TUPLES_OK == status;
+    if ( !ok ) {
+        logf( XW_LOGERROR, "%s: PQexecParams=>%s;%s", __func__,
+              PQresStatus(status), PQresultErrorMessage(*resultp) );
+    }
+    return ok;
+}
+
+void
+DBMgr::LoadStoredMessages( DevIDRelay relayID, vector<MsgInfo>& msgs )
+{
+    METRICS_DB_TIMER();
     StrWPF query;
-    query.catf( fmt, msgids.c_str() );
-    logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
-    execSql( query );
+    query.catf( "devid=%d", relayID );
+    storedMessagesImpl( query, msgs, true );
 }
 
 void
-DBMgr::RemoveStoredMessages( const int* msgIDs, int nMsgIDs )
+DBMgr::LoadStoredMessages( const char* const connName, vector<MsgInfo>& msgs )
 {
-    if ( nMsgIDs > 0 ) {
-        StrWPF ids;
-        size_t len = 0;
-        int ii;
-        for ( ii = 0; ; ) {
-            ids.catf( "%d", msgIDs[ii] );
-            assert( len < sizeof(ids) );
-            if ( ++ii == nMsgIDs ) {
-                break;
+    METRICS_DB_TIMER();
+    StrWPF query;
+    query.catf( "connname = '%s'", connName );
+    storedMessagesImpl( query, msgs, false );
+}
+
+// Write newMsgs and mark sentIDs sent in a single transaction. On success
+// each of newMsgs has had its ID set to that of its new row.
+bool
+DBMgr::CommitStoredMessages( vector<MsgInfo>& newMsgs,
+                             const vector<int>& sentIDs )
+{
+    METRICS_DB_TIMER();
+    PGconn* conn = getThreadConn();
+    PGresult* result = PQexec( conn, "BEGIN" );
+    bool ok = PGRES_COMMAND_OK == PQresultStatus( result );
+    PQclear( result );
+
+    if ( ok && 0 < newMsgs.size() ) {
+        /* RETURNING's row order isn't promised, so each row carries its
+           index into newMsgs. ids come from the sequence up front, since
+           RETURNING can't see the source rows' ord. */
+        const char* msgCol = m_useB64 ? "msg64" : "msg";
+        StrWPF query;
+        query.catf( "WITH src AS (SELECT nextval('" MSGS_TABLE "_id_seq')"
+                    " AS id, v.* FROM (VALUES " );
+        for ( size_t ii = 0; ii < newMsgs.size(); ++ii ) {
+            const MsgInfo& msg = newMsgs[ii];
+            if ( 0 < ii ) {
+                query.append( "," );
+            }
+            if ( msg.hasConnname() ) {
+                query.catf( "(%zu, '%s', %d, %d, %d, ", ii,
+                            msg.connName.c_str(), msg.hid, msg.devID,
+                            msg.token() );
+            } else {
+                query.catf( "(%zu, NULL, NULL::integer, %d, NULL::integer, ",
+                            ii, msg.devID );
+            }
+            if ( m_useB64 ) {
+                gchar* b64 = g_base64_encode( msg.msg.data(), msg.msg.size() );
+                query.catf( "'%s', %zu)", b64, msg.msg.size() );
+                g_free( b64 );
             } else {
-                ids.append( "," );
+                size_t newLen;
+                uint8_t* bytes = PQescapeByteaConn( conn, msg.msg.data(),
+                                                    msg.msg.size(), &newLen );
+                assert( NULL != bytes );
+                query.catf( "E'%s'::bytea, %zu)", bytes, msg.msg.size() );
+                PQfreemem( bytes );
             }
         }
-        RemoveStoredMessages( ids );
+        query.catf( ") AS v(ord, connname, hid, devid, token, %s, msglen)),"
+                    " ins AS (INSERT INTO " MSGS_TABLE
+                    " (id, connname, hid, devid, token, %s, msglen)"
+                    " SELECT id, connname, hid, devid, token, %s, msglen"
+                    " FROM src RETURNING id)"
+                    " SELECT src.id, src.ord FROM src JOIN ins USING (id)",
+                    msgCol, msgCol, msgCol );
+
+        logf( XW_LOGINFO, "%s: inserting %zu msgs", __func__, newMsgs.size() );
+        result = PQexec( conn, query.c_str() );
+        ok = PGRES_TUPLES_OK == PQresultStatus( result )
+            && (int)newMsgs.size() == PQntuples( result );
+        if ( ok ) {
+            for ( int ii = 0; ok && ii < PQntuples( result ); ++ii ) {
+                size_t ord = strtoul( PQgetvalue( result, ii, 1 ), NULL, 10 );
+                ok = ord < newMsgs.size();
+                if ( ok ) {
+                    newMsgs[ord].setMsgID( atoi( PQgetvalue( result, ii, 0 ) ) );
+                }
+            }
+        } else {
+            logf( XW_LOGERROR, "%s: insert=>%s;%s", __func__,
+                  PQresStatus(PQresultStatus(result)),
+                  PQresultErrorMessage(result) );
+        }
+        PQclear( result );
+    }
+
+    if ( ok && 0 < sentIDs.size() ) {
+        StrWPF query;
+        query.catf(
+#ifdef HAVE_STIME
+                   "UPDATE " MSGS_TABLE " SET stime='now' "
+#else
+                   "DELETE FROM " MSGS_TABLE
+#endif
+                   " WHERE id IN (" );
+        vector<int>::const_iterator iter = sentIDs.begin();
+        for ( ; ; ) {
+            query.catf( "%d", *iter );
+            if ( ++iter == sentIDs.end() ) {
+                break;
+            }
+            query.append( "," );
+        }
+        query.append( ")" );
+
+        logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
+        result = PQexec( conn, query.c_str() );
+        ok = PGRES_COMMAND_OK == PQresultStatus( result );
+        if ( !ok ) {
+            logf( XW_LOGERROR, "%s: update=>%s;%s", __func__,
+                  PQresStatus(PQresultStatus(result)),
+                  PQresultErrorMessage(result) );
+        }
+        PQclear( result );
+    }
+
+    result = PQexec( conn, ok ? "COMMIT" : "ROLLBACK" );
+    ok = ok && PGRES_COMMAND_OK == PQresultStatus( result );
+    PQclear( result );
+
+    if ( !ok ) {
+        /* connection may be bad; start over next time */
+        clearThreadConn();
+    }
+    return ok;
+} /* CommitStoredMessages */
+
+void
+DBMgr::RemoveStoredMessages( const int* msgIDs, int nMsgIDs )
+{
+    Metrics::Get()->Inc( MC_MSGS_REMOVED, nMsgIDs );
+    MsgStore* store = MsgStore::Get();
+    if ( NULL != store ) {
+        store->Remove( msgIDs, nMsgIDs );
+    } else if ( nMsgIDs > 0 ) {
+        METRICS_DB_TIMER();
+        PGresult* result;
+        (void)idsQuery(
+#ifdef HAVE_STIME
+                       "UPDATE " MSGS_TABLE " SET stime='now'"
+#else
+                       "DELETE FROM " MSGS_TABLE
+#endif
+                       " WHERE id = ANY($$::integer[])", msgIDs, nMsgIDs,
+                       &result );
+        PQclear( result );
     }
 }
 
@@ -1277,16 +1784,7 @@ void
 DBMgr::RemoveStoredMessages( vector<int>& idv )
 {
     if ( 0 < idv.size() ) {
-        StrWPF ids;
-        vector<int>::const_iterator iter = idv.begin();
-        for ( ; ; ) {
-            ids.catf( "%d", *iter );
-            if ( ++iter == idv.end() ) {
-                break;
-            }
-            ids.catf( "," );
-        }
-        RemoveStoredMessages( ids );
+        RemoveStoredMessages( &idv[0], idv.size() );
     }
 }
 
@@ -1309,69 +1807,86 @@ DBMgr::getCountWhere( const char* table, string& test )
     return count;
 }
 
-void
-DBMgr::formatKey( StrWPF& key, const char* const connName, HostID hid )
-{
-    key.catf( "%s:%d", connName, hid );
-}
-
-bool
-DBMgr::hasNoMessages( const char* const connName, HostID hid )
+/* Keys for the no-messages cache: 63-bit, nonzero, and devids can't
+   collide with game slots */
+/* static */ uint64_t
+DBMgr::noMsgsKey( const char* const connName, HostID hid )
 {
-    StrWPF key;
-    formatKey( key, connName, hid );
-    MutexLock ml( &m_haveNoMessagesMutex );
-    bool result = m_haveNoMessagesConnname.find(key) != m_haveNoMessagesConnname.end();
-    return result;
+    uint64_t hash = 0xcbf29ce484222325ULL; /* FNV-1a */
+    for ( const char* ch = connName; '\0' != *ch; ++ch ) {
+        hash = (hash ^ (uint8_t)*ch) * 0x100000001b3ULL;
+    }
+    hash = (hash ^ hid) * 0x100000001b3ULL;
+    return (hash >> 2) | 1;
 }
 
-void
-DBMgr::setHasNoMessages( const char* const connName, HostID hid )
+/* static */ uint64_t
+DBMgr::noMsgsKey( DevIDRelay devid )
 {
-    StrWPF key;
-    formatKey( key, connName, hid );
-    {
-        MutexLock ml( &m_haveNoMessagesMutex );
-        m_haveNoMessagesConnname.insert( key );
-    }
-    assert( hasNoMessages( connName, hid ) );
+    return (1ULL << 62) | ((uint64_t)devid << 1);
 }
 
 void
 DBMgr::clearHasNoMessages( const char* const connName, HostID hid )
 {
-    StrWPF key;
-    formatKey( key, connName, hid );
-    {
-        MutexLock ml( &m_haveNoMessagesMutex );
-        m_haveNoMessagesConnname.erase( key );
-    }
-    assert( !hasNoMessages( connName, hid ) );
+    m_noMsgs->Clear( noMsgsKey( connName, hid ) );
 }
 
-bool DBMgr::hasNoMessages( DevIDRelay devid )
+void DBMgr::clearHasNoMessages( DevIDRelay devid )
 {
-    MutexLock ml( &m_haveNoMessagesMutex );
-    bool result = m_haveNoMessagesDevID.find(devid) != m_haveNoMessagesDevID.end();
-    return result;
+    NoteHasMessages( devid );
+
+    /* If another relay owns the device its cache needs clearing too */
+    ShardMgr* shards = ShardMgr::Get();
+    if ( NULL != shards ) {
+        shards->NoteHasMessages( devid );
+    }
 }
 
-void DBMgr::setHasNoMessages( DevIDRelay devid )
+void DBMgr::NoteHasMessages( DevIDRelay devid )
 {
-    {
-        MutexLock ml( &m_haveNoMessagesMutex );
-        m_haveNoMessagesDevID.insert( devid );
-    }
-    assert( hasNoMessages( devid ) );
+    m_noMsgs->Clear( noMsgsKey( devid ) );
 }
 
-void DBMgr::clearHasNoMessages( DevIDRelay devid )
+// Load which devices and game slots have messages waiting so that, while
+// everybody's reconnecting after a restart, those that don't needn't each
+// cost a query.
+void
+DBMgr::PrimeNoMessages()
 {
-    {
-        MutexLock ml( &m_haveNoMessagesMutex );
-        m_haveNoMessagesDevID.erase( devid );
+    if ( NULL == MsgStore::Get() ) {
+        METRICS_DB_TIMER();
+        const char* query = "SELECT DISTINCT devid, connname, hid FROM "
+            MSGS_TABLE
+#ifdef HAVE_STIME
+            " WHERE stime = 'epoch'"
+#endif
+            ;
+        PGresult* result = PQexec( getThreadConn(), query );
+        if ( PGRES_TUPLES_OK == PQresultStatus( result ) ) {
+            vector<uint64_t> pending;
+            int nTuples = PQntuples( result );
+            for ( int ii = 0; ii < nTuples; ++ii ) {
+                if ( !PQgetisnull( result, ii, 0 ) ) {
+                    DevIDRelay devid = strtoul( PQgetvalue( result, ii, 0 ),
+                                                NULL, 10 );
+                    pending.push_back( noMsgsKey( devid ) );
+                }
+                if ( !PQgetisnull( result, ii, 1 ) ) {
+                    pending.push_back( noMsgsKey( PQgetvalue( result, ii, 1 ),
+                                                  atoi( PQgetvalue( result, ii, 2 ) ) ) );
+                }
+            }
+            logf( XW_LOGINFO, "%s: %d keys have messages waiting", __func__,
+                  pending.size() );
+            m_noMsgs->Prime( pending );
+        } else {
+            logf( XW_LOGERROR, "%s: PQexec=>%s;%s", __func__,
+                  PQresStatus(PQresultStatus(result)),
+                  PQresultErrorMessage(result) );
+        }
+        PQclear( result );
     }
-    assert( !hasNoMessages( devid ) );
 }
 
 static int
@@ -33,6 +33,8 @@
 #include "devid.h"
 #include "strwpf.h"
 #include "querybld.h"
+#include "nomsgs.h"
+#include "rowcache.h"
 
 using namespace std;
 
@@ -47,12 +49,18 @@ class DBMgr {
     public:
         MsgInfo( int id, AddrInfo::ClientToken tok, bool hc ) { 
             m_msgID = id; m_token = tok; m_hasConnname = hc;
+            devID = DEVID_NONE; hid = 0;
         }
         bool hasConnname() const { return m_hasConnname; }
         AddrInfo::ClientToken token() const { return m_token; }
         int msgID() const { return m_msgID; }
+        void setMsgID( int id ) { m_msgID = id; }
 
         vector<uint8_t> msg;
+        /* where it's going; only MsgStore cares */
+        DevIDRelay devID;
+        HostID hid;
+        string connName;
     private:
         bool m_hasConnname;
         AddrInfo::ClientToken m_token;
@@ -123,6 +131,8 @@ class DBMgr {
     bool AddCID( const char* const connName, CookieID cid );
     void ClearCID( const char* connName );
     void RecordSent( const char* const connName, HostID hid, int nBytes );
+    /* nBytes[hid-1] for each of the game's four hosts; one UPDATE */
+    void RecordSent( const char* const connName, const int* nBytes );
     void RecordSent( const int* msgID, int nMsgIDs );
     void RecordAddress( const char* const connName, HostID hid, 
                         const AddrInfo* addr );
@@ -148,31 +158,65 @@ class DBMgr {
                       int len );
     int StoreMessage( const char* const connName, int destHid,
                       const uint8_t* const buf, int len );
-    void GetStoredMessages( DevIDRelay relayID, vector<MsgInfo>& msgs );
     void GetStoredMessages( const char* const connName, HostID hid, 
                             vector<DBMgr::MsgInfo>& msgs );
 
+    /* Like GetStoredMessages but for sending: the messages returned are
+       marked claimed so that another fetch (e.g. a duplicate request from a
+       reconnecting device) won't resend them until the ack's had time to
+       arrive.  Release any not sent, or whose ack fails. */
+    void ClaimStoredMessages( DevIDRelay relayID, vector<MsgInfo>& msgs );
+    void ClaimStoredMessages( const char* const connName, HostID hid, 
+                              vector<DBMgr::MsgInfo>& msgs );
+    void ReleaseStoredMessages( const int* msgIDs, int nMsgIDs );
+
     void RemoveStoredMessages( const int* msgID, int nMsgIDs );
     void RemoveStoredMessage( const int msgID );
     void RemoveStoredMessages( vector<int>& ids );
 
+    /* For MsgStore, which keeps stored messages in memory and only writes
+       the ones that stick around */
+    void LoadStoredMessages( DevIDRelay relayID, vector<MsgInfo>& msgs );
+    void LoadStoredMessages( const char* const connName,
+                             vector<MsgInfo>& msgs );
+    bool CommitStoredMessages( vector<MsgInfo>& newMsgs,
+                               const vector<int>& sentIDs );
+
     DevIDRelay getDevID( string& relayID );
 
+    /* Another relay's stored messages for a device we own */
+    void NoteHasMessages( DevIDRelay devid );
+
+    /* At startup, before devices reconnect */
+    void PrimeNoMessages();
+
+    /* for metrics */
+    void GetRowCacheSizes( int* nGames, int* nDevices );
+
  private:
     DBMgr();
     bool execSql( const string& query );
     bool execSql( const char* const query ); /* no-results query */
     bool execParams( QueryBuilder& qb );
-    void readArray( const char* const connName, const char* column, int arr[] );
+    bool getGameRow( const char* const connName, GameRow* row );
+    static string devKey( DevIDType typ, const string& devIDString );
+    void devicesChanged( DevIDRelay relayID, const DevID* host );
     DevIDRelay getDevID( const char* connName, int hid );
     DevIDRelay getDevID( const DevID* devID );
+    void getDevIDAndToken( const char* connName, int hid, DevIDRelay* devID,
+                           AddrInfo::ClientToken* token );
     int getCountWhere( const char* table, string& test );
-    void RemoveStoredMessages( string& msgIDs );
+    bool idsQuery( const char* fmt, const int* msgIDs, int nMsgIDs,
+                   PGresult** resultp );
     void decodeMessage( PGresult* result, bool useB64, int rowIndx, int b64indx, 
                         int byteaIndex, vector<uint8_t>& buf );
 
     void storedMessagesImpl( string query, vector<DBMgr::MsgInfo>& msgs, 
                              bool nullConnnameOK );
+    bool claimMessagesImpl( const char* test, QueryBuilder& qb,
+                            vector<DBMgr::MsgInfo>& msgs, bool nullConnnameOK );
+    void readMessages( PGresult* result, int firstCol,
+                       vector<DBMgr::MsgInfo>& msgs );
     int CountStoredMessages( const char* const connName, int hid );
     bool UpdateDevice( DevIDRelay relayID );
     void formatUpdate( QueryBuilder& qb, bool append, const char* const desc, 
@@ -183,13 +227,9 @@ class DBMgr {
     PGconn* getThreadConn( void );
     void clearThreadConn();
 
-    bool hasNoMessages( const char* const connName, HostID hid );
-    void setHasNoMessages( const char* const connName, HostID hid );
+    static uint64_t noMsgsKey( const char* const connName, HostID hid );
+    static uint64_t noMsgsKey( DevIDRelay devid );
     void clearHasNoMessages( const char* const connName, HostID hid );
-    void formatKey( StrWPF& key, const char* const connName, HostID hid );
-
-    bool hasNoMessages( DevIDRelay devid );
-    void setHasNoMessages( DevIDRelay devid );
     void clearHasNoMessages( DevIDRelay devid );
 
     void conn_key_alloc();
@@ -197,10 +237,13 @@ class DBMgr {
     bool m_useB64;
 
     char m_interval[64];
+    int m_claimSecs;            /* how long a claimed message stays so */
+
+    NoMsgsCache* m_noMsgs;
 
-    pthread_mutex_t m_haveNoMessagesMutex;
-    set<DevIDRelay> m_haveNoMessagesDevID;
-    set<StrWPF> m_haveNoMessagesConnname;
+    RowCache<GameRow>* m_games;         /* by connName */
+    RowCache<DevIDRelay>* m_devices;    /* by devKey() */
+    RowCache<string>* m_devKeys;        /* devKey() by relayID, to undo */
 }; /* DBMgr */
 
 
@@ -1,7 +1,6 @@
-/* -*- compile-command: "make -k -j3"; -*- */
-
+/* -*-mode: C; fill-column: 78; c-basic-offset: 4; -*- */
 /* 
- * Copyright 2013 by Eric House (xwords@eehouse.org).  All rights reserved.
+ * Copyright 2018 by Eric House (xwords@eehouse.org).  All rights reserved.
  *
  * This program is free software; you can redistribute it and/or
  * modify it under the terms of the GNU General Public License
@@ -19,11 +18,18 @@
  */
 
 #include <glib.h>
+#include <sched.h>
 #include <algorithm>
 
 #include "devmgr.h"
+#include "configs.h"
+#include "dbmgr.h"
 #include "mlock.h"
 
+#define DEVMGR_DEFAULT_SLOTS (1 << 18)
+/* How far past a key's home slot it may live */
+#define DEVMGR_MAX_PROBE 32
+
 static DevMgr* s_instance = NULL;
 
 /* static */ DevMgr*
@@ -35,48 +41,235 @@ DevMgr::Get()
     return s_instance;
 } /* Get */
 
+DevMgr::DevMgr()
+    : m_nEvicted(0)
+{
+    int nSlots;
+    if ( !RelayConfigs::GetConfigs()->GetValueFor( "DEVMGR_SLOTS", &nSlots )
+         || nSlots < DEVMGR_MAX_PROBE ) {
+        nSlots = DEVMGR_DEFAULT_SLOTS;
+    }
+    uint32_t size = DEVMGR_MAX_PROBE;
+    while ( size < (uint32_t)nSlots ) {
+        size <<= 1;
+    }
+    m_mask = size - 1;
+
+    int secs;
+    if ( !RelayConfigs::GetConfigs()->GetValueFor( "UDP_RECYLE_INTERVAL",
+                                                   &secs ) ) {
+        assert(0);
+    }
+    m_recycleMillis = secs * 1000;
+    m_addrExpireMillis = 2 * m_recycleMillis;
+
+    m_devs = (DevSlot*)calloc( size, sizeof(*m_devs) );
+    m_addrs = (AddrSlot*)calloc( size, sizeof(*m_addrs) );
+    assert( !!m_devs && !!m_addrs );
+    pthread_mutex_init( &m_insertLock, NULL );
+
+    logf( XW_LOGINFO, "%s: %d slots per table", __func__, size );
+}
+
+/* static */ uint64_t
+DevMgr::addrKey( const AddrInfo::AddrUnion* saddr )
+{
+    const struct sockaddr_in* sin = &saddr->u.addr_in;
+    return ((uint64_t)sin->sin_addr.s_addr << 16) | sin->sin_port;
+}
+
+/* murmur3's finalizers: devids are often sequential, and addresses differ
+   mostly in their low bits */
+/* static */ uint32_t
+DevMgr::hashDev( DevIDRelay devid )
+{
+    uint32_t hash = devid;
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6b;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+/* static */ uint32_t
+DevMgr::hashAddr( uint64_t key )
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return (uint32_t)key;
+}
+
+/* Seqlock read: an odd sequence means a writer's inside, and a changed one
+   that the copy may be torn. */
+template<class SLOT> /* static */ void
+DevMgr::readSlot( const SLOT* slot, SLOT* copy )
+{
+    for ( ; ; ) {
+        uint32_t seq = slot->m_seq;
+        if ( 0 == (seq & 1) ) {
+            __sync_synchronize();
+            memcpy( (void*)copy, (const void*)slot, sizeof(*copy) );
+            __sync_synchronize();
+            if ( seq == slot->m_seq ) {
+                copy->m_seq = seq;
+                break;
+            }
+        }
+        sched_yield();
+    }
+}
+
+/* Writers make the sequence odd for as long as they're changing the slot;
+   the CAS also keeps them from interleaving with each other. */
+template<class SLOT> /* static */ uint32_t
+DevMgr::lockSlot( SLOT* slot )
+{
+    for ( ; ; ) {
+        uint32_t seq = slot->m_seq;
+        if ( 0 == (seq & 1)
+             && __sync_bool_compare_and_swap( &slot->m_seq, seq, seq + 1 ) ) {
+            return seq + 1;
+        }
+        sched_yield();
+    }
+}
+
+template<class SLOT> /* static */ void
+DevMgr::unlockSlot( SLOT* slot, uint32_t seq )
+{
+    __sync_synchronize();
+    slot->m_seq = seq + 1;
+}
+
+/* Returns the index of devid's slot, filling in copy, or -1 */
+int
+DevMgr::findDev( DevIDRelay devid, DevSlot* copy )
+{
+    uint32_t home = hashDev( devid );
+    for ( int ii = 0; ii < DEVMGR_MAX_PROBE; ++ii ) {
+        int indx = (home + ii) & m_mask;
+        readSlot( &m_devs[indx], copy );
+        if ( devid == copy->m_devid ) {
+            return indx;
+        } else if ( DBMgr::DEVID_NONE == copy->m_devid ) {
+            break;
+        }
+    }
+    return -1;
+}
+
+int
+DevMgr::findAddr( uint64_t key, AddrSlot* copy )
+{
+    uint32_t home = hashAddr( key );
+    for ( int ii = 0; ii < DEVMGR_MAX_PROBE; ++ii ) {
+        int indx = (home + ii) & m_mask;
+        readSlot( &m_addrs[indx], copy );
+        if ( key == copy->m_key ) {
+            return indx;
+        } else if ( 0 == copy->m_key ) {
+            break;
+        }
+    }
+    return -1;
+}
+
+/* Pick a slot for a devid that's not in the table: the first never-used or
+   forgotten one in its window, else the least recently seen.  Caller holds
+   m_insertLock and has checked devid's not already there. */
+int
+DevMgr::claimDev_locked( DevIDRelay devid )
+{
+    uint32_t home = hashDev( devid );
+    int oldest = -1;
+    uint32_t oldestSeen = 0;
+    for ( int ii = 0; ii < DEVMGR_MAX_PROBE; ++ii ) {
+        int indx = (home + ii) & m_mask;
+        DevSlot copy;
+        readSlot( &m_devs[indx], &copy );
+        if ( DBMgr::DEVID_NONE == copy.m_devid || 0 == copy.m_seen ) {
+            return indx;
+        } else if ( -1 == oldest || copy.m_seen < oldestSeen ) {
+            oldest = indx;
+            oldestSeen = copy.m_seen;
+        }
+    }
+    ++m_nEvicted;
+    logf( XW_LOGERROR, "%s: table full near devid %d; evicting devid %d",
+          __func__, devid, m_devs[oldest].m_devid );
+    return oldest;
+}
+
+int
+DevMgr::claimAddr_locked( uint64_t key, uint32_t when )
+{
+    uint32_t home = hashAddr( key );
+    int oldest = -1;
+    uint32_t oldestSeen = 0;
+    for ( int ii = 0; ii < DEVMGR_MAX_PROBE; ++ii ) {
+        int indx = (home + ii) & m_mask;
+        AddrSlot copy;
+        readSlot( &m_addrs[indx], &copy );
+        if ( 0 == copy.m_key || addrExpired( &copy, when ) ) {
+            return indx;
+        } else if ( -1 == oldest || copy.m_lastSeen < oldestSeen ) {
+            oldest = indx;
+            oldestSeen = copy.m_lastSeen;
+        }
+    }
+    ++m_nEvicted;
+    logf( XW_LOGERROR, "%s: table full; evicting an address", __func__ );
+    return oldest;
+}
+
 void
 DevMgr::rememberDevice( DevIDRelay devid, const AddrInfo::AddrUnion* saddr )
 {
     if ( DBMgr::DEVID_NONE != devid ) {
-        gchar* b64 = g_base64_encode( (uint8_t*)&saddr->u.addr, 
-                                      sizeof(saddr->u.addr) );
-
         XW_LogLevel level = XW_LOGINFO;
         if ( willLog( level ) ) {
+            gchar* b64 = g_base64_encode( (uint8_t*)&saddr->u.addr, 
+                                          sizeof(saddr->u.addr) );
             logf( level, "%s(devid=%d, saddr='%s')", __func__, devid, b64 );
+            g_free( b64 );
         }
 
-        time_t now = time( NULL );
-        UDPAddrRec rec( saddr, now );
-
-        MutexLock ml( &m_mapLock );
-
-        // C++'s insert doesn't replace, but the result tells whether the key was
-        // already there and provides an iterator via which it can be updated
-        pair<map<DevIDRelay,UDPAddrRec>::iterator, bool> result = 
-            m_devAddrMap.insert( pair<DevIDRelay,UDPAddrRec>( devid, rec ) );
-        if ( !result.second ) {
-            logf( XW_LOGINFO, "%s: replacing address for %d", __func__, devid );
-            result.first->second = rec;
+        uint32_t now = time( NULL );
+        bool done = false;
+        DevSlot copy;
+        int indx = findDev( devid, &copy );
+        if ( 0 <= indx ) {
+            // Usual case: we know the device and take only its slot. Make
+            // sure it wasn't reused between our look and our lock.
+            DevSlot* slot = &m_devs[indx];
+            uint32_t seq = lockSlot( slot );
+            if ( devid == slot->m_devid ) {
+                slot->m_addr = *saddr;
+                slot->m_seen = now;
+                done = true;
+            }
+            unlockSlot( slot, seq );
         }
 
-        // Don't think we need m_addrDevMap anymore
-        map<AddrInfo::AddrUnion, DevIDRelay>::iterator iter = 
-            m_addrDevMap.find(*saddr); 
-        if ( m_addrDevMap.end() != iter && devid != iter->second ) {
-            logf( XW_LOGERROR, "%s: addr '%s' already listed (for devid %d)",
-                  __func__, b64, iter->second );
-            // assert(0);              // assert instead about age?
-            iter->second = devid;
-        } else {
-            m_addrDevMap.insert( pair<AddrInfo::AddrUnion, 
-                                 DevIDRelay>(*saddr, devid ) );
+        if ( !done ) {
+            MutexLock ml( &m_insertLock );
+            indx = findDev( devid, &copy ); /* maybe added while we waited */
+            if ( 0 > indx ) {
+                indx = claimDev_locked( devid );
+            }
+            DevSlot* slot = &m_devs[indx];
+            uint32_t seq = lockSlot( slot );
+            slot->m_devid = devid;
+            slot->m_addr = *saddr;
+            slot->m_seen = now;
+            unlockSlot( slot, seq );
         }
 
-        logf( XW_LOGINFO, "dev->addr map now contains %d entries", 
-              m_devAddrMap.size() );
-        g_free( b64 );
+        noteAddrDevice( saddr, devid );
     }
 }
 
@@ -86,38 +279,171 @@ DevMgr::rememberDevice( DevIDRelay devid, const AddrInfo* addr )
     rememberDevice( devid, addr->saddr() );
 }
 
-const AddrInfo::AddrUnion* 
-DevMgr::get( DevIDRelay devid )
+bool
+DevMgr::get( DevIDRelay devid, AddrInfo::AddrUnion* saddr )
+{
+    DevSlot copy;
+    bool found = 0 <= findDev( devid, &copy ) && 0 != copy.m_seen;
+    if ( found ) {
+        *saddr = copy.m_addr;
+        logf( XW_LOGINFO, "%s: found addr for %.8x; is %d seconds old",
+              __func__, devid, time(NULL) - copy.m_seen );
+    }
+    logf( XW_LOGINFO, "%s(devid=%d)=>%s", __func__, devid,
+          found ? "true" : "false" );
+    return found;
+}
+
+DevIDRelay
+DevMgr::devFor( const AddrInfo::AddrUnion* saddr )
+{
+    DevIDRelay result = DBMgr::DEVID_NONE;
+    AddrSlot copy;
+    if ( 0 <= findAddr( addrKey( saddr ), &copy ) ) {
+        result = copy.m_devid;
+    }
+    return result;
+}
+
+void
+DevMgr::noteAddrDevice( const AddrInfo::AddrUnion* saddr, DevIDRelay devid )
 {
-    const AddrInfo::AddrUnion* result = NULL;
-    MutexLock ml( &m_mapLock );
-    map<DevIDRelay,UDPAddrRec>::const_iterator iter;
-    iter = m_devAddrMap.find( devid );
-    if ( m_devAddrMap.end() != iter ) {
-        result = &iter->second.m_addr;
-        logf( XW_LOGINFO, "%s: found addr for %.8x; is %d seconds old", __func__,
-              devid, time(NULL) - iter->second.m_added );
+    uint64_t key = addrKey( saddr );
+    bool done = false;
+    AddrSlot copy;
+    int indx = findAddr( key, &copy );
+    if ( 0 <= indx && devid == copy.m_devid ) {
+        done = true;            /* nothing to change: no need to lock */
+    } else if ( 0 <= indx ) {
+        AddrSlot* slot = &m_addrs[indx];
+        uint32_t seq = lockSlot( slot );
+        if ( key == slot->m_key ) {
+            if ( DBMgr::DEVID_NONE != slot->m_devid ) {
+                logf( XW_LOGERROR, "%s: addr already listed (for devid %d)",
+                      __func__, slot->m_devid );
+            }
+            slot->m_devid = devid;
+            done = true;
+        }
+        unlockSlot( slot, seq );
+    }
+
+    if ( !done ) {
+        // Normally UDPAger's refresh added it; a TCP device's address or a
+        // reused slot needs it added here
+        struct timespec tp;
+        clock_gettime( CLOCK_MONOTONIC, &tp );
+        uint32_t now = (tp.tv_sec * 1000) + (tp.tv_nsec / 1000000);
+
+        MutexLock ml( &m_insertLock );
+        indx = findAddr( key, &copy );
+        bool isNew = 0 > indx;
+        if ( isNew ) {
+            indx = claimAddr_locked( key, now );
+        }
+        AddrSlot* slot = &m_addrs[indx];
+        uint32_t seq = lockSlot( slot );
+        if ( isNew ) {
+            slot->m_key = key;
+            slot->m_created = slot->m_lastSeen = now;
+        }
+        slot->m_devid = devid;
+        unlockSlot( slot, seq );
+    }
+}
+
+// An address is valid as long as we keep hearing from it within
+// UDP_RECYLE_INTERVAL.  When we hear from it but it's been too long, assume
+// it's new and give it a new timestamp.
+int
+DevMgr::refreshAddr( const AddrInfo::AddrUnion* saddr, uint32_t when )
+{
+    int result = -1;
+    bool done = false;
+    uint64_t key = addrKey( saddr );
+    AddrSlot copy;
+    int indx = findAddr( key, &copy );
+    if ( 0 <= indx ) {
+        AddrSlot* slot = &m_addrs[indx];
+        uint32_t seq = lockSlot( slot );
+        if ( key == slot->m_key ) {
+            // Packets can be handled out of order; never move backwards
+            if ( (int32_t)(when - slot->m_lastSeen) <= 0 ) {
+                result = 0;
+            } else {
+                uint32_t interval = when - slot->m_lastSeen;
+                if ( m_recycleMillis >= interval ) {
+                    result = interval;
+                } else {
+                    slot->m_created = when;
+                    slot->m_devid = DBMgr::DEVID_NONE;
+                }
+                slot->m_lastSeen = when;
+            }
+            done = true;
+        }
+        unlockSlot( slot, seq );
+    }
+
+    if ( !done ) {
+        MutexLock ml( &m_insertLock );
+        indx = findAddr( key, &copy );
+        if ( 0 > indx ) {
+            indx = claimAddr_locked( key, when );
+            AddrSlot* slot = &m_addrs[indx];
+            uint32_t seq = lockSlot( slot );
+            slot->m_key = key;
+            slot->m_devid = DBMgr::DEVID_NONE;
+            slot->m_created = slot->m_lastSeen = when;
+            unlockSlot( slot, seq );
+        } else {
+            result = 0;         /* lost a race to add it; close enough */
+        }
     }
-    logf( XW_LOGINFO, "%s(devid=%d)=>%p", __func__, devid, result );
     return result;
 }
 
+bool
+DevMgr::addrCreated( const AddrInfo::AddrUnion* saddr, uint32_t when,
+                     uint32_t* created )
+{
+    AddrSlot copy;
+    /* expired: not heard from in long enough it's likely recycled */
+    bool found = 0 <= findAddr( addrKey( saddr ), &copy )
+        && !addrExpired( &copy, when );
+    if ( found ) {
+        *created = copy.m_created;
+    }
+    return found;
+}
+
 int
 DevMgr::forgetDevices( vector<DevIDRelay>& devids )
 {
     int count = 0;
-    MutexLock ml( &m_mapLock );
     if ( 0 == devids.size() ) {
-        count = m_devAddrMap.size();
-        m_devAddrMap.clear();
+        for ( uint32_t ii = 0; ii <= m_mask; ++ii ) {
+            DevSlot* slot = &m_devs[ii];
+            uint32_t seq = lockSlot( slot );
+            if ( DBMgr::DEVID_NONE != slot->m_devid && 0 != slot->m_seen ) {
+                slot->m_seen = 0;
+                ++count;
+            }
+            unlockSlot( slot, seq );
+        }
     } else {
         vector<DevIDRelay>::const_iterator devidIter;
         for ( devidIter = devids.begin(); devids.end() != devidIter; ++devidIter ) {
-            map<DevIDRelay,UDPAddrRec>::iterator iter = 
-                m_devAddrMap.find( *devidIter );
-            if ( m_devAddrMap.end() != iter ) {
-                ++count;
-                m_devAddrMap.erase( iter );
+            DevSlot copy;
+            int indx = findDev( *devidIter, &copy );
+            if ( 0 <= indx ) {
+                DevSlot* slot = &m_devs[indx];
+                uint32_t seq = lockSlot( slot );
+                if ( *devidIter == slot->m_devid && 0 != slot->m_seen ) {
+                    slot->m_seen = 0;
+                    ++count;
+                }
+                unlockSlot( slot, seq );
             }
         }
     }
@@ -127,66 +453,55 @@ DevMgr::forgetDevices( vector<DevIDRelay>& devids )
 void
 DevMgr::getKnownDevices( vector<DevIDRelay>& devids )
 {
-    MutexLock ml( &m_mapLock );
-    map<DevIDRelay,UDPAddrRec>::const_iterator iter;
-    for ( iter = m_devAddrMap.begin(); m_devAddrMap.end() != iter; ++iter ) {
-        devids.push_back( iter->first );
+    for ( uint32_t ii = 0; ii <= m_mask; ++ii ) {
+        DevSlot copy;
+        readSlot( &m_devs[ii], &copy );
+        if ( DBMgr::DEVID_NONE != copy.m_devid && 0 != copy.m_seen ) {
+            devids.push_back( copy.m_devid );
+        }
     }
 }
 
 // Print info about every device, ordered by how old they are (how long since
-// last remembered).  Build a separate array with the mutex held, then release
-// it, so that as much work as possible is done on the calling thread without
-// holding up more important stuff.
+// last remembered).  Nothing's locked while walking the table, so a device
+// remembered meanwhile may or may not be listed.
 void
 DevMgr::printDevices( StrWPF& str, const vector<DevIDRelay>& devids )
 {
-    map<uint32_t, DevIDRelay> agedDevs;
-    {
-        MutexLock ml( &m_mapLock );
-        map<DevIDRelay, UDPAddrRec>::const_iterator iter;
-        if ( 0 != devids.size() ) {
-            for ( vector<DevIDRelay>::const_iterator iter2 = devids.begin();
-                  devids.end() != iter2; ++iter2 ) {
-                iter = m_devAddrMap.find(*iter2);
-                if ( m_devAddrMap.end() != iter ) {
-                    addDevice( agedDevs, iter );
-                }
+    vector<pair<uint32_t, DevIDRelay> > agedDevs;
+    DevSlot copy;
+    if ( 0 != devids.size() ) {
+        for ( vector<DevIDRelay>::const_iterator iter = devids.begin();
+              devids.end() != iter; ++iter ) {
+            if ( 0 <= findDev( *iter, &copy ) && 0 != copy.m_seen ) {
+                agedDevs.push_back( pair<uint32_t, DevIDRelay>(copy.m_seen,
+                                                               copy.m_devid) );
             }
-        } else {
-            for ( iter = m_devAddrMap.begin(); iter != m_devAddrMap.end(); ++iter ) {
-                addDevice( agedDevs, iter );
+        }
+    } else {
+        for ( uint32_t ii = 0; ii <= m_mask; ++ii ) {
+            readSlot( &m_devs[ii], &copy );
+            if ( DBMgr::DEVID_NONE != copy.m_devid && 0 != copy.m_seen ) {
+                agedDevs.push_back( pair<uint32_t, DevIDRelay>(copy.m_seen,
+                                                               copy.m_devid) );
             }
         }
     }
 
-    // Now sort by age and print
-    vector<uint32_t> keys;
-    map<uint32_t, DevIDRelay>::const_iterator iter;
-    for ( iter = agedDevs.begin(); agedDevs.end() != iter; ++iter ) {
-        keys.push_back( iter->first );
-    }
-
-    std::sort( keys.begin(), keys.end() );
-    std::reverse( keys.begin(), keys.end() );
+    // Now sort by age, most recently seen first, and print
+    std::sort( agedDevs.begin(), agedDevs.end() );
+    std::reverse( agedDevs.begin(), agedDevs.end() );
 
     time_t now = time(NULL);
-    vector<uint32_t>::const_iterator keysIter;
+    vector<pair<uint32_t, DevIDRelay> >::const_iterator iter;
     int row = 0;
-    for ( keysIter = keys.begin(); keys.end() != keysIter; ++keysIter ) {
-        uint32_t age = *keysIter;
-        DevIDRelay devid = agedDevs.find( age )->second;
-        age = now - age;
+    for ( iter = agedDevs.begin(); agedDevs.end() != iter; ++iter ) {
+        uint32_t age = now - iter->first;
         str.catf( "%.3d: devid: % 10d; age: %.3d seconds\n", ++row, 
-                  devid, age );
+                  iter->second, age );
+    }
+    if ( 0 == devids.size() ) {
+        str.catf( "(%d slots per table; %d evictions)\n", m_mask + 1,
+                  m_nEvicted );
     }
-}
-
-void
-DevMgr::addDevice( map<uint32_t, DevIDRelay>& devs, 
-                   map<DevIDRelay,UDPAddrRec>::const_iterator iter )
-{
-    DevIDRelay devid = iter->first;
-    uint32_t added = iter->second.m_added;
-    devs.insert( pair<uint32_t, DevIDRelay>(added, devid) );
 }
@@ -1,11 +1,11 @@
 /* -*-mode: C; fill-column: 78; c-basic-offset: 4; -*- */
 /* 
- * Copyright 2013 by Eric House (xwords@eehouse.org).  All rights reserved.
+ * Copyright 2018 by Eric House (xwords@eehouse.org).  All rights reserved.
  *
  * This program is free software; you can redistribute it and/or
  * modify it under the terms of the GNU General Public License
  * as published by the Free Software Foundation; either version 2
- * of the License, or (at your option.
+ * of the License, or (at your option) any later version.
  *
  * This program is distributed in the hope that it will be useful,
  * but WITHOUT ANY WARRANTY; without even the implied warranty of
@@ -17,7 +17,6 @@
  * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
  */
 
-
 #ifndef _DEVMGR_H_
 #define _DEVMGR_H_
 
@@ -29,11 +28,32 @@
 
 using namespace std;
 
+/* Where each device was last heard from, and for each address when we first
+ * and last heard from it and which device was using it.  Both are consulted
+ * on nearly every packet, so rather than maps behind a mutex they're fixed
+ * size open-addressed tables whose slots are seqlocks: readers copy a slot
+ * and retry if a writer touched it meanwhile, and writers of an existing key
+ * take only that slot.  Adding a key (a device or address we haven't seen
+ * before) is serialized on m_insertLock.  Slots are never emptied, since
+ * that would break probe chains; instead forgotten devices and addresses not
+ * heard from in twice UDP_RECYLE_INTERVAL get reused by later inserts, and
+ * if a key's whole probe window is live the stalest slot in it is.
+ *
+ * DEVMGR_SLOTS sets the size of each table (rounded up to a power of two).
+ */
+
 class DevMgr {
  public:
     static DevMgr* Get();
     void rememberDevice( DevIDRelay devid, const AddrInfo* addr );
-    const AddrInfo::AddrUnion* get( DevIDRelay devid );
+    bool get( DevIDRelay devid, AddrInfo::AddrUnion* saddr );
+    DevIDRelay devFor( const AddrInfo::AddrUnion* saddr );
+
+    /* Address ages, for UDPAger. refreshAddr() returns milliseconds since
+       the address was last seen, or -1 if it's new or was reset */
+    int refreshAddr( const AddrInfo::AddrUnion* saddr, uint32_t when );
+    bool addrCreated( const AddrInfo::AddrUnion* saddr, uint32_t when,
+                      uint32_t* created );
 
     /* Called from ctrl port */
     void printDevices( StrWPF& str, 
@@ -43,28 +63,54 @@ class DevMgr {
 
  private:
 
-    void rememberDevice( DevIDRelay devid, const AddrInfo::AddrUnion* saddr );
-
-    /* destructor's never called.... 
-    ~DevMgr() { pthread_mutex_destroy( &m_mapLock ); }
-    */
-
-    class UDPAddrRec {
+    /* m_seen is time(NULL), or 0 once forgotten */
+    class DevSlot {
     public:
-        UDPAddrRec( const AddrInfo::AddrUnion* addr, time_t tim ) {
-            m_addr = *addr; m_added = tim;
-        }
+        volatile uint32_t m_seq;
+        DevIDRelay m_devid;     /* DEVID_NONE: never used */
+        uint32_t m_seen;
         AddrInfo::AddrUnion m_addr;
-        time_t m_added;
     };
 
-    DevMgr() { pthread_mutex_init( &m_mapLock, NULL ); }
-    void addDevice( map<uint32_t, DevIDRelay>& devs, 
-                    map<DevIDRelay,UDPAddrRec>::const_iterator iter );
+    /* times are milliseconds, as in AddrInfo::created() */
+    class AddrSlot {
+    public:
+        volatile uint32_t m_seq;
+        DevIDRelay m_devid;
+        uint64_t m_key;         /* 0: never used */
+        uint32_t m_created;
+        uint32_t m_lastSeen;
+    };
+
+    DevMgr();
+    void rememberDevice( DevIDRelay devid, const AddrInfo::AddrUnion* saddr );
+    void noteAddrDevice( const AddrInfo::AddrUnion* saddr, DevIDRelay devid );
+
+    static uint64_t addrKey( const AddrInfo::AddrUnion* saddr );
+    static uint32_t hashDev( DevIDRelay devid );
+    static uint32_t hashAddr( uint64_t key );
+
+    template<class SLOT> static void readSlot( const SLOT* slot, SLOT* copy );
+    template<class SLOT> static uint32_t lockSlot( SLOT* slot );
+    template<class SLOT> static void unlockSlot( SLOT* slot, uint32_t seq );
+
+    int findDev( DevIDRelay devid, DevSlot* copy );
+    int findAddr( uint64_t key, AddrSlot* copy );
+    int claimDev_locked( DevIDRelay devid );
+    int claimAddr_locked( uint64_t key, uint32_t when );
+    /* when can predate m_lastSeen: a stored address is asked about with
+       the time its packet arrived, and the device's sent more since */
+    bool addrExpired( const AddrSlot* slot, uint32_t when ) const {
+        return (int32_t)(when - slot->m_lastSeen) > (int32_t)m_addrExpireMillis;
+    }
 
-    map<DevIDRelay,UDPAddrRec> m_devAddrMap;
-    map<AddrInfo::AddrUnion, DevIDRelay> m_addrDevMap; 
-    pthread_mutex_t m_mapLock;
+    DevSlot* m_devs;
+    AddrSlot* m_addrs;
+    uint32_t m_mask;            /* nSlots - 1 */
+    uint32_t m_recycleMillis;   /* config: UDP_RECYLE_INTERVAL */
+    uint32_t m_addrExpireMillis;
+    pthread_mutex_t m_insertLock;
+    int m_nEvicted;
 };
 
 #endif
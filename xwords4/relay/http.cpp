@@ -22,62 +22,64 @@
 
 #include <stdio.h>
 #include <unistd.h>
-#include <netdb.h>		/* gethostbyname */
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/socket.h>
-#include <unistd.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <stdlib.h>
 #include <string.h>
-#include <iostream>
-#include <sstream>
 #include <pthread.h>
 #include <assert.h>
-#include <sys/select.h>
 #include <stdarg.h>
 #include <sys/time.h>
 
 #include "ctrl.h"
 #include "cref.h"
 #include "crefmgr.h"
-#include "mlock.h"
 #include "xwrelay_priv.h"
 #include "configs.h"
 #include "lstnrmgr.h"
 #include "http.h"
+#include "metrics.h"
+#include "strwpf.h"
+
+/* Longest request (line plus headers) we'll wait for */
+#define HTTP_MAX_REQUEST 4096
 
 /*
  * http://www.jbox.dk/sanos/webserver.htm has code for a trivial web server.  Good example.
  */
 
 static void
-send_header( FILE* fil, const char* title )
+send_header( StrWPF& out, const char* title, size_t contentLen,
+             bool keepAlive, const char* contentType = "text/html" )
 {
-    fprintf( fil, "HTTP/1.0 %d %s\r\n", 200, title );
-    fprintf( fil, "Server: xwrelay\r\n" );
-    fprintf( fil, "Content-Type: text/html\r\n" );
-    fprintf( fil, "Connection: close\r\n");
+    out.catf( "HTTP/1.1 %d %s\r\n", 200, title );
+    out.catf( "Server: xwrelay\r\n" );
+    out.catf( "Content-Type: %s\r\n", contentType );
+    out.catf( "Content-Length: %d\r\n", contentLen );
+    out.catf( "Connection: %s\r\n", keepAlive ? "keep-alive" : "close" );
 
-    fprintf( fil, "\r\n");
+    out.catf( "\r\n");
 }
 
 static void
-send_meta( FILE* fil, const CrefMgrInfo* info ) 
+send_meta( StrWPF& out, const CrefMgrInfo* info ) 
 {
     FILE* css;
     RelayConfigs* cfg = RelayConfigs::GetConfigs();
     char pathbuf[256] = { '\0' };
 
-    fprintf( fil, "<head>" );
+    out.catf( "<head>" );
 
     if ( !!cfg ) {
         int refreshSecs;
         if (  cfg->GetValueFor( "WWW_REFRESH_SECS", &refreshSecs ) ) {
-            fprintf( fil, "<meta http-equiv=\"refresh\" content=\"%d\" />",
-                     refreshSecs );
+            out.catf( "<meta http-equiv=\"refresh\" content=\"%d\" />",
+                      refreshSecs );
         }
 
         (void)cfg->GetValueFor( "WWW_CSS_PATH", pathbuf, sizeof(pathbuf) );
@@ -92,50 +94,49 @@ send_meta( FILE* fil, const CrefMgrInfo* info )
                 if ( nread <= 0 ) {
                     break;
                 }
-                (void) fwrite( buf, 1, nread, fil );
+                out.append( buf, nread );
             }
             fclose( css );
         }
     }
 
-	fprintf( fil, "<title>relay: %d/%d</title>\n", info->m_nRoomsFilled, 
-             info->m_nCrefsCurrent );
-    fprintf( fil, "</head>" );
+    out.catf( "<title>relay: %d/%d</title>\n", info->m_nRoomsFilled, 
+              info->m_nCrefsCurrent );
+    out.catf( "</head>" );
 }
 
 static void
-printTail( FILE* fil )
+printTail( StrWPF& out )
 {
     char buf[128];
 
     /* print version and uptime */
-    fprintf( fil, "<div class=\"header\">Relay version</div>" );
+    out.catf( "<div class=\"header\">Relay version</div>" );
     format_rev( buf, sizeof(buf) );
-    fprintf( fil, "<p>%s</p>", buf );
+    out.catf( "<p>%s</p>", buf );
 }
 
 static void
-printCrefs( FILE* fil, const CrefMgrInfo* info, bool isLocal )
+printCrefs( StrWPF& out, const CrefMgrInfo* info, bool isLocal )
 {
-    fprintf( fil, "<div class=\"header\">Connections</div>" );
-    fprintf( fil, "<table><tr>" );
-    fprintf( fil,
-             "<th>Room</th>"
-             "<th>Lang</th>"
-             "<th>ConnName</th>"
-             "<th>ID</th>"
-             "<th>For</th>"
-             "<th>Bytes</th>"
-             "<th>Expect</th>"
-             "<th>Here</th>"
-             "<th>State</th>"
-             "<th>Host IDs</th>"
-             "<th>Seeds</th>"
-             );
+    out.catf( "<div class=\"header\">Connections</div>" );
+    out.catf( "<table><tr>" );
+    out.catf( "<th>Room</th>"
+              "<th>Lang</th>"
+              "<th>ConnName</th>"
+              "<th>ID</th>"
+              "<th>For</th>"
+              "<th>Bytes</th>"
+              "<th>Expect</th>"
+              "<th>Here</th>"
+              "<th>State</th>"
+              "<th>Host IDs</th>"
+              "<th>Seeds</th>"
+              );
     if ( isLocal ) {
-        fprintf( fil, "<th>Host IPs</th>" );
+        out.catf( "<th>Host IPs</th>" );
     }
-    fprintf( fil, "</tr>\n" );
+    out.catf( "</tr>\n" );
 
     time_t curTime = uptime();
     int ii;
@@ -146,168 +147,393 @@ printCrefs( FILE* fil, const CrefMgrInfo* info, bool isLocal )
         format_uptime( curTime - crefInfo->m_startTime, conntime, 
                        sizeof(conntime) );
 
-        fprintf( fil, "<tr>"
-                 "<td>%s</td>"  /* name */
-                 "<td>%d</td>"  /* lang */
-                 "<td>%s</td>"  /* conn name */
-                 "<td>%d</td>"  /* cookie id */
-                 "<td>%s</td>"  /* conntime */
-                 "<td>%d</td>"  /* players */
-                 "<td>%d</td>"  /* players here */
-                 "<td>%s</td>"  /* State */
-                 "<td>%s</td>"  /* Hosts */
-                 "<td>%s</td>"  /* Seeds */
-                 ,
-                 crefInfo->m_cookie.c_str(),
-                 crefInfo->m_langCode,
-                 crefInfo->m_connName.c_str(),
-                 crefInfo->m_cookieID,
-                 conntime,
-                 crefInfo->m_nPlayersSought, crefInfo->m_nPlayersHere, 
-                 stateString( crefInfo->m_curState ),
-                 crefInfo->m_hostsIds.c_str(),
-                 crefInfo->m_hostSeeds.c_str()
-                 );
+        out.catf( "<tr>"
+                  "<td>%s</td>"  /* name */
+                  "<td>%d</td>"  /* lang */
+                  "<td>%s</td>"  /* conn name */
+                  "<td>%d</td>"  /* cookie id */
+                  "<td>%s</td>"  /* conntime */
+                  "<td>%d</td>"  /* players */
+                  "<td>%d</td>"  /* players here */
+                  "<td>%s</td>"  /* State */
+                  "<td>%s</td>"  /* Hosts */
+                  "<td>%s</td>"  /* Seeds */
+                  ,
+                  crefInfo->m_cookie.c_str(),
+                  crefInfo->m_langCode,
+                  crefInfo->m_connName.c_str(),
+                  crefInfo->m_cid,
+                  conntime,
+                  crefInfo->m_nPlayersSought, crefInfo->m_nPlayersHere, 
+                  stateString( crefInfo->m_curState ),
+                  crefInfo->m_hostsIds.c_str(),
+                  crefInfo->m_hostSeeds.c_str()
+                  );
         
         if ( isLocal ) {
-            fprintf( fil, "<td>%s</td>",   /* Ip addrs */
-                     crefInfo->m_hostIps.c_str() );
+            out.catf( "<td>%s</td>",   /* Ip addrs */
+                      crefInfo->m_hostIps.c_str() );
         }
-        fprintf( fil, "</tr>\n" );
+        out.catf( "</tr>\n" );
     }
-    fprintf( fil, "</table>\n" );
+    out.catf( "</table>\n" );
 } /* printCrefs */
 
 static void
-printStats( FILE* fil, const CrefMgrInfo* info, bool isLocal )
+printStats( StrWPF& out, const CrefMgrInfo* info, bool isLocal )
 {
     char uptime1[64];
     char uptime2[64];
     format_uptime( uptime(), uptime1, sizeof(uptime1) );
     format_uptime( time(NULL) - info->m_startTimeSpawn, uptime2, 
                    sizeof(uptime2) );
-    fprintf( fil, "<div class=\"header\">Stats</div>" );
-    fprintf( fil, "<table>" );
-    fprintf( fil, "<tr>"
-             "<th>Ports</th><th>Uptime</th><th>Spawns</th><th>Spawn Utime</th>"
-             "<th>Rooms filled</th><th>Games in play</th></tr>" );
-    fprintf( fil, "<tr><td>%s</td><td>%s</td><td>%d</td>"
-             "<td>%s</td><td>%d</td><td>%d</td></tr>\n", 
-             info->m_ports, uptime1, GetNSpawns(), uptime2, 
-             info->m_nRoomsFilled, info->m_nCrefsCurrent );
-    fprintf( fil, "</table>" );
+    out.catf( "<div class=\"header\">Stats</div>" );
+    out.catf( "<table>" );
+    out.catf( "<tr>"
+              "<th>Ports</th><th>Uptime</th><th>Spawns</th><th>Spawn Utime</th>"
+              "<th>Rooms filled</th><th>Games in play</th></tr>" );
+    out.catf( "<tr><td>%s</td><td>%s</td><td>%d</td>"
+              "<td>%s</td><td>%d</td><td>%d</td></tr>\n", 
+              info->m_ports, uptime1, GetNSpawns(), uptime2, 
+              info->m_nRoomsFilled, info->m_nCrefsCurrent );
+    out.catf( "</table>" );
 }
 
-class HttpInstance {
- public:
-    HttpInstance( int sock, HttpState* state ) {
-        m_sock = sock;
-        m_state = state;
+static void
+printPage( StrWPF& out, const CrefMgrInfo* info, bool isLocal )
+{
+    out.catf( "<html>" );
+    send_meta( out, info );
+    out.catf( "<body><div class=\"main\">" );
+
+    printStats( out, info, isLocal );
+
+    printCrefs( out, info, isLocal );
+
+    printTail( out );
+
+    out.catf( "</div></body></html>" );
+}
+
+HttpServer::HttpServer( int listener, int sampleInterval )
+    : m_listener(listener)
+    , m_sampleInterval(sampleInterval)
+    , m_fresh(NULL)
+    , m_cur(NULL)
+{
+    RelayConfigs* cfg = RelayConfigs::GetConfigs();
+    if ( !cfg->GetValueFor( "WWW_IDLE_SECS", &m_idleSecs ) ) {
+        m_idleSecs = 15;
+    }
+    if ( !cfg->GetValueFor( "WWW_MAX_CONNS", &m_maxConns ) ) {
+        m_maxConns = 32;
     }
-    int m_sock;
-    HttpState* m_state;
-};
+    if ( 0 >= m_sampleInterval ) {
+        m_sampleInterval = 1;
+    }
+
+    int err = fcntl( m_listener, F_SETFL, O_NONBLOCK );
+    assert( 0 == err );
+
+    /* So there's always something to serve */
+    m_fresh = render();
+
+    pthread_t thread;
+    int result = pthread_create( &thread, NULL, thread_main, this );
+    if ( 0 == result ) {
+        pthread_detach( thread );
+    } else {
+        logf( XW_LOGERROR, "%s: pthread_create failed: %s", __func__,
+              strerror(errno) );
+    }
+}
 
-static void*
-http_thread_main( void* arg )
+/* static */ void*
+HttpServer::thread_main( void* arg )
 {
     blockSignals();
+    return ((HttpServer*)arg)->threadProc();
+}
 
-    HttpInstance* inst = (HttpInstance*)arg;
-    HttpState* state = inst->m_state;
-    int sock = inst->m_sock;
+void*
+HttpServer::threadProc()
+{
+    for ( ; ; ) {
+        sleep( m_sampleInterval );
+        Snapshot* snap = render();
+        // If the loop hasn't picked up the last one nobody's seen it: drop
+        // it for this one
+        Snapshot* stale = __sync_lock_test_and_set( &m_fresh, snap );
+        delete stale;
+    }
+    return NULL;
+}
 
-    char buf[512];
-    ssize_t totalRead = 0;
+HttpServer::Snapshot*
+HttpServer::render()
+{
+    Snapshot* snap = new Snapshot;
+
+    CrefMgrInfo info;
+    CRefMgr::Get()->GetStats( info );
+    for ( int isLocal = 0; isLocal < 2; ++isLocal ) {
+        StrWPF page;
+        printPage( page, &info, isLocal );
+        snap->m_html[isLocal].swap( page );
+    }
 
-    while ( totalRead <= 4 ) {  /* have we read enough for GET? */
-        ssize_t nread = read( sock, buf+totalRead, sizeof(buf)-1-totalRead );
-        if ( nread == 0 ) { // EOF
-            break;
-        } else if ( nread > 0 ) {
-            buf[nread] = '\0';
-        } else {
-            logf( XW_LOGERROR, "%s: read() got error: %s", __func__,
-                  strerror(errno) );
-            break;
+    StrWPF metrics;
+    Metrics::Get()->Render( metrics );
+    snap->m_metrics.swap( metrics );
+    return snap;
+}
+
+/* Adopt the newest snapshot if there is one.  Only the loop's thread
+   touches m_cur and refcounts. */
+HttpServer::Snapshot*
+HttpServer::current()
+{
+    Snapshot* fresh = __sync_lock_test_and_set( &m_fresh, NULL );
+    if ( NULL != fresh ) {
+        if ( NULL != m_cur ) {
+            release( m_cur );
         }
-        totalRead += nread;
+        m_cur = fresh;
+        ++m_cur->m_refs;
     }
+    assert( NULL != m_cur );
+    return m_cur;
+}
 
-    if ( 0 == strncasecmp( "GET ", buf, 3 ) ) {
-        struct sockaddr_in name;
-        socklen_t namelen = sizeof(name);
+void
+HttpServer::release( Snapshot* snap )
+{
+    assert( 0 < snap->m_refs );
+    if ( 0 == --snap->m_refs ) {
+        delete snap;
+    }
+}
 
-        bool isLocal = 0 == getpeername( sock, (AddrInfo*)&name, 
-                                         &namelen );
-        if ( isLocal ) {
-            in_addr_t s_addr = name.sin_addr.s_addr;
-            isLocal = 0x7f000001 == htonl(s_addr);
+int
+HttpServer::AddToFDSets( fd_set* rfds, fd_set* wfds, int highest )
+{
+    time_t now = time( NULL );
+    map<int, Conn*>::iterator iter = m_conns.begin();
+    while ( m_conns.end() != iter ) {
+        Conn* conn = iter->second;
+        ++iter;                 /* closeConn() erases */
+        if ( now - conn->m_lastActive > m_idleSecs ) {
+            logf( XW_LOGINFO, "%s: closing idle socket %d", __func__,
+                  conn->m_sock );
+            closeConn( conn );
+        } else {
+            FD_SET( conn->m_sock, conn->writing() ? wfds : rfds );
+            if ( conn->m_sock > highest ) {
+                highest = conn->m_sock;
+            }
         }
+    }
 
-        MutexLock ml(&state->m_dataMutex);
+    /* At the limit, leave new ones in the backlog */
+    if ( (int)m_conns.size() < m_maxConns ) {
+        FD_SET( m_listener, rfds );
+        if ( m_listener > highest ) {
+            highest = m_listener;
+        }
+    }
+    return highest;
+}
 
-        /* We'll handle as many http connections as folks want to throw at us,
-           but will only fetch from the crefmgr infrequently, caching the data
-           for next time.  Only one thread at a time gets to read from it,
-           ensuring we don't nuke it from under somebody.  */
-        time_t curTime = time( NULL );
+bool
+HttpServer::GetTimeout( struct timeval* tv )
+{
+    bool haveConns = 0 < m_conns.size();
+    if ( haveConns ) {
+        tv->tv_sec = m_idleSecs;
+        tv->tv_usec = 0;
+    }
+    return haveConns;
+}
 
-        if ( state->m_nextFetch < curTime ) {
-            delete state->m_crefInfo;
-            state->m_crefInfo = NULL;
+int
+HttpServer::Handle( fd_set* rfds, fd_set* wfds )
+{
+    int nHandled = 0;
+
+    vector<Conn*> ready;
+    map<int, Conn*>::const_iterator iter;
+    for ( iter = m_conns.begin(); m_conns.end() != iter; ++iter ) {
+        Conn* conn = iter->second;
+        if ( FD_ISSET( conn->m_sock, conn->writing() ? wfds : rfds ) ) {
+            ready.push_back( conn );
         }
-        if ( state->m_crefInfo == NULL ) {
-            state->m_crefInfo = new CrefMgrInfo();
-            CRefMgr::Get()->GetStats( *state->m_crefInfo );
-            state->m_nextFetch = curTime + state->m_sampleInterval;
+    }
+    for ( vector<Conn*>::const_iterator iter = ready.begin();
+          ready.end() != iter; ++iter ) {
+        Conn* conn = *iter;
+        ++nHandled;
+        bool ok = conn->writing() ? writeConn( conn ) : readConn( conn );
+        if ( !ok ) {
+            closeConn( conn );
         }
-        const CrefMgrInfo* info = state->m_crefInfo;
+    }
 
-        FILE* fil = fdopen( sock, "r+" );
-        fseek( fil, 0, SEEK_CUR ); // reverse stream
-        
-        send_header( fil, "status page" );
-        fprintf( fil, "<html>" );
-        send_meta( fil, info );
-        fprintf( fil, "<body><div class=\"main\">" );
+    if ( FD_ISSET( m_listener, rfds ) ) {
+        ++nHandled;
+        acceptConn();
+    }
+    return nHandled;
+}
 
-        printStats( fil, info, isLocal );
+void
+HttpServer::acceptConn()
+{
+    struct sockaddr_in name;
+    socklen_t namelen = sizeof(name);
+    int sock = accept( m_listener, (struct sockaddr*)&name, &namelen );
+    if ( 0 > sock ) {
+        if ( EAGAIN != errno && EWOULDBLOCK != errno ) {
+            logf( XW_LOGERROR, "%s: accept() failed: %s", __func__,
+                  strerror(errno) );
+        }
+    } else if ( FD_SETSIZE <= sock ) {
+        logf( XW_LOGERROR, "%s: socket %d too big for select()", __func__,
+              sock );
+        close( sock );
+    } else {
+        int err = fcntl( sock, F_SETFL, O_NONBLOCK );
+        assert( 0 == err );
+        bool isLocal = 0x7f000001 == ntohl( name.sin_addr.s_addr );
+        m_conns[sock] = new Conn( sock, isLocal );
+    }
+}
 
-        printCrefs( fil, info, isLocal );
+/* Returns false if the connection should be closed */
+bool
+HttpServer::readConn( Conn* conn )
+{
+    char buf[1024];
+    ssize_t nRead = read( conn->m_sock, buf, sizeof(buf) );
+    if ( 0 == nRead ) {         /* EOF */
+        return false;
+    } else if ( 0 > nRead ) {
+        return EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno;
+    }
 
-        printTail( fil );
+    conn->m_lastActive = time( NULL );
+    conn->m_in.append( buf, nRead );
+    return parseRequest( conn );
+}
 
-        fprintf( fil, "</div></body></html>" );
+/* If m_in holds a whole request, set up the response to it and try writing
+   it.  Returns false if the connection should be closed. */
+bool
+HttpServer::parseRequest( Conn* conn )
+{
+    size_t end = conn->m_in.find( "\r\n\r\n" );
+    if ( string::npos == end ) {
+        return conn->m_in.size() < HTTP_MAX_REQUEST;
+    }
+    string request( conn->m_in, 0, end + 2 );
+    conn->m_in.erase( 0, end + 4 );
 
-        fclose( fil );
-    } else {
+    if ( 0 != strncasecmp( "GET ", request.c_str(), 4 ) ) {
         logf( XW_LOGINFO, "NOT a GET" );
+        return false;
+    }
+
+    /* Lower-case so header names can be matched */
+    for ( size_t ii = 0; ii < request.size(); ++ii ) {
+        request[ii] = tolower( request[ii] );
+    }
+    size_t lineEnd = request.find( "\r\n" );
+    bool is11 = string::npos != request.rfind( "http/1.1", lineEnd );
+    if ( is11 ) {
+        conn->m_keepAlive =
+            string::npos == request.find( "\r\nconnection: close" );
+    } else {
+        conn->m_keepAlive =
+            string::npos != request.find( "\r\nconnection: keep-alive" );
     }
-    close( sock );
 
-    delete inst;
+    Snapshot* snap = current();
+    ++snap->m_refs;
+    conn->m_snap = snap;
+
+    const char* metricsPath = "get /metrics";
+    size_t metricsLen = strlen( metricsPath );
+    StrWPF header;
+    if ( 0 == request.compare( 0, metricsLen, metricsPath )
+         && NULL != strchr( " ?", request[metricsLen] ) ) {
+        conn->m_body = &snap->m_metrics;
+        send_header( header, "OK", conn->m_body->size(), conn->m_keepAlive,
+                     "text/plain; version=0.0.4" );
+    } else {
+        conn->m_body = &snap->m_html[conn->m_isLocal];
+        send_header( header, "OK", conn->m_body->size(), conn->m_keepAlive );
+    }
+    conn->m_header.swap( header );
+    conn->m_sent = 0;
 
-    return NULL;
-} /* http_thread_main */
+    /* Usually it all fits in the socket buffer and we're done */
+    return writeConn( conn );
+}
 
-void
-run_http_thread( HttpState* state )
+/* Returns false if the connection should be closed */
+bool
+HttpServer::writeConn( Conn* conn )
 {
-    pthread_t thread;
-    sockaddr newaddr;
-    socklen_t siz = sizeof(newaddr);
-    int sock = accept( state->ctrl_sock, &newaddr, &siz );
+    size_t headerLen = conn->m_header.size();
+    size_t total = headerLen + conn->m_body->size();
+    while ( conn->m_sent < total ) {
+        struct iovec iov[2];
+        int nIov = 0;
+        if ( conn->m_sent < headerLen ) {
+            iov[nIov].iov_base = (void*)(conn->m_header.data() + conn->m_sent);
+            iov[nIov].iov_len = headerLen - conn->m_sent;
+            ++nIov;
+            iov[nIov].iov_base = (void*)conn->m_body->data();
+            iov[nIov].iov_len = conn->m_body->size();
+            ++nIov;
+        } else {
+            size_t offset = conn->m_sent - headerLen;
+            iov[nIov].iov_base = (void*)(conn->m_body->data() + offset);
+            iov[nIov].iov_len = conn->m_body->size() - offset;
+            ++nIov;
+        }
 
-    HttpInstance* inst = new HttpInstance( sock, state );
-    int result = pthread_create( &thread, NULL, http_thread_main, 
-                                 (void*)inst );
-    if ( 0 == result ) {
-        pthread_detach( thread );
-    } else {
-        logf( XW_LOGERROR, "%s: pthread_create failed: %s", __func__,
-              strerror(errno) );
+        ssize_t nWritten = writev( conn->m_sock, iov, nIov );
+        if ( 0 > nWritten ) {
+            if ( EAGAIN == errno || EWOULDBLOCK == errno ) {
+                return true;    /* select() will tell us when */
+            } else if ( EINTR != errno ) {
+                logf( XW_LOGERROR, "%s: writev() failed: %s", __func__,
+                      strerror(errno) );
+                return false;
+            }
+        } else {
+            conn->m_sent += nWritten;
+            conn->m_lastActive = time( NULL );
+        }
+    }
+
+    release( conn->m_snap );
+    conn->m_snap = NULL;
+    conn->m_body = NULL;
+
+    /* A pipelining client may already have sent the next one */
+    return conn->m_keepAlive && parseRequest( conn );
+}
+
+void
+HttpServer::closeConn( Conn* conn )
+{
+    if ( NULL != conn->m_snap ) {
+        release( conn->m_snap );
     }
-} /* run_http_thread */
+    close( conn->m_sock );
+    m_conns.erase( conn->m_sock );
+    delete conn;
+}
 
 #endif /* DO_HTTP */
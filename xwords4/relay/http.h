@@ -19,19 +19,85 @@
  * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
  */
 
-
 #ifndef _HTTP_H_
 #define _HTTP_H_
 
-typedef struct _HttpState {
-    int ctrl_sock;
-    int m_sampleInterval;
-    time_t m_nextFetch;
-    pthread_mutex_t m_dataMutex;
-    CrefMgrInfo* m_crefInfo;
-} HttpState;
+#include <sys/select.h>
+#include <time.h>
+#include <map>
+#include <string>
+
+using namespace std;
+
+/* The status page and /metrics, served from the main select() loop rather
+ * than a thread per connection.  Sockets are non-blocking and kept alive
+ * between requests (HTTP/1.1, or 1.0 asking for it).  Nothing's rendered
+ * per request: a background thread renders everything every
+ * WWW_SAMPLE_INTERVAL seconds into an immutable snapshot and hands it to
+ * the loop, and responses writev() a header and the snapshot's bytes.  A
+ * connection keeps a reference to the snapshot it's writing from, so a
+ * newer one can replace it meanwhile.
+ */
+
+class HttpServer {
+ public:
+    HttpServer( int listener, int sampleInterval );
+
+    /* Add our sockets, returning the new highest */
+    int AddToFDSets( fd_set* rfds, fd_set* wfds, int highest );
+    /* Service those that are ready, returning how many were */
+    int Handle( fd_set* rfds, fd_set* wfds );
+    /* How long select() may block before idle connections need closing;
+       false if forever is OK */
+    bool GetTimeout( struct timeval* tv );
+
+ private:
+    /* Refcounted only on the loop's thread */
+    class Snapshot {
+    public:
+        Snapshot() : m_refs(0) {}
+        string m_html[2];       /* indexed by isLocal */
+        string m_metrics;
+        int m_refs;
+    };
+
+    class Conn {
+    public:
+        Conn( int sock, bool isLocal )
+            : m_sock(sock), m_isLocal(isLocal), m_lastActive(time(NULL)),
+              m_snap(NULL), m_body(NULL), m_sent(0), m_keepAlive(false) {}
+        bool writing() const { return NULL != m_body; }
+
+        int m_sock;
+        bool m_isLocal;
+        time_t m_lastActive;
+        string m_in;            /* read, not yet parsed */
+        string m_header;
+        Snapshot* m_snap;       /* m_body's owner */
+        const string* m_body;
+        size_t m_sent;
+        bool m_keepAlive;
+    };
+
+    static void* thread_main( void* arg );
+    void* threadProc();
+    Snapshot* render();
+    Snapshot* current();
+    void release( Snapshot* snap );
+
+    void acceptConn();
+    bool readConn( Conn* conn );
+    bool parseRequest( Conn* conn );
+    bool writeConn( Conn* conn );
+    void closeConn( Conn* conn );
 
-void run_http_thread( HttpState* state );
-/* void stop_http_threads(); */
+    int m_listener;
+    int m_sampleInterval;       /* config: WWW_SAMPLE_INTERVAL */
+    int m_idleSecs;             /* config: WWW_IDLE_SECS */
+    int m_maxConns;             /* config: WWW_MAX_CONNS */
+    Snapshot* volatile m_fresh; /* rendered, not yet picked up */
+    Snapshot* m_cur;
+    map<int, Conn*> m_conns;
+};
 
 #endif
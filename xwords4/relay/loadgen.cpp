@@ -0,0 +1,889 @@
+/* -*- compile-command: "make loadgen"; -*- */
+
+/*
+ * Copyright 2018 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+/* Synthetic load for a (local) relay.  Simulates many devices speaking the
+ * per-device UDP protocol, each on its own socket so the relay sees a
+ * distinct address for each.  Devices register, pair up into two-player
+ * games via CONNECT, and once ALLHERE arrives loop sending game messages to
+ * their partner, keepalives and requests for stored messages, acking
+ * everything the relay sends them.
+ *
+ * Reports, per XWRelayReg command sent, how long the relay took to ack it,
+ * plus end-to-end times for REG->REGRSP, CONNECT->CONNECT_RESP and for a
+ * game message to reach the partner device.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <assert.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <map>
+#include <queue>
+#include <string>
+#include <vector>
+
+#include "xwrelay.h"
+
+using namespace std;
+
+#define DEFAULT_HOST "localhost"
+#define DEFAULT_PORT 10997      /* UDP_PORT in xwrelay.conf */
+#define DEFAULT_NDEVS 1000
+#define DEFAULT_NTHREADS 4
+#define DEFAULT_DURATION 30
+#define DEFAULT_INTERVAL_MS 1000
+#define DEFAULT_REG_RATE 500
+#define DEFAULT_MSG_LEN 64
+#define DEFAULT_GAME_PCT 60
+#define DEFAULT_FETCH_PCT 20
+
+#define CLIENT_VERS 5
+#define TIMEOUT_USECS (10 * 1000000)
+#define DRAIN_USECS (2 * 1000000)
+
+typedef uint8_t HostID;
+
+/* Rows in the report.  The first XWPDEV_N_ELEMS are time-to-relay-ack for
+   each command we send; the rest are end-to-end. */
+enum { STAT_REGRSP = XWPDEV_N_ELEMS,
+       STAT_CONNECT_RESP,
+       STAT_DELIVERY,
+       N_STATS,
+};
+
+static struct {
+    const char* host;
+    int port;
+    int nDevs;
+    int nThreads;
+    int duration;
+    int intervalMS;
+    int regRate;
+    int msgLen;
+    int gamePct;                /* % of a playing device's sends */
+    int fetchPct;               /* same, for RQSTMSGS; the rest keepalives */
+    struct sockaddr_storage addr;
+    socklen_t addrLen;
+    uint64_t start;
+} g_cfg;
+
+static uint64_t
+now_usecs( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static const char*
+statName( int stat )
+{
+    const char* str;
+# define CASE_STR(c)  case c: str = #c; break
+    switch( stat ) {
+    CASE_STR(XWPDEV_REG);
+    CASE_STR(XWPDEV_KEEPALIVE);
+    CASE_STR(XWPDEV_RQSTMSGS);
+    CASE_STR(XWPDEV_MSG);
+    CASE_STR(XWPDEV_DELGAME);
+    CASE_STR(XWPDEV_INVITE);
+    case STAT_REGRSP: str = "REG->REGRSP"; break;
+    case STAT_CONNECT_RESP: str = "CONNECT->CONNECT_RESP"; break;
+    case STAT_DELIVERY: str = "MSG delivery"; break;
+    default:
+        str = "<unknown>";
+        break;
+    }
+# undef CASE_STR
+    return str;
+}
+
+typedef enum { ST_UNREG,
+               ST_REGISTERING,
+               ST_CONNECTING,
+               ST_WAITING,      /* connected; waiting for partner */
+               ST_PLAYING,
+               ST_DEAD,
+} DevState;
+#define N_STATES (ST_DEAD + 1)
+
+static const char*
+stateName( int state )
+{
+    const char* names[] = { "unreg", "registering", "connecting",
+                            "waiting", "playing", "dead", };
+    return names[state];
+}
+
+class Stats {
+ public:
+    Stats() : m_nPacketsSent(0), m_nPacketsRcvd(0), m_nErrors(0) {
+        memset( m_nSent, 0, sizeof(m_nSent) );
+        memset( m_nLost, 0, sizeof(m_nLost) );
+        memset( m_nEverIn, 0, sizeof(m_nEverIn) );
+        memset( m_nEndedIn, 0, sizeof(m_nEndedIn) );
+    }
+
+    void sent( int stat ) { ++m_nSent[stat]; }
+    void lost( int stat ) { ++m_nLost[stat]; }
+    void sample( int stat, uint64_t usecs ) {
+        m_samples[stat].push_back( usecs );
+    }
+    void reached( DevState state ) { ++m_nEverIn[state]; }
+    void ended( DevState state ) { ++m_nEndedIn[state]; }
+
+    void merge( const Stats& other ) {
+        for ( int ii = 0; ii < N_STATS; ++ii ) {
+            m_nSent[ii] += other.m_nSent[ii];
+            m_nLost[ii] += other.m_nLost[ii];
+            m_samples[ii].insert( m_samples[ii].end(),
+                                  other.m_samples[ii].begin(),
+                                  other.m_samples[ii].end() );
+        }
+        for ( int ii = 0; ii < N_STATES; ++ii ) {
+            m_nEverIn[ii] += other.m_nEverIn[ii];
+            m_nEndedIn[ii] += other.m_nEndedIn[ii];
+        }
+        m_nPacketsSent += other.m_nPacketsSent;
+        m_nPacketsRcvd += other.m_nPacketsRcvd;
+        m_nErrors += other.m_nErrors;
+    }
+
+    void print( FILE* out, double secs ) {
+        fprintf( out, "%-22s %8s %8s %6s %9s %9s %9s %9s\n", "command",
+                 "sent", "done", "lost", "per sec", "p50 ms", "p99 ms",
+                 "p999 ms" );
+        for ( int ii = 0; ii < N_STATS; ++ii ) {
+            vector<uint32_t>& samples = m_samples[ii];
+            if ( 0 == m_nSent[ii] && 0 == samples.size() ) {
+                continue;
+            }
+            sort( samples.begin(), samples.end() );
+            fprintf( out, "%-22s %8d %8zu %6d %9.1f %9.2f %9.2f %9.2f\n",
+                     statName( ii ), m_nSent[ii], samples.size(),
+                     m_nLost[ii], samples.size() / secs, pct( samples, 0.50 ),
+                     pct( samples, 0.99 ), pct( samples, 0.999 ) );
+        }
+        fprintf( out, "packets sent: %lld; received: %lld; errors: %d\n",
+                 (long long)m_nPacketsSent, (long long)m_nPacketsRcvd,
+                 m_nErrors );
+
+        /* Only devices that got to playing send game traffic: if few did,
+           the numbers above are mostly registration and connect retries */
+        fprintf( out, "%-22s %8s %8s\n", "device state", "reached",
+                 "ended in" );
+        for ( int ii = ST_REGISTERING; ii < N_STATES; ++ii ) {
+            fprintf( out, "%-22s %8d %8d\n", stateName( ii ), m_nEverIn[ii],
+                     m_nEndedIn[ii] );
+        }
+    }
+
+    int64_t m_nPacketsSent;
+    int64_t m_nPacketsRcvd;
+    int m_nErrors;
+
+ private:
+    static double pct( const vector<uint32_t>& sorted, double frac ) {
+        double result = 0.0;
+        if ( 0 < sorted.size() ) {
+            size_t indx = frac * sorted.size();
+            if ( indx >= sorted.size() ) {
+                indx = sorted.size() - 1;
+            }
+            result = sorted[indx] / 1000.0;
+        }
+        return result;
+    }
+
+    int m_nSent[N_STATS];
+    int m_nLost[N_STATS];
+    vector<uint32_t> m_samples[N_STATS];
+    int m_nEverIn[N_STATES];    /* devices that got there at all */
+    int m_nEndedIn[N_STATES];
+};
+
+typedef struct _Pending {
+    int stat;
+    uint64_t sent;
+} Pending;
+
+class Device {
+ public:
+    Device() : m_sock(-1), m_state(ST_UNREG), m_nextPacketID(0),
+               m_stateSince(0), m_hostID(0), m_cid(0), m_reached(0) {}
+    int m_sock;
+    int m_index;                /* global */
+    DevState m_state;
+    uint32_t m_nextPacketID;
+    uint64_t m_stateSince;
+    string m_relayID;
+    HostID m_hostID;
+    uint16_t m_cid;
+    map<uint32_t, Pending> m_pending; /* packetID => what and when */
+    unsigned int m_reached;     /* bit per DevState */
+};
+
+static void
+putVLI( vector<uint8_t>& out, uint32_t nn )
+{
+    bool done;
+    do {
+        uint8_t byt = nn & 0x7F;
+        nn >>= 7;
+        done = 0 == nn;
+        if ( done ) {
+            byt |= 0x80;
+        }
+        out.push_back( byt );
+    } while ( !done );
+}
+
+static void
+putVLIStr( vector<uint8_t>& out, const string& str )
+{
+    putVLI( out, str.size() );
+    out.insert( out.end(), str.begin(), str.end() );
+}
+
+static void
+putShort( vector<uint8_t>& out, uint16_t val )
+{
+    out.push_back( val >> 8 );
+    out.push_back( val & 0xFF );
+}
+
+static void
+putLong( vector<uint8_t>& out, uint32_t val )
+{
+    putShort( out, val >> 16 );
+    putShort( out, val & 0xFFFF );
+}
+
+static bool
+getVLI( const uint8_t** bufpp, const uint8_t* end, uint32_t* out )
+{
+    uint32_t result = 0;
+    const uint8_t* in = *bufpp;
+    bool done = false;
+    for ( int count = 0; !done && in < end && count < 5; ++count ) {
+        unsigned int byt = *in++;
+        done = 0 != (byt & 0x80);
+        result |= (byt & 0x7F) << (7 * count);
+    }
+    if ( done ) {
+        *bufpp = in;
+        *out = result;
+    }
+    return done;
+}
+
+static bool
+getVLIStr( const uint8_t** bufpp, const uint8_t* end, string& out )
+{
+    uint32_t len;
+    bool success = getVLI( bufpp, end, &len ) && *bufpp + len <= end;
+    if ( success ) {
+        out.assign( (const char*)*bufpp, len );
+        *bufpp += len;
+    }
+    return success;
+}
+
+class Worker {
+ public:
+    Worker( int first, int count );
+    static void* thread_main( void* arg );
+    const Stats& stats() const { return m_stats; }
+
+ private:
+    void* threadProc();
+    void schedule( int indx, uint64_t when );
+    void act( Device& dev, uint64_t now );
+    void expire( Device& dev, uint64_t now );
+    void readFrom( Device& dev );
+    void handlePacket( Device& dev, const uint8_t* ptr, const uint8_t* end );
+    void handleGameMsg( Device& dev, const uint8_t* ptr, const uint8_t* end );
+
+    void startPacket( Device& dev, vector<uint8_t>& out, XWRelayReg cmd,
+                      uint32_t* packetIDP );
+    void send( Device& dev, vector<uint8_t>& packet, int stat,
+               uint32_t packetID );
+    void sendReg( Device& dev );
+    void sendConnect( Device& dev );
+    void sendGameMsg( Device& dev, const vector<uint8_t>& payload, int stat );
+    void sendIDOnly( Device& dev, XWRelayReg cmd );
+    void sendAck( Device& dev, uint32_t packetID );
+    void setState( Device& dev, DevState state ) {
+        dev.m_state = state;
+        dev.m_stateSince = now_usecs();
+        if ( 0 == (dev.m_reached & (1 << state)) ) {
+            dev.m_reached |= 1 << state;
+            m_stats.reached( state );
+        }
+    }
+    Device& partner( Device& dev ) {
+        return m_devs[(dev.m_index ^ 1) - m_first];
+    }
+
+    int m_first;
+    vector<Device> m_devs;
+    int m_epoll;
+    typedef pair<uint64_t, int> Due;
+    priority_queue<Due, vector<Due>, greater<Due> > m_due;
+    uint64_t m_stopSending;
+    Stats m_stats;
+};
+
+Worker::Worker( int first, int count )
+    : m_first(first)
+    , m_devs(count)
+{
+    m_epoll = epoll_create1( 0 );
+    assert( 0 <= m_epoll );
+
+    uint64_t usecsPerReg = 1000000 / g_cfg.regRate;
+    for ( int ii = 0; ii < count; ++ii ) {
+        Device& dev = m_devs[ii];
+        dev.m_index = first + ii;
+        dev.m_sock = socket( g_cfg.addr.ss_family, SOCK_DGRAM, 0 );
+        if ( 0 > dev.m_sock
+             || 0 != connect( dev.m_sock, (struct sockaddr*)&g_cfg.addr,
+                              g_cfg.addrLen ) ) {
+            fprintf( stderr, "socket/connect failed for device %d: %s\n",
+                     dev.m_index, strerror(errno) );
+            exit( 1 );
+        }
+        fcntl( dev.m_sock, F_SETFL, O_NONBLOCK );
+
+        struct epoll_event evt;
+        memset( &evt, 0, sizeof(evt) );
+        evt.events = EPOLLIN;
+        evt.data.u32 = ii;
+        (void)epoll_ctl( m_epoll, EPOLL_CTL_ADD, dev.m_sock, &evt );
+
+        /* ramp up: spread registrations out */
+        schedule( ii, g_cfg.start + dev.m_index * usecsPerReg );
+    }
+    m_stopSending = g_cfg.start + (uint64_t)g_cfg.duration * 1000000;
+}
+
+/* static */ void*
+Worker::thread_main( void* arg )
+{
+    return ((Worker*)arg)->threadProc();
+}
+
+void*
+Worker::threadProc()
+{
+    uint64_t quitTime = m_stopSending + DRAIN_USECS;
+    for ( ; ; ) {
+        uint64_t now = now_usecs();
+        if ( now >= quitTime ) {
+            break;
+        }
+        while ( 0 < m_due.size() && m_due.top().first <= now ) {
+            int indx = m_due.top().second;
+            m_due.pop();
+            if ( now < m_stopSending ) {
+                act( m_devs[indx], now );
+            }
+        }
+
+        int timeout = 100;
+        if ( 0 < m_due.size() ) {
+            uint64_t next = m_due.top().first;
+            timeout = next <= now ? 0 : min( (uint64_t)timeout,
+                                             (next - now + 999) / 1000 );
+        }
+
+        struct epoll_event evts[64];
+        int nEvts = epoll_wait( m_epoll, evts, 64, timeout );
+        for ( int ii = 0; ii < nEvts; ++ii ) {
+            readFrom( m_devs[evts[ii].data.u32] );
+        }
+    }
+
+    /* whatever's still unanswered is lost */
+    for ( size_t ii = 0; ii < m_devs.size(); ++ii ) {
+        expire( m_devs[ii], UINT64_MAX );
+        m_stats.ended( m_devs[ii].m_state );
+        close( m_devs[ii].m_sock );
+    }
+    close( m_epoll );
+    return NULL;
+}
+
+void
+Worker::schedule( int indx, uint64_t when )
+{
+    m_due.push( Due( when, indx ) );
+}
+
+void
+Worker::expire( Device& dev, uint64_t now )
+{
+    map<uint32_t, Pending>::iterator iter = dev.m_pending.begin();
+    while ( iter != dev.m_pending.end() ) {
+        if ( UINT64_MAX == now || iter->second.sent + TIMEOUT_USECS < now ) {
+            m_stats.lost( iter->second.stat );
+            dev.m_pending.erase( iter++ );
+        } else {
+            ++iter;
+        }
+    }
+}
+
+/* Time for this device to do something.  What depends on its state. */
+void
+Worker::act( Device& dev, uint64_t now )
+{
+    expire( dev, now );
+    int indx = dev.m_index - m_first;
+    uint64_t interval = (uint64_t)g_cfg.intervalMS * 1000;
+
+    switch ( dev.m_state ) {
+    case ST_UNREG:
+        sendReg( dev );
+        schedule( indx, now + TIMEOUT_USECS );
+        break;
+    case ST_REGISTERING:
+    case ST_CONNECTING:
+    case ST_WAITING:
+        /* Nothing heard in too long: start over */
+        if ( dev.m_stateSince + TIMEOUT_USECS <= now ) {
+            ++m_stats.m_nErrors;
+            if ( ST_REGISTERING == dev.m_state ) {
+                sendReg( dev );
+            } else {
+                sendConnect( dev );
+            }
+        }
+        schedule( indx, now + TIMEOUT_USECS );
+        break;
+    case ST_PLAYING: {
+        /* Mostly game traffic, with some keepalives and fetches */
+        int choice = random() % 100;
+        if ( choice < g_cfg.gamePct ) {
+            vector<uint8_t> payload;
+            payload.push_back( XWRELAY_MSG_TORELAY );
+            putShort( payload, dev.m_cid );
+            payload.push_back( dev.m_hostID );
+            payload.push_back( 3 - dev.m_hostID ); /* the other of 1 and 2 */
+            uint64_t stamp = now_usecs();
+            const uint8_t* sp = (const uint8_t*)&stamp;
+            payload.insert( payload.end(), sp, sp + sizeof(stamp) );
+            payload.resize( payload.size() + g_cfg.msgLen, 'x' );
+            sendGameMsg( dev, payload, XWPDEV_MSG );
+        } else if ( choice < g_cfg.gamePct + g_cfg.fetchPct ) {
+            sendIDOnly( dev, XWPDEV_RQSTMSGS );
+        } else {
+            sendIDOnly( dev, XWPDEV_KEEPALIVE );
+        }
+        /* jitter so devices don't march in lockstep */
+        schedule( indx, now + interval / 2 + random() % interval );
+        break;
+    }
+    case ST_DEAD:
+        break;
+    }
+}
+
+void
+Worker::readFrom( Device& dev )
+{
+    for ( ; ; ) {
+        uint8_t buf[2048];
+        ssize_t nRead = recv( dev.m_sock, buf, sizeof(buf), 0 );
+        if ( 0 >= nRead ) {
+            if ( EAGAIN != errno && EWOULDBLOCK != errno ) {
+                ++m_stats.m_nErrors;
+            }
+            break;
+        }
+        ++m_stats.m_nPacketsRcvd;
+        handlePacket( dev, buf, buf + nRead );
+    }
+}
+
+void
+Worker::handlePacket( Device& dev, const uint8_t* ptr, const uint8_t* end )
+{
+    uint64_t now = now_usecs();
+    uint32_t packetID;
+    if ( 3 > end - ptr || XWPDEV_PROTO_VERSION_1 != *ptr++
+         || !getVLI( &ptr, end, &packetID ) || ptr >= end ) {
+        ++m_stats.m_nErrors;
+        return;
+    }
+    XWRelayReg cmd = (XWRelayReg)*ptr++;
+
+    switch ( cmd ) {
+    case XWPDEV_ACK: {
+        uint32_t ackedID;
+        if ( getVLI( &ptr, end, &ackedID ) ) {
+            map<uint32_t, Pending>::iterator iter =
+                dev.m_pending.find( ackedID );
+            if ( iter != dev.m_pending.end() ) {
+                m_stats.sample( iter->second.stat, now - iter->second.sent );
+                dev.m_pending.erase( iter );
+            }
+        }
+        break;
+    }
+    case XWPDEV_REGRSP:
+        if ( ST_REGISTERING == dev.m_state
+             && getVLIStr( &ptr, end, dev.m_relayID ) ) {
+            m_stats.sample( STAT_REGRSP, now - dev.m_stateSince );
+            sendConnect( dev );
+        }
+        break;
+    case XWPDEV_BADREG:
+        ++m_stats.m_nErrors;
+        dev.m_relayID.clear();
+        sendReg( dev );
+        break;
+    case XWPDEV_HAVEMSGS:
+        if ( 0 < dev.m_relayID.size() ) {
+            sendIDOnly( dev, XWPDEV_RQSTMSGS );
+        }
+        break;
+    case XWPDEV_MSG:
+        if ( 4 <= end - ptr ) {
+            handleGameMsg( dev, ptr + 4, end ); /* skip clientToken */
+        }
+        break;
+    default:
+        break;
+    }
+
+    if ( XWPDEV_ACK != cmd && XWPDEV_UNAVAIL != cmd ) {
+        sendAck( dev, packetID );
+    }
+}
+
+/* Payload of an XWPDEV_MSG: the older per-game protocol */
+void
+Worker::handleGameMsg( Device& dev, const uint8_t* ptr, const uint8_t* end )
+{
+    if ( ptr >= end ) {
+        return;
+    }
+    uint64_t now = now_usecs();
+    XWRELAY_Cmd cmd = *ptr++;
+    switch ( cmd ) {
+    case XWRELAY_CONNECT_RESP:
+        if ( ST_CONNECTING == dev.m_state && 3 <= end - ptr ) {
+            m_stats.sample( STAT_CONNECT_RESP, now - dev.m_stateSince );
+            dev.m_hostID = ptr[0];
+            dev.m_cid = (ptr[1] << 8) | ptr[2];
+            setState( dev, ST_WAITING );
+
+            vector<uint8_t> payload;
+            payload.push_back( XWRELAY_ACK );
+            payload.push_back( dev.m_hostID );
+            sendGameMsg( dev, payload, XWPDEV_MSG );
+        }
+        break;
+    case XWRELAY_ALLHERE:
+        if ( ST_WAITING == dev.m_state ) {
+            setState( dev, ST_PLAYING );
+            schedule( dev.m_index - m_first,
+                      now + random() % ((uint64_t)g_cfg.intervalMS * 1000) );
+        }
+        break;
+    case XWRELAY_MSG_FROMRELAY: {
+        uint64_t stamp;
+        if ( 4 + sizeof(stamp) <= (size_t)(end - ptr) ) {
+            memcpy( &stamp, ptr + 4, sizeof(stamp) ); /* skip cid, src, dest */
+            if ( stamp <= now ) {
+                m_stats.sample( STAT_DELIVERY, now - stamp );
+            }
+        }
+        break;
+    }
+    case XWRELAY_CONNECTDENIED:
+    case XWRELAY_DISCONNECT_YOU:
+        ++m_stats.m_nErrors;
+        setState( dev, ST_DEAD );
+        break;
+    default:
+        break;
+    }
+}
+
+void
+Worker::startPacket( Device& dev, vector<uint8_t>& out, XWRelayReg cmd,
+                     uint32_t* packetIDP )
+{
+    uint32_t packetID = 0;      /* acks themselves don't get acked */
+    if ( XWPDEV_ACK != cmd ) {
+        packetID = ++dev.m_nextPacketID;
+    }
+    out.push_back( XWPDEV_PROTO_VERSION_1 );
+    putVLI( out, packetID );
+    out.push_back( cmd );
+    *packetIDP = packetID;
+}
+
+void
+Worker::send( Device& dev, vector<uint8_t>& packet, int stat,
+              uint32_t packetID )
+{
+    ssize_t nSent = ::send( dev.m_sock, packet.data(), packet.size(), 0 );
+    if ( nSent != (ssize_t)packet.size() ) {
+        ++m_stats.m_nErrors;
+    } else {
+        ++m_stats.m_nPacketsSent;
+        if ( 0 != packetID ) {
+            m_stats.sent( stat );
+            Pending pending = { stat, now_usecs() };
+            dev.m_pending[packetID] = pending;
+        }
+    }
+}
+
+void
+Worker::sendReg( Device& dev )
+{
+    char devID[64];
+    snprintf( devID, sizeof(devID), "loadgen:%d:%d", getpid(), dev.m_index );
+
+    vector<uint8_t> packet;
+    uint32_t packetID;
+    startPacket( dev, packet, XWPDEV_REG, &packetID );
+    putVLIStr( packet, dev.m_relayID ); /* empty the first time */
+    packet.push_back( ID_TYPE_LINUX );
+    putVLIStr( packet, devID );
+    putShort( packet, CLIENT_VERS );
+    putVLIStr( packet, "loadgen" );     /* devDesc */
+    putVLIStr( packet, "loadgen" );     /* model */
+    putVLIStr( packet, "linux" );       /* osVers */
+    putShort( packet, 0 );              /* variantCode */
+
+    setState( dev, ST_REGISTERING );
+    send( dev, packet, XWPDEV_REG, packetID );
+}
+
+/* Each pair of devices shares a cookie, so they wind up in the same
+   two-player game */
+void
+Worker::sendConnect( Device& dev )
+{
+    char cookie[32];
+    snprintf( cookie, sizeof(cookie), "lg%d.%d", getpid(), dev.m_index / 2 );
+    size_t cookieLen = strlen( cookie );
+
+    vector<uint8_t> payload;
+    payload.push_back( XWRELAY_GAME_CONNECT );
+    payload.push_back( XWRELAY_PROTO_VERSION );
+    putShort( payload, CLIENT_VERS );
+    payload.push_back( cookieLen );
+    payload.insert( payload.end(), cookie, cookie + cookieLen );
+    payload.push_back( 0 );     /* wantsPublic */
+    payload.push_back( 0 );     /* makePublic */
+    payload.push_back( 1 );     /* nPlayersH */
+    payload.push_back( 2 );     /* nPlayersT */
+    putShort( payload, 1 + (random() % 0xFFFE) ); /* seed */
+    payload.push_back( 1 );     /* langCode */
+    payload.push_back( ID_TYPE_RELAY );
+    payload.insert( payload.end(), dev.m_relayID.begin(),
+                    dev.m_relayID.end() );
+    payload.push_back( '\0' );
+    payload.push_back( 0 );     /* clientIndx */
+
+    setState( dev, ST_CONNECTING );
+    sendGameMsg( dev, payload, XWPDEV_MSG );
+}
+
+void
+Worker::sendGameMsg( Device& dev, const vector<uint8_t>& payload, int stat )
+{
+    vector<uint8_t> packet;
+    uint32_t packetID;
+    startPacket( dev, packet, XWPDEV_MSG, &packetID );
+    /* clientToken; mustn't be 0. The relay finds games by token and hid,
+       so a token mustn't match one from an earlier run's still-open games */
+    putLong( packet, ((uint32_t)getpid() << 16) + 1 + dev.m_index );
+    packet.insert( packet.end(), payload.begin(), payload.end() );
+    send( dev, packet, stat, packetID );
+}
+
+void
+Worker::sendIDOnly( Device& dev, XWRelayReg cmd )
+{
+    vector<uint8_t> packet;
+    uint32_t packetID;
+    startPacket( dev, packet, cmd, &packetID );
+    putVLIStr( packet, dev.m_relayID );
+    send( dev, packet, cmd, packetID );
+}
+
+void
+Worker::sendAck( Device& dev, uint32_t packetID )
+{
+    vector<uint8_t> packet;
+    uint32_t unused;
+    startPacket( dev, packet, XWPDEV_ACK, &unused );
+    putVLI( packet, packetID );
+    send( dev, packet, XWPDEV_ACK, 0 );
+}
+
+static void
+usage( const char * const argv0 )
+{
+    fprintf( stderr, "usage: %s \\\n", argv0 );
+    fprintf( stderr, "\t[-a <host>]     # relay host (default: %s) \\\n",
+             DEFAULT_HOST );
+    fprintf( stderr, "\t[-p <port>]     # relay UDP port (default: %d) \\\n",
+             DEFAULT_PORT );
+    fprintf( stderr, "\t[-n <n>]        # devices to simulate (default: %d) \\\n",
+             DEFAULT_NDEVS );
+    fprintf( stderr, "\t[-t <n>]        # threads (default: %d) \\\n",
+             DEFAULT_NTHREADS );
+    fprintf( stderr, "\t[-d <secs>]     # how long to run (default: %d) \\\n",
+             DEFAULT_DURATION );
+    fprintf( stderr, "\t[-i <ms>]       # mean ms between a device's sends "
+             "(default: %d) \\\n", DEFAULT_INTERVAL_MS );
+    fprintf( stderr, "\t[-r <n>]        # registrations per second during "
+             "ramp-up (default: %d) \\\n", DEFAULT_REG_RATE );
+    fprintf( stderr, "\t[-s <n>]        # game message size (default: %d) \\\n",
+             DEFAULT_MSG_LEN );
+    fprintf( stderr, "\t[-g <pct>]      # %% of sends, once playing, that are "
+             "game messages (default: %d) \\\n", DEFAULT_GAME_PCT );
+    fprintf( stderr, "\t[-f <pct>]      # %% that are RQSTMSGS; the rest are "
+             "keepalives (default: %d)\n", DEFAULT_FETCH_PCT );
+    exit( 1 );
+}
+
+int
+main( int argc, char** argv )
+{
+    g_cfg.host = DEFAULT_HOST;
+    g_cfg.port = DEFAULT_PORT;
+    g_cfg.nDevs = DEFAULT_NDEVS;
+    g_cfg.nThreads = DEFAULT_NTHREADS;
+    g_cfg.duration = DEFAULT_DURATION;
+    g_cfg.intervalMS = DEFAULT_INTERVAL_MS;
+    g_cfg.regRate = DEFAULT_REG_RATE;
+    g_cfg.msgLen = DEFAULT_MSG_LEN;
+    g_cfg.gamePct = DEFAULT_GAME_PCT;
+    g_cfg.fetchPct = DEFAULT_FETCH_PCT;
+
+    for ( ; ; ) {
+        int opt = getopt( argc, argv, "a:p:n:t:d:i:r:s:g:f:" );
+        if ( opt < 0 ) {
+            break;
+        }
+        switch ( opt ) {
+        case 'a': g_cfg.host = optarg; break;
+        case 'p': g_cfg.port = atoi( optarg ); break;
+        case 'n': g_cfg.nDevs = atoi( optarg ); break;
+        case 't': g_cfg.nThreads = atoi( optarg ); break;
+        case 'd': g_cfg.duration = atoi( optarg ); break;
+        case 'i': g_cfg.intervalMS = atoi( optarg ); break;
+        case 'r': g_cfg.regRate = atoi( optarg ); break;
+        case 's': g_cfg.msgLen = atoi( optarg ); break;
+        case 'g': g_cfg.gamePct = atoi( optarg ); break;
+        case 'f': g_cfg.fetchPct = atoi( optarg ); break;
+        default:
+            usage( argv[0] );
+        }
+    }
+    if ( 2 > g_cfg.nDevs || 1 > g_cfg.nThreads || 1 > g_cfg.duration
+         || 1 > g_cfg.intervalMS || 1 > g_cfg.regRate || 0 > g_cfg.msgLen
+         || 0 > g_cfg.gamePct || 0 > g_cfg.fetchPct
+         || 100 < g_cfg.gamePct + g_cfg.fetchPct ) {
+        usage( argv[0] );
+    }
+    g_cfg.nDevs += g_cfg.nDevs % 2; /* devices come in pairs */
+
+    struct addrinfo hints, *res;
+    memset( &hints, 0, sizeof(hints) );
+    hints.ai_socktype = SOCK_DGRAM;
+    char portStr[16];
+    snprintf( portStr, sizeof(portStr), "%d", g_cfg.port );
+    int err = getaddrinfo( g_cfg.host, portStr, &hints, &res );
+    if ( 0 != err ) {
+        fprintf( stderr, "can't resolve %s: %s\n", g_cfg.host,
+                 gai_strerror(err) );
+        exit( 1 );
+    }
+    memcpy( &g_cfg.addr, res->ai_addr, res->ai_addrlen );
+    g_cfg.addrLen = res->ai_addrlen;
+    freeaddrinfo( res );
+
+    /* one socket per device */
+    struct rlimit rl;
+    if ( 0 == getrlimit( RLIMIT_NOFILE, &rl ) ) {
+        rlim_t want = g_cfg.nDevs + g_cfg.nThreads + 64;
+        if ( rl.rlim_cur < want ) {
+            rl.rlim_cur = min( want, rl.rlim_max );
+            (void)setrlimit( RLIMIT_NOFILE, &rl );
+        }
+    }
+
+    srandom( getpid() );
+    g_cfg.start = now_usecs() + 100000;
+
+    /* Partners must share a thread, so hand out devices in pairs */
+    int nPairs = g_cfg.nDevs / 2;
+    vector<Worker*> workers;
+    vector<pthread_t> threads;
+    int first = 0;
+    for ( int ii = 0; ii < g_cfg.nThreads; ++ii ) {
+        int count = 2 * ((nPairs + ii) / g_cfg.nThreads);
+        if ( 0 < count ) {
+            Worker* worker = new Worker( first, count );
+            first += count;
+            pthread_t thread;
+            pthread_create( &thread, NULL, Worker::thread_main, worker );
+            workers.push_back( worker );
+            threads.push_back( thread );
+        }
+    }
+    assert( first == g_cfg.nDevs );
+
+    fprintf( stderr, "%d devices on %zu threads against %s:%d for %d "
+             "seconds...\n", g_cfg.nDevs, threads.size(), g_cfg.host,
+             g_cfg.port, g_cfg.duration );
+
+    Stats total;
+    for ( size_t ii = 0; ii < threads.size(); ++ii ) {
+        pthread_join( threads[ii], NULL );
+        total.merge( workers[ii]->stats() );
+        delete workers[ii];
+    }
+    total.print( stdout, g_cfg.duration );
+    return 0;
+}
@@ -0,0 +1,255 @@
+/* -*-mode: C; fill-column: 78; c-basic-offset: 4; -*- */
+/* 
+ * Copyright 2018 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <string.h>
+#include <assert.h>
+
+#include "metrics.h"
+#include "mlock.h"
+#include "tpool.h"
+#include "crefmgr.h"
+#include "udpqueue.h"
+#include "msgstore.h"
+#include "dbmgr.h"
+
+static Metrics* s_instance = NULL;
+
+static const struct {
+    const char* name;
+    const char* labels;
+    const char* help;
+} s_counterInfo[] = {
+    { "xwrelay_udp_packets_received_total", "",
+      "UDP packets read" },
+    { "xwrelay_udp_packets_sent_total", "",
+      "UDP packets sent or queued for sending" },
+    { "xwrelay_udp_send_errors_total", "",
+      "UDP packets that could not be sent" },
+    { "xwrelay_acks_total", "outcome=\"acked\"",
+      "Packets sent expecting an ack, by outcome" },
+    { "xwrelay_acks_total", "outcome=\"nacked\"", NULL },
+    { "xwrelay_acks_total", "outcome=\"timedout\"", NULL },
+    { "xwrelay_acks_total", "outcome=\"unknown\"", NULL },
+    { "xwrelay_msgs_stored_total", "",
+      "Messages stored for later delivery" },
+    { "xwrelay_msgs_removed_total", "",
+      "Stored messages removed after delivery" },
+    { "xwrelay_tpool_steals_total", "",
+      "Work run by a worker other than the one it was queued for" },
+    { "xwrelay_rowcache_lookups_total", "table=\"games\",result=\"hit\"",
+      "Game and device lookups, by whether the row was cached" },
+    { "xwrelay_rowcache_lookups_total", "table=\"games\",result=\"miss\"",
+      NULL },
+    { "xwrelay_rowcache_lookups_total", "table=\"devices\",result=\"hit\"",
+      NULL },
+    { "xwrelay_rowcache_lookups_total",
+      "table=\"devices\",result=\"miss\"", NULL },
+    { "xwrelay_coalesced_total", "what=\"event\"",
+      "Work folded into other work rather than done on its own" },
+    { "xwrelay_coalesced_total", "what=\"dupack\"", NULL },
+    { "xwrelay_coalesced_total", "what=\"sentrecord\"", NULL },
+    { "xwrelay_coalesced_total", "what=\"msgack\"", NULL },
+};
+
+Histogram::Histogram()
+{
+    memset( m_buckets, 0, sizeof(m_buckets) );
+    m_sum = 0;
+}
+
+/* Largest value (inclusive, in usecs) that lands in bucket indx */
+/* static */ uint64_t
+Histogram::upperBound( int indx )
+{
+    uint64_t result;
+    int group = indx >> HIST_SUB_BITS;
+    if ( 0 == group ) {
+        result = indx;
+    } else {
+        int sub = indx & ((1 << HIST_SUB_BITS) - 1);
+        result = ((uint64_t)((1 << HIST_SUB_BITS) + sub + 1) << (group - 1)) - 1;
+    }
+    return result;
+}
+
+uint64_t
+Histogram::Count() const
+{
+    uint64_t total = 0;
+    for ( int ii = 0; ii < HIST_NBUCKETS; ++ii ) {
+        total += m_buckets[ii];
+    }
+    return total;
+}
+
+void
+Histogram::render( StrWPF& out, const char* name, const char* labels ) const
+{
+    uint64_t counts[HIST_NBUCKETS];
+    int last = -1;
+    for ( int ii = 0; ii < HIST_NBUCKETS; ++ii ) {
+        counts[ii] = m_buckets[ii];
+        if ( 0 != counts[ii] ) {
+            last = ii;
+        }
+    }
+    const char* sep = '\0' == labels[0] ? "" : ",";
+
+    /* Prometheus wants cumulative counts, and seconds */
+    uint64_t total = 0;
+    for ( int ii = 0; ii <= last; ++ii ) {
+        total += counts[ii];
+        out.catf( "%s_bucket{%s%sle=\"%.6f\"} %llu\n", name, labels, sep,
+                  upperBound(ii) / 1000000.0, (unsigned long long)total );
+    }
+    out.catf( "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels, sep,
+              (unsigned long long)total );
+    out.catf( "%s_sum{%s} %.6f\n", name, labels, m_sum / 1000000.0 );
+    out.catf( "%s_count{%s} %llu\n", name, labels,
+              (unsigned long long)total );
+}
+
+/* static */ Metrics*
+Metrics::Get()
+{
+    if ( NULL == s_instance ) {
+        s_instance = new Metrics();
+    }
+    return s_instance;
+}
+
+Metrics::Metrics()
+{
+    assert( MC_N_COUNTERS == VSIZE(s_counterInfo) );
+    memset( m_counters, 0, sizeof(m_counters) );
+    pthread_mutex_init( &m_dbMutex, NULL );
+    m_nDBHists = 0;
+}
+
+Histogram*
+Metrics::DBHistogram( const char* method )
+{
+    MutexLock ml( &m_dbMutex );
+    int indx;
+    for ( indx = 0; indx < m_nDBHists; ++indx ) {
+        if ( 0 == strcmp( method, m_dbNames[indx] ) ) {
+            break;
+        }
+    }
+    if ( indx == m_nDBHists ) {
+        if ( indx < METRICS_MAX_DB - 1 ) {
+            m_dbNames[indx] = method;
+            ++m_nDBHists;
+        } else {
+            logf( XW_LOGERROR, "%s: no room for %s", __func__, method );
+            indx = METRICS_MAX_DB - 1;
+            m_dbNames[indx] = "other";
+            m_nDBHists = METRICS_MAX_DB;
+        }
+    }
+    return &m_dbHists[indx];
+}
+
+static void
+renderHeader( StrWPF& out, const char* name, const char* type,
+              const char* help )
+{
+    out.catf( "# HELP %s %s\n", name, help );
+    out.catf( "# TYPE %s %s\n", name, type );
+}
+
+static void
+renderGauge( StrWPF& out, const char* name, const char* help, long value )
+{
+    renderHeader( out, name, "gauge", help );
+    out.catf( "%s %ld\n", name, value );
+}
+
+void
+Metrics::Render( StrWPF& out )
+{
+    for ( int ii = 0; ii < MC_N_COUNTERS; ++ii ) {
+        if ( NULL != s_counterInfo[ii].help ) {
+            renderHeader( out, s_counterInfo[ii].name, "counter",
+                          s_counterInfo[ii].help );
+        }
+        const char* labels = s_counterInfo[ii].labels;
+        out.catf( "%s%s%s%s %llu\n", s_counterInfo[ii].name,
+                  '\0' == labels[0] ? "" : "{", labels,
+                  '\0' == labels[0] ? "" : "}",
+                  (unsigned long long)m_counters[ii] );
+    }
+
+    renderGauge( out, "xwrelay_uptime_seconds", "Seconds since start",
+                 uptime() );
+    renderGauge( out, "xwrelay_sockets_active", "TCP sockets being polled",
+                 XWThreadPool::GetTPool()->CountSockets() );
+    renderGauge( out, "xwrelay_cookies", "Games (cookies) in memory",
+                 CRefMgr::Get()->GetSize() );
+    renderGauge( out, "xwrelay_packets_queued",
+                 "Packets and kills waiting for a worker",
+                 XWThreadPool::GetTPool()->CountQueued() );
+    int nGames, nDevices;
+    DBMgr::Get()->GetRowCacheSizes( &nGames, &nDevices );
+    renderGauge( out, "xwrelay_rowcache_games", "Games rows cached",
+                 nGames );
+    renderGauge( out, "xwrelay_rowcache_devices", "Devices rows cached",
+                 nDevices );
+    MsgStore* store = MsgStore::Get();
+    if ( NULL != store ) {
+        int nMsgs, nUnflushed;
+        store->GetCounts( &nMsgs, &nUnflushed );
+        renderGauge( out, "xwrelay_msgstore_msgs",
+                     "Stored messages held in memory", nMsgs );
+        renderGauge( out, "xwrelay_msgstore_unflushed",
+                     "Stored messages not yet written to the DB",
+                     nUnflushed );
+    }
+
+    renderHeader( out, "xwrelay_queue_wait_seconds", "histogram",
+                  "Time packets spent queued before a worker took them" );
+    m_queueWait.render( out, "xwrelay_queue_wait_seconds", "" );
+
+    renderHeader( out, "xwrelay_cmd_seconds", "histogram",
+                  "Time spent processing each UDP packet, by command" );
+    for ( int ii = 0; ii < METRICS_MAX_CMD; ++ii ) {
+        if ( 0 == m_cmdHists[ii].Count() ) {
+            continue;           /* skip those never seen */
+        }
+        StrWPF labels;
+        const char* name = msgToStr( (XWRelayReg)ii );
+        if ( ii == METRICS_MAX_CMD - 1 ) {
+            labels.catf( "cmd=\"other\"" );
+        } else if ( '<' == name[0] ) {  /* "<unknown>" */
+            labels.catf( "cmd=\"%d\"", ii );
+        } else {
+            labels.catf( "cmd=\"%s\"", name );
+        }
+        m_cmdHists[ii].render( out, "xwrelay_cmd_seconds", labels.c_str() );
+    }
+
+    renderHeader( out, "xwrelay_db_seconds", "histogram",
+                  "Latency of DBMgr methods" );
+    MutexLock ml( &m_dbMutex );
+    for ( int ii = 0; ii < m_nDBHists; ++ii ) {
+        StrWPF labels;
+        labels.catf( "method=\"%s\"", m_dbNames[ii] );
+        m_dbHists[ii].render( out, "xwrelay_db_seconds", labels.c_str() );
+    }
+}
@@ -0,0 +1,161 @@
+/* -*-mode: C; fill-column: 78; c-basic-offset: 4; -*- */
+/* 
+ * Copyright 2018 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "xwrelay_priv.h"
+#include "strwpf.h"
+
+/* Counters and latency histograms, exported in Prometheus text format (via
+ * GET /metrics on the http port, and the "metrics" ctrl command).  Recording
+ * is an atomic add or two and never takes a lock; everything expensive
+ * (summing buckets, reading gauges from other modules) happens when the
+ * metrics are rendered.
+ */
+
+typedef enum {
+    MC_UDP_RCVD,
+    MC_UDP_SENT,
+    MC_UDP_SENDFAIL,
+    MC_ACK_ACKED,
+    MC_ACK_NACKED,
+    MC_ACK_TIMEDOUT,
+    MC_ACK_UNKNOWN,
+    MC_MSGS_STORED,
+    MC_MSGS_REMOVED,
+    MC_TPOOL_STOLEN,
+    MC_ROWCACHE_GAMES_HIT,
+    MC_ROWCACHE_GAMES_MISS,
+    MC_ROWCACHE_DEVICES_HIT,
+    MC_ROWCACHE_DEVICES_MISS,
+    MC_COALESCED_EVENT,
+    MC_COALESCED_DUPACK,
+    MC_COALESCED_SENTREC,
+    MC_COALESCED_MSGACK,
+
+    MC_N_COUNTERS
+} MetricsCounter;
+
+/* Log-linear buckets: exact below 4, then four per power of two, so the
+ * error's never more than 25%.  Values are microseconds; the last bucket
+ * catches everything from about two hours up.
+ */
+#define HIST_SUB_BITS 2
+#define HIST_NBUCKETS 128
+
+class Histogram {
+ public:
+    Histogram();
+    void Record( uint64_t usecs ) {
+        __sync_fetch_and_add( &m_buckets[bucketFor(usecs)], 1 );
+        __sync_fetch_and_add( &m_sum, usecs );
+    }
+
+    uint64_t Count() const;
+    void render( StrWPF& out, const char* name, const char* labels ) const;
+
+ private:
+    static int bucketFor( uint64_t val ) {
+        int indx;
+        if ( val < (1 << HIST_SUB_BITS) ) {
+            indx = val;
+        } else {
+            int msb = 63 - __builtin_clzll( val );
+            int shift = msb - HIST_SUB_BITS;
+            indx = ((shift + 1) << HIST_SUB_BITS)
+                + ((val >> shift) & ((1 << HIST_SUB_BITS) - 1));
+            if ( indx >= HIST_NBUCKETS ) {
+                indx = HIST_NBUCKETS - 1;
+            }
+        }
+        return indx;
+    }
+    static uint64_t upperBound( int indx );
+
+    uint64_t m_buckets[HIST_NBUCKETS];
+    uint64_t m_sum;
+};
+
+/* Most distinct DBMgr methods we'll keep histograms for */
+#define METRICS_MAX_DB 64
+/* One per XWRelayReg value, plus the last for anything out of range */
+#define METRICS_MAX_CMD 32
+
+class Metrics {
+ public:
+    static Metrics* Get();
+    static uint64_t NowUsecs() {
+        struct timespec ts;
+        clock_gettime( CLOCK_MONOTONIC, &ts );
+        return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+    }
+
+    void Inc( MetricsCounter which, uint64_t by = 1 ) {
+        __sync_fetch_and_add( &m_counters[which], by );
+    }
+    void RecordQueueWait( uint64_t usecs ) { m_queueWait.Record( usecs ); }
+    Histogram* CmdHistogram( XWRelayReg cmd ) {
+        int indx = cmd;
+        if ( indx < 0 || indx >= METRICS_MAX_CMD - 1 ) {
+            indx = METRICS_MAX_CMD - 1;
+        }
+        return &m_cmdHists[indx];
+    }
+
+    /* Slow (takes a lock): call once and keep the result */
+    Histogram* DBHistogram( const char* method );
+
+    /* Prometheus text exposition format, version 0.0.4 */
+    void Render( StrWPF& out );
+
+ private:
+    Metrics();
+
+    uint64_t m_counters[MC_N_COUNTERS];
+    Histogram m_queueWait;
+    Histogram m_cmdHists[METRICS_MAX_CMD];
+
+    pthread_mutex_t m_dbMutex;
+    int m_nDBHists;
+    const char* m_dbNames[METRICS_MAX_DB];
+    Histogram m_dbHists[METRICS_MAX_DB];
+};
+
+/* Records the time between its creation and destruction */
+class HistTimer {
+ public:
+    HistTimer( Histogram* hist )
+        : m_hist(hist), m_start(Metrics::NowUsecs()) {}
+    ~HistTimer() { m_hist->Record( Metrics::NowUsecs() - m_start ); }
+ private:
+    Histogram* m_hist;
+    uint64_t m_start;
+};
+
+/* Put at the top of a DBMgr method to track its latency under its name */
+#define METRICS_DB_TIMER()                                              \
+    static Histogram* s_dbHist = Metrics::Get()->DBHistogram( __func__ ); \
+    HistTimer dbTimer( s_dbHist )
+
+#endif
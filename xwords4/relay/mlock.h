@@ -27,14 +27,21 @@
 #include "xwrelay_priv.h"
 #include "cref.h"
 
+/* The optional nContended counter is bumped whenever the lock couldn't be
+   had without waiting. */
 class MutexLock {
  public:
-    MutexLock( pthread_mutex_t* mutex ) { 
+    MutexLock( pthread_mutex_t* mutex, int* nContended = NULL ) { 
         m_mutex = mutex;
 #ifdef DEBUG_LOCKS
         logf( XW_LOGINFO, "tlm %p", mutex );
 #endif
-        pthread_mutex_lock( mutex );
+        if ( NULL == nContended ) {
+            pthread_mutex_lock( mutex );
+        } else if ( 0 != pthread_mutex_trylock( mutex ) ) {
+            pthread_mutex_lock( mutex );
+            ++*nContended;      /* we hold the mutex it protects */
+        }
 #ifdef DEBUG_LOCKS
         logf( XW_LOGINFO, "slm %p", mutex );
 #endif
@@ -85,11 +92,16 @@ class SocketWriteLock {
 
 class RWReadLock {
  public:
-    RWReadLock( pthread_rwlock_t* rwl ) {
+    RWReadLock( pthread_rwlock_t* rwl, int* nContended = NULL ) {
 #ifdef DEBUG_LOCKS
         logf( XW_LOGINFO, "tlrr %p", rwl );
 #endif
-        pthread_rwlock_rdlock( rwl );
+        if ( NULL == nContended ) {
+            pthread_rwlock_rdlock( rwl );
+        } else if ( 0 != pthread_rwlock_tryrdlock( rwl ) ) {
+            pthread_rwlock_rdlock( rwl );
+            __sync_fetch_and_add( nContended, 1 ); /* other readers */
+        }
 #ifdef DEBUG_LOCKS
         logf( XW_LOGINFO, "slrr %p", rwl );
 #endif
@@ -108,11 +120,17 @@ class RWReadLock {
 
 class RWWriteLock {
  public:
-    RWWriteLock( pthread_rwlock_t* rwl ) : _rwl(rwl) {
+    RWWriteLock( pthread_rwlock_t* rwl, int* nContended = NULL ) 
+        : _rwl(rwl) {
 #ifdef DEBUG_LOCKS
         logf( XW_LOGINFO, "tlww %p", rwl );
 #endif
-        pthread_rwlock_wrlock( rwl );
+        if ( NULL == nContended ) {
+            pthread_rwlock_wrlock( rwl );
+        } else if ( 0 != pthread_rwlock_trywrlock( rwl ) ) {
+            pthread_rwlock_wrlock( rwl );
+            __sync_fetch_and_add( nContended, 1 );
+        }
 #ifdef DEBUG_LOCKS
         logf( XW_LOGINFO, "slww %p", rwl );
 #endif
@@ -0,0 +1,774 @@
+/* -*- compile-command: "make -k -j3"; -*- */
+
+/*
+ * Copyright 2018 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "msgstore.h"
+#include "configs.h"
+#include "mlock.h"
+#include "shardmgr.h"
+
+/* Rewrite the log once appends of messages acked before they were flushed
+   have grown it this much. */
+#define MAX_LOG_BYTES (1024 * 1024)
+
+/* Log record types */
+#define LOG_STORE 'S'           /* stored, not yet flushed */
+#define LOG_ACKED 'A'           /* acked before flush; forget it */
+#define LOG_DBSENT 'D'          /* flushed, then acked; mark sent in DB */
+
+static MsgStore* s_instance = NULL;
+static bool s_checked = false;
+
+static void
+pushInt( vector<uint8_t>& out, uint32_t val )
+{
+    out.insert( out.end(), (uint8_t*)&val, ((uint8_t*)&val) + sizeof(val) );
+}
+
+static bool
+getInt( const uint8_t** bufpp, const uint8_t* end, uint32_t* out )
+{
+    bool ok = *bufpp + sizeof(*out) <= end;
+    if ( ok ) {
+        memcpy( out, *bufpp, sizeof(*out) );
+        *bufpp += sizeof(*out);
+    }
+    return ok;
+}
+
+/* static */ MsgStore*
+MsgStore::Get()
+{
+    if ( !s_checked ) {
+        RelayConfigs* rc = RelayConfigs::GetConfigs();
+        int flushSecs = 0;
+        (void)rc->GetValueFor( "MSGSTORE_FLUSH_SECS", &flushSecs );
+        if ( 0 < flushSecs && NULL != ShardMgr::Get() ) {
+            /* Other relays read the msgs table directly, so it can't lag */
+            logf( XW_LOGERROR, "%s: ignoring MSGSTORE_FLUSH_SECS because "
+                  "SHARD_NODES is set", __func__ );
+        } else if ( 0 < flushSecs ) {
+            int evictSecs;
+            if ( !rc->GetValueFor( "MSGSTORE_EVICT_SECS", &evictSecs ) ) {
+                evictSecs = 300;
+            }
+            char path[256];
+            if ( !rc->GetValueFor( "MSGSTORE_LOG_PATH", path, sizeof(path) ) ) {
+                snprintf( path, sizeof(path), "%s", "./xwrelay_msgs.log" );
+            }
+            s_instance = new MsgStore( flushSecs, evictSecs, path );
+        }
+        s_checked = true;
+    }
+    return s_instance;
+} /* Get */
+
+MsgStore::MsgStore( int flushSecs, int evictSecs, const char* logPath )
+{
+    m_flushSecs = flushSecs;
+    m_evictSecs = evictSecs;
+    m_logPath = logPath;
+    m_logFD = -1;
+    m_logDirty = false;
+    m_logBytes = 0;
+    m_nextID = 0;
+    m_loadGen = 0;
+    m_nStored = m_nAckedUnflushed = m_nFlushed = m_nLoaded = m_nCommits
+        = m_nEvicted = 0;
+
+    pthread_mutex_init( &m_mutex, NULL );
+
+    {
+        MutexLock ml( &m_mutex );
+        replayLog();
+        /* Start over with a clean log, dropping any partial record a crash
+           left at the end */
+        rewriteLog_locked();
+    }
+    logf( XW_LOGINFO, "%s: flush after %d s; %zu messages recovered from %s",
+          __func__, m_flushSecs, m_unflushed.size(), m_logPath.c_str() );
+
+    pthread_t thread;
+    int result = pthread_create( &thread, NULL, thread_main, (void*)this );
+    assert( result == 0 );
+    result = pthread_detach( thread );
+    assert( result == 0 );
+}
+
+int
+MsgStore::Store( DevIDRelay devid, const uint8_t* buf, int len )
+{
+    MutexLock ml( &m_mutex );
+    MsgRec* rec = add_locked( new MsgRec( ++m_nextID, devid, NULL, 0,
+                                          AddrInfo::NULL_TOKEN, buf, len ) );
+    logStore_locked( rec );
+    ++m_nStored;
+    return rec->m_id;
+}
+
+int
+MsgStore::Store( const char* const connName, HostID hid, DevIDRelay devid,
+                 AddrInfo::ClientToken token, const uint8_t* buf, int len )
+{
+    int msgID = 0;
+    /* Need what's in the DB to catch duplicates */
+    loadIf( connName );
+
+    MutexLock ml( &m_mutex );
+    MsgQueue* queue = getQueue_locked( connName );
+    bool dup = false;
+    set<int>::const_iterator iter;
+    for ( iter = queue->m_ids.begin(); !dup && queue->m_ids.end() != iter;
+          ++iter ) {
+        const MsgRec* rec = m_msgs.find( *iter )->second;
+        dup = rec->m_hid == hid && (int)rec->m_msg.size() == len
+            && 0 == memcmp( rec->m_msg.data(), buf, len );
+    }
+
+    if ( dup ) {
+        logf( XW_LOGINFO, "Not stored; duplicate?" );
+    } else {
+        MsgRec* rec = add_locked( new MsgRec( ++m_nextID, devid, connName,
+                                              hid, token, buf, len ) );
+        logStore_locked( rec );
+        ++m_nStored;
+        msgID = rec->m_id;
+    }
+    return msgID;
+}
+
+void
+MsgStore::GetStored( DevIDRelay devid, vector<DBMgr::MsgInfo>& msgs )
+{
+    loadIf( devid );
+    MutexLock ml( &m_mutex );
+    collect_locked( getQueue_locked( devid )->m_ids, -1, msgs );
+}
+
+void
+MsgStore::GetStored( const char* const connName, HostID hid,
+                     vector<DBMgr::MsgInfo>& msgs )
+{
+    loadIf( connName );
+    MutexLock ml( &m_mutex );
+    collect_locked( getQueue_locked( connName )->m_ids, hid, msgs );
+}
+
+int
+MsgStore::CountStored( DevIDRelay devid )
+{
+    loadIf( devid );
+    MutexLock ml( &m_mutex );
+    return getQueue_locked( devid )->m_ids.size();
+}
+
+int
+MsgStore::CountStored( const char* const connName )
+{
+    loadIf( connName );
+    MutexLock ml( &m_mutex );
+    return getQueue_locked( connName )->m_ids.size();
+}
+
+// Acked messages that never made it to the DB are simply forgotten.  Those
+// that did are queued to be marked sent with the next flush.
+void
+MsgStore::Remove( const int* msgIDs, int nMsgIDs )
+{
+    MutexLock ml( &m_mutex );
+    for ( int ii = 0; ii < nMsgIDs; ++ii ) {
+        map<int, MsgRec*>::iterator iter = m_msgs.find( msgIDs[ii] );
+        if ( m_msgs.end() == iter ) {
+            logf( XW_LOGINFO, "%s: msg %d not found", __func__, msgIDs[ii] );
+        } else {
+            MsgRec* rec = iter->second;
+            if ( 0 == rec->m_dbID ) {
+                ++m_nAckedUnflushed;
+                drop_locked( rec, true );
+            } else {
+                m_dbRemovals.insert( rec->m_dbID );
+                logRemove_locked( LOG_DBSENT, rec->m_dbID );
+                drop_locked( rec, false );
+            }
+        }
+    }
+}
+
+void
+MsgStore::RecordSent( const int* msgIDs, int nMsgIDs )
+{
+    map<pair<string, HostID>, int> sums;
+    {
+        MutexLock ml( &m_mutex );
+        for ( int ii = 0; ii < nMsgIDs; ++ii ) {
+            map<int, MsgRec*>::const_iterator iter = m_msgs.find( msgIDs[ii] );
+            if ( m_msgs.end() != iter && iter->second->hasConnname() ) {
+                const MsgRec* rec = iter->second;
+                sums[pair<string, HostID>(rec->m_connName, rec->m_hid)]
+                    += rec->m_msg.size();
+            }
+        }
+    }
+
+    DBMgr* dbmgr = DBMgr::Get();
+    map<pair<string, HostID>, int>::const_iterator iter;
+    for ( iter = sums.begin(); sums.end() != iter; ++iter ) {
+        dbmgr->RecordSent( iter->first.first.c_str(), iter->first.second,
+                           iter->second );
+    }
+}
+
+// The DB keeps a dead game's messages but never returns them. Do the same by
+// dropping them here.
+void
+MsgStore::GameDied( const char* const connName )
+{
+    MutexLock ml( &m_mutex );
+    map<string, MsgQueue>::iterator qiter = m_connQueues.find( connName );
+    if ( m_connQueues.end() != qiter ) {
+        set<int> ids = qiter->second.m_ids;
+        set<int>::const_iterator iter;
+        for ( iter = ids.begin(); ids.end() != iter; ++iter ) {
+            drop_locked( m_msgs.find( *iter )->second, true );
+        }
+        m_connQueues.erase( qiter );
+    }
+}
+
+void
+MsgStore::printStats( StrWPF& out )
+{
+    MutexLock ml( &m_mutex );
+    out.catf( "flush after: %d s; evict after: %d s\n", m_flushSecs,
+              m_evictSecs );
+    out.catf( "in memory: %zu msgs (%zu unflushed); %zu device queues; "
+              "%zu game queues\n", m_msgs.size(), m_unflushed.size(),
+              m_devQueues.size(), m_connQueues.size() );
+    out.catf( "stored: %d; acked before flush: %d; flushed: %d\n",
+              m_nStored, m_nAckedUnflushed, m_nFlushed );
+    out.catf( "loaded from db: %d; commits: %d; queues evicted: %d\n",
+              m_nLoaded, m_nCommits, m_nEvicted );
+    out.catf( "awaiting mark-sent: %zu; log: %s (%zu bytes)\n",
+              m_dbRemovals.size(), m_logPath.c_str(), m_logBytes );
+}
+
+void
+MsgStore::GetCounts( int* nMsgs, int* nUnflushed )
+{
+    MutexLock ml( &m_mutex );
+    *nMsgs = m_msgs.size();
+    *nUnflushed = m_unflushed.size();
+}
+
+MsgStore::MsgQueue*
+MsgStore::getQueue_locked( DevIDRelay devid )
+{
+    MsgQueue* queue = &m_devQueues[devid];
+    queue->m_lastUse = time( NULL );
+    return queue;
+}
+
+MsgStore::MsgQueue*
+MsgStore::getQueue_locked( const char* const connName )
+{
+    MsgQueue* queue = &m_connQueues[connName];
+    queue->m_lastUse = time( NULL );
+    return queue;
+}
+
+// Read the device's messages from the DB the first time it's asked about. If
+// a flush changed the table while the query was running, the results may
+// duplicate or resurrect something, so try again.
+void
+MsgStore::loadIf( DevIDRelay devid )
+{
+    for ( ; ; ) {
+        uint32_t gen;
+        {
+            MutexLock ml( &m_mutex );
+            if ( getQueue_locked( devid )->m_loaded ) {
+                break;
+            }
+            gen = m_loadGen;
+        }
+
+        vector<DBMgr::MsgInfo> rows;
+        DBMgr::Get()->LoadStoredMessages( devid, rows );
+
+        MutexLock ml( &m_mutex );
+        if ( gen == m_loadGen ) {
+            merge_locked( rows );
+            getQueue_locked( devid )->m_loaded = true;
+            break;
+        }
+    }
+}
+
+void
+MsgStore::loadIf( const char* const connName )
+{
+    for ( ; ; ) {
+        uint32_t gen;
+        {
+            MutexLock ml( &m_mutex );
+            if ( getQueue_locked( connName )->m_loaded ) {
+                break;
+            }
+            gen = m_loadGen;
+        }
+
+        vector<DBMgr::MsgInfo> rows;
+        DBMgr::Get()->LoadStoredMessages( connName, rows );
+
+        MutexLock ml( &m_mutex );
+        if ( gen == m_loadGen ) {
+            merge_locked( rows );
+            getQueue_locked( connName )->m_loaded = true;
+            break;
+        }
+    }
+}
+
+void
+MsgStore::merge_locked( vector<DBMgr::MsgInfo>& rows )
+{
+    vector<DBMgr::MsgInfo>::const_iterator iter;
+    for ( iter = rows.begin(); rows.end() != iter; ++iter ) {
+        int dbID = iter->msgID();
+        if ( m_dbRemovals.end() != m_dbRemovals.find( dbID ) ) {
+            continue;           /* acked; just not marked yet */
+        }
+        map<int, int>::const_iterator idIter = m_dbIDs.find( dbID );
+        if ( m_dbIDs.end() != idIter ) {
+            attach_locked( m_msgs.find( idIter->second )->second );
+        } else {
+            MsgRec* rec = new MsgRec( ++m_nextID, iter->devID,
+                                      iter->connName.c_str(), iter->hid,
+                                      iter->token(), iter->msg.data(),
+                                      iter->msg.size() );
+            rec->m_dbID = dbID;
+            add_locked( rec );
+            ++m_nLoaded;
+        }
+    }
+}
+
+MsgStore::MsgRec*
+MsgStore::add_locked( MsgRec* rec )
+{
+    m_msgs.insert( pair<int, MsgRec*>( rec->m_id, rec ) );
+    if ( 0 == rec->m_dbID ) {
+        m_unflushed.insert( rec->m_id );
+    } else {
+        m_dbIDs.insert( pair<int, int>( rec->m_dbID, rec->m_id ) );
+    }
+    attach_locked( rec );
+    return rec;
+}
+
+void
+MsgStore::attach_locked( MsgRec* rec )
+{
+    if ( !rec->m_inDev && DBMgr::DEVID_NONE != rec->m_devID ) {
+        getQueue_locked( rec->m_devID )->m_ids.insert( rec->m_id );
+        rec->m_inDev = true;
+    }
+    if ( !rec->m_inConn && rec->hasConnname() ) {
+        getQueue_locked( rec->m_connName.c_str() )->m_ids.insert( rec->m_id );
+        rec->m_inConn = true;
+    }
+}
+
+void
+MsgStore::drop_locked( MsgRec* rec, bool logIt )
+{
+    if ( rec->m_inDev ) {
+        map<DevIDRelay, MsgQueue>::iterator iter =
+            m_devQueues.find( rec->m_devID );
+        if ( m_devQueues.end() != iter ) {
+            iter->second.m_ids.erase( rec->m_id );
+        }
+    }
+    if ( rec->m_inConn ) {
+        map<string, MsgQueue>::iterator iter =
+            m_connQueues.find( rec->m_connName );
+        if ( m_connQueues.end() != iter ) {
+            iter->second.m_ids.erase( rec->m_id );
+        }
+    }
+
+    if ( 0 == rec->m_dbID ) {
+        m_unflushed.erase( rec->m_id );
+        if ( logIt ) {
+            logRemove_locked( LOG_ACKED, rec->m_id );
+        }
+    } else {
+        m_dbIDs.erase( rec->m_dbID );
+    }
+    m_msgs.erase( rec->m_id );
+    delete rec;
+}
+
+/* static */ bool
+MsgStore::recOrder( const MsgRec* rec1, const MsgRec* rec2 )
+{
+    /* Anything in the DB was stored before anything not yet flushed */
+    bool result;
+    if ( (0 == rec1->m_dbID) != (0 == rec2->m_dbID) ) {
+        result = 0 != rec1->m_dbID;
+    } else if ( 0 != rec1->m_dbID ) {
+        result = rec1->m_dbID < rec2->m_dbID;
+    } else {
+        result = rec1->m_id < rec2->m_id;
+    }
+    return result;
+}
+
+void
+MsgStore::collect_locked( const set<int>& ids, int hid,
+                          vector<DBMgr::MsgInfo>& msgs )
+{
+    vector<const MsgRec*> recs;
+    set<int>::const_iterator iter;
+    for ( iter = ids.begin(); ids.end() != iter; ++iter ) {
+        const MsgRec* rec = m_msgs.find( *iter )->second;
+        if ( -1 == hid || hid == rec->m_hid ) {
+            recs.push_back( rec );
+        }
+    }
+    std::sort( recs.begin(), recs.end(), recOrder );
+
+    vector<const MsgRec*>::const_iterator recIter;
+    for ( recIter = recs.begin(); recs.end() != recIter; ++recIter ) {
+        const MsgRec* rec = *recIter;
+        DBMgr::MsgInfo msg( rec->m_id, rec->m_token, rec->hasConnname() );
+        msg.msg = rec->m_msg;
+        msgs.push_back( msg );
+    }
+}
+
+// Group commit: everything that's been sitting unacked for m_flushSecs goes
+// into the DB in one transaction, along with marking sent whatever's been
+// acked since being flushed.  The lock is not held while talking to the DB.
+void
+MsgStore::flush()
+{
+    vector<DBMgr::MsgInfo> newMsgs;
+    vector<int> ids;
+    vector<int> removals;
+    int logFD;
+    bool sync;
+    bool compact;
+    {
+        MutexLock ml( &m_mutex );
+        logFD = m_logFD;
+        sync = m_logDirty;
+        m_logDirty = false;
+        compact = MAX_LOG_BYTES < m_logBytes;
+
+        time_t now = time( NULL );
+        set<int>::iterator iter;
+        for ( iter = m_unflushed.begin(); m_unflushed.end() != iter; ) {
+            const MsgRec* rec = m_msgs.find( *iter )->second;
+            if ( now - rec->m_created < m_flushSecs ) {
+                break;          /* ids are in the order stored */
+            }
+            DBMgr::MsgInfo msg( rec->m_id, rec->m_token, rec->hasConnname() );
+            msg.msg = rec->m_msg;
+            msg.devID = rec->m_devID;
+            msg.hid = rec->m_hid;
+            msg.connName = rec->m_connName;
+            newMsgs.push_back( msg );
+            ids.push_back( rec->m_id );
+            m_unflushed.erase( iter++ );
+        }
+        removals.assign( m_dbRemovals.begin(), m_dbRemovals.end() );
+    }
+
+    /* Only this thread closes the log, so it's safe to sync unlocked */
+    if ( sync && 0 <= logFD && 0 != fdatasync( logFD ) ) {
+        logf( XW_LOGERROR, "%s: fdatasync(%s) failed: %s", __func__,
+              m_logPath.c_str(), strerror(errno) );
+    }
+
+    if ( 0 < newMsgs.size() || 0 < removals.size() ) {
+        bool ok = DBMgr::Get()->CommitStoredMessages( newMsgs, removals );
+
+        MutexLock ml( &m_mutex );
+        ++m_loadGen;
+        if ( ok ) {
+            ++m_nCommits;
+            m_nFlushed += newMsgs.size();
+            for ( size_t ii = 0; ii < newMsgs.size(); ++ii ) {
+                int dbID = newMsgs[ii].msgID();
+                map<int, MsgRec*>::iterator iter = m_msgs.find( ids[ii] );
+                if ( m_msgs.end() == iter ) {
+                    /* acked while we were writing it */
+                    m_dbRemovals.insert( dbID );
+                } else {
+                    iter->second->m_dbID = dbID;
+                    m_dbIDs.insert( pair<int, int>( dbID, ids[ii] ) );
+                }
+            }
+            vector<int>::const_iterator iter;
+            for ( iter = removals.begin(); removals.end() != iter; ++iter ) {
+                m_dbRemovals.erase( *iter );
+            }
+            rewriteLog_locked();
+        } else {
+            logf( XW_LOGERROR, "%s: commit failed; will retry", __func__ );
+            vector<int>::const_iterator iter;
+            for ( iter = ids.begin(); ids.end() != iter; ++iter ) {
+                if ( m_msgs.end() != m_msgs.find( *iter ) ) {
+                    m_unflushed.insert( *iter );
+                }
+            }
+        }
+    } else if ( compact ) {
+        MutexLock ml( &m_mutex );
+        rewriteLog_locked();
+    }
+} /* flush */
+
+// Forget queues nobody's asked about in a while, provided everything in
+// them is safely in the DB.  They'll be reloaded if needed.
+void
+MsgStore::evict_locked( time_t now )
+{
+    time_t oldest = now - m_evictSecs;
+
+    map<DevIDRelay, MsgQueue>::iterator devIter;
+    for ( devIter = m_devQueues.begin(); m_devQueues.end() != devIter; ) {
+        MsgQueue& queue = devIter->second;
+        bool evict = queue.m_lastUse < oldest;
+        set<int>::const_iterator iter;
+        for ( iter = queue.m_ids.begin(); evict && queue.m_ids.end() != iter;
+              ++iter ) {
+            evict = 0 != m_msgs.find( *iter )->second->m_dbID;
+        }
+        if ( evict ) {
+            for ( iter = queue.m_ids.begin(); queue.m_ids.end() != iter;
+                  ++iter ) {
+                MsgRec* rec = m_msgs.find( *iter )->second;
+                rec->m_inDev = false;
+                if ( !rec->m_inConn ) {
+                    drop_locked( rec, false );
+                }
+            }
+            m_devQueues.erase( devIter++ );
+            ++m_nEvicted;
+        } else {
+            ++devIter;
+        }
+    }
+
+    map<string, MsgQueue>::iterator connIter;
+    for ( connIter = m_connQueues.begin(); m_connQueues.end() != connIter; ) {
+        MsgQueue& queue = connIter->second;
+        bool evict = queue.m_lastUse < oldest;
+        set<int>::const_iterator iter;
+        for ( iter = queue.m_ids.begin(); evict && queue.m_ids.end() != iter;
+              ++iter ) {
+            evict = 0 != m_msgs.find( *iter )->second->m_dbID;
+        }
+        if ( evict ) {
+            for ( iter = queue.m_ids.begin(); queue.m_ids.end() != iter;
+                  ++iter ) {
+                MsgRec* rec = m_msgs.find( *iter )->second;
+                rec->m_inConn = false;
+                if ( !rec->m_inDev ) {
+                    drop_locked( rec, false );
+                }
+            }
+            m_connQueues.erase( connIter++ );
+            ++m_nEvicted;
+        } else {
+            ++connIter;
+        }
+    }
+} /* evict_locked */
+
+void
+MsgStore::replayLog()
+{
+    vector<uint8_t> buf;
+    int fd = open( m_logPath.c_str(), O_RDONLY );
+    if ( 0 <= fd ) {
+        uint8_t tmp[4096];
+        ssize_t nRead;
+        while ( 0 < (nRead = read( fd, tmp, sizeof(tmp) ) ) ) {
+            buf.insert( buf.end(), tmp, tmp + nRead );
+        }
+        close( fd );
+    }
+
+    const uint8_t* ptr = buf.data();
+    const uint8_t* end = ptr + buf.size();
+    while ( ptr < end ) {
+        uint8_t type = *ptr++;
+        uint32_t id;
+        if ( !getInt( &ptr, end, &id ) ) {
+            break;
+        }
+        if ( LOG_STORE == type ) {
+            uint32_t devid, hid, token, created, connLen, msgLen;
+            if ( !getInt( &ptr, end, &devid ) || !getInt( &ptr, end, &hid )
+                 || !getInt( &ptr, end, &token )
+                 || !getInt( &ptr, end, &created )
+                 || !getInt( &ptr, end, &connLen )
+                 || ptr + connLen > end ) {
+                break;
+            }
+            string connName( (const char*)ptr, connLen );
+            ptr += connLen;
+            if ( !getInt( &ptr, end, &msgLen ) || ptr + msgLen > end ) {
+                break;
+            }
+            MsgRec* rec = new MsgRec( id, devid, connName.c_str(), hid, token,
+                                      ptr, msgLen );
+            rec->m_created = created;
+            add_locked( rec );
+            ptr += msgLen;
+            if ( m_nextID < (int)id ) {
+                m_nextID = id;
+            }
+        } else if ( LOG_ACKED == type ) {
+            map<int, MsgRec*>::iterator iter = m_msgs.find( id );
+            if ( m_msgs.end() != iter ) {
+                drop_locked( iter->second, false );
+            }
+        } else if ( LOG_DBSENT == type ) {
+            m_dbRemovals.insert( id );
+        } else {
+            logf( XW_LOGERROR, "%s: bad record type %d in %s", __func__,
+                  type, m_logPath.c_str() );
+            break;
+        }
+    }
+} /* replayLog */
+
+void
+MsgStore::logStore_locked( const MsgRec* rec )
+{
+    vector<uint8_t> out;
+    out.push_back( LOG_STORE );
+    pushInt( out, rec->m_id );
+    pushInt( out, rec->m_devID );
+    pushInt( out, rec->m_hid );
+    pushInt( out, rec->m_token );
+    pushInt( out, rec->m_created );
+    pushInt( out, rec->m_connName.size() );
+    out.insert( out.end(), rec->m_connName.begin(), rec->m_connName.end() );
+    pushInt( out, rec->m_msg.size() );
+    out.insert( out.end(), rec->m_msg.begin(), rec->m_msg.end() );
+    logWrite_locked( out );
+}
+
+void
+MsgStore::logRemove_locked( char type, int id )
+{
+    vector<uint8_t> out;
+    out.push_back( type );
+    pushInt( out, id );
+    logWrite_locked( out );
+}
+
+void
+MsgStore::logWrite_locked( const vector<uint8_t>& rec )
+{
+    if ( 0 <= m_logFD ) {
+        ssize_t nWritten = write( m_logFD, rec.data(), rec.size() );
+        if ( nWritten != (ssize_t)rec.size() ) {
+            logf( XW_LOGERROR, "%s: write to %s failed: %s", __func__,
+                  m_logPath.c_str(), strerror(errno) );
+        }
+        m_logBytes += rec.size();
+        m_logDirty = true;
+    }
+}
+
+// Replace the log with one holding only what's not yet in the DB: messages
+// not flushed and flushed messages not yet marked sent.
+void
+MsgStore::rewriteLog_locked()
+{
+    string tmpPath = m_logPath + ".tmp";
+    int fd = open( tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600 );
+    if ( 0 > fd ) {
+        logf( XW_LOGERROR, "%s: unable to open %s: %s", __func__,
+              tmpPath.c_str(), strerror(errno) );
+    } else {
+        int oldFD = m_logFD;
+        m_logFD = fd;
+        m_logBytes = 0;
+
+        set<int>::const_iterator iter;
+        for ( iter = m_unflushed.begin(); m_unflushed.end() != iter; ++iter ) {
+            logStore_locked( m_msgs.find( *iter )->second );
+        }
+        for ( iter = m_dbRemovals.begin(); m_dbRemovals.end() != iter;
+              ++iter ) {
+            logRemove_locked( LOG_DBSENT, *iter );
+        }
+
+        (void)fdatasync( fd );
+        m_logDirty = false;
+        if ( 0 != rename( tmpPath.c_str(), m_logPath.c_str() ) ) {
+            logf( XW_LOGERROR, "%s: rename to %s failed: %s", __func__,
+                  m_logPath.c_str(), strerror(errno) );
+        }
+        if ( 0 <= oldFD ) {
+            close( oldFD );
+        }
+    }
+} /* rewriteLog_locked */
+
+void*
+MsgStore::threadProc()
+{
+    time_t lastEvict = time( NULL );
+    for ( ; ; ) {
+        sleep( 1 );
+        flush();
+
+        time_t now = time( NULL );
+        if ( m_flushSecs <= now - lastEvict ) {
+            MutexLock ml( &m_mutex );
+            evict_locked( now );
+            lastEvict = now;
+        }
+    }
+    return NULL;
+}
+
+/* static */ void*
+MsgStore::thread_main( void* arg )
+{
+    blockSignals();
+
+    MsgStore* self = (MsgStore*)arg;
+    return self->threadProc();
+}
@@ -0,0 +1,153 @@
+/* -*-mode: C; fill-column: 78; c-basic-offset: 4; -*- */
+/*
+ * Copyright 2018 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef _MSGSTORE_H_
+#define _MSGSTORE_H_
+
+#include <pthread.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "xwrelay_priv.h"
+#include "dbmgr.h"
+#include "strwpf.h"
+
+using namespace std;
+
+/* Write-behind cache in front of the msgs table.  Most stored messages are
+ * acked within seconds of being stored, so rather than INSERT each one and
+ * then mark it sent, keep them in per-device (and per-game) queues in
+ * memory, append them to a local log so a crash doesn't lose them, and only
+ * write to the DB those that are still around after MSGSTORE_FLUSH_SECS.
+ * Flushing happens in one transaction per pass, along with marking sent any
+ * flushed messages that have since been acked.
+ *
+ * Message IDs handed out are the store's own, not msgs.id.  Disabled (Get()
+ * returns NULL and DBMgr goes straight to the DB) unless
+ * MSGSTORE_FLUSH_SECS is set.
+ */
+
+class MsgStore {
+ public:
+    static MsgStore* Get();
+
+    int Store( DevIDRelay devid, const uint8_t* buf, int len );
+    int Store( const char* const connName, HostID hid, DevIDRelay devid,
+               AddrInfo::ClientToken token, const uint8_t* buf, int len );
+    void GetStored( DevIDRelay devid, vector<DBMgr::MsgInfo>& msgs );
+    void GetStored( const char* const connName, HostID hid,
+                    vector<DBMgr::MsgInfo>& msgs );
+    int CountStored( DevIDRelay devid );
+    int CountStored( const char* const connName );
+    void Remove( const int* msgIDs, int nMsgIDs );
+    void RecordSent( const int* msgIDs, int nMsgIDs );
+    void GameDied( const char* const connName );
+
+    /* called from ctrl port */
+    void printStats( StrWPF& out );
+    void GetCounts( int* nMsgs, int* nUnflushed );
+
+ private:
+    class MsgRec {
+    public:
+        MsgRec( int id, DevIDRelay devid, const char* connName, HostID hid,
+                AddrInfo::ClientToken token, const uint8_t* buf, int len )
+            : m_id(id), m_dbID(0), m_devID(devid),
+              m_connName(NULL == connName ? "" : connName), m_hid(hid),
+              m_token(token), m_created(time(NULL)), m_msg(buf, buf + len),
+              m_inDev(false), m_inConn(false)
+            {}
+        bool hasConnname() const { return 0 < m_connName.size(); }
+
+        int m_id;
+        int m_dbID;             /* 0 until flushed */
+        DevIDRelay m_devID;
+        string m_connName;
+        HostID m_hid;
+        AddrInfo::ClientToken m_token;
+        time_t m_created;
+        vector<uint8_t> m_msg;
+        bool m_inDev;
+        bool m_inConn;
+    };
+
+    /* A device's or game's messages.  Not loaded means the DB may have
+       messages for it that haven't been read into memory yet. */
+    class MsgQueue {
+    public:
+        MsgQueue() : m_loaded(false), m_lastUse(0) {}
+        bool m_loaded;
+        time_t m_lastUse;
+        set<int> m_ids;
+    };
+
+    MsgStore( int flushSecs, int evictSecs, const char* logPath );
+    static void* thread_main( void* arg );
+    void* threadProc();
+
+    MsgQueue* getQueue_locked( DevIDRelay devid );
+    MsgQueue* getQueue_locked( const char* const connName );
+    void loadIf( DevIDRelay devid );
+    void loadIf( const char* const connName );
+    void merge_locked( vector<DBMgr::MsgInfo>& rows );
+    MsgRec* add_locked( MsgRec* rec );
+    void attach_locked( MsgRec* rec );
+    void drop_locked( MsgRec* rec, bool logIt );
+    void collect_locked( const set<int>& ids, int hid,
+                         vector<DBMgr::MsgInfo>& msgs );
+
+    static bool recOrder( const MsgRec* rec1, const MsgRec* rec2 );
+    void flush();
+    void evict_locked( time_t now );
+
+    void replayLog();
+    void logStore_locked( const MsgRec* rec );
+    void logRemove_locked( char type, int id );
+    void logWrite_locked( const vector<uint8_t>& rec );
+    void rewriteLog_locked();
+
+    int m_flushSecs;            /* config: how long before going to DB */
+    int m_evictSecs;            /* config: how long to keep idle queues */
+    string m_logPath;
+    int m_logFD;
+    bool m_logDirty;
+    size_t m_logBytes;
+
+    pthread_mutex_t m_mutex;
+    int m_nextID;
+    uint32_t m_loadGen;         /* bumped whenever the msgs table changes */
+    map<int, MsgRec*> m_msgs;
+    map<int, int> m_dbIDs;      /* msgs.id => our id */
+    map<DevIDRelay, MsgQueue> m_devQueues;
+    map<string, MsgQueue> m_connQueues;
+    set<int> m_unflushed;
+    set<int> m_dbRemovals;      /* flushed, acked, not yet marked in DB */
+
+    /* stats */
+    int m_nStored;
+    int m_nAckedUnflushed;
+    int m_nFlushed;
+    int m_nLoaded;
+    int m_nCommits;
+    int m_nEvicted;
+};
+
+#endif
@@ -0,0 +1,124 @@
+/* -*-mode: C; fill-column: 78; c-basic-offset: 4; -*- */
+/* 
+ * Copyright 2018 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <algorithm>
+
+#include "nomsgs.h"
+#include "mlock.h"
+#include "xwrelay_priv.h"
+
+#define NOMSGS_STRIPES 32
+
+NoMsgsCache::NoMsgsCache( int nSlots )
+    : m_primed(false)
+{
+    m_slotsPerStripe = (nSlots + NOMSGS_STRIPES - 1) / NOMSGS_STRIPES;
+    if ( 0 == m_slotsPerStripe ) {
+        m_slotsPerStripe = 1;
+    }
+    m_slots = (uint64_t*)calloc( NOMSGS_STRIPES * m_slotsPerStripe,
+                                 sizeof(*m_slots) );
+    m_stripes = new Stripe[NOMSGS_STRIPES];
+    for ( int ii = 0; ii < NOMSGS_STRIPES; ++ii ) {
+        pthread_mutex_init( &m_stripes[ii].m_mutex, NULL );
+        m_stripes[ii].m_gen = 0;
+    }
+}
+
+int
+NoMsgsCache::stripeFor( uint64_t key ) const
+{
+    return key % NOMSGS_STRIPES;
+}
+
+/* A key's slot is always in its stripe's range so that stripe's lock covers
+   it */
+uint64_t*
+NoMsgsCache::slotFor( uint64_t key )
+{
+    uint32_t indx = (key / NOMSGS_STRIPES) % m_slotsPerStripe;
+    return &m_slots[(stripeFor(key) * m_slotsPerStripe) + indx];
+}
+
+bool
+NoMsgsCache::Has( uint64_t key, uint32_t* gen )
+{
+    bool result;
+    Stripe* stripe = &m_stripes[stripeFor(key)];
+    {
+        MutexLock ml( &stripe->m_mutex );
+        uint64_t val = *slotFor( key );
+        if ( key == keyOf( val ) ) {
+            result = val == hasNone( key );
+        } else {
+            result = m_primed
+                && !std::binary_search( m_pending.begin(), m_pending.end(),
+                                        key );
+        }
+        *gen = stripe->m_gen;
+    }
+    return result;
+}
+
+void
+NoMsgsCache::Set( uint64_t key, uint32_t gen )
+{
+    Stripe* stripe = &m_stripes[stripeFor(key)];
+    MutexLock ml( &stripe->m_mutex );
+    if ( gen == stripe->m_gen ) {
+        uint64_t* slot = slotFor( key );
+        if ( m_primed && 0 != *slot && *slot == hasSome( keyOf(*slot) ) ) {
+            logf( XW_LOGINFO, "%s: evicting cleared key; unpriming", __func__ );
+            m_primed = false;
+        }
+        *slot = hasNone( key );
+    }
+}
+
+void
+NoMsgsCache::Clear( uint64_t key )
+{
+    Stripe* stripe = &m_stripes[stripeFor(key)];
+    MutexLock ml( &stripe->m_mutex );
+    ++stripe->m_gen;
+    uint64_t* slot = slotFor( key );
+    if ( m_primed ) {
+        if ( 0 != *slot && keyOf(*slot) != key
+             && *slot == hasSome( keyOf(*slot) ) ) {
+            logf( XW_LOGINFO, "%s: evicting cleared key; unpriming", __func__ );
+            m_primed = false;
+        }
+        *slot = hasSome( key );
+    } else if ( key == keyOf( *slot ) ) {
+        *slot = 0;
+    }
+}
+
+/* Called once, before anything's looked up */
+void
+NoMsgsCache::Prime( vector<uint64_t>& pending )
+{
+    assert( !m_primed && 0 == m_pending.size() );
+    m_pending.swap( pending );
+    std::sort( m_pending.begin(), m_pending.end() );
+    __sync_synchronize();
+    m_primed = true;
+}
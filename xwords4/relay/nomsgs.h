@@ -0,0 +1,76 @@
+/* -*-mode: C; fill-column: 78; c-basic-offset: 4; -*- */
+/* 
+ * Copyright 2018 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef _NOMSGS_H_
+#define _NOMSGS_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <vector>
+
+using namespace std;
+
+/* Negative cache for stored-message fetches: remembers which devices and
+ * game slots were found to have nothing waiting so the DB needn't be asked
+ * again until something's stored for them.  Keys are 64-bit hashes (see
+ * DBMgr); a slot holds one key, so the cache is bounded and a collision
+ * just evicts, costing a query.  Slots are split among lock stripes.
+ *
+ * Each stripe has a generation bumped by every Clear() so that a fetch that
+ * raced with a store can't mark the key empty afterwards: pass Set() the
+ * generation Has() returned before the query.
+ *
+ * After a restart the cache would be empty just when every device is
+ * reconnecting.  Prime() takes the (sorted) keys that have messages waiting,
+ * after which any key absent from the cache and from that list is known to
+ * have none.  That only holds while every Clear() since is still remembered,
+ * so evicting a cleared key ends priming.
+ */
+
+class NoMsgsCache {
+ public:
+    NoMsgsCache( int nSlots );
+    bool Has( uint64_t key, uint32_t* gen );
+    void Set( uint64_t key, uint32_t gen );
+    void Clear( uint64_t key );
+    void Prime( vector<uint64_t>& pending );
+
+ private:
+    class Stripe {
+    public:
+        pthread_mutex_t m_mutex;
+        uint32_t m_gen;
+    };
+
+    /* Low bit of a slot's value says which: keys are stored shifted */
+    static uint64_t hasNone( uint64_t key ) { return (key << 1) | 1; }
+    static uint64_t hasSome( uint64_t key ) { return key << 1; }
+    static uint64_t keyOf( uint64_t val ) { return val >> 1; }
+
+    int stripeFor( uint64_t key ) const;
+    uint64_t* slotFor( uint64_t key );
+
+    Stripe* m_stripes;
+    uint64_t* m_slots;          /* 0: empty */
+    uint32_t m_slotsPerStripe;
+    vector<uint64_t> m_pending; /* set once by Prime() */
+    volatile bool m_primed;
+};
+
+#endif
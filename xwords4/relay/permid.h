@@ -36,6 +36,7 @@ class PermID {
     static void SetServerName( const char* name );
     static void SetStartTime( time_t startTime );
     static std::string GetNextUniqueID();
+    static const std::string& GetServerName() { return s_serverName; }
 
  private:
     static pthread_mutex_t    s_guard;        /* guard access to the whole
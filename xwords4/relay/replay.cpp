@@ -0,0 +1,417 @@
+/* -*-mode: C; fill-column: 78; c-basic-offset: 4; -*- */
+/* 
+ * Copyright 2018 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+/* Replays a capture made by the relay (see capture.h, capfmt.h) against a
+ * (test) relay, for benchmarking it on real traffic.  Each sender in the
+ * capture gets a stand-in socket of its own, so the relay sees as many
+ * distinct clients as the original did: a UDP socket per sender address,
+ * and for TCP a connection per sender, opened when its first packet's due,
+ * to the port the original came in on (or -T's).
+ *
+ * Packets go out on the captured schedule divided by -x's speedup, or as
+ * fast as possible with -x 0.  Whatever the relay sends back is read and
+ * counted but not otherwise looked at: the replayed acks don't match the
+ * relay's new packet IDs, and devices it tries to reach only hear it if
+ * their stand-in was the last to use that address.  Same capture, same
+ * relay state and same speed make for comparable runs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <assert.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "capfmt.h"
+
+using namespace std;
+
+#define DEFAULT_HOST "localhost"
+#define DEFAULT_PORT 10997      /* UDP_PORT in xwrelay.conf */
+#define DEFAULT_DRAIN_SECS 2
+
+static struct {
+    const char* host;
+    int port;
+    int tcpPort;                /* 0: use the captured one */
+    double speed;               /* 0: as fast as possible */
+    int drainSecs;
+    struct sockaddr_in addr;
+} g_cfg;
+
+/* One per captured packet, pointing into the file's bytes */
+struct Rec {
+    uint64_t when;              /* usecs since capture start */
+    uint8_t kind;
+    uint16_t lport;
+    uint32_t addr;
+    uint16_t port;
+    uint16_t len;
+    const uint8_t* data;
+};
+
+/* A stand-in for one captured sender */
+struct StandIn {
+    StandIn() : m_sock(-1), m_failed(false) {}
+    int m_sock;
+    bool m_failed;
+};
+
+static struct {
+    uint64_t nSent[CAP_KIND_TCP + 1];
+    uint64_t nBytesSent;
+    uint64_t nSendErrors;
+    uint64_t maxLagUsecs;
+    uint64_t sumLagUsecs;
+    volatile uint64_t nReads;
+    volatile uint64_t nBytesRead;
+} g_stats;
+
+static volatile bool g_done = false;
+
+static uint64_t
+now_usecs( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t
+getInt( const uint8_t* ptr, int nBytes )
+{
+    uint64_t val = 0;
+    for ( int ii = 0; ii < nBytes; ++ii ) {
+        val = (val << 8) | ptr[ii];
+    }
+    return val;
+}
+
+static void
+readCapture( const char* path, vector<uint8_t>& bytes, vector<Rec>& recs )
+{
+    FILE* fil = fopen( path, "r" );
+    if ( NULL == fil ) {
+        fprintf( stderr, "can't open %s: %s\n", path, strerror(errno) );
+        exit( 1 );
+    }
+    for ( ; ; ) {
+        uint8_t buf[64 * 1024];
+        size_t nRead = fread( buf, 1, sizeof(buf), fil );
+        if ( 0 == nRead ) {
+            break;
+        }
+        bytes.insert( bytes.end(), buf, buf + nRead );
+    }
+    fclose( fil );
+
+    if ( bytes.size() < CAP_FILE_HDR_LEN
+         || 0 != memcmp( &bytes[0], CAP_MAGIC, strlen(CAP_MAGIC) )
+         || CAP_VERSION != getInt( &bytes[6], 2 ) ) {
+        fprintf( stderr, "%s isn't a version %d capture\n", path,
+                 CAP_VERSION );
+        exit( 1 );
+    }
+
+    uint64_t when = 0;
+    size_t offset = CAP_FILE_HDR_LEN;
+    while ( offset + CAP_REC_HDR_LEN <= bytes.size() ) {
+        const uint8_t* ptr = &bytes[offset];
+        Rec rec;
+        when += getInt( ptr, 4 );
+        rec.when = when;
+        rec.kind = ptr[4];
+        rec.lport = getInt( ptr + 6, 2 );
+        rec.addr = getInt( ptr + 8, 4 );
+        rec.port = getInt( ptr + 12, 2 );
+        rec.len = getInt( ptr + 14, 2 );
+        offset += CAP_REC_HDR_LEN;
+        if ( offset + rec.len > bytes.size() ) {
+            fprintf( stderr, "capture truncated after %zu packets\n",
+                     recs.size() );
+            break;
+        }
+        rec.data = &bytes[offset];
+        offset += rec.len;
+        if ( CAP_KIND_UDP == rec.kind || CAP_KIND_TCP == rec.kind ) {
+            recs.push_back( rec );
+        }
+    }
+}
+
+static uint64_t
+senderKey( const Rec& rec )
+{
+    return ((uint64_t)rec.kind << 48) | ((uint64_t)rec.addr << 16) | rec.port;
+}
+
+static int
+openStandIn( const Rec& rec, int epoll )
+{
+    struct sockaddr_in dest = g_cfg.addr;
+    int type = SOCK_DGRAM;
+    if ( CAP_KIND_TCP == rec.kind ) {
+        type = SOCK_STREAM;
+        dest.sin_port = htons( 0 != g_cfg.tcpPort ? g_cfg.tcpPort : rec.lport );
+    }
+
+    int sock = socket( AF_INET, type, 0 );
+    if ( 0 > sock ) {
+        fprintf( stderr, "socket() failed: %s\n", strerror(errno) );
+    } else if ( 0 != connect( sock, (struct sockaddr*)&dest, sizeof(dest) ) ) {
+        fprintf( stderr, "connect() to port %d failed: %s\n",
+                 ntohs(dest.sin_port), strerror(errno) );
+        close( sock );
+        sock = -1;
+    } else {
+        struct epoll_event ev;
+        memset( &ev, 0, sizeof(ev) );
+        ev.events = EPOLLIN;
+        ev.data.fd = sock;
+        (void)epoll_ctl( epoll, EPOLL_CTL_ADD, sock, &ev );
+    }
+    return sock;
+}
+
+/* Reads and counts whatever comes back */
+static void*
+reader_main( void* arg )
+{
+    int epoll = (int)(intptr_t)arg;
+    uint8_t buf[64 * 1024];
+    while ( !g_done ) {
+        struct epoll_event events[64];
+        int nEvents = epoll_wait( epoll, events, 64, 100 );
+        for ( int ii = 0; ii < nEvents; ++ii ) {
+            int sock = events[ii].data.fd;
+            ssize_t nRead = recv( sock, buf, sizeof(buf), MSG_DONTWAIT );
+            if ( 0 < nRead ) {
+                __sync_fetch_and_add( &g_stats.nReads, 1 );
+                __sync_fetch_and_add( &g_stats.nBytesRead, nRead );
+            } else if ( 0 == nRead
+                        || (EAGAIN != errno && EWOULDBLOCK != errno) ) {
+                /* closed, or UDP's ICMP unreachable: stop listening */
+                (void)epoll_ctl( epoll, EPOLL_CTL_DEL, sock, NULL );
+            }
+        }
+    }
+    return NULL;
+}
+
+static void
+sendRec( const Rec& rec, int sock )
+{
+    ssize_t nSent;
+    size_t want = rec.len;
+    if ( CAP_KIND_TCP == rec.kind ) {
+        uint16_t len = htons( rec.len );
+        struct iovec iov[2];
+        iov[0].iov_base = &len;
+        iov[0].iov_len = sizeof(len);
+        iov[1].iov_base = (void*)rec.data;
+        iov[1].iov_len = rec.len;
+        want += sizeof(len);
+        nSent = writev( sock, iov, 2 );
+    } else {
+        nSent = send( sock, rec.data, rec.len, 0 );
+    }
+    if ( (ssize_t)want == nSent ) {
+        ++g_stats.nSent[rec.kind];
+        g_stats.nBytesSent += nSent;
+    } else {
+        ++g_stats.nSendErrors;
+    }
+}
+
+static void
+usage( const char * const argv0 )
+{
+    fprintf( stderr, "usage: %s \\\n", argv0 );
+    fprintf( stderr, "\t[-a <host>]     # relay host (default: %s) \\\n",
+             DEFAULT_HOST );
+    fprintf( stderr, "\t[-p <port>]     # relay UDP port (default: %d) \\\n",
+             DEFAULT_PORT );
+    fprintf( stderr, "\t[-T <port>]     # send all TCP here (default: the "
+             "captured port) \\\n" );
+    fprintf( stderr, "\t[-x <speedup>]  # 1 for real time, 10 for ten times "
+             "faster, 0 for flat out (default: 1) \\\n" );
+    fprintf( stderr, "\t[-d <secs>]     # wait for replies after the last "
+             "send (default: %d) \\\n", DEFAULT_DRAIN_SECS );
+    fprintf( stderr, "\t<capture file>\n" );
+    exit( 1 );
+}
+
+int
+main( int argc, char** argv )
+{
+    g_cfg.host = DEFAULT_HOST;
+    g_cfg.port = DEFAULT_PORT;
+    g_cfg.speed = 1.0;
+    g_cfg.drainSecs = DEFAULT_DRAIN_SECS;
+
+    for ( ; ; ) {
+        int opt = getopt( argc, argv, "a:p:T:x:d:" );
+        if ( opt < 0 ) {
+            break;
+        }
+        switch ( opt ) {
+        case 'a': g_cfg.host = optarg; break;
+        case 'p': g_cfg.port = atoi( optarg ); break;
+        case 'T': g_cfg.tcpPort = atoi( optarg ); break;
+        case 'x': g_cfg.speed = atof( optarg ); break;
+        case 'd': g_cfg.drainSecs = atoi( optarg ); break;
+        default:
+            usage( argv[0] );
+        }
+    }
+    if ( optind + 1 != argc || 0 > g_cfg.speed || 0 > g_cfg.drainSecs ) {
+        usage( argv[0] );
+    }
+
+    struct addrinfo hints, *res;
+    memset( &hints, 0, sizeof(hints) );
+    hints.ai_family = AF_INET;  /* captures are IPv4 */
+    char portStr[16];
+    snprintf( portStr, sizeof(portStr), "%d", g_cfg.port );
+    int err = getaddrinfo( g_cfg.host, portStr, &hints, &res );
+    if ( 0 != err ) {
+        fprintf( stderr, "can't resolve %s: %s\n", g_cfg.host,
+                 gai_strerror(err) );
+        exit( 1 );
+    }
+    memcpy( &g_cfg.addr, res->ai_addr, sizeof(g_cfg.addr) );
+    freeaddrinfo( res );
+
+    vector<uint8_t> bytes;
+    vector<Rec> recs;
+    readCapture( argv[optind], bytes, recs );
+
+    map<uint64_t, StandIn> standIns;
+    for ( size_t ii = 0; ii < recs.size(); ++ii ) {
+        (void)standIns[senderKey(recs[ii])];
+    }
+
+    /* one socket per sender */
+    struct rlimit rl;
+    if ( 0 == getrlimit( RLIMIT_NOFILE, &rl ) ) {
+        rlim_t want = standIns.size() + 64;
+        if ( rl.rlim_cur < want ) {
+            rl.rlim_cur = min( want, rl.rlim_max );
+            (void)setrlimit( RLIMIT_NOFILE, &rl );
+        }
+    }
+
+    int epoll = epoll_create1( 0 );
+    assert( 0 <= epoll );
+    pthread_t reader;
+    pthread_create( &reader, NULL, reader_main, (void*)(intptr_t)epoll );
+
+    /* UDP sockets are cheap to set up ahead of time so that isn't timed;
+       TCP connects happen when the original would have */
+    map<uint64_t, StandIn>::iterator iter;
+    for ( iter = standIns.begin(); standIns.end() != iter; ++iter ) {
+        if ( CAP_KIND_UDP == (iter->first >> 48) ) {
+            size_t ii;
+            for ( ii = 0; senderKey(recs[ii]) != iter->first; ++ii ) {
+            }
+            iter->second.m_sock = openStandIn( recs[ii], epoll );
+            iter->second.m_failed = 0 > iter->second.m_sock;
+        }
+    }
+
+    char speedStr[32];
+    if ( 0 == g_cfg.speed ) {
+        snprintf( speedStr, sizeof(speedStr), "full speed" );
+    } else {
+        snprintf( speedStr, sizeof(speedStr), "%gx", g_cfg.speed );
+    }
+    fprintf( stderr, "replaying %zu packets from %zu senders (%.1f seconds "
+             "as captured) at %s against %s:%d...\n", recs.size(),
+             standIns.size(),
+             recs.empty() ? 0.0 : recs.back().when / 1000000.0,
+             speedStr, g_cfg.host, g_cfg.port );
+
+    uint64_t start = now_usecs();
+    for ( size_t ii = 0; ii < recs.size(); ++ii ) {
+        const Rec& rec = recs[ii];
+        if ( 0 < g_cfg.speed ) {
+            uint64_t due = start + (uint64_t)(rec.when / g_cfg.speed);
+            uint64_t now = now_usecs();
+            if ( now < due ) {
+                usleep( due - now );
+                now = now_usecs();
+            }
+            uint64_t lag = now > due ? now - due : 0;
+            g_stats.sumLagUsecs += lag;
+            g_stats.maxLagUsecs = max( g_stats.maxLagUsecs, lag );
+        }
+
+        StandIn& standIn = standIns[senderKey(rec)];
+        if ( -1 == standIn.m_sock && !standIn.m_failed ) {
+            standIn.m_sock = openStandIn( rec, epoll );
+            standIn.m_failed = 0 > standIn.m_sock;
+        }
+        if ( standIn.m_failed ) {
+            ++g_stats.nSendErrors;
+        } else {
+            sendRec( rec, standIn.m_sock );
+        }
+    }
+    uint64_t elapsed = now_usecs() - start;
+
+    sleep( g_cfg.drainSecs );
+    g_done = true;
+    pthread_join( reader, NULL );
+
+    double secs = elapsed / 1000000.0;
+    uint64_t nSent = g_stats.nSent[CAP_KIND_UDP] + g_stats.nSent[CAP_KIND_TCP];
+    fprintf( stdout, "sent %llu packets (%llu UDP, %llu TCP; %llu bytes) "
+             "in %.3f seconds: %.0f packets/second\n",
+             (unsigned long long)nSent,
+             (unsigned long long)g_stats.nSent[CAP_KIND_UDP],
+             (unsigned long long)g_stats.nSent[CAP_KIND_TCP],
+             (unsigned long long)g_stats.nBytesSent, secs,
+             0 < secs ? nSent / secs : 0.0 );
+    fprintf( stdout, "send errors: %llu\n",
+             (unsigned long long)g_stats.nSendErrors );
+    if ( 0 < g_cfg.speed && 0 < recs.size() ) {
+        fprintf( stdout, "behind schedule: mean %.3f ms, max %.3f ms\n",
+                 g_stats.sumLagUsecs / 1000.0 / recs.size(),
+                 g_stats.maxLagUsecs / 1000.0 );
+    }
+    fprintf( stdout, "received %llu reads (%llu bytes) from the relay\n",
+             (unsigned long long)g_stats.nReads,
+             (unsigned long long)g_stats.nBytesRead );
+    return 0;
+}
@@ -0,0 +1,105 @@
+/* -*-mode: C; fill-column: 78; c-basic-offset: 4; -*- */
+/* 
+ * Copyright 2018 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rowcache.h"
+
+void
+PGArray4::Parse( const char* str, bool isNull, bool chars )
+{
+    m_null = isNull;
+    m_lo = 1;
+    m_hi = 0;
+    m_nonNull = 0;
+    if ( !isNull ) {
+        if ( '[' == str[0] ) {
+            int hi;
+            (void)sscanf( str, "[%d:%d]=", &m_lo, &hi );
+        }
+        const char* ptr = strchr( str, '{' );
+        if ( NULL != ptr && '}' != ptr[1] ) {
+            int indx = m_lo;
+            for ( ++ptr; ; ++indx ) {
+                size_t len = strcspn( ptr, ",}" );
+                if ( 4 == len && 0 == strncmp( ptr, "NULL", 4 ) ) {
+                    /* stays NULL */
+                } else if ( 1 <= indx && indx <= 4 ) {
+                    const char* val = '"' == ptr[0] ? ptr + 1 : ptr;
+                    m_vals[indx-1] = chars ? val[0] : atoi( val );
+                    m_nonNull |= 1 << (indx-1);
+                }
+                ptr += len;
+                if ( ',' != *ptr++ ) {
+                    break;
+                }
+            }
+            m_hi = indx;
+        }
+    }
+}
+
+void
+PGArray4::Set( int indx, int val, bool isNull )
+{
+    assert( 1 <= indx && indx <= 4 );
+    if ( m_null || m_hi < m_lo ) {
+        m_lo = m_hi = indx;
+        m_null = false;
+    } else if ( indx < m_lo ) {
+        m_lo = indx;
+    } else if ( indx > m_hi ) {
+        m_hi = indx;
+    }
+
+    int bit = 1 << (indx-1);
+    if ( isNull ) {
+        m_nonNull &= ~bit;
+    } else {
+        m_vals[indx-1] = val;
+        m_nonNull |= bit;
+    }
+}
+
+bool
+PGArray4::Sum( int* sum ) const
+{
+    bool any = false;
+    *sum = 0;
+    for ( int indx = m_lo; indx <= m_hi; ++indx ) {
+        if ( !IsNull( indx ) ) {
+            *sum += m_vals[indx-1];
+            any = true;
+        }
+    }
+    return any;
+}
+
+bool
+PGArray4::All( int val ) const
+{
+    bool result = !m_null;
+    for ( int indx = m_lo; result && indx <= m_hi; ++indx ) {
+        result = Is( indx, val );
+    }
+    return result;
+}
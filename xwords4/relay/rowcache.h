@@ -0,0 +1,278 @@
+/* -*-mode: C; fill-column: 78; c-basic-offset: 4; -*- */
+/* 
+ * Copyright 2018 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef _ROWCACHE_H_
+#define _ROWCACHE_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <list>
+#include <map>
+#include <string>
+
+#include "xwrelay_priv.h"
+#include "devid.h"
+
+using namespace std;
+
+/* (No MutexLock here: mlock.h includes cref.h, which includes dbmgr.h) */
+
+/* In-process copies of rows DBMgr keeps asking Postgres for: games by
+ * connName and devices by their platform IDs.  DBMgr fills the cache on a
+ * miss and writes its own changes through, so the cache stays current as
+ * long as this relay is the only writer; anybody else's changes (another
+ * relay taking over a game, xwrelay.sh) show up after ROWCACHE_SECS.
+ *
+ * Entries are split among lock stripes by key, each an LRU holding at most
+ * its share of the size limit.  Every write bumps its stripe's generation,
+ * and a fill only lands if the generation hasn't changed since the miss,
+ * so a row read before some write can't be cached after it.
+ */
+
+template <class Row> class RowCache {
+ private:
+    static const int N_STRIPES = 16;
+
+    class Entry {
+    public:
+        Row m_row;
+        time_t m_loaded;
+        list<string>::iterator m_lruPos;
+    };
+
+    class Stripe {
+    public:
+        void erase( typename map<string, Entry>::iterator iter )
+        {
+            m_lru.erase( iter->second.m_lruPos );
+            m_rows.erase( iter );
+        }
+
+        pthread_mutex_t m_mutex;
+        uint32_t m_gen;
+        map<string, Entry> m_rows;
+        list<string> m_lru;         /* most recently used first */
+    };
+
+ public:
+    RowCache( int maxRows, int ttlSecs )
+        : m_ttlSecs(ttlSecs)
+    {
+        m_maxPerStripe = (maxRows + N_STRIPES - 1) / N_STRIPES;
+        for ( int ii = 0; ii < N_STRIPES; ++ii ) {
+            pthread_mutex_init( &m_stripes[ii].m_mutex, NULL );
+            m_stripes[ii].m_gen = 0;
+        }
+    }
+
+    /* On a miss, *gen is what to pass Put() once the row's been read */
+    bool Get( const string& key, Row* row, uint32_t* gen )
+    {
+        bool found = false;
+        Stripe* stripe = stripeFor( key );
+        pthread_mutex_lock( &stripe->m_mutex );
+        typename map<string, Entry>::iterator iter = stripe->m_rows.find( key );
+        if ( stripe->m_rows.end() != iter ) {
+            if ( time( NULL ) - iter->second.m_loaded < m_ttlSecs ) {
+                *row = iter->second.m_row;
+                stripe->m_lru.splice( stripe->m_lru.begin(), stripe->m_lru,
+                                      iter->second.m_lruPos );
+                found = true;
+            } else {
+                stripe->erase( iter );
+            }
+        }
+        *gen = stripe->m_gen;
+        pthread_mutex_unlock( &stripe->m_mutex );
+        return found;
+    }
+
+    void Put( const string& key, const Row& row, uint32_t gen )
+    {
+        Stripe* stripe = stripeFor( key );
+        pthread_mutex_lock( &stripe->m_mutex );
+        if ( gen == stripe->m_gen ) {
+            set_locked( stripe, key, row );
+        }
+        pthread_mutex_unlock( &stripe->m_mutex );
+    }
+
+    void Drop( const string& key )
+    {
+        Update upd( this, key );
+        upd.Drop();
+    }
+
+    void Clear()
+    {
+        for ( int ii = 0; ii < N_STRIPES; ++ii ) {
+            Stripe* stripe = &m_stripes[ii];
+            pthread_mutex_lock( &stripe->m_mutex );
+            ++stripe->m_gen;
+            stripe->m_rows.clear();
+            stripe->m_lru.clear();
+            pthread_mutex_unlock( &stripe->m_mutex );
+        }
+    }
+
+    int Size()
+    {
+        int size = 0;
+        for ( int ii = 0; ii < N_STRIPES; ++ii ) {
+            pthread_mutex_lock( &m_stripes[ii].m_mutex );
+            size += m_stripes[ii].m_rows.size();
+            pthread_mutex_unlock( &m_stripes[ii].m_mutex );
+        }
+        return size;
+    }
+
+    /* Write-through: for as long as this exists the key's stripe is locked;
+       GetRow() is NULL if the key isn't cached.  Make the change to the DB
+       first. */
+    class Update {
+    public:
+        Update( RowCache* cache, const string& key )
+            : m_cache(cache), m_key(key), m_row(NULL)
+        {
+            m_stripe = cache->stripeFor( key );
+            pthread_mutex_lock( &m_stripe->m_mutex );
+            ++m_stripe->m_gen;
+            typename map<string, Entry>::iterator iter =
+                m_stripe->m_rows.find( key );
+            if ( m_stripe->m_rows.end() != iter ) {
+                m_row = &iter->second.m_row;
+            }
+        }
+        ~Update() { pthread_mutex_unlock( &m_stripe->m_mutex ); }
+
+        Row* GetRow() { return m_row; }
+        void Set( const Row& row )
+        {
+            m_row = m_cache->set_locked( m_stripe, m_key, row );
+        }
+        void Drop()
+        {
+            typename map<string, Entry>::iterator iter =
+                m_stripe->m_rows.find( m_key );
+            if ( m_stripe->m_rows.end() != iter ) {
+                m_stripe->erase( iter );
+            }
+            m_row = NULL;
+        }
+
+    private:
+        RowCache* m_cache;
+        string m_key;
+        Stripe* m_stripe;
+        Row* m_row;
+    };
+
+ private:
+    Stripe* stripeFor( const string& key )
+    {
+        uint32_t hash = 2166136261U; /* FNV-1a */
+        for ( size_t ii = 0; ii < key.size(); ++ii ) {
+            hash = (hash ^ (uint8_t)key[ii]) * 16777619U;
+        }
+        return &m_stripes[hash % N_STRIPES];
+    }
+
+    Row* set_locked( Stripe* stripe, const string& key, const Row& row )
+    {
+        Row* result = NULL;
+        if ( 0 < m_maxPerStripe ) {
+            typename map<string, Entry>::iterator iter =
+                stripe->m_rows.find( key );
+            if ( stripe->m_rows.end() == iter ) {
+                if ( m_maxPerStripe <= (int)stripe->m_rows.size() ) {
+                    stripe->erase( stripe->m_rows.find( stripe->m_lru.back() ) );
+                }
+                iter = stripe->m_rows.insert( make_pair( key, Entry() ) ).first;
+                stripe->m_lru.push_front( key );
+            } else {
+                stripe->m_lru.splice( stripe->m_lru.begin(), stripe->m_lru,
+                                      iter->second.m_lruPos );
+            }
+            iter->second.m_row = row;
+            iter->second.m_loaded = time( NULL );
+            iter->second.m_lruPos = stripe->m_lru.begin();
+            result = &iter->second.m_row;
+        }
+        return result;
+    }
+
+    int m_maxPerStripe;
+    int m_ttlSecs;
+    Stripe m_stripes[N_STRIPES];
+};
+
+/* One of the games table's four-element arrays, as Postgres has it: the
+ * array itself may be NULL, its bounds needn't be [1:4], and elements within
+ * them may be NULL. */
+class PGArray4 {
+ public:
+    PGArray4() : m_null(true), m_lo(1), m_hi(0), m_nonNull(0) {}
+
+    /* Text form, e.g. "{1,NULL,3}" or "[2:3]={5,6}"; isNull for SQL NULL */
+    void Parse( const char* str, bool isNull, bool chars = false );
+
+    /* arr[indx] = val (or NULL), growing the array as Postgres would */
+    void Set( int indx, int val, bool isNull = false );
+
+    /* What atoi(PQgetvalue()) would give for arr[indx]: 0 for NULL */
+    int Get( int indx ) const
+        { return IsNull( indx ) ? 0 : m_vals[indx-1]; }
+    /* SQL's arr[indx] = val */
+    bool Is( int indx, int val ) const
+        { return !IsNull( indx ) && m_vals[indx-1] == val; }
+    bool IsNull( int indx ) const
+        { return indx < 1 || indx > 4 || 0 == (m_nonNull & (1 << (indx-1))); }
+
+    /* sum_array(arr), false if that's NULL */
+    bool Sum( int* sum ) const;
+    /* val = ALL(arr): true, or false for false or NULL */
+    bool All( int val ) const;
+
+ private:
+    bool m_null;
+    int m_lo, m_hi;             /* bounds; m_hi < m_lo if empty */
+    int m_nonNull;              /* bit indx-1 set if arr[indx] isn't NULL */
+    int m_vals[4];
+};
+
+class GameRow {
+ public:
+    GameRow()
+        : m_cid(0), m_cidNull(true), m_lang(0), m_nTotal(0), m_dead(false) {}
+
+    CookieID m_cid;
+    bool m_cidNull;
+    string m_room;
+    int m_lang;
+    int m_nTotal;
+    bool m_dead;
+    PGArray4 m_nPerDevice;
+    PGArray4 m_seeds;
+    PGArray4 m_ack;             /* chars */
+    PGArray4 m_devids;
+    PGArray4 m_tokens;
+};
+
+#endif
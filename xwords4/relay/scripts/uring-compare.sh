@@ -0,0 +1,90 @@
+#!/bin/sh
+
+# Run loadgen against the relay with IO_URING=0 and IO_URING=1, alternating,
+# and print each run's results plus the CPU time the relay used. Run from the
+# relay directory after "make xwrelay loadgen", with the DB in CONF set up
+# (xwrelay.sh mkdb). Anything after the options goes to loadgen.
+#
+# Check loadgen's device states first: if few devices got to playing, the
+# run measured registration and connect retries. And on a host the relay
+# shares with loadgen and Postgres, compare relay CPU per packet at a load
+# below saturation rather than throughput.
+#
+# Each run starts by deleting what earlier loadgen runs left in the DB (its
+# devices and rooms are named "loadgen:" and "lg"): registration scans the
+# devices table, so left in place they slow every run after the first.
+
+set -e -u
+
+CONF=./xwrelay.conf
+RUNS=3
+TMPDIR=$(mktemp -d)
+
+usage() {
+    echo "usage: $0 [--conf <file>]  # default: $CONF \\"
+    echo "   [--runs <n>]             # runs per setting; default: $RUNS \\"
+    echo "   [-- <loadgen args>]"
+    exit 1
+}
+
+while [ $# -gt 0 ]; do
+    case $1 in
+        --conf)
+            CONF=$2
+            shift
+            ;;
+        --runs)
+            RUNS=$2
+            shift
+            ;;
+        --)
+            shift
+            break
+            ;;
+        *) usage
+            ;;
+    esac
+    shift
+done
+
+[ -f "$CONF" ] || usage
+DBNAME=$(grep '^DB_NAME' $CONF | sed 's,^.*=,,')
+
+clearLoadgen() {
+    psql -q $DBNAME <<EOF
+DELETE FROM msgs WHERE connname IN (SELECT connname FROM games WHERE room LIKE 'lg%');
+DELETE FROM games WHERE room LIKE 'lg%';
+DELETE FROM devices WHERE devids[1] LIKE 'loadgen:%';
+EOF
+}
+
+cleanup() {
+    rm -rf $TMPDIR
+}
+trap cleanup EXIT
+
+# utime + stime, in clock ticks
+cpuTicks() {
+    awk '{print $14 + $15}' /proc/$1/stat
+}
+
+RUN=1
+while [ $RUN -le $RUNS ]; do
+    for URING in 0 1; do
+        clearLoadgen
+        sed -e "s,^IO_URING=.*,IO_URING=$URING," \
+            -e "s,^LOGFILE_PATH=.*,LOGFILE_PATH=$TMPDIR/xwrelay.log," \
+            $CONF > $TMPDIR/conf
+        ./xwrelay -f $TMPDIR/conf -D -F > $TMPDIR/out 2>&1 &
+        PID=$!
+        sleep 3
+        echo "=== IO_URING=$URING run $RUN"
+        BEFORE=$(cpuTicks $PID)
+        ./loadgen "$@"
+        AFTER=$(cpuTicks $PID)
+        echo "relay cpu: $(( (AFTER - BEFORE) * 1000 / $(getconf CLK_TCK) )) ms"
+        kill $PID
+        wait $PID || true
+    done
+    RUN=$((RUN + 1))
+done
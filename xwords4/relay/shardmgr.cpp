@@ -0,0 +1,496 @@
+/* -*-mode: C; fill-column: 78; c-basic-offset: 4; -*- */
+/* 
+ * Copyright 2018 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <assert.h>
+#include <ctype.h>
+#include <algorithm>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "shardmgr.h"
+#include "configs.h"
+#include "mlock.h"
+#include "udpager.h"
+#include "devmgr.h"
+#include "dbmgr.h"
+#include "metrics.h"
+
+#define SHARD_PROTO 1
+/* proto, cmd, sending node */
+#define SHARD_HDR_LEN 3
+/* IPv4 address and port of the device */
+#define SHARD_CLIENT_LEN 6
+/* Forget how a device reached us after this long without hearing from it */
+#define SHARD_VIA_SECS 600
+
+static ShardMgr* s_instance = NULL;
+static bool s_checked = false;
+
+/* static */ ShardMgr*
+ShardMgr::Get()
+{
+    if ( !s_checked ) {
+        RelayConfigs* rc = RelayConfigs::GetConfigs();
+        char buf[1024];
+        int self;
+        if ( rc->GetValueFor( "SHARD_NODES", buf, sizeof(buf) )
+             && rc->GetValueFor( "SHARD_SELF", &self ) ) {
+            vector<string> nodes;
+            char* saveptr;
+            for ( char* tok = strtok_r( buf, ",", &saveptr ); NULL != tok;
+                  tok = strtok_r( NULL, ",", &saveptr ) ) {
+                nodes.push_back( tok );
+            }
+            int nVnodes;
+            if ( !rc->GetValueFor( "SHARD_VNODES", &nVnodes ) ) {
+                nVnodes = 100;
+            }
+            if ( 0 <= self && self < (int)nodes.size()
+                 && nodes.size() <= SHARD_MAX_NODES ) {
+                s_instance = new ShardMgr( nodes, self, nVnodes );
+            } else {
+                logf( XW_LOGERROR, "%s: bad SHARD_SELF (%d) or too many "
+                      "SHARD_NODES (%d); not sharding", __func__, self, 
+                      nodes.size() );
+            }
+        }
+        s_checked = true;
+    }
+    return s_instance;
+}
+
+ShardMgr::ShardMgr( const vector<string>& nodes, int self, int nVnodes )
+    : m_self(self)
+    , m_linkSock(-1)
+    , m_udpsock(-1)
+    , m_proc(NULL)
+    , m_names(nodes)
+    , m_nextPrune(0)
+{
+    pthread_mutex_init( &m_mutex, NULL );
+
+    memset( m_nodeAddrs, 0, sizeof(m_nodeAddrs) );
+    for ( size_t ii = 0; ii < nodes.size(); ++ii ) {
+        const char* name = nodes[ii].c_str();
+        const char* colon = strchr( name, ':' );
+        string host( name, NULL == colon ? strlen(name) : colon - name );
+        struct sockaddr_in* addr = &m_nodeAddrs[ii];
+        addr->sin_family = AF_INET;
+        addr->sin_port = htons( NULL == colon ? 0 : atoi( colon + 1 ) );
+        if ( 0 == inet_aton( host.c_str(), &addr->sin_addr )
+             || 0 == addr->sin_port ) {
+            logf( XW_LOGERROR, "%s: can't parse node %s (want a.b.c.d:port)",
+                  __func__, name );
+            assert( 0 );
+        }
+
+        /* Each node gets nVnodes points on the ring, placed by its name so
+           every relay builds the same ring from the same list */
+        for ( int vv = 0; vv < nVnodes; ++vv ) {
+            StrWPF point;
+            point.catf( "%s#%d", name, vv );
+            m_ring.push_back( pair<uint32_t, int>( 
+                                  hashBytes( point.c_str(), point.size() ),
+                                  ii ) );
+        }
+    }
+    sort( m_ring.begin(), m_ring.end() );
+    logf( XW_LOGINFO, "%s: node %d of %d (%s)", __func__, self,
+          nodes.size(), m_names[self].c_str() );
+}
+
+/* FNV-1a, then murmur3's finalizer so similar keys spread out */
+/* static */ uint32_t
+ShardMgr::hashBytes( const void* data, size_t len )
+{
+    uint32_t hash = 2166136261U;
+    const uint8_t* bytes = (const uint8_t*)data;
+    for ( size_t ii = 0; ii < len; ++ii ) {
+        hash ^= bytes[ii];
+        hash *= 16777619U;
+    }
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6b;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+int
+ShardMgr::ownerOf( char type, const void* key, size_t len ) const
+{
+    uint8_t buf[1 + MAX_CONNNAME_LEN + 1];
+    buf[0] = type;              /* so a devid and a cid with the same value
+                                   needn't land together */
+    if ( len > sizeof(buf) - 1 ) {
+        len = sizeof(buf) - 1;
+    }
+    memcpy( &buf[1], key, len );
+    uint32_t hash = hashBytes( buf, len + 1 );
+
+    vector<pair<uint32_t, int> >::const_iterator iter = 
+        lower_bound( m_ring.begin(), m_ring.end(), 
+                     pair<uint32_t, int>( hash, 0 ) );
+    if ( m_ring.end() == iter ) {
+        iter = m_ring.begin();
+    }
+    return iter->second;
+}
+
+int
+ShardMgr::OwnerOfDevice( DevIDRelay devid ) const
+{
+    uint32_t key = htonl( devid );
+    return ownerOf( 'd', &key, sizeof(key) );
+}
+
+int
+ShardMgr::OwnerOfGame( const char* const connName ) const
+{
+    return ownerOf( 'g', connName, strlen( connName ) );
+}
+
+/* Rooms are matched case-insensitively (ILIKE), so hash them that way */
+int
+ShardMgr::OwnerOfRoom( const char* const cookie ) const
+{
+    char lower[MAX_INVITE_LEN + 1];
+    size_t len;
+    for ( len = 0; len < sizeof(lower) - 1 && '\0' != cookie[len]; ++len ) {
+        lower[len] = tolower( cookie[len] );
+    }
+    return ownerOf( 'r', lower, len );
+}
+
+int
+ShardMgr::OwnerOfCid( CookieID cid ) const
+{
+    uint16_t key = htons( cid );
+    return ownerOf( 'c', &key, sizeof(key) );
+}
+
+int
+ShardMgr::OwnerOfPacket( uint32_t packetID ) const
+{
+    uint32_t key = htonl( packetID );
+    return ownerOf( 'p', &key, sizeof(key) );
+}
+
+/* static */ bool
+ShardMgr::OwnsDevice( DevIDRelay devid )
+{
+    ShardMgr* self = Get();
+    return NULL == self || self->m_self == self->OwnerOfDevice( devid );
+}
+
+/* static */ bool
+ShardMgr::OwnsGame( const char* const connName )
+{
+    ShardMgr* self = Get();
+    return NULL == self || self->m_self == self->OwnerOfGame( connName );
+}
+
+/* static */ bool
+ShardMgr::OwnsCid( CookieID cid )
+{
+    ShardMgr* self = Get();
+    return NULL == self || self->m_self == self->OwnerOfCid( cid );
+}
+
+/* static */ bool
+ShardMgr::OwnsPacket( uint32_t packetID )
+{
+    ShardMgr* self = Get();
+    return NULL == self || self->m_self == self->OwnerOfPacket( packetID );
+}
+
+/* static */ uint64_t
+ShardMgr::addrKey( const struct sockaddr_in* addr )
+{
+    return ((uint64_t)addr->sin_addr.s_addr << 16) | addr->sin_port;
+}
+
+int
+ShardMgr::ReplyOwner( const AddrInfo::AddrUnion* saddr )
+{
+    int result = SHARD_LOCAL;
+    MutexLock ml( &m_mutex );
+    map<uint64_t, ViaRec>::const_iterator iter = 
+        m_replies.find( addrKey( &saddr->u.addr_in ) );
+    if ( m_replies.end() != iter ) {
+        result = iter->second.m_node;
+    }
+    return result;
+}
+
+void
+ShardMgr::Start( int udpsock, QueueCallback proc )
+{
+    m_udpsock = udpsock;
+    m_proc = proc;
+
+    m_linkSock = socket( AF_INET, SOCK_DGRAM, IPPROTO_UDP );
+    struct sockaddr_in* addr = &m_nodeAddrs[m_self];
+    if ( 0 != bind( m_linkSock, (struct sockaddr*)addr, sizeof(*addr) ) ) {
+        logf( XW_LOGERROR, "%s: bind(%s) failed: %s", __func__, 
+              m_names[m_self].c_str(), strerror(errno) );
+        assert( 0 );
+    }
+
+    /* wake up now and then to prune even if nothing's arriving */
+    struct timeval tv = { 10, 0 };
+    (void)setsockopt( m_linkSock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv) );
+
+    pthread_t thread;
+    int result = pthread_create( &thread, NULL, thread_main, this );
+    assert( 0 == result );
+    pthread_detach( thread );
+}
+
+void
+ShardMgr::sendFrame( int node, ShardCmd cmd, const struct sockaddr_in* client,
+                     const uint8_t* buf, size_t len )
+{
+    assert( node != m_self && 0 <= node && node < (int)m_names.size() );
+    uint8_t frame[SHARD_HDR_LEN + SHARD_CLIENT_LEN + MAX_MSG_LEN];
+    size_t used = 0;
+    frame[used++] = SHARD_PROTO;
+    frame[used++] = cmd;
+    frame[used++] = m_self;
+    if ( NULL != client ) {
+        memcpy( &frame[used], &client->sin_addr.s_addr, 4 );
+        used += 4;
+        memcpy( &frame[used], &client->sin_port, 2 );
+        used += 2;
+    }
+    if ( len > sizeof(frame) - used ) {
+        logf( XW_LOGERROR, "%s: dropping %d-byte packet", __func__, len );
+    } else {
+        memcpy( &frame[used], buf, len );
+        used += len;
+        ssize_t nSent = sendto( m_linkSock, frame, used, 0,
+                                (struct sockaddr*)&m_nodeAddrs[node],
+                                sizeof(m_nodeAddrs[node]) );
+        if ( nSent != (ssize_t)used ) {
+            logf( XW_LOGERROR, "%s: sendto(%s) failed: %s", __func__,
+                  m_names[node].c_str(), strerror(errno) );
+        }
+    }
+}
+
+void
+ShardMgr::Forward( int node, const AddrInfo::AddrUnion* from,
+                   const uint8_t* buf, size_t len )
+{
+    logf( XW_LOGINFO, "%s: %d bytes to node %d", __func__, len, node );
+    __sync_fetch_and_add( &m_stats[node].m_nFwd, 1 );
+    sendFrame( node, SHARD_CMD_FWD, &from->u.addr_in, buf, len );
+}
+
+void
+ShardMgr::NoteDirect( const AddrInfo::AddrUnion* from )
+{
+    MutexLock ml( &m_mutex );
+    if ( 0 < m_via.size() ) {
+        m_via.erase( addrKey( &from->u.addr_in ) );
+    }
+}
+
+bool
+ShardMgr::SendVia( const struct sockaddr* dest, const uint8_t* buf,
+                   size_t len )
+{
+    const struct sockaddr_in* client = (const struct sockaddr_in*)dest;
+    int node = SHARD_LOCAL;
+    {
+        MutexLock ml( &m_mutex );
+        map<uint64_t, ViaRec>::const_iterator iter = 
+            m_via.find( addrKey( client ) );
+        if ( m_via.end() != iter ) {
+            node = iter->second.m_node;
+        }
+    }
+
+    bool sent = SHARD_LOCAL != node;
+    if ( sent ) {
+        __sync_fetch_and_add( &m_stats[node].m_nOut, 1 );
+        sendFrame( node, SHARD_CMD_OUT, client, buf, len );
+    }
+    return sent;
+}
+
+void
+ShardMgr::NoteHasMessages( DevIDRelay devid )
+{
+    int node = OwnerOfDevice( devid );
+    if ( node != m_self ) {
+        __sync_fetch_and_add( &m_stats[node].m_nHasMsgs, 1 );
+        uint32_t netDevid = htonl( devid );
+        sendFrame( node, SHARD_CMD_HASMSGS, NULL, (uint8_t*)&netDevid,
+                   sizeof(netDevid) );
+    }
+}
+
+void
+ShardMgr::handleFrame( const uint8_t* buf, size_t len )
+{
+    if ( len < SHARD_HDR_LEN || SHARD_PROTO != buf[0]
+         || buf[2] >= m_names.size() ) {
+        logf( XW_LOGERROR, "%s: dropping malformed frame", __func__ );
+        return;
+    }
+    ShardCmd cmd = (ShardCmd)buf[1];
+    int from = buf[2];
+    __sync_fetch_and_add( &m_stats[from].m_nRcvd, 1 );
+    buf += SHARD_HDR_LEN;
+    len -= SHARD_HDR_LEN;
+
+    if ( SHARD_CMD_HASMSGS == cmd ) {
+        DevIDRelay devid;
+        if ( sizeof(devid) == len ) {
+            memcpy( &devid, buf, sizeof(devid) );
+            devid = ntohl( devid );
+            DBMgr::Get()->NoteHasMessages( devid );
+            AddrInfo::AddrUnion saddr;
+            if ( DevMgr::Get()->get( devid, &saddr ) ) {
+                AddrInfo addr( &saddr );
+                send_havemsgs( &addr );
+            }
+        }
+        return;
+    }
+
+    if ( len < SHARD_CLIENT_LEN ) {
+        logf( XW_LOGERROR, "%s: short frame", __func__ );
+        return;
+    }
+    AddrInfo::AddrUnion saddr;
+    memset( &saddr, 0, sizeof(saddr) );
+    saddr.u.addr_in.sin_family = AF_INET;
+    memcpy( &saddr.u.addr_in.sin_addr.s_addr, buf, 4 );
+    memcpy( &saddr.u.addr_in.sin_port, buf + 4, 2 );
+    buf += SHARD_CLIENT_LEN;
+    len -= SHARD_CLIENT_LEN;
+    uint64_t key = addrKey( &saddr.u.addr_in );
+    time_t now = time( NULL );
+
+    switch ( cmd ) {
+    case SHARD_CMD_FWD: {
+        /* We own it: handle as though the device had sent it to us, but
+           remember to route what we send it back through its front node */
+        {
+            MutexLock ml( &m_mutex );
+            ViaRec& rec = m_via[key];
+            rec.m_node = from;
+            rec.m_seen = now;
+        }
+        Metrics::Get()->Inc( MC_UDP_RCVD );
+        AddrInfo addr( m_udpsock, &saddr, false );
+        UDPAger::Get()->Refresh( &addr );
+        UdpQueue::get()->handle( &addr, buf, len, m_proc );
+        break;
+    }
+    case SHARD_CMD_OUT: {
+        {
+            MutexLock ml( &m_mutex );
+            ViaRec& rec = m_replies[key];
+            rec.m_node = from;
+            rec.m_seen = now;
+        }
+        ssize_t nSent = sendto( m_udpsock, buf, len, 0, &saddr.u.addr,
+                                sizeof(saddr.u.addr_in) );
+        Metrics::Get()->Inc( 0 <= nSent ? MC_UDP_SENT : MC_UDP_SENDFAIL );
+        break;
+    }
+    default:
+        logf( XW_LOGERROR, "%s: unknown cmd %d from node %d", __func__,
+              cmd, from );
+        break;
+    }
+}
+
+void
+ShardMgr::prune_locked( time_t now )
+{
+    map<uint64_t, ViaRec>* maps[] = { &m_via, &m_replies };
+    for ( size_t ii = 0; ii < VSIZE(maps); ++ii ) {
+        map<uint64_t, ViaRec>::iterator iter;
+        for ( iter = maps[ii]->begin(); maps[ii]->end() != iter; ) {
+            if ( iter->second.m_seen + SHARD_VIA_SECS < now ) {
+                maps[ii]->erase( iter++ );
+            } else {
+                ++iter;
+            }
+        }
+    }
+}
+
+void*
+ShardMgr::threadProc()
+{
+    uint8_t buf[SHARD_HDR_LEN + SHARD_CLIENT_LEN + MAX_MSG_LEN];
+    for ( ; ; ) {
+        ssize_t nRead = recv( m_linkSock, buf, sizeof(buf), 0 );
+        if ( 0 < nRead ) {
+            handleFrame( buf, nRead );
+        } else if ( EAGAIN != errno && EINTR != errno ) {
+            logf( XW_LOGERROR, "%s: recv failed: %s", __func__,
+                  strerror(errno) );
+        }
+
+        time_t now = time( NULL );
+        if ( m_nextPrune <= now ) {
+            MutexLock ml( &m_mutex );
+            prune_locked( now );
+            m_nextPrune = now + 60;
+        }
+    }
+    return NULL;
+}
+
+/* static */ void*
+ShardMgr::thread_main( void* arg )
+{
+    blockSignals();
+    return ((ShardMgr*)arg)->threadProc();
+}
+
+void
+ShardMgr::printStats( StrWPF& out )
+{
+    out.catf( "this is node %d (%s); %d points on ring\n", m_self,
+              m_names[m_self].c_str(), m_ring.size() );
+    for ( size_t ii = 0; ii < m_names.size(); ++ii ) {
+        if ( (int)ii != m_self ) {
+            const NodeStats* stats = &m_stats[ii];
+            out.catf( "node %d (%s): fwd: %d; out: %d; hasmsgs: %d; "
+                      "rcvd: %d\n", ii, m_names[ii].c_str(), stats->m_nFwd,
+                      stats->m_nOut, stats->m_nHasMsgs, stats->m_nRcvd );
+        }
+    }
+    MutexLock ml( &m_mutex );
+    out.catf( "devices reached via other nodes: %d; replied for: %d\n",
+              m_via.size(), m_replies.size() );
+}
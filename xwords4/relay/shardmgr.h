@@ -0,0 +1,143 @@
+/* -*-mode: C; fill-column: 78; c-basic-offset: 4; -*- */
+/* 
+ * Copyright 2018 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef _SHARDMGR_H_
+#define _SHARDMGR_H_
+
+#include <pthread.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "xwrelay_priv.h"
+#include "addrinfo.h"
+#include "udpqueue.h"
+#include "strwpf.h"
+
+using namespace std;
+
+/* Lets several relays (on one host or many, sharing one database) split the
+ * load.  Devices (by DevIDRelay), games (by connName, room, or CookieID) and
+ * outstanding UDP packet IDs are each owned by exactly one node, picked by
+ * consistent hashing so adding a node moves only its share of the keys.
+ * New ids are only minted if they hash to the node minting them.
+ *
+ * A node that gets a packet for something it doesn't own forwards it over
+ * the inter-node link (UDP, SHARD_NODES) to the owner, which handles it as
+ * if it had come from the device directly.  Replies go back the same way so
+ * that devices only ever hear from the address they sent to.  Nodes also
+ * tell a device's owner when messages have been stored for it so the owner
+ * can drop its "has no messages" cache entry and nudge the device.
+ *
+ * Disabled (Get() returns NULL and all the Owns*() tests succeed) unless
+ * SHARD_NODES is set.
+ */
+
+#define SHARD_MAX_NODES 16
+#define SHARD_LOCAL (-1)
+
+class ShardMgr {
+ public:
+    static ShardMgr* Get();
+
+    /* True when sharding's off, so callers needn't check */
+    static bool OwnsDevice( DevIDRelay devid );
+    static bool OwnsGame( const char* const connName );
+    static bool OwnsCid( CookieID cid );
+    static bool OwnsPacket( uint32_t packetID );
+
+    int Self() const { return m_self; }
+    int OwnerOfDevice( DevIDRelay devid ) const;
+    int OwnerOfGame( const char* const connName ) const;
+    int OwnerOfRoom( const char* const cookie ) const;
+    int OwnerOfCid( CookieID cid ) const;
+    int OwnerOfPacket( uint32_t packetID ) const;
+    /* node whose replies to this address we last passed on, if any */
+    int ReplyOwner( const AddrInfo::AddrUnion* saddr );
+
+    void Start( int udpsock, QueueCallback proc );
+
+    /* pass a device's packet to the node that owns it */
+    void Forward( int node, const AddrInfo::AddrUnion* from,
+                  const uint8_t* buf, size_t len );
+    /* device's been heard from directly, so reply directly */
+    void NoteDirect( const AddrInfo::AddrUnion* from );
+    /* if the device at dest reached us through another node, send it there
+       and return true */
+    bool SendVia( const struct sockaddr* dest, const uint8_t* buf,
+                  size_t len );
+    /* tell devid's owner (if not us) a message's been stored for it */
+    void NoteHasMessages( DevIDRelay devid );
+
+    /* called from ctrl port */
+    void printStats( StrWPF& out );
+
+ private:
+    typedef enum {
+        SHARD_CMD_NONE,
+        SHARD_CMD_FWD,          /* device -> owning node */
+        SHARD_CMD_OUT,          /* owning node -> device's front node */
+        SHARD_CMD_HASMSGS,      /* any node -> device's owner */
+    } ShardCmd;
+
+    class ViaRec {
+    public:
+        ViaRec() : m_node(SHARD_LOCAL), m_seen(0) {}
+        int m_node;
+        time_t m_seen;
+    };
+
+    class NodeStats {
+    public:
+        NodeStats() : m_nFwd(0), m_nOut(0), m_nHasMsgs(0), m_nRcvd(0) {}
+        int m_nFwd;
+        int m_nOut;
+        int m_nHasMsgs;
+        int m_nRcvd;
+    };
+
+    ShardMgr( const vector<string>& nodes, int self, int nVnodes );
+    static uint32_t hashBytes( const void* data, size_t len );
+    static uint64_t addrKey( const struct sockaddr_in* addr );
+    int ownerOf( char type, const void* key, size_t len ) const;
+
+    static void* thread_main( void* arg );
+    void* threadProc();
+    void handleFrame( const uint8_t* buf, size_t len );
+    void sendFrame( int node, ShardCmd cmd, const struct sockaddr_in* client,
+                    const uint8_t* buf, size_t len );
+    void prune_locked( time_t now );
+
+    int m_self;
+    int m_linkSock;
+    int m_udpsock;
+    QueueCallback m_proc;
+
+    vector<string> m_names;
+    struct sockaddr_in m_nodeAddrs[SHARD_MAX_NODES];
+    vector<pair<uint32_t, int> > m_ring;   /* sorted by hash */
+
+    pthread_mutex_t m_mutex;
+    map<uint64_t, ViaRec> m_via;        /* device -> node it came through */
+    map<uint64_t, ViaRec> m_replies;    /* device -> node we relayed for */
+    time_t m_nextPrune;
+    NodeStats m_stats[SHARD_MAX_NODES];
+};
+
+#endif
@@ -22,16 +22,35 @@
 #include <sys/time.h>
 #include <errno.h>
 #include <assert.h>
+#include <string.h>
+#include <unistd.h>
 #include "timermgr.h"
 #include "xwrelay_priv.h"
 #include "configs.h"
 #include "mlock.h"
+#include "udpbatch.h"
+#include "udpack.h"
+
+#define SLOT_MASK (TIMER_NSLOTS - 1)
+#define LEVEL_SHIFT(level) (TIMER_SLOT_BITS * (level))
 
 TimerMgr::TimerMgr()
-    : m_nextFireTime(0)
+    : m_curTick(uptime())
     ,m_nextID(0)
+    ,m_nSet(0)
+    ,m_nCleared(0)
+    ,m_nFired(0)
+    ,m_nCascaded(0)
 {
+    memset( m_wheel, 0, sizeof(m_wheel) );
+    memset( m_levelCounts, 0, sizeof(m_levelCounts) );
     pthread_mutex_init( &m_timersMutex, NULL );
+
+    pthread_t thread;
+    int result = pthread_create( &thread, NULL, thread_main, (void*)this );
+    assert( result == 0 );
+    result = pthread_detach( thread );
+    assert( result == 0 );
 }
 
 /* static */TimerMgr* 
@@ -48,100 +67,116 @@ void
 TimerMgr::SetTimer( time_t inSeconds, TimerProc proc, void* closure,
                     int interval )
 {
-    logf( XW_LOGINFO, "%s: uptime = %ld", __func__, uptime() );
-    TimerInfo ti;
-    ti.proc = proc;
-    ti.closure = closure;
-    ti.when = uptime() + inSeconds;
-    ti.interval = interval;
-
     MutexLock ml( &m_timersMutex );
-    ti.id = ++m_nextID;
 
-    if ( getTimer( proc, closure ) ) {
-        logf( XW_LOGINFO, "%s: clearing old timer", __func__ );
-        clearTimerImpl( proc, closure );
-    }
+    clearTimerImpl( proc, closure );
 
-    m_timers.push_back( ti );
+    TimerInfo* tip = new TimerInfo;
+    tip->proc = proc;
+    tip->closure = closure;
+    tip->when = uptime() + inSeconds;
+    /* the current slot's already been run */
+    if ( tip->when <= m_curTick ) {
+        tip->when = m_curTick + 1;
+    }
+    tip->interval = interval;
+    tip->id = ++m_nextID;
 
-    figureNextFire();
-    logf( XW_LOGINFO, "setTimer done" );
+    m_timers.insert( pair<TimerKey, TimerInfo*>( TimerKey( proc, closure ),
+                                                 tip ) );
+    link( tip );
+    ++m_nSet;
+    logf( XW_LOGVERBOSE0, "%s: timer id=%d fires at %ld", __func__, tip->id,
+          tip->when );
 }
 
-time_t 
-TimerMgr::GetPollTimeoutMillis()
+void
+TimerMgr::ClearTimer( TimerProc proc, void* closure )
 {
     MutexLock ml( &m_timersMutex );
+    clearTimerImpl( proc, closure );
+}
 
-    time_t tout = m_nextFireTime;
-    if ( tout == 0 ) {
-        tout = -1;
-    } else {
-        tout -= uptime();
-        if ( tout < 0 ) {
-            tout = 0;
-        }
-        tout *= 1000;           /* convert to milliseconds */
+void
+TimerMgr::printStats( StrWPF& out )
+{
+    MutexLock ml( &m_timersMutex );
+    out.catf( "active timers: %d (", m_timers.size() );
+    for ( int level = 0; level < TIMER_NLEVELS; ++level ) {
+        out.catf( "%slevel %d: %d", 0 == level ? "" : ", ", level,
+                  m_levelCounts[level] );
     }
-    return tout;
-} /* GetPollTimeoutMillis */
+    out.catf( ")\n" );
+    out.catf( "set: %u; cleared: %u; fired: %u; cascaded: %u\n",
+              m_nSet, m_nCleared, m_nFired, m_nCascaded );
+}
 
-bool
-TimerMgr::getTimer( TimerProc proc, void* closure )
+// Put the timer in the lowest wheel whose span covers how far off it is.
+// Timers too far out for the top wheel go in its furthest slot and get
+// cascaded back up until they're in range.
+void
+TimerMgr::link( TimerInfo* tip )
 {
-    /* Don't call this unless have the lock!!! */
-    list<TimerInfo>::iterator iter;
-    for ( iter = m_timers.begin(); iter != m_timers.end(); ++iter ) {
-        if ( (*iter).proc == proc
-             && (*iter).closure == closure ) {
-            return true;
-        }
+    time_t delta = tip->when - m_curTick;
+    if ( delta < 0 ) {
+        delta = 0;
+    }
+    int level = 0;
+    while ( level < TIMER_NLEVELS - 1
+            && delta >= ((time_t)1 << LEVEL_SHIFT(level + 1)) ) {
+        ++level;
     }
+    time_t when = m_curTick + delta;
+    time_t maxDelta = ((time_t)1 << LEVEL_SHIFT(TIMER_NLEVELS)) - 1;
+    if ( delta > maxDelta ) {
+        when = m_curTick + maxDelta;
+    }
+    int slot = (when >> LEVEL_SHIFT(level)) & SLOT_MASK;
 
-    return false;
-} /* getTimer */
+    tip->level = level;
+    tip->slot = slot;
+    tip->prev = NULL;
+    tip->next = m_wheel[level][slot];
+    if ( NULL != tip->next ) {
+        tip->next->prev = tip;
+    }
+    m_wheel[level][slot] = tip;
+    ++m_levelCounts[level];
+}
 
 void
-TimerMgr::figureNextFire()
+TimerMgr::unlink( TimerInfo* tip )
 {
-    /* Don't call this unless have the lock!!! */
-    time_t t = 0x7FFFFFFF;
-    time_t cur = uptime();
-
-    list<TimerInfo>::iterator iter = m_timers.begin();
-
-    while ( iter != m_timers.end() ) {
-        time_t when = iter->when;
-
-        if ( when == 0 ) {
-            if ( iter->interval ) {
-                when = iter->when = cur + iter->interval;
-            } else {
-                m_timers.erase(iter);
-                iter = m_timers.begin();
-                continue;
-            }
-        }
-
-        if ( when < t ) {
-            t = when;
-        }
-        ++iter;
+    if ( NULL != tip->prev ) {
+        tip->prev->next = tip->next;
+    } else {
+        m_wheel[tip->level][tip->slot] = tip->next;
     }
+    if ( NULL != tip->next ) {
+        tip->next->prev = tip->prev;
+    }
+    --m_levelCounts[tip->level];
+}
 
-    m_nextFireTime = t == 0x7FFFFFFF? 0 : t;
-} /* figureNextFire */
-
+// Move everything in the current slot of this level down to where it now
+// belongs.
 void
-TimerMgr::ClearTimer( TimerProc proc, void* closure )
+TimerMgr::cascade( int level )
 {
-    MutexLock ml( &m_timersMutex );
-    clearTimerImpl( proc, closure );
+    int slot = (m_curTick >> LEVEL_SHIFT(level)) & SLOT_MASK;
+    TimerInfo* tip = m_wheel[level][slot];
+    m_wheel[level][slot] = NULL;
+    while ( NULL != tip ) {
+        TimerInfo* next = tip->next;
+        --m_levelCounts[level];
+        link( tip );
+        ++m_nCascaded;
+        tip = next;
+    }
 }
 
 void
-TimerMgr::FireElapsedTimers()
+TimerMgr::fireElapsedTimers()
 {
     time_t curTime = uptime();
 
@@ -150,49 +185,84 @@ TimerMgr::FireElapsedTimers()
     vector<uint32_t> ids;
     {
         MutexLock ml( &m_timersMutex );
-        /* loop until we get through without firing a single one.  Only fire one
-           per run, though, since calling erase invalidates the iterator.
-           PENDING: all this needs a mutex!!!! */
-        list<TimerInfo>::iterator iter;
-        for ( iter = m_timers.begin(); iter != m_timers.end(); ++iter ) {
-            TimerInfo* tip = &(*iter);
-            if ( tip->when <= curTime ) {
-
-                procs.push_back(tip->proc);
-                closures.push_back(tip->closure);
-                ids.push_back(tip->id);
+        while ( m_curTick < curTime ) {
+            ++m_curTick;
+            for ( int level = 1; level < TIMER_NLEVELS; ++level ) {
+                if ( 0 != (m_curTick & (((time_t)1 << LEVEL_SHIFT(level)) - 1)) ) {
+                    break;
+                }
+                cascade( level );
+            }
+
+            int slot = m_curTick & SLOT_MASK;
+            TimerInfo* tip = m_wheel[0][slot];
+            m_wheel[0][slot] = NULL;
+            while ( NULL != tip ) {
+                TimerInfo* next = tip->next;
+                --m_levelCounts[0];
+                assert( tip->when <= m_curTick );
+
+                procs.push_back( tip->proc );
+                closures.push_back( tip->closure );
+                ids.push_back( tip->id );
 
                 if ( tip->interval ) {
                     tip->when += tip->interval;
+                    if ( tip->when <= m_curTick ) {
+                        tip->when = m_curTick + 1;
+                    }
+                    link( tip );
                 } else {
-                    tip->when = 0;      /* flag for removal */
+                    m_timers.erase( TimerKey( tip->proc, tip->closure ) );
+                    delete tip;
                 }
+                tip = next;
             }
         }
+        m_nFired += procs.size();
     }
 
     vector<TimerProc>::const_iterator procs_iter = procs.begin();
     vector<void*>::const_iterator closures_iter = closures.begin();
     vector<uint32_t>::const_iterator ids_iter = ids.begin();
+    UDPSendBatch batch;         /* e.g. a heartbeat sweep */
+    MsgAckBatch ackBatch;       /* e.g. a run of ack timeouts */
     while ( procs_iter != procs.end() ) {
         logf( XW_LOGINFO, "%s: firing timer id=%d", __func__, *ids_iter++ );
         (*procs_iter++)(*closures_iter++);
     }
-
-    MutexLock ml( &m_timersMutex );
-    figureNextFire();
 } /* fireElapsedTimers */
 
 void
 TimerMgr::clearTimerImpl( TimerProc proc, void* closure )
 {
-    list<TimerInfo>::iterator iter;
-    for ( iter = m_timers.begin(); iter != m_timers.end(); ++iter ) {
-        TimerInfo* tip = &(*iter);
-        if ( tip->proc == proc && tip->closure == closure ) {
-            logf( XW_LOGINFO, "clearing timer id=%d", tip->id );
-            m_timers.erase(iter);
-            break;
-        }
+    unordered_map<TimerKey, TimerInfo*, TimerKeyHash>::iterator iter =
+        m_timers.find( TimerKey( proc, closure ) );
+    if ( m_timers.end() != iter ) {
+        TimerInfo* tip = iter->second;
+        logf( XW_LOGVERBOSE0, "clearing timer id=%d", tip->id );
+        unlink( tip );
+        m_timers.erase( iter );
+        delete tip;
+        ++m_nCleared;
+    }
+}
+
+void*
+TimerMgr::threadProc()
+{
+    for ( ; ; ) {
+        sleep( 1 );
+        fireElapsedTimers();
     }
+    return NULL;
+}
+
+/* static */ void*
+TimerMgr::thread_main( void* arg )
+{
+    blockSignals();
+
+    TimerMgr* self = (TimerMgr*)arg;
+    return self->threadProc();
 }
@@ -21,52 +21,95 @@
 #ifndef _TIMERMGR_H_
 #define _TIMERMGR_H_
 
-#include "list"
+#include <unordered_map>
 
 #include <pthread.h>
 
 #include "xwrelay_priv.h"
+#include "strwpf.h"
 
 using namespace std;
 
 typedef void (*TimerProc)( void* closure );
 
+/* Timers live in a hierarchical timing wheel: TIMER_NLEVELS wheels of
+ * TIMER_NSLOTS one-second slots, each slot of a wheel spanning a full turn of
+ * the one below.  Setting and clearing are constant-time; a thread owned by
+ * TimerMgr advances the wheel once a second, moving timers down a level as
+ * they get close and firing those in the current bottom slot.
+ */
+#define TIMER_SLOT_BITS 6
+#define TIMER_NSLOTS (1 << TIMER_SLOT_BITS)
+#define TIMER_NLEVELS 4         /* 64^4 seconds is about six months */
 
 class TimerMgr {
 
  public:
     static TimerMgr* GetTimerMgr();
 
-    void SetTimer( time_t inMillis, TimerProc proc, void* closure,
+    void SetTimer( time_t inSeconds, TimerProc proc, void* closure,
                    int interval ); /* 0 means non-recurring */
     void ClearTimer( TimerProc proc, void* closure );
-  
-    time_t GetPollTimeoutMillis();
-    void FireElapsedTimers();
+
+    /* called from ctrl port */
+    void printStats( StrWPF& out );
 
  private:
 
-    typedef struct {
+    class TimerInfo {
+    public:
         TimerProc proc;
         void* closure;
         time_t when;
         int interval;
         uint32_t id;
-    } TimerInfo;
-  
+        int level;              /* where it's linked */
+        int slot;
+        TimerInfo* prev;        /* within its slot */
+        TimerInfo* next;
+    };
+
+    class TimerKey {
+    public:
+        TimerKey( TimerProc proc, void* closure )
+            : m_proc(proc), m_closure(closure) {}
+        bool operator==( const TimerKey& other ) const {
+            return m_proc == other.m_proc && m_closure == other.m_closure;
+        }
+        TimerProc m_proc;
+        void* m_closure;
+    };
+
+    class TimerKeyHash {
+    public:
+        size_t operator()( const TimerKey& key ) const {
+            return ((uintptr_t)key.m_closure >> 3) ^ (uintptr_t)key.m_proc;
+        }
+    };
 
     TimerMgr();
+    static void* thread_main( void* arg );
+    void* threadProc();
+    void fireElapsedTimers();
 
     /* run once we have the mutex */
     void clearTimerImpl( TimerProc proc, void* closure );
-    bool getTimer( TimerProc proc, void* closure );
-    void figureNextFire();
-  
-    pthread_mutex_t m_timersMutex;
-    list<TimerInfo> m_timers;
+    void link( TimerInfo* tip );
+    void unlink( TimerInfo* tip );
+    void cascade( int level );
 
-    time_t m_nextFireTime;
+    pthread_mutex_t m_timersMutex;
+    unordered_map<TimerKey, TimerInfo*, TimerKeyHash> m_timers;
+    TimerInfo* m_wheel[TIMER_NLEVELS][TIMER_NSLOTS];
+    time_t m_curTick;           /* uptime() the wheel's been advanced to */
     uint32_t m_nextID;
+
+    /* stats */
+    int m_levelCounts[TIMER_NLEVELS];
+    uint32_t m_nSet;
+    uint32_t m_nCleared;
+    uint32_t m_nFired;
+    uint32_t m_nCascaded;
 };
 
 #endif
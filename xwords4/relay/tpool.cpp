@@ -34,9 +34,22 @@
 #include "tpool.h"
 #include "xwrelay_priv.h"
 #include "xwrelay.h"
-#include "timermgr.h"
 #include "mlock.h"
-#include "strwpf.h"
+#include "metrics.h"
+#include "udpbatch.h"
+#include "udpack.h"
+
+/* Must be powers of 2 */
+#define AFFINITY_SLOTS 4096
+#define AFFINITY_MUTEXES 64
+/* Most packets a worker dispatches from its own deque before flushing what
+   they've sent */
+#define MAX_BATCH 32
+/* How far into another worker's deque to look for something to steal */
+#define STEAL_SCAN 16
+/* How long an idle worker sleeps before looking for something to steal
+   again, in case it missed being woken */
+#define STEAL_POLL_MS 250
 
 XWThreadPool* XWThreadPool::g_instance = NULL;
 
@@ -52,13 +65,23 @@ XWThreadPool::GetTPool()
 }
 
 XWThreadPool::XWThreadPool()
-    : m_timeToDie(false)
+    : m_nextWorker(0)
+    , m_timeToDie(false)
     , m_nThreads(0)
+    , m_threadInfos(NULL)
+    , m_uring(NULL)
 {
     pthread_rwlock_init( &m_activeSocketsRWLock, NULL );
-    pthread_mutex_init ( &m_queueMutex, NULL );
 
-    pthread_cond_init( &m_queueCondVar, NULL );
+    m_affinities = new Affinity[AFFINITY_SLOTS];
+    for ( int ii = 0; ii < AFFINITY_SLOTS; ++ii ) {
+        m_affinities[ii].worker = -1;
+        m_affinities[ii].pending = 0;
+    }
+    m_affinityMutexes = new pthread_mutex_t[AFFINITY_MUTEXES];
+    for ( int ii = 0; ii < AFFINITY_MUTEXES; ++ii ) {
+        pthread_mutex_init( &m_affinityMutexes[ii], NULL );
+    }
 
     int fd[2];
     if ( pipe( fd ) ) {
@@ -72,33 +95,55 @@ XWThreadPool::XWThreadPool()
 
 XWThreadPool::~XWThreadPool()
 {
-    pthread_cond_destroy( &m_queueCondVar );
+    for ( int ii = 0; ii < m_nThreads; ++ii ) {
+        ThreadInfo* tip = &m_threadInfos[ii];
+        pthread_cond_destroy( &tip->queueCondVar );
+        pthread_mutex_destroy( &tip->queueMutex );
+    }
+    delete[] m_threadInfos;
+    for ( int ii = 0; ii < AFFINITY_MUTEXES; ++ii ) {
+        pthread_mutex_destroy( &m_affinityMutexes[ii] );
+    }
+    delete[] m_affinityMutexes;
+    delete[] m_affinities;
 
     pthread_rwlock_destroy( &m_activeSocketsRWLock );
-    pthread_mutex_destroy ( &m_queueMutex );
-    free( m_threadInfos );
 } /* ~XWThreadPool */
 
 void
 XWThreadPool::Setup( int nThreads, kill_func kFunc )
 {
+    if ( nThreads < 1 ) {
+        nThreads = 1;
+    }
     m_nThreads = nThreads;
-    m_threadInfos = (ThreadInfo*)malloc( nThreads * sizeof(*m_threadInfos) );
+    m_threadInfos = new ThreadInfo[nThreads];
     m_kFunc = kFunc;
 
     for ( int ii = 0; ii < nThreads; ++ii ) {
         ThreadInfo* tip = &m_threadInfos[ii];
         tip->me = this;
+        tip->index = ii;
+        tip->recentTime = 0;
+        tip->idle = false;
+        pthread_mutex_init( &tip->queueMutex, NULL );
+        pthread_cond_init( &tip->queueCondVar, NULL );
+    }
+    for ( int ii = 0; ii < nThreads; ++ii ) {
+        ThreadInfo* tip = &m_threadInfos[ii];
         int result = pthread_create( &tip->thread, NULL, tpool_main, tip );
         assert( result == 0 );
         pthread_detach( tip->thread );
     }
 
-    pthread_t thread;
-    int result = pthread_create( &thread, NULL, listener_main, this );
-    assert( result == 0 );
-    result = pthread_detach( thread );
-    assert( result == 0 );
+    m_uring = URing::Get();
+    if ( NULL == m_uring ) {
+        pthread_t thread;
+        int result = pthread_create( &thread, NULL, listener_main, this );
+        assert( result == 0 );
+        result = pthread_detach( thread );
+        assert( result == 0 );
+    }
 }
 
 void
@@ -106,11 +151,10 @@ XWThreadPool::Stop()
 {
     m_timeToDie = true;
 
-    int ii;
-    for ( ii = 0; ii < m_nThreads; ++ii ) {
-        SockInfo si;
-        si.m_type = STYPE_UNKNOWN;
-        enqueue( si );
+    for ( int ii = 0; ii < m_nThreads; ++ii ) {
+        ThreadInfo* tip = &m_threadInfos[ii];
+        MutexLock ml( &tip->queueMutex );
+        pthread_cond_signal( &tip->queueCondVar );
     }
 
     interrupt_poll();
@@ -132,7 +176,11 @@ XWThreadPool::AddSocket( SockType stype, QueueCallback proc, const AddrInfo* fro
         assert( m_activeSockets.find( sock ) == m_activeSockets.end() );
         m_activeSockets.insert( pair<int, SockInfo>( sock, si ) );
     }
-    interrupt_poll();
+    if ( NULL != m_uring ) {
+        m_uring->AddTCP( from, proc );
+    } else {
+        interrupt_poll();
+    }
 }
 
 bool
@@ -171,6 +219,9 @@ XWThreadPool::RemoveSocket( const AddrInfo* addr )
         logf( XW_LOGINFO, "%s(): AFTER closing %d: %d sockets active (was %d)", __func__,
               sock, m_activeSockets.size(), prevSize );
     }
+    if ( found && NULL != m_uring ) {
+        m_uring->RemoveTCP( addr );
+    }
     return found;
 } /* RemoveSocket */
 
@@ -179,14 +230,24 @@ XWThreadPool::CloseSocket( const AddrInfo* addr )
 {
     if ( addr->isTCP() ) {
         if ( !RemoveSocket( addr ) ) {
-            MutexLock ml( &m_queueMutex );
-            deque<QueuePr>::iterator iter = m_queue.begin();
-            while ( iter != m_queue.end() ) {
-                if ( iter->m_info.m_addr.equals( *addr ) ) {
-                    m_queue.erase( iter );
-                    break;
+            /* Drop the kill that's likely queued for it */
+            bool found = false;
+            for ( int ii = 0; !found && ii < m_nThreads; ++ii ) {
+                ThreadInfo* tip = &m_threadInfos[ii];
+                MutexLock ml( &tip->queueMutex );
+                deque<QueuePr>::iterator iter;
+                for ( iter = tip->queue.begin(); iter != tip->queue.end();
+                      ++iter ) {
+                    if ( Q_KILL == iter->m_act
+                         && iter->m_info.m_addr.equals( *addr ) ) {
+                        tip->queue.erase( iter );
+                        found = true;
+                        break;
+                    }
                 }
-                ++iter;
+            }
+            if ( found ) {
+                done_with( keyFor( addr ) );
             }
         }
         int sock = addr->getSocket();
@@ -211,15 +272,55 @@ XWThreadPool::EnqueueKill( const AddrInfo* addr, const char* const why )
 {
     logf( XW_LOGINFO, "%s(socket = %d) reason: %s", __func__, addr->getSocket(), why );
     if ( addr->isTCP() ) {
-        SockInfo si;
-        si.m_type = STYPE_UNKNOWN;
-        si.m_addr = *addr;
-        enqueue( si, Q_KILL );
+        QueuePr pr;
+        pr.m_act = Q_KILL;
+        pr.m_key = keyFor( addr );
+        pr.m_info.m_type = STYPE_UNKNOWN;
+        pr.m_info.m_addr = *addr;
+        pr.m_ptc = NULL;
+        enqueue( pr );
+    }
+}
+
+void
+XWThreadPool::SocketGone( const AddrInfo* addr, const char* const why )
+{
+    if ( RemoveSocket( addr ) ) {
+        EnqueueKill( addr, why );
+    }
+}
+
+void
+XWThreadPool::EnqueuePacket( PacketThreadClosure* ptc )
+{
+    QueuePr pr;
+    pr.m_act = Q_PACKET;
+    pr.m_key = keyFor( ptc->addr() );
+    pr.m_ptc = ptc;
+    enqueue( pr );
+}
+
+int
+XWThreadPool::CountQueued()
+{
+    int count = 0;
+    for ( int ii = 0; ii < m_nThreads; ++ii ) {
+        ThreadInfo* tip = &m_threadInfos[ii];
+        MutexLock ml( &tip->queueMutex );
+        count += tip->queue.size();
     }
+    return count;
 }
 
 // return true if the addr passed in has a timestamp >= what we have as the
 // creation time of the now-open socket.  If the socket isn't open, return false.
+int
+XWThreadPool::CountSockets()
+{
+    RWReadLock ml( &m_activeSocketsRWLock );
+    return m_activeSockets.size();
+}
+
 bool
 XWThreadPool::IsCurrent( const AddrInfo* addr )
 {
@@ -250,64 +351,68 @@ XWThreadPool::tpool_main( void* closure )
 void*
 XWThreadPool::real_tpool_main( ThreadInfo* tip )
 {
-    logf( XW_LOGINFO, "tpool worker thread starting" );
-    int sock = -1;
+    logf( XW_LOGINFO, "tpool worker thread %d starting", tip->index );
     for ( ; ; ) {
-        pthread_mutex_lock( &m_queueMutex );
         tip->recentTime = 0;
-
-        release_socket_locked( sock );
-
-        while ( !m_timeToDie && m_queue.size() == 0 ) {
-            pthread_cond_wait( &m_queueCondVar, &m_queueMutex );
-        }
-
         if ( m_timeToDie ) {
-            logf( XW_LOGINFO, "%s: unlocking b/c m_timeToDie set", __func__ );
-            pthread_mutex_unlock( &m_queueMutex );
+            logf( XW_LOGINFO, "%s: exiting b/c m_timeToDie set", __func__ );
             break;
         }
 
         QueuePr pr;
-        bool gotOne = grab_elem_locked( &pr );
-
-        tip->recentTime = time( NULL );
-        pthread_mutex_unlock( &m_queueMutex );
-
-        if ( gotOne ) {
-            sock = pr.m_info.m_addr.getSocket();
-            switch ( pr.m_act ) {
-            case Q_READ:
-                assert( 0 );
-                // assert( socket >= 0 );
-                // if ( get_process_packet( pr.m_info.m_type, pr.m_info.m_proc, &pr.m_info.m_addr ) ) {
-                //     AddSocket( pr.m_info.m_type, pr.m_info.m_proc, &pr.m_info.m_addr );
-                // }
-                break;
-            case Q_KILL:
-                logf( XW_LOGINFO, "worker thread got socket %d from queue (to close it)", sock );
-                (*m_kFunc)( &pr.m_info.m_addr );
-                pr.m_info.m_addr.unref();
-                break;
-            }
+        if ( grab_own( tip, &pr ) ) {
+            /* Replies to everything run in this pass go out together, as
+               do the DB updates for stored messages it acks */
+            UDPSendBatch sendBatch;
+            MsgAckBatch ackBatch;
+            int nRun = 0;
+            do {
+                tip->recentTime = time( NULL );
+                run( &pr );
+            } while ( ++nRun < MAX_BATCH && grab_own( tip, &pr ) );
+        } else if ( steal( tip, &pr ) ) {
+            tip->recentTime = time( NULL );
+            UDPSendBatch sendBatch;
+            MsgAckBatch ackBatch;
+            run( &pr );
         } else {
-            sock = -1;
+            wait_for_work( tip );
         }
     }
-    logf( XW_LOGINFO, "tpool worker thread exiting" );
+    logf( XW_LOGINFO, "tpool worker thread %d exiting", tip->index );
     return NULL;
 }
 
+void
+XWThreadPool::run( QueuePr* prp )
+{
+    uint64_t key = prp->m_key;
+    switch ( prp->m_act ) {
+    case Q_PACKET:
+        UdpQueue::Dispatch( prp->m_ptc );
+        break;
+    case Q_KILL:
+        logf( XW_LOGINFO, "worker thread got socket %d from queue (to close it)",
+              prp->m_info.m_addr.getSocket() );
+        (*m_kFunc)( &prp->m_info.m_addr );
+        prp->m_info.m_addr.unref();
+        break;
+    }
+    done_with( key );
+}
+
 void
 XWThreadPool::interrupt_poll()
 {
 #ifdef LOG_POLL
     logf( XW_LOGINFO, __func__ );
 #endif
-    uint8_t byt = 0;
-    int nSent = write( m_pipeWrite, &byt, 1 );
-    if ( nSent != 1 ) {
-        logf( XW_LOGERROR, "errno = %s (%d)", strerror(errno), errno );
+    if ( NULL == m_uring ) {    /* else nobody's reading the pipe */
+        uint8_t byt = 0;
+        int nSent = write( m_pipeWrite, &byt, 1 );
+        if ( nSent != 1 ) {
+            logf( XW_LOGERROR, "errno = %s (%d)", strerror(errno), errno );
+        }
     }
 }
 
@@ -315,7 +420,6 @@ void*
 XWThreadPool::real_listener()
 {
     int flags = POLLIN | POLLERR | POLLHUP | POLLRDHUP;
-    TimerMgr* tmgr = TimerMgr::GetTimerMgr();
     int nSocketsAllocd = 1;
 
     struct pollfd* fds = (pollfd*)calloc( nSocketsAllocd, sizeof(fds[0]) );
@@ -368,7 +472,8 @@ XWThreadPool::real_listener()
         }
         pthread_rwlock_unlock( &m_activeSocketsRWLock );
 
-        int nMillis = tmgr->GetPollTimeoutMillis();
+        /* Timers have their own thread now; wait for sockets only */
+        int nMillis = -1;
 
 #ifdef LOG_POLL
         logf( XW_LOGINFO, "polling %s nmillis=%d", log, nMillis );
@@ -381,9 +486,7 @@ XWThreadPool::real_listener()
             break;
         }
 
-        if ( nEvents == 0 ) {
-            tmgr->FireElapsedTimers();
-        } else if ( nEvents < 0 ) {
+        if ( nEvents < 0 ) {
             logf( XW_LOGERROR, "poll failed: errno: %s (%d)", 
                   strerror(errno), errno );
         } 
@@ -461,65 +564,147 @@ XWThreadPool::listener_main( void* closure )
     return me->real_listener();
 }
 
+/* static */ uint64_t
+XWThreadPool::keyFor( const AddrInfo* addr )
+{
+    uint64_t key;
+    if ( addr->isTCP() ) {
+        key = addr->getSocket();
+    } else {
+        const struct sockaddr_in* sin = &addr->saddr()->u.addr_in;
+        key = (1ULL << 48) | ((uint64_t)ntohl(sin->sin_addr.s_addr) << 16)
+            | ntohs(sin->sin_port);
+    }
+    return key;
+}
+
+XWThreadPool::Affinity*
+XWThreadPool::affinityFor( uint64_t key, pthread_mutex_t** mutexp )
+{
+    /* Fibonacci hashing: sender ports and sockets are close together */
+    int indx = (key * 0x9E3779B97F4A7C15ULL) >> 52;
+    assert( indx < AFFINITY_SLOTS );
+    *mutexp = &m_affinityMutexes[indx & (AFFINITY_MUTEXES - 1)];
+    return &m_affinities[indx];
+}
+
 void
-XWThreadPool::enqueue( SockInfo si, QAction act ) 
+XWThreadPool::enqueue( const QueuePr& pr )
 {
-    QueuePr pr = { act, si };
-    MutexLock ml( &m_queueMutex );
-    m_queue.push_back( pr );
+    ThreadInfo* owner;
+    {
+        pthread_mutex_t* mutex;
+        Affinity* aff = affinityFor( pr.m_key, &mutex );
+        MutexLock ml( mutex );
+        if ( 0 > aff->worker ) {
+            /* Stripes don't share a lock, so the counter needs its own */
+            unsigned int next = __sync_fetch_and_add( &m_nextWorker, 1 );
+            aff->worker = next % m_nThreads;
+        }
+        ++aff->pending;
+        owner = &m_threadInfos[aff->worker];
+
+        /* Push while still holding the affinity lock so nobody can steal
+           this key's earlier work between our deciding and our pushing */
+        MutexLock ml2( &owner->queueMutex );
+        owner->queue.push_back( pr );
+        pthread_cond_signal( &owner->queueCondVar );
+    }
 
-    pthread_cond_signal( &m_queueCondVar );
+    if ( !owner->idle ) {
+        wake_idle( owner );
+    }
     log_hung_threads();
 }
 
+/* The worker just handed something is busy: wake somebody to steal it if
+   it can */
+void
+XWThreadPool::wake_idle( const ThreadInfo* busy )
+{
+    for ( int ii = 1; ii < m_nThreads; ++ii ) {
+        ThreadInfo* tip = &m_threadInfos[(busy->index + ii) % m_nThreads];
+        if ( tip->idle ) {
+            MutexLock ml( &tip->queueMutex );
+            pthread_cond_signal( &tip->queueCondVar );
+            break;
+        }
+    }
+}
+
 bool
-XWThreadPool::grab_elem_locked( QueuePr* prp )
+XWThreadPool::grab_own( ThreadInfo* tip, QueuePr* prp )
+{
+    MutexLock ml( &tip->queueMutex );
+    bool found = 0 < tip->queue.size();
+    if ( found ) {
+        *prp = tip->queue.front();
+        tip->queue.pop_front();
+    }
+    return found;
+}
+
+/* Take the oldest work from another worker whose key has nothing else queued
+   or running.  Lock order elsewhere is affinity then queue, so here, holding
+   the victim's queue, we can only try for the affinity lock. */
+bool
+XWThreadPool::steal( ThreadInfo* thief, QueuePr* prp )
 {
     bool found = false;
-    deque<QueuePr>::iterator iter;
-    for ( iter = m_queue.begin(); !found && iter != m_queue.end(); ++iter ) {
-        int sock = iter->m_info.m_addr.getSocket();
-        /* If NOT found */
-        if ( -1 != sock
-             && m_sockets_in_use.end() == m_sockets_in_use.find( sock ) ) {
-            *prp = *iter;
-            m_queue.erase( iter ); /* this was a double-free once! */
-            m_sockets_in_use.insert( sock );
-            found = true;
+    for ( int ii = 1; !found && ii < m_nThreads; ++ii ) {
+        ThreadInfo* victim = &m_threadInfos[(thief->index + ii) % m_nThreads];
+        MutexLock ml( &victim->queueMutex );
+        deque<QueuePr>::iterator iter = victim->queue.begin();
+        for ( int nScanned = 0; !found && iter != victim->queue.end()
+                  && nScanned < STEAL_SCAN; ++iter, ++nScanned ) {
+            pthread_mutex_t* mutex;
+            Affinity* aff = affinityFor( iter->m_key, &mutex );
+            if ( 0 == pthread_mutex_trylock( mutex ) ) {
+                if ( 1 == aff->pending ) {
+                    aff->worker = thief->index;
+                    *prp = *iter;
+                    victim->queue.erase( iter );
+                    found = true;
+                }
+                pthread_mutex_unlock( mutex );
+            }
         }
     }
-
-    print_in_use();
+    if ( found ) {
+        Metrics::Get()->Inc( MC_TPOOL_STOLEN );
+    }
     return found;
-} /* grab_elem_locked */
+}
 
 void
-XWThreadPool::release_socket_locked( int sock )
+XWThreadPool::wait_for_work( ThreadInfo* tip )
 {
-    if ( -1 != sock ) {
-        set<int>::iterator iter = m_sockets_in_use.find( sock );
-        assert( iter != m_sockets_in_use.end() );
-        m_sockets_in_use.erase( iter );
+    MutexLock ml( &tip->queueMutex );
+    if ( !m_timeToDie && 0 == tip->queue.size() ) {
+        struct timespec ts;
+        clock_gettime( CLOCK_REALTIME, &ts );
+        ts.tv_nsec += STEAL_POLL_MS * 1000000;
+        if ( ts.tv_nsec >= 1000000000 ) {
+            ts.tv_sec += 1;
+            ts.tv_nsec -= 1000000000;
+        }
+        tip->idle = true;
+        (void)pthread_cond_timedwait( &tip->queueCondVar, &tip->queueMutex,
+                                      &ts );
+        tip->idle = false;
     }
-    print_in_use();
 }
 
 void
-XWThreadPool::print_in_use( void )
+XWThreadPool::done_with( uint64_t key )
 {
-    StrWPF str;
-    set<int>::iterator iter;
-
-    for ( iter = m_sockets_in_use.begin(); 
-          iter != m_sockets_in_use.end(); ++iter ) {
-        str.catf( "%d ", *iter );
-    }
-    if ( 0 < str.size() ) {
-        logf( XW_LOGINFO, "Sockets in use: %s", str.c_str() );
-    }
+    pthread_mutex_t* mutex;
+    Affinity* aff = affinityFor( key, &mutex );
+    MutexLock ml( mutex );
+    assert( 0 < aff->pending );
+    --aff->pending;
 }
 
-// We have the mutex when this is called
 void
 XWThreadPool::log_hung_threads( void )
 {
@@ -20,19 +20,30 @@
  */
 
 /* Runs a single thread polling for activity on any of the sockets in its
- * list.  When there is activity, removes the socket from that list and adds
- * it ot a queue of socket ready for reading.  Starts up a bunch of threads
- * waiting on that queue.  When a new socket appears, a thread grabs the
- * socket, reads from it, passes the buffer on, and puts the socket back in
- * the list being read from in our main thread.
+ * list.  When there is activity, reads from the socket and hands anything
+ * complete to UdpQueue, which hands it back as a packet for the pool of
+ * worker threads to dispatch.  Kills (closing a socket and dropping its
+ * references) run on the workers too.
+ *
+ * With IO_URING on (see uring.h) there's no polling thread: URing reads
+ * the sockets and reports here only when one goes away.
+ *
+ * Each worker has its own deque.  Work is queued with a key (the socket for
+ * TCP, the sender's address for UDP) and goes to the worker that last ran
+ * something with that key, so a device or its game stays on one thread and
+ * in one cache, and two workers rarely contend for the same CidLock.  While
+ * a key has anything queued or running, all its work goes to that one
+ * worker, which keeps it in order.  A worker with nothing to do steals from
+ * the others, but only work whose key has nothing else queued or running,
+ * and that key then belongs to the thief.
  */
 
 #include <vector>
 #include <deque>
-#include <set>
 
 #include "addrinfo.h" 
 #include "udpqueue.h"
+#include "uring.h"
 
 using namespace std;
 
@@ -46,11 +57,26 @@ class XWThreadPool {
         AddrInfo m_addr;
     } SockInfo;
 
-    typedef struct _ThreadInfo {
+    typedef enum { Q_PACKET, Q_KILL } QAction;
+    typedef struct {
+        QAction m_act;
+        uint64_t m_key;
+        SockInfo m_info;                /* Q_KILL */
+        PacketThreadClosure* m_ptc;     /* Q_PACKET */
+    } QueuePr;
+
+    class ThreadInfo {
+    public:
         XWThreadPool* me;
+        int index;
         pthread_t thread;
         time_t recentTime;
-    } ThreadInfo;
+        volatile bool idle;
+
+        pthread_mutex_t queueMutex;
+        pthread_cond_t queueCondVar;
+        deque<QueuePr> queue;
+    };
 
     static XWThreadPool* GetTPool();
     typedef void (*kill_func)( const AddrInfo* addr );
@@ -67,23 +93,38 @@ class XWThreadPool {
     void CloseSocket( const AddrInfo* addr );
 
     void EnqueueKill( const AddrInfo* addr, const char* const why );
+    /* Remote closed or errored: stop listening and kill */
+    void SocketGone( const AddrInfo* addr, const char* const why );
+    void EnqueuePacket( PacketThreadClosure* ptc );
+
+    int CountQueued();
 
     bool IsCurrent( const AddrInfo* addr );
+    int CountSockets();
 
  private:
-    typedef enum { Q_READ, Q_KILL } QAction;
-    typedef struct { QAction m_act; SockInfo m_info; } QueuePr;
+    /* Which worker a key's work goes to, and how many of its items are
+       queued or running.  Keys are hashed into a fixed table; two that
+       collide just get serialized together. */
+    typedef struct {
+        int worker;
+        int pending;
+    } Affinity;
 
     /* Remove from set being listened on */
     bool RemoveSocket( const AddrInfo* addr );
     /* test if is in set being listened on */
     bool SocketFound( const AddrInfo* addr );
 
-    void enqueue( QAction act = Q_READ );
-    void enqueue( SockInfo si, QAction act = Q_READ );
-    void release_socket_locked( int socket );
-    bool grab_elem_locked( QueuePr* qpp );
-    void print_in_use( void );
+    static uint64_t keyFor( const AddrInfo* addr );
+    Affinity* affinityFor( uint64_t key, pthread_mutex_t** mutexp );
+    void enqueue( const QueuePr& pr );
+    void wake_idle( const ThreadInfo* busy );
+    bool grab_own( ThreadInfo* tip, QueuePr* prp );
+    bool steal( ThreadInfo* thief, QueuePr* prp );
+    void wait_for_work( ThreadInfo* tip );
+    void done_with( uint64_t key );
+    void run( QueuePr* prp );
     void log_hung_threads( void );
 
     bool get_process_packet( SockType stype, QueueCallback proc, const AddrInfo* from );
@@ -99,11 +140,9 @@ class XWThreadPool {
     map<int, SockInfo>m_activeSockets;
     pthread_rwlock_t m_activeSocketsRWLock;
 
-    /* Sockets waiting for a thread to read 'em */
-    deque<QueuePr> m_queue;
-    set<int> m_sockets_in_use;
-    pthread_mutex_t m_queueMutex;
-    pthread_cond_t m_queueCondVar;
+    Affinity* m_affinities;
+    pthread_mutex_t* m_affinityMutexes;
+    unsigned int m_nextWorker;  /* round-robin for keys never seen; atomic */
 
     /* for self-write pipe hack */
     int m_pipeRead;
@@ -113,6 +152,7 @@ class XWThreadPool {
     int m_nThreads;
     kill_func m_kFunc;
     ThreadInfo* m_threadInfos;
+    URing* m_uring;             /* NULL: we poll */
 
     static XWThreadPool* g_instance;
 };
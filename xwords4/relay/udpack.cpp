@@ -21,6 +21,10 @@
 #include "udpack.h"
 #include "mlock.h" 
 #include "configs.h"
+#include "timermgr.h"
+#include "metrics.h"
+#include "shardmgr.h"
+#include "dbmgr.h"
 
 UDPAckTrack* UDPAckTrack::s_self = NULL;
 
@@ -79,10 +83,6 @@ UDPAckTrack::UDPAckTrack()
     m_nextID = PACKETID_NONE;
 
     pthread_mutex_init( &m_mutex, NULL );
-
-    pthread_t thread;
-    pthread_create( &thread, NULL, thread_main, (void*)this );
-    pthread_detach( thread );
 }
 
 time_t
@@ -100,9 +100,14 @@ uint32_t
 UDPAckTrack::nextPacketIDImpl( XWRelayReg cmd )
 {
     MutexLock ml( &m_mutex );
-    uint32_t result = ++m_nextID;
+    uint32_t result;
+    do {                        /* acks must find their way back here */
+        result = ++m_nextID;
+    } while ( PACKETID_NONE == result || !ShardMgr::OwnsPacket( result ) );
     AckRecord record( cmd , result );
     m_pendings.insert( pair<uint32_t,AckRecord>(result, record) );
+    TimerMgr::GetTimerMgr()->SetTimer( ackLimit(), timerProc,
+                                       (void*)(uintptr_t)result, 0 );
     return result;
 }
 
@@ -111,11 +116,14 @@ UDPAckTrack::recordAckImpl( uint32_t packetID )
 {
     string str;
     map<uint32_t, AckRecord>::iterator iter;
+    MsgAckBatch ackBatch;       /* outlives ml */
     MutexLock ml( &m_mutex );
     iter = m_pendings.find( packetID );
     if ( m_pendings.end() == iter ) {
         logf( XW_LOGERROR, "%s: packet ID %d not found", __func__, packetID );
+        Metrics::Get()->Inc( MC_ACK_UNKNOWN );
     } else {
+        Metrics::Get()->Inc( MC_ACK_ACKED );
         AckRecord& rec = iter->second;
         str = rec.toStr();
         time_t took = time( NULL ) - rec.m_createTime;
@@ -126,6 +134,8 @@ UDPAckTrack::recordAckImpl( uint32_t packetID )
 
         callProc( iter, true );
         m_pendings.erase( iter );
+        TimerMgr::GetTimerMgr()->ClearTimer( timerProc,
+                                             (void*)(uintptr_t)packetID );
     }
     return str;
 }
@@ -161,11 +171,16 @@ UDPAckTrack::printAcksImpl( StrWPF& out )
 void
 UDPAckTrack::doNackImpl( vector<uint32_t>& ids )
 {
+    TimerMgr* tmgr = TimerMgr::GetTimerMgr();
+    MsgAckBatch ackBatch;       /* outlives ml */
     MutexLock ml( &m_mutex );
     map<uint32_t, AckRecord>::iterator iter;
+    Metrics* metrics = Metrics::Get();
     if ( 0 == ids.size() ) {
         for ( iter = m_pendings.begin(); m_pendings.end() != iter; ) {
+            metrics->Inc( MC_ACK_NACKED );
             callProc( iter, false );
+            tmgr->ClearTimer( timerProc, (void*)(uintptr_t)iter->first );
             m_pendings.erase( iter++ );
         }
     } else {
@@ -173,7 +188,9 @@ UDPAckTrack::doNackImpl( vector<uint32_t>& ids )
         for ( idsIter = ids.begin(); ids.end() != idsIter; ++idsIter ) {
             iter = m_pendings.find( *idsIter );
             if ( m_pendings.end() != iter ) {
+                metrics->Inc( MC_ACK_NACKED );
                 callProc( iter, false );
+                tmgr->ClearTimer( timerProc, (void*)(uintptr_t)iter->first );
                 m_pendings.erase( iter );
             }
         }
@@ -193,50 +210,99 @@ UDPAckTrack::callProc( const map<uint32_t, AckRecord>::iterator iter, bool acked
     }
 }
 
-void*
-UDPAckTrack::threadProc()
-{
-    for ( ; ; ) {
-        time_t limit = ackLimit();
-        sleep( limit / 2 );
-        vector<string> older;
-        {
-            MutexLock ml( &m_mutex );
-            time_t now = time( NULL );
-            map<uint32_t, AckRecord>::iterator iter;
-            for ( iter = m_pendings.begin(); m_pendings.end() != iter; ) {
-                AckRecord& rec = iter->second;
-                time_t took = now - rec.m_createTime;
-                if ( limit < took ) {
-                    older.push_back( rec.toStr() );
-                    callProc( iter, false );
-                    m_pendings.erase( iter++ );
-                } else {
-                    ++iter;
-                }
-            }
-        }
-        if ( 0 < older.size() ) {
-            string leaked;
-            vector<string>::const_iterator iter = older.begin();
-            for ( ; ; ) {
-                leaked += iter->c_str();
-                if ( ++iter == older.end() ) {
-                    break;
-                }
-                leaked += ", ";
-            }
-            logf( XW_LOGERROR, "%s: these packets leaked (were not ack'd "
-                  "within %d seconds): %s", __func__, 
-                  limit, leaked.c_str() );
-        }
+// Fired by TimerMgr when a packet's gone UDP_ACK_LIMIT seconds without an
+// ack.
+void
+UDPAckTrack::timedOut( uint32_t packetID )
+{
+    MsgAckBatch ackBatch;       /* outlives ml */
+    MutexLock ml( &m_mutex );
+    map<uint32_t, AckRecord>::iterator iter = m_pendings.find( packetID );
+    if ( m_pendings.end() != iter ) {
+        logf( XW_LOGERROR, "%s: packet %s leaked (was not ack'd within %d "
+              "seconds)", __func__, iter->second.toStr().c_str(),
+              time( NULL ) - iter->second.m_createTime );
+        Metrics::Get()->Inc( MC_ACK_TIMEDOUT );
+        callProc( iter, false );
+        m_pendings.erase( iter );
     }
-    return NULL;
 }
 
-/* static */ void*
-UDPAckTrack::thread_main( void* arg )
+/* static */ void
+UDPAckTrack::timerProc( void* closure )
 {
-    UDPAckTrack* self = (UDPAckTrack*)arg;
-    return self->threadProc();
+    get()->timedOut( (uint32_t)(uintptr_t)closure );
+}
+
+pthread_key_t MsgAckBatch::s_key;
+pthread_once_t MsgAckBatch::s_keyOnce = PTHREAD_ONCE_INIT;
+
+/* static */ void
+MsgAckBatch::makeKey()
+{
+    pthread_key_create( &s_key, NULL );
+}
+
+/* static */ MsgAckBatch*
+MsgAckBatch::current()
+{
+    pthread_once( &s_keyOnce, makeKey );
+    return (MsgAckBatch*)pthread_getspecific( s_key );
+}
+
+MsgAckBatch::MsgAckBatch()
+{
+    m_outermost = NULL == current();
+    if ( m_outermost ) {
+        pthread_setspecific( s_key, this );
+    }
+}
+
+MsgAckBatch::~MsgAckBatch()
+{
+    if ( m_outermost ) {
+        pthread_setspecific( s_key, NULL );
+        flush();
+    }
+}
+
+/* static */ void
+MsgAckBatch::Acked( int msgID )
+{
+    MsgAckBatch* batch = current();
+    if ( NULL == batch ) {
+        DBMgr::Get()->RemoveStoredMessage( msgID );
+    } else {
+        batch->m_acked.push_back( msgID );
+    }
+}
+
+/* static */ void
+MsgAckBatch::Released( int msgID )
+{
+    MsgAckBatch* batch = current();
+    if ( NULL == batch ) {
+        DBMgr::Get()->ReleaseStoredMessages( &msgID, 1 );
+    } else {
+        batch->m_released.push_back( msgID );
+    }
+}
+
+void
+MsgAckBatch::flush()
+{
+    DBMgr* dbmgr = DBMgr::Get();
+    Metrics* metrics = Metrics::Get();
+    if ( 0 < m_acked.size() ) {
+        metrics->Inc( MC_COALESCED_MSGACK, m_acked.size() - 1 );
+        dbmgr->RemoveStoredMessages( m_acked );
+    }
+    if ( 0 < m_released.size() ) {
+        metrics->Inc( MC_COALESCED_MSGACK, m_released.size() - 1 );
+        dbmgr->ReleaseStoredMessages( m_released.data(), m_released.size() );
+    }
+    if ( 1 < m_acked.size() + m_released.size() ) {
+        logf( XW_LOGVERBOSE0, "%s: %d acked, %d released", __func__,
+              m_acked.size(), m_released.size() );
+    }
 }
@@ -22,6 +22,8 @@
 #define _UDPACK_H_
 
 #include <stdio.h>
+#include <pthread.h>
+#include <vector>
 
 #include "xwrelay_priv.h"
 #include "xwrelay.h"
@@ -67,7 +69,7 @@ class UDPAckTrack {
 
  private:
     static UDPAckTrack* get();
-    static void* thread_main( void* arg );
+    static void timerProc( void* closure );
     UDPAckTrack();
     time_t ackLimit();
     uint32_t nextPacketIDImpl( XWRelayReg cmd );
@@ -76,7 +78,7 @@ class UDPAckTrack {
     void callProc( const map<uint32_t, AckRecord>::iterator iter, bool acked );
     void printAcksImpl( StrWPF& out );
     void doNackImpl( vector<uint32_t>& ids );
-    void* threadProc();
+    void timedOut( uint32_t packetID );
 
     static UDPAckTrack* s_self;
     uint32_t m_nextID;
@@ -84,4 +86,31 @@ class UDPAckTrack {
     map<uint32_t, AckRecord> m_pendings;
 };
 
+/* Stack-based, like UDPSendBatch: while one's open on a thread, stored
+ * messages acked (or nacked, or timed out) on that thread are collected and
+ * removed (or released) with one DB call each when the outermost batch goes
+ * away.  Open it before taking any lock the acks arrive under so the DB work
+ * happens after that lock's released.
+ */
+class MsgAckBatch {
+ public:
+    MsgAckBatch();
+    ~MsgAckBatch();
+
+    static void Acked( int msgID );
+    static void Released( int msgID );
+
+ private:
+    void flush();
+    static MsgAckBatch* current();
+    static void makeKey();
+
+    bool m_outermost;
+    vector<int> m_acked;
+    vector<int> m_released;
+
+    static pthread_key_t s_key;
+    static pthread_once_t s_keyOnce;
+};
+
 #endif
@@ -19,10 +19,11 @@
  */
 
 #include <glib.h>
+#include <time.h>
 
 #include "udpager.h"
 #include "configs.h"
-#include "mlock.h"
+#include "devmgr.h"
 
 static UDPAger* s_instance = NULL;
 
@@ -43,70 +44,43 @@ UDPAger::UDPAger()
     }
     logf( XW_LOGINFO, "read %d from configs for UDP_RECYLE_INTERVAL", 
           m_maxIntervalSecs );
-    m_maxIntervalMillis = m_maxIntervalSecs * 1000;
-
-    pthread_mutex_init( &m_addrTimeMapLock, NULL );
 }
 
 // An address is valid as long as we keep hearing from it within a certain
 // frequency.  When we hear from it but it's been too long, assume it's new
-// and give it a new timestamp.
+// and give it a new timestamp.  The times live in DevMgr's address table;
+// those not refreshed for twice the interval are treated as gone and their
+// slots reused.
 void
 UDPAger::Refresh( const AddrInfo* addr )
 {
     const AddrInfo::AddrUnion* saddr = addr->saddr();
-    uint32_t readWhen = addr->created();
-    gchar* b64 = g_base64_encode( (uint8_t*)&saddr->u.addr, 
-                                  sizeof(saddr->u.addr) );
-
-    MutexLock ml( &m_addrTimeMapLock );
+    int interval = DevMgr::Get()->refreshAddr( saddr, addr->created() );
 
-    map<AddrInfo::AddrUnion, AgePair*>::iterator iter = 
-        m_addrTimeMap.find( *saddr ); 
-    if ( m_addrTimeMap.end() == iter ) { // it's new; just insert
-        AgePair* ap = new AgePair( readWhen, readWhen );
-        m_addrTimeMap.insert( pair<AddrInfo::AddrUnion, 
-                              AgePair*>(*saddr, ap ) );
-            logf( XW_LOGINFO, "%s: adding '%s'", __func__, b64 );
-    } else {
-        AgePair* ap = iter->second;
-        assert( ap->lastSeen() <= readWhen );
-        int interval = readWhen - ap->lastSeen();
-        if ( m_maxIntervalMillis >= interval ) {
-            logf( XW_LOGINFO, "%s: refreshing '%s'; last seen %d "
-                  "milliseconds ago", __func__, b64, interval );
-            ap->update( readWhen );
+    XW_LogLevel level = XW_LOGINFO;
+    if ( willLog( level ) ) {
+        gchar* b64 = g_base64_encode( (uint8_t*)&saddr->u.addr, 
+                                      sizeof(saddr->u.addr) );
+        if ( 0 > interval ) {
+            logf( level, "%s: adding or RESETTING '%s'", __func__, b64 );
         } else {
-            logf( XW_LOGINFO, "%s: RESETTING '%s'; last seen %d "
+            logf( level, "%s: refreshing '%s'; last seen %d "
                   "milliseconds ago", __func__, b64, interval );
-            delete ap;
-            iter->second = new AgePair( readWhen, readWhen );
         }
+        g_free( b64 );
     }
-
-    g_free( b64 );
 }
 
 bool
 UDPAger::IsCurrent( const AddrInfo* addr )
 {
-    bool result;
-#if 0
-    result = false;
-#else
-    const AddrInfo::AddrUnion* saddr = addr->saddr();
     uint32_t readWhen = addr->created();
-
-    MutexLock ml( &m_addrTimeMapLock );
-    map<AddrInfo::AddrUnion, AgePair*>::const_iterator iter =
-        m_addrTimeMap.find( *saddr );
-    assert( m_addrTimeMap.end() != iter );
-
-    AgePair* ap = iter->second;
-    result = readWhen >= ap->created();
-#endif
+    uint32_t created;
+    bool result = DevMgr::Get()->addrCreated( addr->saddr(), readWhen,
+                                              &created )
+        && readWhen >= created;
     if ( !result ) {
         logf( XW_LOGINFO, "%s() => false", __func__ );
     }
     return result;
- }
+}
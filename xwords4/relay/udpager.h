@@ -20,8 +20,6 @@
 #ifndef _UDPAGER_H_
 #define _UDPAGER_H_
 
-#include <map>
-
 #include "addrinfo.h"
 
 using namespace std;
@@ -35,28 +33,7 @@ class UDPAger {
     uint16_t MaxIntervalSeconds() const { return m_maxIntervalSecs; }
 
  private:
-
-    class AgePair {
-    public:
-        AgePair( uint32_t created, uint32_t lastSeen ) {
-            m_created = created;
-            m_lastSeen = lastSeen;
-        }
-        void update( uint32_t lastSeen ) { m_lastSeen = lastSeen; }
-        uint32_t lastSeen() const { return m_lastSeen; }
-        uint32_t created() const { return m_created; }
-    private:
-        uint32_t m_created;
-        uint32_t m_lastSeen;
-    };
-
     int m_maxIntervalSecs;          /* config: how long since we heard */
-    int m_maxIntervalMillis;
-
-    /* Map socket addresses against times, moving the time forward only
-       when it's been too long since we saw it. */
-    map<AddrInfo::AddrUnion, AgePair*> m_addrTimeMap; 
-    pthread_mutex_t m_addrTimeMapLock;
 };
 
 #endif
@@ -0,0 +1,123 @@
+/* -*-mode: C; fill-column: 78; c-basic-offset: 4; -*- */
+/* 
+ * Copyright 2018 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <assert.h>
+
+#include "udpbatch.h"
+
+/* Most we'll pass to a single sendmmsg() call */
+#define MAX_PER_CALL 64
+
+pthread_key_t UDPSendBatch::s_key;
+pthread_once_t UDPSendBatch::s_keyOnce = PTHREAD_ONCE_INIT;
+
+/* static */ void
+UDPSendBatch::makeKey()
+{
+    pthread_key_create( &s_key, NULL );
+}
+
+UDPSendBatch::UDPSendBatch()
+{
+    pthread_once( &s_keyOnce, makeKey );
+    m_outermost = NULL == pthread_getspecific( s_key );
+    if ( m_outermost ) {
+        pthread_setspecific( s_key, this );
+    }
+}
+
+UDPSendBatch::~UDPSendBatch()
+{
+    if ( m_outermost ) {
+        pthread_setspecific( s_key, NULL );
+        flush();
+    }
+}
+
+/* static */ ssize_t
+UDPSendBatch::Send( int sock, const struct sockaddr* dest_addr,
+                    const uint8_t* buf, size_t len )
+{
+    ssize_t result;
+    pthread_once( &s_keyOnce, makeKey );
+    UDPSendBatch* batch = (UDPSendBatch*)pthread_getspecific( s_key );
+    if ( NULL == batch ) {
+        result = sendto( sock, buf, len, 0 /*flags*/, dest_addr, 
+                         sizeof(*dest_addr) );
+        if ( 0 > result ) {
+            logf( XW_LOGERROR, "%s: sendto->errno %d (%s)", __func__, errno, 
+                  strerror(errno) );
+        }
+    } else {
+        batch->m_queued.resize( batch->m_queued.size() + 1 );
+        Queued& queued = batch->m_queued.back();
+        queued.sock = sock;
+        queued.addr = *dest_addr;
+        queued.packet.assign( buf, buf + len );
+        result = len;
+    }
+    return result;
+}
+
+void
+UDPSendBatch::flush()
+{
+    size_t nQueued = m_queued.size();
+    size_t next = 0;
+    int nCalls = 0;
+    while ( next < nQueued ) {
+        struct mmsghdr msgs[MAX_PER_CALL];
+        struct iovec iovs[MAX_PER_CALL];
+
+        /* one call can only cover consecutive packets on the same socket */
+        int sock = m_queued[next].sock;
+        unsigned int count = 0;
+        while ( count < MAX_PER_CALL && next + count < nQueued
+                && sock == m_queued[next + count].sock ) {
+            Queued& queued = m_queued[next + count];
+            iovs[count].iov_base = queued.packet.data();
+            iovs[count].iov_len = queued.packet.size();
+            memset( &msgs[count], 0, sizeof(msgs[count]) );
+            msgs[count].msg_hdr.msg_name = &queued.addr;
+            msgs[count].msg_hdr.msg_namelen = sizeof(queued.addr);
+            msgs[count].msg_hdr.msg_iov = &iovs[count];
+            msgs[count].msg_hdr.msg_iovlen = 1;
+            ++count;
+        }
+
+        int nSent = sendmmsg( sock, msgs, count, 0 );
+        ++nCalls;
+        if ( 0 > nSent ) {
+            /* Skip the one that failed (there's no retrying UDP) so the
+               rest still go out */
+            logf( XW_LOGERROR, "%s: sendmmsg->errno %d (%s)", __func__, 
+                  errno, strerror(errno) );
+            nSent = 1;
+        }
+        next += nSent;
+    }
+
+    if ( 0 < nQueued ) {
+        logf( XW_LOGVERBOSE0, "%s: sent %d packets in %d calls", __func__,
+              nQueued, nCalls );
+    }
+    m_queued.clear();
+}
@@ -0,0 +1,66 @@
+/* -*-mode: C; fill-column: 78; c-basic-offset: 4; -*- */
+/* 
+ * Copyright 2018 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef _UDPBATCH_H_
+#define _UDPBATCH_H_
+
+#include <pthread.h>
+#include <sys/socket.h>
+#include <vector>
+
+#include "xwrelay_priv.h"
+
+using namespace std;
+
+/* Stack-based class that, for as long as it exists, holds onto UDP packets
+ * sent by the thread that created it and then sends them all with as few
+ * sendmmsg() calls as possible when it's destroyed.  Packets go out in the
+ * order they were queued, so per-destination order is unchanged.  Threads
+ * with no batch on their stack send immediately as before.  Nested batches
+ * join the outermost one.
+ */
+
+class UDPSendBatch {
+ public:
+    UDPSendBatch();
+    ~UDPSendBatch();
+
+    /* Queue if the calling thread has a batch open, otherwise send now.
+       Returns bytes sent (or queued), or -1 on error. */
+    static ssize_t Send( int sock, const struct sockaddr* dest_addr,
+                         const uint8_t* buf, size_t len );
+
+ private:
+    typedef struct _Queued {
+        int sock;
+        struct sockaddr addr;
+        vector<uint8_t> packet;
+    } Queued;
+
+    void flush();
+    static void makeKey();
+
+    bool m_outermost;
+    vector<Queued> m_queued;
+
+    static pthread_key_t s_key;
+    static pthread_once_t s_keyOnce;
+};
+
+#endif
@@ -22,7 +22,8 @@
 #include <errno.h>
 #include "udpqueue.h"
 #include "mlock.h"
-
+#include "capture.h"
+#include "tpool.h"
 
 static UdpQueue* s_instance = NULL;
 
@@ -77,20 +78,10 @@ UdpQueue::UdpQueue()
 {
     m_nextID = 0;
     pthread_mutex_init ( &m_partialsMutex, NULL );
-    pthread_mutex_init ( &m_queueMutex, NULL );
-    pthread_cond_init( &m_queueCondVar, NULL );
-
-    pthread_t thread;
-    int result = pthread_create( &thread, NULL, thread_main_static, this );
-    assert( result == 0 );
-    result = pthread_detach( thread );
-    assert( result == 0 );
 }
 
 UdpQueue::~UdpQueue() 
 {
-    pthread_cond_destroy( &m_queueCondVar );
-    pthread_mutex_destroy ( &m_queueMutex );
     pthread_mutex_destroy ( &m_partialsMutex );
 }
 
@@ -156,20 +147,78 @@ UdpQueue::handle( const AddrInfo* addr, QueueCallback cb )
     return success;
 }
 
+// Like the above, but for bytes already read from the socket (by URing):
+// dispatch every packet they complete and keep any remainder for next time.
+//
+// Return false if socket should no longer be used.
+bool
+UdpQueue::handleStream( const AddrInfo* addr, const uint8_t* data, int len,
+                        QueueCallback cb )
+{
+    assert( addr->isTCP() );
+    bool success = true;
+    int sock = addr->getSocket();
+
+    MutexLock ml( &m_partialsMutex );
+
+    while ( success && 0 < len ) {
+        PartialPacket* packet;
+        map<int, PartialPacket*>::iterator iter = m_partialPackets.find( sock );
+        if ( m_partialPackets.end() == iter ) {
+            packet = new PartialPacket( sock );
+            m_partialPackets.insert( pair<int, PartialPacket*>( sock, packet ) );
+        } else {
+            packet = iter->second;
+        }
+
+        int used;
+        if ( packet->readSoFar() < sizeof( packet->m_len ) ) {
+            used = sizeof(packet->m_len) - packet->readSoFar();
+            if ( used > len ) {
+                used = len;
+            }
+            packet->append( data, used );
+            if ( packet->readSoFar() == sizeof( packet->m_len ) ) {
+                uint16_t tmp;
+                memcpy( &tmp, packet->data(), sizeof(tmp) );
+                packet->m_len = ntohs(tmp);
+                success = 0 < packet->m_len;
+            }
+        } else {
+            int leftToRead = 
+                packet->m_len - (packet->readSoFar() - sizeof(packet->m_len));
+            used = leftToRead < len ? leftToRead : len;
+            packet->append( data, used );
+            if ( used == leftToRead ) {
+                handle( addr, packet->data() + sizeof(packet->m_len), 
+                        packet->m_len, cb );
+                newSocket_locked( sock );
+            }
+        }
+        data += used;
+        len -= used;
+    }
+
+    logf( XW_LOGVERBOSE0, "%s(sock=%d) => %d", __func__, sock, success );
+    return success;
+}
+
 void 
 UdpQueue::handle( const AddrInfo* addr, const uint8_t* buf, int len, 
                   QueueCallback cb )
 {
     // addr->ref();
+    PacketCapture* capture = PacketCapture::Get();
+    if ( capture->IsOn() ) {
+        capture->Record( addr, buf, len );
+    }
+
     PacketThreadClosure* ptc = new PacketThreadClosure( addr, buf, len, cb );
-    MutexLock ml( &m_queueMutex );
-    int id = ++m_nextID;
+    int id = __sync_add_and_fetch( &m_nextID, 1 );
     ptc->setID( id );
     logf( XW_LOGINFO, "%s(): enqueuing packet %d (socket %d, len %d)",
           __func__, id, addr->getSocket(), len );
-    m_queue.push_back( ptc );
-
-    pthread_cond_signal( &m_queueCondVar );
+    XWThreadPool::GetTPool()->EnqueuePacket( ptc );
 }
 
 // Remove any PartialPacket record with the same socket/fd. This makes sense
@@ -198,44 +247,23 @@ UdpQueue::newSocket( const AddrInfo* addr )
     newSocket( addr->getSocket() );
 }
 
-void* 
-UdpQueue::thread_main()
+/* Called on a tpool worker thread */
+/* static */ void
+UdpQueue::Dispatch( PacketThreadClosure* ptc )
 {
-    for ( ; ; ) {
-        pthread_mutex_lock( &m_queueMutex );
-        while ( m_queue.size() == 0 ) {
-            pthread_cond_wait( &m_queueCondVar, &m_queueMutex );
-        }
-        PacketThreadClosure* ptc = m_queue.front();
-        m_queue.pop_front();
-
-        pthread_mutex_unlock( &m_queueMutex );
+    ptc->noteDequeued();
+    Metrics::Get()->RecordQueueWait( Metrics::NowUsecs() - ptc->createdUsecs() );
 
-        ptc->noteDequeued();
-
-        time_t age = ptc->ageInSeconds();
-        if ( 30 > age ) {
-            logf( XW_LOGINFO, "%s: dispatching packet %d (socket %d); "
-                  "%d seconds old", __func__, ptc->getID(),
-                  ptc->addr()->getSocket(), age );
-            (*ptc->cb())( ptc );
-            ptc->logStats();
-        } else {
-            logf( XW_LOGINFO, "%s: dropping packet %d; it's %d seconds old!", 
-                  __func__, age );
-        }
-        // ptc->addr()->unref();
-        delete ptc;
+    time_t age = ptc->ageInSeconds();
+    if ( 30 > age ) {
+        logf( XW_LOGINFO, "%s: dispatching packet %d (socket %d); "
+              "%d seconds old", __func__, ptc->getID(),
+              ptc->addr()->getSocket(), age );
+        (*ptc->cb())( ptc );
+        ptc->logStats();
+    } else {
+        logf( XW_LOGINFO, "%s: dropping packet %d; it's %d seconds old!", 
+              __func__, ptc->getID(), age );
     }
-    return NULL;
+    delete ptc;
 }
-
-/* static */ void*
-UdpQueue::thread_main_static( void* closure )
-{
-    blockSignals();
-
-    UdpQueue* me = (UdpQueue*)closure;
-    return me->thread_main();
-}
-
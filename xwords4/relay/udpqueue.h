@@ -22,11 +22,11 @@
 #define _UDPQUEUE_H_
 
 #include <pthread.h>
-#include <deque>
 #include <map>
 
 #include "xwrelay_priv.h"
 #include "addrinfo.h"
+#include "metrics.h"
 
 using namespace std;
 
@@ -43,6 +43,7 @@ public:
         , m_addr(*addr)
         , m_cb(cb)
         , m_created(time( NULL ))
+        , m_createdUsecs(Metrics::NowUsecs())
         { 
             memcpy( m_buf, buf, len );
             m_addr.ref();
@@ -60,6 +61,7 @@ public:
     void noteDequeued() { m_dequed = time( NULL ); }
     void logStats();
     time_t ageInSeconds() { return time( NULL ) - m_created; }
+    uint64_t createdUsecs() const { return m_createdUsecs; }
     const QueueCallback cb() const { return m_cb; }
     void setID( int id ) { m_id = id; }
     int getID( void ) { return m_id; }
@@ -70,6 +72,7 @@ public:
     AddrInfo m_addr;
     QueueCallback m_cb;
     time_t m_created;
+    uint64_t m_createdUsecs;
     time_t m_dequed;
     int m_id;
 };
@@ -83,6 +86,9 @@ class PartialPacket {
         {}
     bool stillGood() const ;
     bool readAtMost( int len );
+    void append( const uint8_t* data, int len ) {
+        m_buf.insert( m_buf.end(), data, data + len );
+    }
     size_t readSoFar() const { return m_buf.size(); }
     const uint8_t* data() const { return m_buf.data(); }
 
@@ -102,19 +108,18 @@ class UdpQueue {
     bool handle( const AddrInfo* addr, QueueCallback cb );
     void handle( const AddrInfo* addr, const uint8_t* buf, int len,
                  QueueCallback cb );
+    bool handleStream( const AddrInfo* addr, const uint8_t* data, int len,
+                       QueueCallback cb );
     void newSocket( int sock );
     void newSocket( const AddrInfo* addr );
 
+    /* Run a packet's callback; XWThreadPool's workers call this */
+    static void Dispatch( PacketThreadClosure* ptc );
+
  private:
     void newSocket_locked( int sock );
-    static void* thread_main_static( void* closure );
-    void* thread_main();
 
     pthread_mutex_t m_partialsMutex;
-    pthread_mutex_t m_queueMutex;
-    pthread_cond_t m_queueCondVar;
-    deque<PacketThreadClosure*> m_queue;
-    // map<int, vector<PacketThreadClosure*> > m_bySocket;
     int m_nextID;
     map<int, PartialPacket*> m_partialPackets;
 };
@@ -0,0 +1,588 @@
+/* -*-mode: C; fill-column: 78; c-basic-offset: 4; -*- */
+/* 
+ * Copyright 2018 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <assert.h>
+
+#include "uring.h"
+
+#ifdef HAVE_IO_URING
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/io_uring.h>
+
+#include "configs.h"
+#include "mlock.h"
+#include "tpool.h"
+#include "udpbatch.h"
+
+#define SQ_ENTRIES 256
+#define CQ_ENTRIES 4096
+#define N_BUFS 1024             /* power of 2 */
+#define BUF_SIZE 4096           /* a datagram plus recvmsg's header */
+#define BUF_GROUP 0
+
+/* user_data of what's not a TCP socket's recv */
+#define TAG_WAKE 1
+#define TAG_UDP 2
+#define TAG_CANCEL 3
+#define TAG_FIRST_TCP 16
+
+static URing* s_instance = NULL;
+static bool s_tried = false;
+
+/* No liburing: the three syscalls are all we need */
+static int
+sys_setup( unsigned entries, struct io_uring_params* params )
+{
+    return syscall( __NR_io_uring_setup, entries, params );
+}
+
+static int
+sys_enter( int fd, unsigned toSubmit, unsigned minComplete, unsigned flags )
+{
+    return syscall( __NR_io_uring_enter, fd, toSubmit, minComplete, flags,
+                    NULL, 0 );
+}
+
+static int
+sys_register( int fd, unsigned op, void* arg, unsigned nArgs )
+{
+    return syscall( __NR_io_uring_register, fd, op, arg, nArgs );
+}
+
+/* static */ URing*
+URing::Get()
+{
+    if ( !s_tried ) {
+        s_tried = true;
+        int useIt = 0;
+        (void)RelayConfigs::GetConfigs()->GetValueFor( "IO_URING", &useIt );
+        if ( useIt ) {
+            URing* uring = new URing();
+            if ( uring->setup() ) {
+                pthread_t thread;
+                int result = pthread_create( &thread, NULL, thread_main,
+                                             uring );
+                assert( 0 == result );
+                pthread_detach( thread );
+                s_instance = uring;
+                logf( XW_LOGINFO, "%s: receiving via io_uring", __func__ );
+            } else {
+                logf( XW_LOGERROR, "%s: io_uring unavailable; using poll",
+                      __func__ );
+                delete uring;
+            }
+        }
+    }
+    return s_instance;
+}
+
+URing::URing()
+    : m_fd(-1)
+    , m_ringMem(MAP_FAILED)
+    , m_ringSize(0)
+    , m_sqesSize(0)
+    , m_sqUnsubmitted(0)
+    , m_sqes((struct io_uring_sqe*)MAP_FAILED)
+    , m_bufRing(NULL)
+    , m_bufs(NULL)
+    , m_bufTail(0)
+    , m_udpsock(-1)
+    , m_udpProc(NULL)
+    , m_wakeFD(-1)
+    , m_udpPending(false)
+    , m_nextTag(TAG_FIRST_TCP)
+{
+    memset( &m_udpHdr, 0, sizeof(m_udpHdr) );
+    pthread_mutex_init( &m_mutex, NULL );
+}
+
+/* Only reached when setup() fails; once running we're never deleted */
+URing::~URing()
+{
+    if ( 0 <= m_wakeFD ) {
+        close( m_wakeFD );
+    }
+    if ( MAP_FAILED != m_sqes ) {
+        munmap( m_sqes, m_sqesSize );
+    }
+    if ( MAP_FAILED != m_ringMem ) {
+        munmap( m_ringMem, m_ringSize );
+    }
+    if ( 0 <= m_fd ) {
+        close( m_fd );
+    }
+    free( m_bufRing );
+    delete[] m_bufs;
+    pthread_mutex_destroy( &m_mutex );
+}
+
+bool
+URing::setup()
+{
+    struct io_uring_params params;
+    memset( &params, 0, sizeof(params) );
+    /* Kernels that know SINGLE_ISSUER (6.0) also do multishot recv, so
+       asking for it is our version check.  Start disabled so that the
+       thread that enables the ring, ours, is the one issuer. */
+    params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_R_DISABLED
+        | IORING_SETUP_CQSIZE;
+    params.cq_entries = CQ_ENTRIES;
+    m_fd = sys_setup( SQ_ENTRIES, &params );
+    bool ok = 0 <= m_fd;
+    if ( !ok ) {
+        logf( XW_LOGERROR, "%s: io_uring_setup: %s", __func__,
+              strerror(errno) );
+    }
+
+    if ( ok ) {
+        /* SINGLE_MMAP's been there since 5.4 */
+        assert( 0 != (params.features & IORING_FEAT_SINGLE_MMAP) );
+        size_t sqSize = params.sq_off.array
+            + params.sq_entries * sizeof(unsigned);
+        size_t cqSize = params.cq_off.cqes
+            + params.cq_entries * sizeof(struct io_uring_cqe);
+        m_ringSize = sqSize > cqSize ? sqSize : cqSize;
+        m_ringMem = mmap( NULL, m_ringSize, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING );
+        m_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+        m_sqes = (struct io_uring_sqe*)
+            mmap( NULL, m_sqesSize, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES );
+        ok = MAP_FAILED != m_ringMem && MAP_FAILED != m_sqes;
+        if ( !ok ) {
+            logf( XW_LOGERROR, "%s: mmap: %s", __func__, strerror(errno) );
+        }
+    }
+
+    if ( ok ) {
+        uint8_t* ring = (uint8_t*)m_ringMem;
+        m_sqHead = (unsigned*)(ring + params.sq_off.head);
+        m_sqTail = (unsigned*)(ring + params.sq_off.tail);
+        m_sqArray = (unsigned*)(ring + params.sq_off.array);
+        m_sqMask = *(unsigned*)(ring + params.sq_off.ring_mask);
+        m_sqEntries = params.sq_entries;
+        m_cqHead = (unsigned*)(ring + params.cq_off.head);
+        m_cqTail = (unsigned*)(ring + params.cq_off.tail);
+        m_cqMask = *(unsigned*)(ring + params.cq_off.ring_mask);
+        m_cqes = (struct io_uring_cqe*)(ring + params.cq_off.cqes);
+
+        void* mem;
+        size_t ringBytes = N_BUFS * sizeof(struct io_uring_buf);
+        ok = 0 == posix_memalign( &mem, getpagesize(), ringBytes );
+        if ( ok ) {
+            memset( mem, 0, ringBytes );
+            m_bufRing = (struct io_uring_buf*)mem;
+            m_bufs = new uint8_t[N_BUFS * BUF_SIZE];
+
+            struct io_uring_buf_reg reg;
+            memset( &reg, 0, sizeof(reg) );
+            reg.ring_addr = (uintptr_t)m_bufRing;
+            reg.ring_entries = N_BUFS;
+            reg.bgid = BUF_GROUP;
+            ok = 0 == sys_register( m_fd, IORING_REGISTER_PBUF_RING,
+                                    &reg, 1 );
+            if ( !ok ) {
+                logf( XW_LOGERROR, "%s: registering buffers: %s", __func__,
+                      strerror(errno) );
+            }
+        }
+    }
+
+    if ( ok ) {
+        for ( unsigned bid = 0; bid < N_BUFS; ++bid ) {
+            recycle( bid );
+        }
+        m_wakeFD = eventfd( 0, EFD_CLOEXEC );
+        ok = 0 <= m_wakeFD;
+    }
+    return ok;
+} /* setup */
+
+void
+URing::StartUDP( int udpsock, URingUDPProc proc )
+{
+    {
+        MutexLock ml( &m_mutex );
+        m_udpsock = udpsock;
+        m_udpProc = proc;
+        m_udpHdr.msg_namelen = sizeof(((AddrInfo::AddrUnion*)0)->u.addr_in);
+        m_udpPending = true;
+    }
+    wake();
+}
+
+void
+URing::AddTCP( const AddrInfo* addr, QueueCallback proc )
+{
+    {
+        MutexLock ml( &m_mutex );
+        uint64_t tag = m_nextTag++;
+        TCPSock ts = { *addr, proc };
+        m_tcpByTag.insert( pair<uint64_t, TCPSock>( tag, ts ) );
+        m_tagBySock[addr->getSocket()] = tag;
+        m_toArm.push_back( tag );
+    }
+    wake();
+}
+
+/* The recv holds its own reference to the socket, so this has to follow
+   any close() for the far end to see it.  Tags aren't reused, so a new
+   socket with the old one's number is safe from the cancel. */
+void
+URing::RemoveTCP( const AddrInfo* addr )
+{
+    bool found = false;
+    {
+        MutexLock ml( &m_mutex );
+        map<int, uint64_t>::iterator iter =
+            m_tagBySock.find( addr->getSocket() );
+        if ( m_tagBySock.end() != iter ) {
+            uint64_t tag = iter->second;
+            map<uint64_t, TCPSock>::iterator tcpIter = m_tcpByTag.find( tag );
+            assert( m_tcpByTag.end() != tcpIter );
+            if ( tcpIter->second.addr.equals( *addr ) ) {
+                m_tcpByTag.erase( tcpIter );
+                m_tagBySock.erase( iter );
+                m_toCancel.push_back( tag );
+                found = true;
+            }
+        }
+    }
+    if ( found ) {
+        wake();
+    }
+}
+
+void
+URing::wake()
+{
+    uint64_t one = 1;
+    if ( sizeof(one) != write( m_wakeFD, &one, sizeof(one) ) ) {
+        logf( XW_LOGERROR, "%s: write: %s", __func__, strerror(errno) );
+    }
+}
+
+/* static */ void*
+URing::thread_main( void* arg )
+{
+    blockSignals();
+    return ((URing*)arg)->threadProc();
+}
+
+void*
+URing::threadProc()
+{
+    if ( 0 != sys_register( m_fd, IORING_REGISTER_ENABLE_RINGS, NULL, 0 ) ) {
+        logf( XW_LOGERROR, "%s: enabling ring: %s", __func__,
+              strerror(errno) );
+        assert( 0 );
+    }
+
+    armWake();
+    for ( ; ; ) {
+        runCommands();
+        submit( 1 );
+        reap();
+    }
+    return NULL;
+}
+
+/* Post whatever other threads have asked for since last time */
+void
+URing::runCommands()
+{
+    MutexLock ml( &m_mutex );
+    if ( m_udpPending ) {
+        m_udpPending = false;
+        armUDP();
+    }
+
+    vector<uint64_t>::const_iterator iter;
+    for ( iter = m_toArm.begin(); m_toArm.end() != iter; ++iter ) {
+        map<uint64_t, TCPSock>::const_iterator tcpIter =
+            m_tcpByTag.find( *iter );
+        if ( m_tcpByTag.end() != tcpIter ) { /* else removed already */
+            armTCP( *iter, tcpIter->second.addr.getSocket() );
+        }
+    }
+    m_toArm.clear();
+
+    for ( iter = m_toCancel.begin(); m_toCancel.end() != iter; ++iter ) {
+        cancel( *iter );
+    }
+    m_toCancel.clear();
+}
+
+struct io_uring_sqe*
+URing::getSQE()
+{
+    unsigned tail = *m_sqTail;
+    if ( tail - *(volatile unsigned*)m_sqHead >= m_sqEntries ) {
+        submit( 0 );            /* full: the kernel takes them all now */
+    }
+    unsigned indx = tail & m_sqMask;
+    struct io_uring_sqe* sqe = &m_sqes[indx];
+    memset( sqe, 0, sizeof(*sqe) );
+    m_sqArray[indx] = indx;
+    return sqe;
+}
+
+void
+URing::commitSQE()
+{
+    __sync_synchronize();       /* sqe filled in before the tail moves */
+    *(volatile unsigned*)m_sqTail = *m_sqTail + 1;
+    ++m_sqUnsubmitted;
+}
+
+/* Hand the kernel what we've queued, waiting for minComplete completions */
+void
+URing::submit( unsigned minComplete )
+{
+    unsigned flags = 0 < minComplete ? IORING_ENTER_GETEVENTS : 0;
+    for ( ; ; ) {
+        int nSubmitted = sys_enter( m_fd, m_sqUnsubmitted, minComplete,
+                                    flags );
+        if ( 0 <= nSubmitted ) {
+            m_sqUnsubmitted -= nSubmitted;
+            break;
+        } else if ( EINTR != errno ) {
+            /* e.g. EBUSY with completions backed up: reaping fixes it */
+            logf( XW_LOGERROR, "%s: io_uring_enter: %s", __func__,
+                  strerror(errno) );
+            break;
+        }
+    }
+}
+
+void
+URing::reap()
+{
+    /* Replies and shard forwards sent from here go out together */
+    UDPSendBatch sendBatch;
+
+    unsigned head = *m_cqHead;
+    for ( ; ; ) {
+        unsigned tail = *(volatile unsigned*)m_cqTail;
+        __sync_synchronize();
+        if ( head == tail ) {
+            break;
+        }
+        const struct io_uring_cqe* cqe = &m_cqes[head & m_cqMask];
+        switch ( cqe->user_data ) {
+        case TAG_WAKE:
+            armWake();
+            break;
+        case TAG_UDP:
+            gotUDP( cqe );
+            break;
+        case TAG_CANCEL:
+            break;
+        default:
+            gotTCP( cqe );
+            break;
+        }
+        ++head;
+        __sync_synchronize();   /* done with the cqe before it's reused */
+        *(volatile unsigned*)m_cqHead = head;
+    }
+}
+
+/* Give a buffer back to the kernel.  The ring's an array of io_uring_buf
+   whose tail overlays the first entry's resv field; struct
+   io_uring_buf_ring says as much, but C++ gives its empty flex-array
+   wrapper a size and so misplaces bufs[]. */
+void
+URing::recycle( unsigned bid )
+{
+    struct io_uring_buf* buf = &m_bufRing[m_bufTail & (N_BUFS - 1)];
+    buf->addr = (uintptr_t)(m_bufs + bid * BUF_SIZE);
+    buf->len = BUF_SIZE;
+    buf->bid = bid;
+    ++m_bufTail;
+    __sync_synchronize();
+    *(volatile uint16_t*)&m_bufRing[0].resv = m_bufTail;
+}
+
+void
+URing::armUDP()
+{
+    struct io_uring_sqe* sqe = getSQE();
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = m_udpsock;
+    sqe->addr = (uintptr_t)&m_udpHdr;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUF_GROUP;
+    sqe->user_data = TAG_UDP;
+    commitSQE();
+}
+
+void
+URing::armTCP( uint64_t tag, int sock )
+{
+    struct io_uring_sqe* sqe = getSQE();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = sock;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUF_GROUP;
+    sqe->user_data = tag;
+    commitSQE();
+}
+
+void
+URing::armWake()
+{
+    struct io_uring_sqe* sqe = getSQE();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = m_wakeFD;
+    sqe->addr = (uintptr_t)&m_wakeVal;
+    sqe->len = sizeof(m_wakeVal);
+    sqe->user_data = TAG_WAKE;
+    commitSQE();
+}
+
+void
+URing::cancel( uint64_t tag )
+{
+    struct io_uring_sqe* sqe = getSQE();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = tag;
+    sqe->user_data = TAG_CANCEL;
+    commitSQE();
+}
+
+void
+URing::gotUDP( const struct io_uring_cqe* cqe )
+{
+    if ( 0 != (cqe->flags & IORING_CQE_F_BUFFER) ) {
+        unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        const uint8_t* buf = m_bufs + bid * BUF_SIZE;
+        const struct io_uring_recvmsg_out* out =
+            (const struct io_uring_recvmsg_out*)buf;
+        if ( 0 != (out->flags & MSG_TRUNC) ) {
+            logf( XW_LOGERROR, "%s: dropping oversize datagram (%d bytes)",
+                  __func__, out->payloadlen );
+        } else if ( 0 < cqe->res ) {
+            AddrInfo::AddrUnion saddr;
+            memset( &saddr, 0, sizeof(saddr) );
+            size_t nameLen = out->namelen < m_udpHdr.msg_namelen
+                ? out->namelen : m_udpHdr.msg_namelen;
+            memcpy( &saddr.u, buf + sizeof(*out), nameLen );
+            const uint8_t* payload = buf + sizeof(*out)
+                + m_udpHdr.msg_namelen + m_udpHdr.msg_controllen;
+            (*m_udpProc)( m_udpsock, &saddr, payload, out->payloadlen );
+        }
+        recycle( bid );
+    } else if ( 0 > cqe->res ) {
+        /* ENOBUFS: we've fallen behind and the recv's stopped.  Re-arming
+           picks up what's queued in the socket meanwhile. */
+        logf( XW_LOGERROR, "%s: recvmsg: %s", __func__,
+              strerror(-cqe->res) );
+    }
+
+    if ( 0 == (cqe->flags & IORING_CQE_F_MORE) ) {
+        armUDP();
+    }
+}
+
+void
+URing::gotTCP( const struct io_uring_cqe* cqe )
+{
+    TCPSock ts;
+    bool live;
+    {
+        MutexLock ml( &m_mutex );
+        map<uint64_t, TCPSock>::const_iterator iter =
+            m_tcpByTag.find( cqe->user_data );
+        live = m_tcpByTag.end() != iter;
+        if ( live ) {
+            ts = iter->second;
+        }
+    }
+
+    const char* gone = NULL;
+    if ( 0 != (cqe->flags & IORING_CQE_F_BUFFER) ) {
+        unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        if ( live && 0 < cqe->res
+             && !UdpQueue::get()->handleStream( &ts.addr,
+                                                m_bufs + bid * BUF_SIZE,
+                                                cqe->res, ts.proc ) ) {
+            gone = "bad packet length";
+        }
+        recycle( bid );
+    } else if ( !live ) {
+        /* cancelled, or the last of a removed socket's data */
+    } else if ( 0 == cqe->res ) {
+        gone = "got EOF";
+    } else if ( -ENOBUFS == cqe->res ) {
+        logf( XW_LOGERROR, "%s: out of buffers", __func__ );
+    } else if ( 0 > cqe->res ) {
+        logf( XW_LOGERROR, "%s: recv on socket %d: %s", __func__,
+              ts.addr.getSocket(), strerror(-cqe->res) );
+        gone = "recv failed";
+    }
+
+    if ( !live ) {
+        /* nothing to do */
+    } else if ( NULL != gone ) {
+        /* Comes back to RemoveTCP() to cancel the recv */
+        XWThreadPool::GetTPool()->SocketGone( &ts.addr, gone );
+    } else if ( 0 == (cqe->flags & IORING_CQE_F_MORE) ) {
+        armTCP( cqe->user_data, ts.addr.getSocket() );
+    }
+}
+
+#else  /* HAVE_IO_URING */
+
+/* static */ URing*
+URing::Get()
+{
+    return NULL;
+}
+
+void
+URing::StartUDP( int /*udpsock*/, URingUDPProc /*proc*/ )
+{
+    assert( 0 );
+}
+
+void
+URing::AddTCP( const AddrInfo* /*addr*/, QueueCallback /*proc*/ )
+{
+    assert( 0 );
+}
+
+void
+URing::RemoveTCP( const AddrInfo* /*addr*/ )
+{
+    assert( 0 );
+}
+
+#endif  /* HAVE_IO_URING */
@@ -0,0 +1,132 @@
+/* -*-mode: C; fill-column: 78; c-basic-offset: 4; -*- */
+/* 
+ * Copyright 2018 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef _URING_H_
+#define _URING_H_
+
+#include <pthread.h>
+#include <sys/socket.h>
+#include <map>
+#include <vector>
+
+#include "xwrelay_priv.h"
+#include "addrinfo.h"
+#include "udpqueue.h"
+
+using namespace std;
+
+/* Optional io_uring receive path, built when the kernel headers are new
+ * enough (HAVE_IO_URING; see the Makefile) and used when IO_URING is set in
+ * the conf and the running kernel (6.0 or later) lets us have a ring.
+ *
+ * One thread owns the ring.  It keeps a multishot RECVMSG posted on the UDP
+ * socket and a multishot RECV on each TCP socket the thread pool is given,
+ * all filling buffers from one ring of provided buffers, so a burst of
+ * packets costs one io_uring_enter() rather than a select() or poll() plus
+ * a recv per packet.  What arrives goes to the same handlers the select and
+ * poll paths feed.  Get() returns NULL when it's not available, and the
+ * relay runs as it always has.
+ */
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf;
+
+typedef void (*URingUDPProc)( int sock, const AddrInfo::AddrUnion* saddr,
+                              const uint8_t* buf, int len );
+
+class URing {
+ public:
+    static URing* Get();
+
+    void StartUDP( int udpsock, URingUDPProc proc );
+    void AddTCP( const AddrInfo* addr, QueueCallback proc );
+    void RemoveTCP( const AddrInfo* addr );
+
+ private:
+    typedef struct {
+        AddrInfo addr;
+        QueueCallback proc;
+    } TCPSock;
+
+    URing();
+    ~URing();
+    bool setup();
+    static void* thread_main( void* arg );
+    void* threadProc();
+
+    void wake();
+    void runCommands();
+    struct io_uring_sqe* getSQE();
+    void commitSQE();
+    void submit( unsigned minComplete );
+    void reap();
+    void recycle( unsigned bid );
+
+    void armUDP();
+    void armTCP( uint64_t tag, int sock );
+    void armWake();
+    void cancel( uint64_t tag );
+
+    void gotUDP( const struct io_uring_cqe* cqe );
+    void gotTCP( const struct io_uring_cqe* cqe );
+
+    int m_fd;
+    void* m_ringMem;
+    size_t m_ringSize;
+    size_t m_sqesSize;
+
+    /* submission queue; only our thread touches the tail */
+    unsigned* m_sqHead;
+    unsigned* m_sqTail;
+    unsigned* m_sqArray;
+    unsigned m_sqMask;
+    unsigned m_sqEntries;
+    unsigned m_sqUnsubmitted;
+    struct io_uring_sqe* m_sqes;
+
+    /* completion queue */
+    unsigned* m_cqHead;
+    unsigned* m_cqTail;
+    unsigned m_cqMask;
+    struct io_uring_cqe* m_cqes;
+
+    /* provided buffers */
+    struct io_uring_buf* m_bufRing;
+    uint8_t* m_bufs;
+    uint16_t m_bufTail;
+
+    int m_udpsock;
+    URingUDPProc m_udpProc;
+    struct msghdr m_udpHdr;
+
+    int m_wakeFD;               /* eventfd other threads poke */
+    uint64_t m_wakeVal;
+
+    /* Shared with the threads adding and removing sockets */
+    pthread_mutex_t m_mutex;
+    bool m_udpPending;
+    uint64_t m_nextTag;
+    map<uint64_t, TCPSock> m_tcpByTag;
+    map<int, uint64_t> m_tagBySock;
+    vector<uint64_t> m_toArm;
+    vector<uint64_t> m_toCancel;
+};
+
+#endif
@@ -82,6 +82,12 @@
 #include "udpqueue.h"
 #include "udpack.h"
 #include "udpager.h"
+#include "msgstore.h"
+#include "udpbatch.h"
+#include "uring.h"
+#include "metrics.h"
+#include "shardmgr.h"
+#include "capture.h"
 
 static void log_hex( const uint8_t* memp, size_t len, const char* tag );
 
@@ -611,12 +617,18 @@ static ssize_t
 send_packet_via_udp_impl( vector<uint8_t>& packet, 
                           int sock, const struct sockaddr* dest_addr )
 {
-    ssize_t nSent = sendto( sock, packet.data(), packet.size(), 0 /*flags*/,
-                            dest_addr, sizeof(*dest_addr) );
-    if ( 0 > nSent ) {
-        logf( XW_LOGERROR, "%s: sendmsg->errno %d (%s)", __func__, errno, 
-              strerror(errno) );
+    /* Goes out now, or when the caller's UDPSendBatch is flushed */
+    ssize_t nSent;
+    ShardMgr* shards = ShardMgr::Get();
+    if ( NULL != shards
+         && shards->SendVia( dest_addr, packet.data(), packet.size() ) ) {
+        nSent = packet.size();
     } else {
+        nSent = UDPSendBatch::Send( sock, dest_addr, packet.data(), 
+                                    packet.size() );
+    }
+    Metrics::Get()->Inc( 0 <= nSent ? MC_UDP_SENT : MC_UDP_SENDFAIL );
+    if ( 0 <= nSent ) {
 #ifdef LOG_PACKET_MD5SUMS
         gchar* sum = g_compute_checksum_for_data( G_CHECKSUM_MD5, packet.data(), 
                                                   packet.size() );
@@ -807,12 +819,12 @@ post_or_store( DevIDRelay destDevID, vector<uint8_t>& packet, uint32_t packetID,
 {
     int msgID = DBMgr::Get()->StoreMessage( destDevID, packet.data(), packet.size() );
 
-    const AddrInfo::AddrUnion* addru = DevMgr::Get()->get( destDevID );
-    bool canSendNow = !!addru;
+    AddrInfo::AddrUnion addru;
+    bool canSendNow = DevMgr::Get()->get( destDevID, &addru );
     
     bool sent = false;
     if ( canSendNow ) {
-        AddrInfo addr( addru );
+        AddrInfo addr( &addru );
         int sock;
         const struct sockaddr* dest_addr;
         if ( get_addr_info_if( &addr, &sock, &dest_addr ) ) {
@@ -1339,7 +1351,11 @@ handleMsgsMsg( const AddrInfo* addr, bool sendFull,
             /* For each relayID, write the number of messages and then
                each message (in the getmsg case) */
             vector<DBMgr::MsgInfo> msgs;
-            dbmgr->GetStoredMessages( connName, hid, msgs );
+            if ( sendFull ) {
+                dbmgr->ClaimStoredMessages( connName, hid, msgs );
+            } else {
+                dbmgr->GetStoredMessages( connName, hid, msgs );
+            }
             pushShort( out, msgs.size() );
             if ( sendFull ) {
                 pushMsgs( out, dbmgr, connName, hid, msgs, msgIDs );
@@ -1656,9 +1672,11 @@ onMsgAcked( bool acked, uint32_t packetID, void* data )
 {
     logf( XW_LOGINFO, "%s(packetID=%d, acked=%s)", __func__, packetID, 
           acked?"true":"false" );
+    int msgID = (int)(uintptr_t)data;
     if ( acked ) {
-        int msgID = (int)(uintptr_t)data;
-        DBMgr::Get()->RemoveStoredMessage( msgID );
+        MsgAckBatch::Acked( msgID );
+    } else {
+        MsgAckBatch::Released( msgID );
     }
 }
 
@@ -1667,7 +1685,7 @@ retrieveMessages( DevID& devID, const AddrInfo* addr )
 {
     DBMgr* dbMgr = DBMgr::Get();
     vector<DBMgr::MsgInfo> msgs;
-    dbMgr->GetStoredMessages( devID.asRelayID(), msgs );
+    dbMgr->ClaimStoredMessages( devID.asRelayID(), msgs );
 
     logf( XW_LOGINFO, "%s(): found %d msgs for %d", __func__, msgs.size(),
           devID.asRelayID() );
@@ -1696,6 +1714,11 @@ retrieveMessages( DevID& devID, const AddrInfo* addr )
         } else {
             logf( XW_LOGERROR, "%s: unable to send to devID %d", 
                   __func__, devID.asRelayID() );
+            vector<int> unsent;
+            for ( ; iter != msgs.end(); ++iter ) {
+                unsent.push_back( iter->msgID() );
+            }
+            dbMgr->ReleaseStoredMessages( &unsent[0], unsent.size() );
             break;
         }
         UDPAckTrack::setOnAck( onMsgAcked, packetID, 
@@ -1753,6 +1776,8 @@ handle_udp_packet( PacketThreadClosure* ptc )
     UDPHeader header;
     if ( getHeader( &ptr, end, &header ) ) {
         logf( XW_LOGINFO, "%s(msg=%s)", __func__, msgToStr( header.cmd ) );
+        HistTimer timer( Metrics::Get()->CmdHistogram( header.cmd ) );
+        bool forwarded = false;
         switch( header.cmd ) {
         case XWPDEV_REG: {
             string relayID;
@@ -1880,8 +1905,16 @@ handle_udp_packet( PacketThreadClosure* ptc )
                 unsigned short seed;
                 HostID hid;
                 string connName;
-                if ( DBMgr::Get()->FindPlayer( devID.asRelayID(), clientToken, 
-                                               connName, &hid, &seed ) ) {
+                if ( !DBMgr::Get()->FindPlayer( devID.asRelayID(), clientToken,
+                                                connName, &hid, &seed ) ) {
+                    // nothing to do
+                } else if ( !ShardMgr::OwnsGame( connName.c_str() ) ) {
+                    /* Only now do we know whose game it is */
+                    ShardMgr* shards = ShardMgr::Get();
+                    shards->Forward( shards->OwnerOfGame( connName.c_str() ),
+                                     ptc->saddr(), ptc->buf(), ptc->len() );
+                    forwarded = true;
+                } else {
                     SafeCref scr( connName.c_str(), hid );
                     scr.DeviceGone( hid, seed );
                 }
@@ -1892,8 +1925,173 @@ handle_udp_packet( PacketThreadClosure* ptc )
             logf( XW_LOGERROR, "%s: unexpected msg %d", __func__, header.cmd );
         }
 
-        // Do this after the device and address are registered
-        ackPacketIf( &header, ptc->addr() );
+        // Do this after the device and address are registered. If it's gone
+        // to another relay that one will ack it.
+        if ( !forwarded ) {
+            ackPacketIf( &header, ptc->addr() );
+        }
+    }
+}
+
+/* Which relay owns the game an XWPDEV_MSG's inner message is for.  Connects
+ * go by room, and games then get connNames and cookieIDs that hash to the
+ * same relay.  Acks carry neither, so go to whichever relay the device's
+ * been hearing from.
+ */
+static int
+gameOwner( ShardMgr* shards, const AddrInfo::AddrUnion* saddr, 
+           const uint8_t* ptr, const uint8_t* end )
+{
+    int owner = SHARD_LOCAL;
+    uint8_t cmd;
+    if ( getNetByte( &ptr, end, &cmd ) ) {
+        switch ( cmd ) {
+        case XWRELAY_GAME_CONNECT:
+        case XWRELAY_GAME_RECONNECT: {
+            unsigned short clientVersion;
+            unsigned short flags;
+            char cookie[MAX_INVITE_LEN+1];
+            if ( XWRELAY_ERROR_NONE == flagsOK( &ptr, end, &clientVersion, 
+                                                &flags )
+                 && readStr( &ptr, end, cookie, sizeof(cookie) ) ) {
+                owner = shards->OwnerOfRoom( cookie );
+
+                /* wantsPublic, makePublic, srcID, nPlayersH, nPlayersT,
+                   seed: 2, langCode */
+                const int skip = 8;
+                char connName[MAX_CONNNAME_LEN+1];
+                if ( XWRELAY_GAME_RECONNECT == cmd && ptr + skip < end ) {
+                    ptr += skip;
+                    if ( readStr( &ptr, end, connName, sizeof(connName) )
+                         && '\0' != connName[0] ) {
+                        owner = shards->OwnerOfGame( connName );
+                    }
+                }
+            }
+            break;
+        }
+        case XWRELAY_GAME_DISCONNECT:
+        case XWRELAY_MSG_TORELAY: {
+            CookieID cookieID;
+            if ( getNetShort( &ptr, end, &cookieID ) 
+                 && COOKIE_ID_NONE != cookieID ) {
+                owner = shards->OwnerOfCid( cookieID );
+            } else {
+                owner = shards->ReplyOwner( saddr );
+            }
+            break;
+        }
+        case XWRELAY_ACK:
+            owner = shards->ReplyOwner( saddr );
+            break;
+        }
+    }
+    return owner;
+}
+
+/* Which relay should handle this packet, if it can be told cheaply.
+ * SHARD_LOCAL means handle it here (possibly forwarding it later).
+ */
+static int
+packetOwner( ShardMgr* shards, const AddrInfo::AddrUnion* saddr,
+             const uint8_t* buf, int len )
+{
+    int owner = SHARD_LOCAL;
+    const uint8_t* ptr = buf;
+    const uint8_t* end = ptr + len;
+
+    UDPHeader header;
+    if ( getHeader( &ptr, end, &header ) ) {
+        switch ( header.cmd ) {
+        case XWPDEV_REG: {
+            /* Unless it already has one, the device gets an ID we own */
+            string relayID;
+            if ( getVLIString( &ptr, end, relayID ) && ptr < end ) {
+                DevID devID( (DevIDType)*ptr++ );
+                if ( ID_TYPE_RELAY == devID.m_devIDType
+                     && getRelayDevID( &ptr, end, devID ) ) {
+                    owner = shards->OwnerOfDevice( devID.asRelayID() );
+                }
+            }
+            break;
+        }
+        case XWPDEV_KEEPALIVE:
+        case XWPDEV_RQSTMSGS: {
+            DevID devID( ID_TYPE_RELAY );
+            if ( getVLIString( &ptr, end, devID.m_devIDString ) ) {
+                owner = shards->OwnerOfDevice( devID.asRelayID() );
+            }
+            break;
+        }
+        case XWPDEV_MSG:
+            ptr += sizeof(AddrInfo::ClientToken);
+            owner = gameOwner( shards, saddr, ptr, end );
+            break;
+        case XWPDEV_MSGNOCONN: {
+            AddrInfo::ClientToken clientToken;
+            if ( getNetLong( &ptr, end, &clientToken ) ) {
+                /* parseRelayID wants a terminated string */
+                char relayID[MAX_CONNNAME_LEN + 4];
+                int idLen = min( (int)(end - ptr), (int)sizeof(relayID) - 1 );
+                memcpy( relayID, ptr, idLen );
+                relayID[idLen] = '\0';
+                const uint8_t* idp = (const uint8_t*)relayID;
+                char connName[MAX_CONNNAME_LEN+1];
+                HostID hid;
+                if ( parseRelayID( &idp, idp + idLen, connName, 
+                                   sizeof(connName), &hid ) ) {
+                    owner = shards->OwnerOfGame( connName );
+                }
+            }
+            break;
+        }
+        case XWPDEV_ACK: {
+            uint32_t packetID;
+            if ( vli2un( &ptr, end, &packetID ) ) {
+                owner = shards->OwnerOfPacket( packetID );
+            }
+            break;
+        }
+        default:                /* INVITE and DELGAME need the DB */
+            break;
+        }
+    }
+    return owner;
+}
+
+/* A datagram's arrived, via read_udp_packet() or URing */
+static void
+got_udp_packet( int udpsock, const AddrInfo::AddrUnion* saddr,
+                const uint8_t* buf, int nRead )
+{
+#ifdef LOG_UDP_PACKETS
+    gchar* b64 = g_base64_encode( (uint8_t*)saddr, sizeof(*saddr) );
+    logf( XW_LOGINFO, "%s: recvfrom=>%d (saddr='%s')", __func__, nRead, b64 );
+    g_free( b64 );
+#endif
+#ifdef LOG_PACKET_MD5SUMS
+    gchar* sum = g_compute_checksum_for_data( G_CHECKSUM_MD5, buf, nRead );
+    logf( XW_LOGINFO, "%s: recvfrom=>%d (sum=%s)", __func__, nRead, sum );
+    g_free( sum );
+#endif
+
+    int owner = SHARD_LOCAL;
+    ShardMgr* shards = ShardMgr::Get();
+    if ( NULL != shards ) {
+        shards->NoteDirect( saddr );
+        owner = packetOwner( shards, saddr, buf, nRead );
+        if ( shards->Self() == owner ) {
+            owner = SHARD_LOCAL;
+        }
+    }
+
+    if ( SHARD_LOCAL != owner ) {
+        shards->Forward( owner, saddr, buf, nRead );
+    } else {
+        Metrics::Get()->Inc( MC_UDP_RCVD );
+        AddrInfo addr( udpsock, saddr, false );
+        UDPAger::Get()->Refresh( &addr );
+        UdpQueue::get()->handle( &addr, buf, nRead, handle_udp_packet );
     }
 }
 
@@ -1908,20 +2106,7 @@ read_udp_packet( int udpsock )
     ssize_t nRead = recvfrom( udpsock, buf, sizeof(buf), 0 /*flags*/,
                               &saddr.u.addr, &fromlen );
     if ( 0 < nRead ) {
-#ifdef LOG_UDP_PACKETS
-        gchar* b64 = g_base64_encode( (uint8_t*)&saddr, sizeof(saddr) );
-        logf( XW_LOGINFO, "%s: recvfrom=>%d (saddr='%s')", __func__, nRead, b64 );
-        g_free( b64 );
-#endif
-#ifdef LOG_PACKET_MD5SUMS
-        gchar* sum = g_compute_checksum_for_data( G_CHECKSUM_MD5, buf, nRead );
-        logf( XW_LOGINFO, "%s: recvfrom=>%d (sum=%s)", __func__, nRead, sum );
-        g_free( sum );
-#endif
-
-        AddrInfo addr( udpsock, &saddr, false );
-        UDPAger::Get()->Refresh( &addr );
-        UdpQueue::get()->handle( &addr, buf, nRead, handle_udp_packet );
+        got_udp_packet( udpsock, &saddr, buf, nRead );
     }
 }
 
@@ -2305,7 +2490,25 @@ main( int argc, char** argv )
         exit( 1 );
     }
 
+    (void)Metrics::Get();
     DBMgr::Get()->ClearCIDs();  /* get prev boot's state in db */
+    (void)MsgStore::Get();      /* recover messages logged but not flushed */
+    DBMgr::Get()->PrimeNoMessages(); /* before the reconnect rush */
+
+    char capturePath[256];
+    if ( cfg->GetValueFor( "CAPTURE_PATH", capturePath,
+                           sizeof(capturePath) ) ) {
+        string err;
+        if ( !PacketCapture::Get()->Start( capturePath, err ) ) {
+            logf( XW_LOGERROR, "unable to capture to %s: %s", capturePath,
+                  err.c_str() );
+        }
+    }
+
+    ShardMgr* shards = ShardMgr::Get();
+    if ( NULL != shards && -1 != g_udpsock ) {
+        shards->Start( g_udpsock, handle_udp_packet );
+    }
 
     vector<int>::const_iterator iter_game;
     for ( iter_game = ints_game.begin(); iter_game != ints_game.end(); 
@@ -2342,21 +2545,17 @@ main( int argc, char** argv )
     }
 
 #ifdef DO_HTTP
-    HttpState http_state;
+    HttpServer* httpServer = NULL;
+    int sampleInterval;
     int addr;
 
-    memset( &http_state, 0, sizeof(http_state) );
-    if ( cfg->GetValueFor( "WWW_SAMPLE_INTERVAL", 
-                           &http_state.m_sampleInterval )
+    if ( cfg->GetValueFor( "WWW_SAMPLE_INTERVAL", &sampleInterval )
          && cfg->GetValueFor( "WWW_LISTEN_ADDR", &addr ) ) {
         g_http = make_socket( addr, httpport );
         if ( g_http == -1 ) {
             exit( 1 );
         }
-        http_state.ctrl_sock = g_http;
-    }
-    if ( -1 != g_http ) {
-        pthread_mutex_init( &http_state.m_dataMutex, NULL );
+        httpServer = new HttpServer( g_http, sampleInterval );
     }
 #endif
 
@@ -2368,35 +2567,45 @@ main( int argc, char** argv )
     XWThreadPool* tPool = XWThreadPool::GetTPool();
     tPool->Setup( nWorkerThreads, rmSocketRefs );
 
+    /* select() on the UDP socket unless URing's reading it */
+    int udpsock = g_udpsock;
+    URing* uring = URing::Get();
+    if ( NULL != uring && -1 != udpsock ) {
+        uring->StartUDP( udpsock, got_udp_packet );
+        udpsock = -1;
+    }
+
     /* set up select call */
     fd_set rfds;
+    fd_set wfds;
     for ( ; ; ) {
         FD_ZERO(&rfds);
+        FD_ZERO(&wfds);
         g_listeners.AddToFDSet( &rfds );
         FD_SET( g_control, &rfds );
-        if ( -1 != g_udpsock ) {
-            FD_SET( g_udpsock, &rfds );
-        }
-#ifdef DO_HTTP
-        if ( -1 != g_http ) {
-            FD_SET( g_http, &rfds );
+        if ( -1 != udpsock ) {
+            FD_SET( udpsock, &rfds );
         }
-#endif
         int highest = g_listeners.GetHighest();
         if ( g_control > highest ) {
             highest = g_control;
         }
-        if ( g_udpsock > highest ) {
-            highest = g_udpsock;
+        if ( udpsock > highest ) {
+            highest = udpsock;
         }
+        struct timeval* tvp = NULL;
 #ifdef DO_HTTP
-        if ( g_http > highest ) {
-            highest = g_http;
+        struct timeval tv;
+        if ( NULL != httpServer ) {
+            highest = httpServer->AddToFDSets( &rfds, &wfds, highest );
+            if ( httpServer->GetTimeout( &tv ) ) {
+                tvp = &tv;
+            }
         }
 #endif
         ++highest;
 
-        int retval = select( highest, &rfds, NULL, NULL, NULL );
+        int retval = select( highest, &rfds, &wfds, NULL, tvp );
         if ( retval < 0 ) {
             if ( errno != 4 ) { /* 4's what we get when signal interrupts */
                 logf( XW_LOGINFO, "errno: %s (%d)", strerror(errno), errno );
@@ -2451,17 +2660,15 @@ main( int argc, char** argv )
                 run_ctrl_thread( g_control );
                 --retval;
             }
-            if ( -1 != g_udpsock && FD_ISSET( g_udpsock, &rfds ) ) {
+            if ( -1 != udpsock && FD_ISSET( udpsock, &rfds ) ) {
                 // This will need to be done in a separate thread, or pushed
                 // to the existing thread pool
-                read_udp_packet( g_udpsock );
+                read_udp_packet( udpsock );
                 --retval;
             }
 #ifdef DO_HTTP
-            if ( FD_ISSET( g_http, &rfds ) ) {
-                FD_CLR( g_http, &rfds );
-                run_http_thread( &http_state );
-                --retval;
+            if ( NULL != httpServer ) {
+                retval -= httpServer->Handle( &rfds, &wfds );
             }
 #endif
             assert( retval == 0 );
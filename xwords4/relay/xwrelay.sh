@@ -14,7 +14,7 @@ LOGFILE=/tmp/xwrelay_log_$$.txt
 date > $LOGFILE
 
 usage() {
-    echo "usage: $0 start | stop | restart | mkdb | debs_install"
+    echo "usage: $0 start | stop | restart | mkdb | upgradedb | debs_install"
 }
 
 setup_user() {
@@ -85,6 +85,7 @@ id SERIAL
 ,msg BYTEA
 ,msg64 TEXT
 ,msglen INTEGER
+,claimed TIMESTAMP DEFAULT 'epoch'
 , UNIQUE ( connName, hid, msg64, stime )
 );
 EOF
@@ -103,6 +104,22 @@ id INTEGER UNIQUE PRIMARY KEY
 ,mtimes TIMESTAMP[]
 ,unreg BOOLEAN DEFAULT FALSE
 );
+EOF
+
+    upgrade_db
+}
+
+# Safe to run more than once; brings an older database up to date
+upgrade_db() {
+    if [ -z "${DBNAME:-}" ]; then
+        DBNAME=$(grep '^DB_NAME' $CONFFILE | sed 's,^.*=,,')
+    fi
+    cat <<-EOF | psql $DBNAME --file -
+ALTER TABLE msgs ADD COLUMN IF NOT EXISTS claimed TIMESTAMP DEFAULT 'epoch';
+CREATE INDEX IF NOT EXISTS msgs_devid_unsent ON msgs ( devid, id )
+WHERE stime = 'epoch';
+CREATE INDEX IF NOT EXISTS msgs_connname_unsent ON msgs ( connName, hid, id )
+WHERE stime = 'epoch';
 EOF
 }
 
@@ -165,6 +182,10 @@ case $1 in
         make_db
         ;;
 
+    upgradedb)
+        upgrade_db
+        ;;
+
     debs_install)
 		install_debs
 		;;